@@ -41,6 +41,7 @@
 #include <glib/gi18n-lib.h>
 
 #include "libebackend/e-dbhash.h"
+#include "libebackend/e-change-log.h"
 #include "libebackend/e-db3-utils.h"
 
 #include "libedataserver/e-data-server-util.h"
@@ -50,6 +51,7 @@
 
 #include "libedata-book/e-book-backend-sexp.h"
 #include "libedata-book/e-book-backend-summary.h"
+#include "libedata-book/e-book-backend-sqlitedb.h"
 #include "libedata-book/e-data-book.h"
 #include "libedata-book/e-data-book-view.h"
 
@@ -58,6 +60,7 @@
 #define d(x)
 
 #define CHANGES_DB_SUFFIX ".changes.db"
+#define CHANGE_LOG_SUFFIX ".changes.log"
 
 #define E_BOOK_BACKEND_FILE_VERSION_NAME "PAS-DB-VERSION"
 #define E_BOOK_BACKEND_FILE_VERSION "0.2"
@@ -65,6 +68,15 @@
 #define PAS_ID_PREFIX "pas-id-"
 #define SUMMARY_FLUSH_TIMEOUT 5000
 
+/* the mtime of the db the SQLite index was last in sync with */
+#define SQLITEDB_DB_MTIME_KEY "db_mtime"
+#define SQLITEDB_BUILD_BATCH 256
+
+/* the records of a book view are matched and notified in chunks */
+#define VIEW_CHUNK_SIZE 256
+/* how many chunks may be queued or matched before the reader waits */
+#define VIEW_MAX_PENDING_CHUNKS 16
+
 #define EDB_ERROR(_code) e_data_book_create_error (E_DATA_BOOK_STATUS_ ## _code, NULL)
 #define EDB_ERROR_EX(_code, _msg) e_data_book_create_error (E_DATA_BOOK_STATUS_ ## _code, _msg)
 
@@ -77,6 +89,13 @@ struct _EBookBackendFilePrivate {
 	DB       *file_db;
 	DB_ENV   *env;
 	EBookBackendSummary *summary;
+	gchar     *sqlitedb_filename;
+	EBookBackendSqliteDB *sqlitedb;
+	gboolean   sqlitedb_dirty;	/* missed a change, rebuilt on the next load */
+	gchar     *change_log_filename;
+	EChangeLog *change_log;	/* the contacts changed, for get_changes */
+	GMutex    *scans_lock;
+	GHashTable *scans;	/* query -> running FileBackendScan */
 	/* for future use */
 	gpointer reserved1;
 	gpointer reserved2;
@@ -168,6 +187,107 @@ build_summary (EBookBackendFilePrivate *bfpriv)
 	return TRUE;
 }
 
+/* Refills the SQLite index of the non-summary fields from the db */
+static gboolean
+build_sqlitedb (EBookBackendFilePrivate *bfpriv, GError **error)
+{
+	DB             *db = bfpriv->file_db;
+	DBC            *dbc;
+	gint            db_error;
+	DBT  id_dbt, vcard_dbt;
+	GList *contacts = NULL;
+	gint n_contacts = 0;
+	gboolean success;
+
+	if (!e_book_backend_sqlitedb_clear (bfpriv->sqlitedb, error))
+		return FALSE;
+
+	db_error = db->cursor (db, NULL, &dbc, 0);
+
+	if (db_error != 0) {
+		g_warning (G_STRLOC ": db->cursor failed with %s", db_strerror (db_error));
+		db_error_to_gerror (db_error, error);
+		return FALSE;
+	}
+
+	memset (&vcard_dbt, 0, sizeof (vcard_dbt));
+	memset (&id_dbt, 0, sizeof (id_dbt));
+	db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_FIRST);
+
+	success = TRUE;
+	while (db_error == 0 && success) {
+
+		/* don't include the version in the list of cards */
+		if (id_dbt.size != strlen (E_BOOK_BACKEND_FILE_VERSION_NAME) + 1
+		    || strcmp (id_dbt.data, E_BOOK_BACKEND_FILE_VERSION_NAME)) {
+			contacts = g_list_prepend (contacts, create_contact (id_dbt.data, vcard_dbt.data));
+			n_contacts++;
+		}
+
+		db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_NEXT);
+
+		/* add the contacts in batches, each is one transaction */
+		if (n_contacts == SQLITEDB_BUILD_BATCH || (db_error != 0 && contacts)) {
+			success = e_book_backend_sqlitedb_add_contacts (bfpriv->sqlitedb, contacts, error);
+
+			g_list_foreach (contacts, (GFunc) g_object_unref, NULL);
+			g_list_free (contacts);
+			contacts = NULL;
+			n_contacts = 0;
+		}
+	}
+
+	dbc->c_close (dbc);
+
+	return success;
+}
+
+/* The index missed a change: stop using it, and make sure the next load
+   rebuilds it rather than trust it as in sync with the db.  Book view
+   threads may be searching it, so it is kept open until dispose. */
+static void
+sqlitedb_mark_dirty (EBookBackendFile *bf)
+{
+	bf->priv->sqlitedb_dirty = TRUE;
+	e_book_backend_sqlitedb_set_key_value (bf->priv->sqlitedb, SQLITEDB_DB_MTIME_KEY, "", NULL);
+}
+
+static void
+sqlitedb_add_contact (EBookBackendFile *bf, EContact *contact)
+{
+	GList contacts = { contact, NULL, NULL };
+	GError *error = NULL;
+
+	if (bf->priv->sqlitedb && !bf->priv->sqlitedb_dirty
+	    && !e_book_backend_sqlitedb_add_contacts (bf->priv->sqlitedb, &contacts, &error)) {
+		g_warning (G_STRLOC ": Failed to index contact: %s", error->message);
+		g_error_free (error);
+		sqlitedb_mark_dirty (bf);
+	}
+}
+
+/* Looks up the UIDs of the contacts matching @query in the SQLite index.
+   Only queries the index answers exactly are looked up there, the others
+   would still have to check most contacts. */
+static gboolean
+sqlitedb_search_uids (EBookBackendFile *bf, const gchar *query, GList **uids)
+{
+	GError *error = NULL;
+	gboolean exact = FALSE;
+
+	if (!bf->priv->sqlitedb || bf->priv->sqlitedb_dirty || !e_book_backend_sqlitedb_is_sql_query (query))
+		return FALSE;
+
+	*uids = e_book_backend_sqlitedb_search_uids (bf->priv->sqlitedb, query, &exact, &error);
+	if (error) {
+		g_warning (G_STRLOC ": Failed to search the index: %s", error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	return exact;
+}
+
 static gchar *
 e_book_backend_file_create_unique_id (void)
 {
@@ -257,6 +377,9 @@ e_book_backend_file_create_contact (EBookBackendSync *backend,
 
 	if (do_create (bf, vcard, contact, perror)) {
 		e_book_backend_summary_add_contact (bf->priv->summary, *contact);
+		sqlitedb_add_contact (bf, *contact);
+		if (bf->priv->change_log)
+			e_change_log_touch (bf->priv->change_log, e_contact_get_const (*contact, E_CONTACT_UID));
 	}
 }
 
@@ -289,6 +412,8 @@ e_book_backend_file_remove_contacts (EBookBackendSync *backend,
 		}
 
 		removed_cards = g_list_prepend (removed_cards, id);
+		if (bf->priv->change_log)
+			e_change_log_touch (bf->priv->change_log, id);
 	}
 
 	/* if we actually removed some, try to sync */
@@ -304,6 +429,16 @@ e_book_backend_file_remove_contacts (EBookBackendSync *backend,
 		gchar *id = l->data;
 		e_book_backend_summary_remove_contact (bf->priv->summary, id);
 	}
+
+	if (removed_cards && bf->priv->sqlitedb && !bf->priv->sqlitedb_dirty) {
+		GError *error = NULL;
+
+		if (!e_book_backend_sqlitedb_remove_contacts (bf->priv->sqlitedb, removed_cards, &error)) {
+			g_warning (G_STRLOC ": Failed to remove contacts from the index: %s", error->message);
+			g_error_free (error);
+			sqlitedb_mark_dirty (bf);
+		}
+	}
 }
 
 static void
@@ -350,12 +485,16 @@ e_book_backend_file_modify_contact (EBookBackendSync *backend,
 	db_error = db->put (db, NULL, &id_dbt, &vcard_dbt, 0);
 
 	if (0 == db_error) {
+		if (bf->priv->change_log)
+			e_change_log_touch (bf->priv->change_log, lookup_id);
+
 		db_error = db->sync (db, 0);
 		if (db_error != 0) {
 			g_warning (G_STRLOC ": db->sync failed with %s", db_strerror (db_error));
 		} else {
 			e_book_backend_summary_remove_contact (bf->priv->summary, id);
 			e_book_backend_summary_add_contact (bf->priv->summary, *contact);
+			sqlitedb_add_contact (bf, *contact);
 		}
 	} else {
 		g_warning (G_STRLOC ": db->put failed with %s", db_strerror(db_error));
@@ -414,6 +553,7 @@ e_book_backend_file_get_contact_list (EBookBackendSync *backend,
 	gboolean search_needed;
 	const gchar *search = query;
 	GList *contact_list = NULL;
+	GList *uids = NULL, *l;
 
 	d(printf ("e_book_backend_file_get_contact_list (%s)\n", search));
 	if (e_book_backend_summary_is_summary_query (bf->priv->summary, search)) {
@@ -443,6 +583,27 @@ e_book_backend_file_get_contact_list (EBookBackendSync *backend,
 			}
 		}
 		g_ptr_array_free (ids, TRUE);
+	} else if (strcmp (search, "(contains \"x-evolution-any-field\" \"\")")
+		   && sqlitedb_search_uids (bf, search, &uids)) {
+
+		/* do an indexed query */
+		for (l = uids; l; l = l->next) {
+			string_to_dbt (l->data, &id_dbt);
+			memset (&vcard_dbt, 0, sizeof (vcard_dbt));
+			vcard_dbt.flags = DB_DBT_MALLOC;
+
+			db_error = db->get (db, NULL, &id_dbt, &vcard_dbt, 0);
+			if (db_error == 0) {
+				contact_list = g_list_prepend (contact_list, vcard_dbt.data);
+			} else {
+				g_warning (G_STRLOC ": db->get failed with %s", db_strerror (db_error));
+				db_error_to_gerror (db_error, perror);
+				break;
+			}
+		}
+
+		g_list_foreach (uids, (GFunc) g_free, NULL);
+		g_list_free (uids);
 	} else {
 		search_needed = TRUE;
 		if (!strcmp (search, "(contains \"x-evolution-any-field\" \"\")"))
@@ -500,28 +661,207 @@ e_book_backend_file_get_contact_list (EBookBackendSync *backend,
 	*contacts = contact_list;
 }
 
+/* The initial population of the book views.  Views started with the same
+   query while a population runs join it: the contacts notified so far are
+   read again and replayed to them, and they get the rest as it is found,
+   so the book is only scanned once however many clients open the same
+   view. */
 typedef struct {
+	volatile gint ref_count;
 	EBookBackendFile *bf;
-	GThread *thread;
-	EFlag *running;
+	gchar *query;
+
+	EFlag *running;		/* cleared when the last view stops */
+	GMutex *lock;
+	GList *views;		/* the views being populated */
+	GPtrArray *notified;	/* the UIDs notified so far, for late views,
+				   NULL once no view can join any more */
+} FileBackendScan;
+
+typedef struct {
+	FileBackendScan *scan;
 } FileBackendSearchClosure;
 
+/* A population which isn't answered by an index is a pipeline: the scan
+   thread reads the raw records off the db cursor into chunks, a pool of
+   workers matches the chunks against the query, and the scan thread
+   notifies the matched chunks in the db order. */
+typedef struct {
+	FileBackendScan *scan;
+	const gchar *query;	/* NULL when every record matches */
+	EFlag *running;
+
+	GAsyncQueue *sexps;	/* idle sexps, one is used per worker */
+	GAsyncQueue *done;	/* matched chunks */
+	GHashTable *ready;	/* matched chunks waiting for earlier ones */
+	struct _ViewChunk *chunk;	/* the chunk being read */
+	guint read_seq;
+	guint notify_seq;
+	guint n_pending;
+} ViewPipeline;
+
+typedef struct _ViewChunk {
+	ViewPipeline *pipeline;
+	guint seq;
+	guint n;
+	gchar *ids[VIEW_CHUNK_SIZE];
+	gchar *vcards[VIEW_CHUNK_SIZE];
+} ViewChunk;
+
+static GThreadPool *view_pool = NULL;
+G_LOCK_DEFINE_STATIC (view_pool);
+
+static void
+view_chunk_free (ViewChunk *chunk)
+{
+	guint i;
+
+	for (i = 0; i < chunk->n; i++) {
+		g_free (chunk->ids[i]);
+		g_free (chunk->vcards[i]);
+	}
+	g_free (chunk);
+}
+
+static FileBackendScan *
+file_backend_scan_new (EBookBackendFile *bf, const gchar *query)
+{
+	FileBackendScan *scan = g_new0 (FileBackendScan, 1);
+
+	scan->ref_count = 1;
+	scan->bf = bf;
+	scan->query = g_strdup (query);
+	scan->running = e_flag_new ();
+	scan->lock = g_mutex_new ();
+	scan->notified = g_ptr_array_new ();
+
+	e_flag_set (scan->running);
+
+	return scan;
+}
+
+static FileBackendScan *
+file_backend_scan_ref (FileBackendScan *scan)
+{
+	g_atomic_int_inc (&scan->ref_count);
+
+	return scan;
+}
+
+/* Called with scan->lock held, once the scan is out of priv->scans */
+static void
+file_backend_scan_drop_notified (FileBackendScan *scan)
+{
+	if (!scan->notified)
+		return;
+
+	g_ptr_array_foreach (scan->notified, (GFunc) g_free, NULL);
+	g_ptr_array_free (scan->notified, TRUE);
+	scan->notified = NULL;
+}
+
+static void
+file_backend_scan_unref (FileBackendScan *scan)
+{
+	if (!g_atomic_int_dec_and_test (&scan->ref_count))
+		return;
+
+	g_list_foreach (scan->views, (GFunc) e_data_book_view_unref, NULL);
+	g_list_free (scan->views);
+	file_backend_scan_drop_notified (scan);
+	g_mutex_free (scan->lock);
+	e_flag_free (scan->running);
+	g_free (scan->query);
+	g_free (scan);
+}
+
+/* the views free the vCards they are given, so each gets its own copies */
+static void
+notify_view_chunk (EDataBookView *book_view, ViewChunk *chunk)
+{
+	gchar *vcards[VIEW_CHUNK_SIZE];
+	guint i;
+
+	for (i = 0; i < chunk->n; i++)
+		vcards[i] = g_strdup (chunk->vcards[i]);
+
+	e_data_book_view_notify_update_prefiltered_vcards (book_view, chunk->ids, vcards, chunk->n);
+}
+
+/* Notifies @chunk to the views of @scan, and keeps its UIDs for the
+   views joining later */
+static void
+file_backend_scan_notify (FileBackendScan *scan, ViewChunk *chunk)
+{
+	GList *l;
+	guint i;
+
+	if (!chunk->n) {
+		g_free (chunk);
+		return;
+	}
+
+	g_mutex_lock (scan->lock);
+
+	for (l = scan->views; l; l = l->next)
+		notify_view_chunk (l->data, chunk);
+	for (i = 0; scan->notified && i < chunk->n; i++)
+		g_ptr_array_add (scan->notified, g_strdup (chunk->ids[i]));
+
+	g_mutex_unlock (scan->lock);
+
+	view_chunk_free (chunk);
+}
+
+/* Reads the contacts notified so far again for a view joining @scan; they
+   are matched again, as they may have changed since */
+static void
+file_backend_scan_replay (FileBackendScan *scan, EDataBookView *book_view)
+{
+	DB *db = scan->bf->priv->file_db;
+	DBT id_dbt, vcard_dbt;
+	guint i;
+
+	for (i = 0; scan->notified && i < scan->notified->len; i++) {
+		string_to_dbt (g_ptr_array_index (scan->notified, i), &id_dbt);
+		memset (&vcard_dbt, 0, sizeof (vcard_dbt));
+		vcard_dbt.flags = DB_DBT_MALLOC;
+
+		/* removed since it was notified */
+		if (db->get (db, NULL, &id_dbt, &vcard_dbt, 0) != 0)
+			continue;
+
+		e_data_book_view_notify_update_vcard (book_view, vcard_dbt.data);
+	}
+}
+
+static void
+file_backend_scan_add_view (FileBackendScan *scan, EDataBookView *book_view)
+{
+	g_mutex_lock (scan->lock);
+
+	file_backend_scan_replay (scan, book_view);
+
+	e_data_book_view_ref (book_view);
+	scan->views = g_list_prepend (scan->views, book_view);
+
+	g_mutex_unlock (scan->lock);
+}
+
 static void
 closure_destroy (FileBackendSearchClosure *closure)
 {
 	d(printf ("destroying search closure\n"));
-	e_flag_free (closure->running);
+	file_backend_scan_unref (closure->scan);
 	g_free (closure);
 }
 
 static FileBackendSearchClosure*
-init_closure (EDataBookView *book_view, EBookBackendFile *bf)
+init_closure (EDataBookView *book_view, FileBackendScan *scan)
 {
 	FileBackendSearchClosure *closure = g_new (FileBackendSearchClosure, 1);
 
-	closure->bf = bf;
-	closure->thread = NULL;
-	closure->running = e_flag_new ();
+	closure->scan = scan;
 
 	g_object_set_data_full (G_OBJECT (book_view), "EBookBackendFile.BookView::closure",
 				closure, (GDestroyNotify)closure_destroy);
@@ -535,60 +875,193 @@ get_closure (EDataBookView *book_view)
 	return g_object_get_data (G_OBJECT (book_view), "EBookBackendFile.BookView::closure");
 }
 
-static gpointer
-book_view_thread (gpointer data)
+static void
+match_chunk_cb (gpointer data, gpointer user_data)
 {
-	EDataBookView *book_view;
-	FileBackendSearchClosure *closure;
-	EBookBackendFile *bf;
-	const gchar *query;
-	DB  *db;
-	DBT id_dbt, vcard_dbt;
-	gint db_error;
-	gboolean allcontacts;
+	ViewChunk *chunk = data;
+	ViewPipeline *pipeline = chunk->pipeline;
+	EBookBackendSExp *sexp = NULL;
+	guint i, n_matched = 0;
+
+	/* the sexps keep the matched record while they run, so the
+	   workers can't share one */
+	if (e_flag_is_set (pipeline->running)) {
+		sexp = g_async_queue_try_pop (pipeline->sexps);
+		if (!sexp)
+			sexp = e_book_backend_sexp_new (pipeline->query);
+	}
 
-	g_return_val_if_fail (E_IS_DATA_BOOK_VIEW (data), NULL);
+	for (i = 0; i < chunk->n; i++) {
+		if (sexp && e_flag_is_set (pipeline->running)
+		    && e_book_backend_sexp_match_vcard (sexp, chunk->vcards[i])) {
+			chunk->ids[n_matched] = chunk->ids[i];
+			chunk->vcards[n_matched] = chunk->vcards[i];
+			n_matched++;
+		} else {
+			g_free (chunk->ids[i]);
+			g_free (chunk->vcards[i]);
+		}
+	}
+	chunk->n = n_matched;
 
-	book_view = data;
-	closure = get_closure (book_view);
-	if (!closure) {
-		g_warning (G_STRLOC ": NULL closure in book view thread");
-		return NULL;
+	if (sexp)
+		g_async_queue_push (pipeline->sexps, sexp);
+	g_async_queue_push (pipeline->done, chunk);
+}
+
+static GThreadPool *
+get_view_pool (void)
+{
+	G_LOCK (view_pool);
+	if (!view_pool) {
+		gint n_threads = 2;
+
+#ifdef _SC_NPROCESSORS_ONLN
+		n_threads = MAX (n_threads, sysconf (_SC_NPROCESSORS_ONLN));
+#endif
+		view_pool = g_thread_pool_new (match_chunk_cb, NULL, n_threads, FALSE, NULL);
 	}
-	bf = closure->bf;
+	G_UNLOCK (view_pool);
 
-	d(printf ("starting initial population of book view\n"));
+	return view_pool;
+}
 
-	/* ref the book view because it'll be removed and unrefed
-	   when/if it's stopped */
-	e_data_book_view_ref (book_view);
+static void
+view_pipeline_init (ViewPipeline *pipeline, FileBackendScan *scan)
+{
+	pipeline->scan = scan;
+	pipeline->query = NULL;
+	pipeline->running = scan->running;
+	pipeline->sexps = g_async_queue_new ();
+	pipeline->done = g_async_queue_new ();
+	pipeline->ready = g_hash_table_new (g_direct_hash, g_direct_equal);
+	pipeline->chunk = NULL;
+	pipeline->read_seq = 0;
+	pipeline->notify_seq = 0;
+	pipeline->n_pending = 0;
+}
 
-	db = bf->priv->file_db;
-	query = e_data_book_view_get_card_query (book_view);
+static void
+notify_chunk (ViewPipeline *pipeline, ViewChunk *chunk)
+{
+	if (e_flag_is_set (pipeline->running))
+		file_backend_scan_notify (pipeline->scan, chunk);
+	else
+		view_chunk_free (chunk);
+}
 
-	if ( !strcmp (query, "(contains \"x-evolution-any-field\" \"\")")) {
-		e_data_book_view_notify_status_message (book_view, _("Loading..."));
-		allcontacts = TRUE;
-	} else {
-		e_data_book_view_notify_status_message (book_view, _("Searching..."));
-		allcontacts = FALSE;
+/* Notifies the matched chunks which are next in the db order, waiting
+   for the workers while more than @max_pending chunks are in flight */
+static void
+view_pipeline_notify (ViewPipeline *pipeline, guint max_pending)
+{
+	ViewChunk *chunk;
+
+	while (pipeline->n_pending > 0) {
+		if (pipeline->n_pending > max_pending)
+			chunk = g_async_queue_pop (pipeline->done);
+		else
+			chunk = g_async_queue_try_pop (pipeline->done);
+
+		if (!chunk)
+			break;
+
+		g_hash_table_insert (pipeline->ready, GUINT_TO_POINTER (chunk->seq), chunk);
+
+		while ((chunk = g_hash_table_lookup (pipeline->ready, GUINT_TO_POINTER (pipeline->notify_seq)))) {
+			g_hash_table_remove (pipeline->ready, GUINT_TO_POINTER (pipeline->notify_seq));
+			pipeline->notify_seq++;
+			pipeline->n_pending--;
+
+			notify_chunk (pipeline, chunk);
+		}
+	}
+}
+
+static void
+view_pipeline_push (ViewPipeline *pipeline, ViewChunk *chunk)
+{
+	if (!pipeline->query) {
+		/* nothing to match, and nothing can be in flight */
+		notify_chunk (pipeline, chunk);
+		return;
+	}
+
+	chunk->pipeline = pipeline;
+	chunk->seq = pipeline->read_seq++;
+	pipeline->n_pending++;
+
+	g_thread_pool_push (get_view_pool (), chunk, NULL);
+
+	view_pipeline_notify (pipeline, VIEW_MAX_PENDING_CHUNKS);
+}
+
+/* Queues a record read from the db, taking @id and @vcard */
+static void
+view_pipeline_add (ViewPipeline *pipeline, gchar *id, gchar *vcard)
+{
+	ViewChunk *chunk = pipeline->chunk;
+
+	if (!chunk)
+		chunk = pipeline->chunk = g_new0 (ViewChunk, 1);
+
+	chunk->ids[chunk->n] = id;
+	chunk->vcards[chunk->n] = vcard;
+	chunk->n++;
+
+	if (chunk->n == VIEW_CHUNK_SIZE) {
+		pipeline->chunk = NULL;
+		view_pipeline_push (pipeline, chunk);
+	}
+}
+
+/* Waits for the chunks still in flight and frees the pipeline */
+static void
+view_pipeline_finish (ViewPipeline *pipeline)
+{
+	EBookBackendSExp *sexp;
+
+	if (pipeline->chunk) {
+		view_pipeline_push (pipeline, pipeline->chunk);
+		pipeline->chunk = NULL;
 	}
 
-	d(printf ("signalling parent thread\n"));
-	e_flag_set (closure->running);
+	view_pipeline_notify (pipeline, 0);
+
+	while ((sexp = g_async_queue_try_pop (pipeline->sexps)))
+		g_object_unref (sexp);
+
+	g_async_queue_unref (pipeline->sexps);
+	g_async_queue_unref (pipeline->done);
+	g_hash_table_destroy (pipeline->ready);
+}
+
+static gpointer
+book_view_thread (gpointer data)
+{
+	FileBackendScan *scan = data;
+	EBookBackendFile *bf = scan->bf;
+	const gchar *query = scan->query;
+	ViewPipeline pipeline;
+	DB  *db;
+	DBT id_dbt, vcard_dbt;
+	gint db_error;
+	GList *uids = NULL, *views, *l;
+
+	d(printf ("starting initial population of book views\n"));
+
+	db = bf->priv->file_db;
+	view_pipeline_init (&pipeline, scan);
 
 	if (e_book_backend_summary_is_summary_query (bf->priv->summary, query)) {
 		/* do a summary query */
-		GPtrArray *ids = e_book_backend_summary_search (bf->priv->summary, e_data_book_view_get_card_query (book_view));
+		GPtrArray *ids = e_book_backend_summary_search (bf->priv->summary, query);
 		gint i;
 
-		if (!ids)
-			goto done;
-
-		for (i = 0; i < ids->len; i++) {
+		for (i = 0; ids && i < ids->len; i++) {
 			gchar *id = g_ptr_array_index (ids, i);
 
-			if (!e_flag_is_set (closure->running))
+			if (!e_flag_is_set (scan->running))
 				break;
 
 			string_to_dbt (id, &id_dbt);
@@ -598,19 +1071,47 @@ book_view_thread (gpointer data)
 			db_error = db->get (db, NULL, &id_dbt, &vcard_dbt, 0);
 
 			if (db_error == 0) {
-				e_data_book_view_notify_update_prefiltered_vcard (book_view, id, vcard_dbt.data);
+				view_pipeline_add (&pipeline, g_strdup (id), vcard_dbt.data);
 			}
 			else {
 				g_warning (G_STRLOC ": db->get failed with %s", db_strerror (db_error));
 			}
 		}
 
-		g_ptr_array_free (ids, TRUE);
+		if (ids)
+			g_ptr_array_free (ids, TRUE);
+	}
+	else if (strcmp (query, "(contains \"x-evolution-any-field\" \"\")")
+		 && sqlitedb_search_uids (bf, query, &uids)) {
+		/* do an indexed query */
+		for (l = uids; l; l = l->next) {
+			if (!e_flag_is_set (scan->running))
+				break;
+
+			string_to_dbt (l->data, &id_dbt);
+			memset (&vcard_dbt, 0, sizeof (vcard_dbt));
+			vcard_dbt.flags = DB_DBT_MALLOC;
+
+			db_error = db->get (db, NULL, &id_dbt, &vcard_dbt, 0);
+
+			if (db_error == 0) {
+				view_pipeline_add (&pipeline, g_strdup (l->data), vcard_dbt.data);
+			}
+			else {
+				g_warning (G_STRLOC ": db->get failed with %s", db_strerror (db_error));
+			}
+		}
+
+		g_list_foreach (uids, (GFunc) g_free, NULL);
+		g_list_free (uids);
 	}
 	else {
 		/* iterate over the db and do the query there */
 		DBC    *dbc;
 
+		if (strcmp (query, "(contains \"x-evolution-any-field\" \"\")"))
+			pipeline.query = query;
+
 		memset (&id_dbt, 0, sizeof (id_dbt));
 		memset (&vcard_dbt, 0, sizeof (vcard_dbt));
 		vcard_dbt.flags = DB_DBT_MALLOC;
@@ -621,15 +1122,14 @@ book_view_thread (gpointer data)
 			db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_FIRST);
 			while (db_error == 0) {
 
-				if (!e_flag_is_set (closure->running))
+				if (!e_flag_is_set (scan->running)) {
+					g_free (vcard_dbt.data);
 					break;
+				}
 
 				/* don't include the version in the list of cards */
 				if (strcmp (id_dbt.data, E_BOOK_BACKEND_FILE_VERSION_NAME)) {
-					if (allcontacts)
-						e_data_book_view_notify_update_prefiltered_vcard (book_view, id_dbt.data, vcard_dbt.data);
-					else
-						e_data_book_view_notify_update_vcard (book_view, vcard_dbt.data);
+					view_pipeline_add (&pipeline, g_strdup (id_dbt.data), vcard_dbt.data);
 				} else {
 					g_free (vcard_dbt.data);
 				}
@@ -647,17 +1147,32 @@ book_view_thread (gpointer data)
 				   bf->priv->filename);
 			abort ();
 		}
-
 	}
-done:
-	if (e_flag_is_set (closure->running))
-		e_data_book_view_notify_complete (book_view, NULL /* Success */);
 
-	/* unref the */
-	printf("book_view file uref \n");
-	e_data_book_view_unref (book_view);
+	view_pipeline_finish (&pipeline);
+
+	/* views started from now on need a population of their own */
+	g_mutex_lock (bf->priv->scans_lock);
+	if (g_hash_table_lookup (bf->priv->scans, query) == scan)
+		g_hash_table_remove (bf->priv->scans, query);
+	g_mutex_unlock (bf->priv->scans_lock);
+
+	g_mutex_lock (scan->lock);
+	file_backend_scan_drop_notified (scan);
+	for (l = scan->views; l; l = l->next)
+		e_data_book_view_notify_complete (l->data, NULL /* Success */);
+	views = scan->views;
+	scan->views = NULL;
+	g_mutex_unlock (scan->lock);
+
+	/* the views may go away now */
+	g_list_foreach (views, (GFunc) e_data_book_view_unref, NULL);
+	g_list_free (views);
+
+	d(printf ("finished population of book views\n"));
 
-	d(printf ("finished population of book view\n"));
+	file_backend_scan_unref (scan);
+	g_object_unref (bf);
 
 	return NULL;
 }
@@ -666,33 +1181,79 @@ static void
 e_book_backend_file_start_book_view (EBookBackend  *backend,
 				     EDataBookView *book_view)
 {
-	FileBackendSearchClosure *closure = init_closure (book_view, E_BOOK_BACKEND_FILE (backend));
+	EBookBackendFile *bf = E_BOOK_BACKEND_FILE (backend);
+	const gchar *query = e_data_book_view_get_card_query (book_view);
+	FileBackendScan *scan;
+	gboolean new_scan = FALSE;
+
+	if (!strcmp (query, "(contains \"x-evolution-any-field\" \"\")"))
+		e_data_book_view_notify_status_message (book_view, _("Loading..."));
+	else
+		e_data_book_view_notify_status_message (book_view, _("Searching..."));
 
-	d(printf ("starting book view thread\n"));
-	closure->thread = g_thread_create (book_view_thread, book_view, TRUE, NULL);
+	g_mutex_lock (bf->priv->scans_lock);
 
-	e_flag_wait (closure->running);
+	scan = g_hash_table_lookup (bf->priv->scans, query);
+	if (scan) {
+		d(printf ("joining the running book view population\n"));
+		file_backend_scan_ref (scan);
+	} else {
+		scan = file_backend_scan_new (bf, query);
+		g_hash_table_insert (bf->priv->scans, scan->query, scan);
+		new_scan = TRUE;
+	}
+
+	init_closure (book_view, scan);
+	file_backend_scan_add_view (scan, book_view);
 
-	/* at this point we know the book view thread is actually running */
-	d(printf ("returning from start_book_view\n"));
+	g_mutex_unlock (bf->priv->scans_lock);
+
+	if (new_scan) {
+		d(printf ("starting book view thread\n"));
+		g_object_ref (bf);
+		g_thread_create (book_view_thread, file_backend_scan_ref (scan), FALSE, NULL);
+	}
 }
 
 static void
 e_book_backend_file_stop_book_view (EBookBackend  *backend,
 				    EDataBookView *book_view)
 {
+	EBookBackendFile *bf = E_BOOK_BACKEND_FILE (backend);
 	FileBackendSearchClosure *closure = get_closure (book_view);
-	gboolean need_join;
+	FileBackendScan *scan;
+	GList *link;
 
 	if (!closure)
 		return;
 
 	d(printf ("stopping query\n"));
-	need_join = e_flag_is_set (closure->running);
-	e_flag_clear (closure->running);
+	scan = closure->scan;
+
+	g_mutex_lock (bf->priv->scans_lock);
+	g_mutex_lock (scan->lock);
+
+	/* once this returns, no more contacts are notified to the view */
+	link = g_list_find (scan->views, book_view);
+	if (link)
+		scan->views = g_list_remove_link (scan->views, link);
+
+	/* nobody is waiting for the population any more */
+	if (!scan->views) {
+		e_flag_clear (scan->running);
+		if (g_hash_table_lookup (bf->priv->scans, scan->query) == scan)
+			g_hash_table_remove (bf->priv->scans, scan->query);
+		file_backend_scan_drop_notified (scan);
+	}
+
+	g_mutex_unlock (scan->lock);
+	g_mutex_unlock (bf->priv->scans_lock);
 
-	if (need_join)
-		g_thread_join (closure->thread);
+	/* this may drop the last reference to the view, and to the scan */
+	if (link) {
+		e_data_book_view_unref (book_view);
+		g_list_free_1 (link);
+	}
 }
 
 typedef struct {
@@ -741,6 +1302,80 @@ e_book_backend_file_changes_foreach_key (const gchar *key, gpointer user_data)
 	}
 }
 
+/* Compares the contact with the client's hash and records the change */
+static void
+e_book_backend_file_changes_compare (EBookBackendFileChangeContext *ctx,
+				     EDbHash *ehash,
+				     const gchar *id,
+				     const gchar *vcard)
+{
+	EContact *contact;
+	gchar *vcard_string;
+
+	/* Remove fields the user can't change
+	 * and can change without the rest of the
+	 * card changing
+	 */
+	contact = create_contact ((gchar *) id, vcard);
+
+#ifdef notyet
+	g_object_set (card, "last_use", NULL, "use_score", 0.0, NULL);
+#endif
+	vcard_string = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
+	g_object_unref (contact);
+
+	/* check what type of change has occurred, if any */
+	switch (e_dbhash_compare (ehash, id, vcard_string)) {
+	case E_DBHASH_STATUS_SAME:
+		g_free (vcard_string);
+		break;
+	case E_DBHASH_STATUS_NOT_FOUND:
+		ctx->add_cards = g_list_append (ctx->add_cards, vcard_string);
+		ctx->add_ids = g_list_append (ctx->add_ids, g_strdup (id));
+		break;
+	case E_DBHASH_STATUS_DIFFERENT:
+		ctx->mod_cards = g_list_append (ctx->mod_cards, vcard_string);
+		ctx->mod_ids = g_list_append (ctx->mod_ids, g_strdup (id));
+		break;
+	}
+}
+
+/* Compares only the contacts the change log has seen changing since the
+ * client's last call.  Removed contacts are reported only when the client
+ * knew them. */
+static gint
+e_book_backend_file_changes_since (EBookBackendFileChangeContext *ctx,
+				   EDbHash *ehash,
+				   GSList *uids)
+{
+	DB      *db = ctx->db;
+	DBT     id_dbt, vcard_dbt;
+	gint     db_error;
+	GSList *l;
+
+	for (l = uids; l; l = l->next) {
+		const gchar *id = l->data;
+
+		string_to_dbt (id, &id_dbt);
+		memset (&vcard_dbt, 0, sizeof (vcard_dbt));
+		vcard_dbt.flags = DB_DBT_MALLOC;
+
+		db_error = db->get (db, NULL, &id_dbt, &vcard_dbt, 0);
+
+		if (db_error == 0) {
+			e_book_backend_file_changes_compare (ctx, ehash, id, vcard_dbt.data);
+			g_free (vcard_dbt.data);
+		} else if (db_error == DB_NOTFOUND) {
+			if (e_dbhash_compare (ehash, id, "") != E_DBHASH_STATUS_NOT_FOUND)
+				e_book_backend_file_changes_foreach_key (id, ctx);
+		} else {
+			return db_error;
+		}
+	}
+
+	return DB_NOTFOUND;
+}
+
 static void
 e_book_backend_file_get_changes (EBookBackendSync *backend,
 				 EDataBook *book,
@@ -759,6 +1394,8 @@ e_book_backend_file_get_changes (EBookBackendSync *backend,
 	DBC *dbc;
 	GList *changes = NULL;
 	EBookBackendFileChangeContext ctx;
+	gboolean known_client;
+	guint64 client_sequence = 0, sequence = 0;
 
 	memset (&id_dbt, 0, sizeof (id_dbt));
 	memset (&vcard_dbt, 0, sizeof (vcard_dbt));
@@ -769,59 +1406,48 @@ e_book_backend_file_get_changes (EBookBackendSync *backend,
 
 	/* Find the changed ids */
 	filename = g_strdup_printf ("%s/%s" CHANGES_DB_SUFFIX, bf->priv->dirname, change_id);
+	known_client = g_file_test (filename, G_FILE_TEST_EXISTS);
 	ehash = e_dbhash_new (filename);
 	g_free (filename);
 
-	db_error = db->cursor (db, NULL, &dbc, 0);
-
-	if (db_error != 0) {
-		g_warning (G_STRLOC ": db->cursor failed with %s", db_strerror (db_error));
+	if (bf->priv->change_log) {
+		/* changes made while we compare are seen the next time */
+		sequence = e_change_log_get_sequence (bf->priv->change_log);
+		known_client = known_client && e_change_log_get_client_sequence (bf->priv->change_log, change_id, &client_sequence);
 	} else {
-		db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_FIRST);
+		known_client = FALSE;
+	}
 
-		while (db_error == 0) {
+	if (known_client) {
+		GSList *uids;
 
-			/* don't include the version in the list of cards */
-			if (id_dbt.size != strlen (E_BOOK_BACKEND_FILE_VERSION_NAME) + 1
-			    || strcmp (id_dbt.data, E_BOOK_BACKEND_FILE_VERSION_NAME)) {
-				EContact *contact;
-				gchar *id = id_dbt.data;
-				gchar *vcard_string;
+		uids = e_change_log_get_changed_uids (bf->priv->change_log, client_sequence);
+		db_error = e_book_backend_file_changes_since (&ctx, ehash, uids);
+		g_slist_foreach (uids, (GFunc) g_free, NULL);
+		g_slist_free (uids);
+	} else {
+		db_error = db->cursor (db, NULL, &dbc, 0);
 
-				/* Remove fields the user can't change
-				 * and can change without the rest of the
-				 * card changing
-				 */
-				contact = create_contact (id_dbt.data, vcard_dbt.data);
+		if (db_error != 0) {
+			g_warning (G_STRLOC ": db->cursor failed with %s", db_strerror (db_error));
+		} else {
+			db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_FIRST);
 
-#ifdef notyet
-				g_object_set (card, "last_use", NULL, "use_score", 0.0, NULL);
-#endif
-				vcard_string = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
-				g_object_unref (contact);
+			while (db_error == 0) {
 
-				/* check what type of change has occurred, if any */
-				switch (e_dbhash_compare (ehash, id, vcard_string)) {
-				case E_DBHASH_STATUS_SAME:
-					g_free (vcard_string);
-					break;
-				case E_DBHASH_STATUS_NOT_FOUND:
-					ctx.add_cards = g_list_append (ctx.add_cards, vcard_string);
-					ctx.add_ids = g_list_append (ctx.add_ids, g_strdup (id));
-					break;
-				case E_DBHASH_STATUS_DIFFERENT:
-					ctx.mod_cards = g_list_append (ctx.mod_cards, vcard_string);
-					ctx.mod_ids = g_list_append (ctx.mod_ids, g_strdup (id));
-					break;
+				/* don't include the version in the list of cards */
+				if (id_dbt.size != strlen (E_BOOK_BACKEND_FILE_VERSION_NAME) + 1
+				    || strcmp (id_dbt.data, E_BOOK_BACKEND_FILE_VERSION_NAME)) {
+					e_book_backend_file_changes_compare (&ctx, ehash, id_dbt.data, vcard_dbt.data);
 				}
-			}
 
-			db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_NEXT);
+				db_error = dbc->c_get (dbc, &id_dbt, &vcard_dbt, DB_NEXT);
+			}
+			dbc->c_close (dbc);
 		}
-		dbc->c_close (dbc);
-	}
 
-	e_dbhash_foreach_key (ehash, (EDbHashFunc)e_book_backend_file_changes_foreach_key, &ctx);
+		e_dbhash_foreach_key (ehash, (EDbHashFunc)e_book_backend_file_changes_foreach_key, &ctx);
+	}
 
 	/* Send the changes */
 	if (db_error != DB_NOTFOUND) {
@@ -867,6 +1493,9 @@ e_book_backend_file_get_changes (EBookBackendSync *backend,
 
 		e_dbhash_write (ehash);
 
+		if (bf->priv->change_log)
+			e_change_log_set_client_sequence (bf->priv->change_log, change_id, sequence);
+
 		*changes_out = changes;
 	}
 
@@ -1107,7 +1736,9 @@ e_book_backend_file_load_source (EBookBackend           *backend,
 	DB *db;
 	DB_ENV *env;
 	time_t db_mtime;
+	gchar *mtime_str;
 	struct stat sb;
+	GError *local_error = NULL;
 
 	dirname = e_book_backend_file_extract_path_from_source (source);
 	filename = g_build_filename (dirname, "addressbook.db", NULL);
@@ -1302,6 +1933,38 @@ e_book_backend_file_load_source (EBookBackend           *backend,
 		}
 	}
 
+	/* the index only speeds up searches, the book works without it */
+	g_free (bf->priv->sqlitedb_filename);
+	bf->priv->sqlitedb_filename = g_strconcat (bf->priv->filename, ".sqlite", NULL);
+	bf->priv->sqlitedb = e_book_backend_sqlitedb_new (bf->priv->sqlitedb_filename, FALSE, &local_error);
+
+	if (bf->priv->sqlitedb) {
+		gchar *indexed_mtime;
+
+		indexed_mtime = e_book_backend_sqlitedb_get_key_value (bf->priv->sqlitedb, SQLITEDB_DB_MTIME_KEY, NULL);
+		mtime_str = g_strdup_printf ("%ld", (glong) db_mtime);
+
+		if (g_strcmp0 (indexed_mtime, mtime_str) && !build_sqlitedb (bf->priv, &local_error)) {
+			g_object_unref (bf->priv->sqlitedb);
+			bf->priv->sqlitedb = NULL;
+		}
+
+		g_free (indexed_mtime);
+		g_free (mtime_str);
+	}
+
+	if (local_error) {
+		g_warning ("Failed to build the index for an address book %s: %s", bf->priv->filename, local_error->message);
+		g_error_free (local_error);
+	}
+
+	/* without the change log, get_changes compares every contact */
+	g_free (bf->priv->change_log_filename);
+	bf->priv->change_log_filename = g_strconcat (bf->priv->filename, CHANGE_LOG_SUFFIX, NULL);
+	mtime_str = g_strdup_printf ("%ld", (glong) db_mtime);
+	bf->priv->change_log = e_change_log_new (bf->priv->change_log_filename, mtime_str);
+	g_free (mtime_str);
+
 	e_book_backend_set_is_loaded (backend, TRUE);
 	e_book_backend_set_is_writable (backend, writable);
 }
@@ -1342,6 +2005,20 @@ e_book_backend_file_remove (EBookBackendSync *backend,
 		return;
 	}
 
+	if (bf->priv->sqlitedb) {
+		g_object_unref (bf->priv->sqlitedb);
+		bf->priv->sqlitedb = NULL;
+	}
+	if (-1 == g_unlink (bf->priv->sqlitedb_filename) && errno != ENOENT)
+		g_warning ("failed to remove index file `%s`: %s", bf->priv->sqlitedb_filename, g_strerror (errno));
+
+	if (bf->priv->change_log) {
+		e_change_log_destroy (bf->priv->change_log);
+		bf->priv->change_log = NULL;
+	}
+	if (-1 == g_unlink (bf->priv->change_log_filename) && errno != ENOENT)
+		g_warning ("failed to remove change log `%s`: %s", bf->priv->change_log_filename, g_strerror (errno));
+
 	/* unref the summary before we remove the file so it's not written out again */
 	g_object_unref (bf->priv->summary);
 	bf->priv->summary = NULL;
@@ -1432,6 +2109,36 @@ e_book_backend_file_dispose (GObject *object)
 		bf->priv->file_db = NULL;
 	}
 
+	if (bf->priv->sqlitedb) {
+		struct stat sb;
+
+		/* the index is up to date with the db as it is now */
+		if (!bf->priv->sqlitedb_dirty && g_stat (bf->priv->filename, &sb) == 0) {
+			gchar *mtime_str = g_strdup_printf ("%ld", (glong) sb.st_mtime);
+
+			e_book_backend_sqlitedb_set_key_value (bf->priv->sqlitedb, SQLITEDB_DB_MTIME_KEY, mtime_str, NULL);
+			g_free (mtime_str);
+		}
+
+		g_object_unref (bf->priv->sqlitedb);
+		bf->priv->sqlitedb = NULL;
+	}
+
+	if (bf->priv->change_log) {
+		struct stat sb;
+
+		/* the log knows all the changes made to the db as it is now */
+		if (g_stat (bf->priv->filename, &sb) == 0) {
+			gchar *mtime_str = g_strdup_printf ("%ld", (glong) sb.st_mtime);
+
+			e_change_log_set_stamp (bf->priv->change_log, mtime_str);
+			g_free (mtime_str);
+		}
+
+		e_change_log_destroy (bf->priv->change_log);
+		bf->priv->change_log = NULL;
+	}
+
 	G_LOCK (global_env);
 	global_env.ref_count--;
 	if (global_env.ref_count == 0) {
@@ -1458,6 +2165,10 @@ e_book_backend_file_finalize (GObject *object)
 	g_free (bf->priv->filename);
 	g_free (bf->priv->dirname);
 	g_free (bf->priv->summary_filename);
+	g_free (bf->priv->sqlitedb_filename);
+	g_free (bf->priv->change_log_filename);
+	g_hash_table_destroy (bf->priv->scans);
+	g_mutex_free (bf->priv->scans_lock);
 
 	g_free (bf->priv);
 
@@ -1559,6 +2270,8 @@ e_book_backend_file_init (EBookBackendFile *backend)
 	EBookBackendFilePrivate *priv;
 
 	priv             = g_new0 (EBookBackendFilePrivate, 1);
+	priv->scans_lock = g_mutex_new ();
+	priv->scans = g_hash_table_new (g_str_hash, g_str_equal);
 
 	backend->priv = priv;
 }
@@ -119,6 +119,11 @@
 #include "openldap-extract.h"
 #endif
 
+/* the Simple Paged Results control (RFC 2696) as OpenLDAP 2.4 provides it */
+#if defined (OPENLDAP2) && !defined (SUNLDAP) && defined (LDAP_CONTROL_PAGEDRESULTS) && LDAP_VENDOR_VERSION >= 20400
+#define ENABLE_PAGED_RESULTS
+#endif
+
 #endif
 
 #include <sys/time.h>
@@ -149,6 +154,9 @@ typedef enum {
 /* timeout for ldap_result */
 #define LDAP_RESULT_TIMEOUT_MILLIS 10
 
+/* the entries asked for at once when downloading the offline cache */
+#define CACHE_PAGE_SIZE 500
+
 #define TV_TO_MILLIS(timeval) ((timeval).tv_sec * 1000 + (timeval).tv_usec / 1000)
 
 /* the objectClasses we need */
@@ -210,6 +218,10 @@ struct _EBookBackendLDAPPrivate {
 	gboolean calEntrySupported;
 	gboolean evolutionPersonChecked;
 	gboolean marked_for_offline;
+	gboolean paged_results_supported;
+	gboolean generating_cache;	/* a generate_cache() thread runs */
+	gint generate_cache_msgid;	/* its search, under eds_ldap_handler_lock */
+	GAsyncQueue *generate_cache_results;	/* its messages poll_ldap() got */
 
 	gint mode;
 	/* our operations */
@@ -727,10 +739,15 @@ query_ldap_root_dse (EBookBackendLDAP *bl)
 	g_static_rec_mutex_lock (&eds_ldap_handler_lock);
 	values = ldap_get_values (bl->priv->ldap, resp, "supportedControl");
 	g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
+	bl->priv->paged_results_supported = FALSE;
 	if (values) {
-		if (enable_debug) {
-			for (i = 0; values[i]; i++)
+		for (i = 0; values[i]; i++) {
+			if (enable_debug)
 				g_message ("supported server control: %s", values[i]);
+#ifdef ENABLE_PAGED_RESULTS
+			if (!strcmp (values[i], LDAP_CONTROL_PAGEDRESULTS))
+				bl->priv->paged_results_supported = TRUE;
+#endif
 		}
 		ldap_value_free (values);
 	}
@@ -4286,6 +4303,11 @@ poll_ldap (EBookBackendLDAP *bl)
 
 	g_static_rec_mutex_lock (&eds_ldap_handler_lock);
 	rc = ldap_result (bl->priv->ldap, LDAP_RES_ANY, 0, &timeout, &res);
+	if (rc != 0 && rc != -1 && ldap_msgid (res) == bl->priv->generate_cache_msgid) {
+		/* the offline cache download, its thread reads it */
+		g_async_queue_push (bl->priv->generate_cache_results, res);
+		rc = 0;
+	}
 	g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
 	if (rc != 0) {/* rc == 0 means timeout exceeded */
 		if (rc == -1) {
@@ -4606,150 +4628,432 @@ e_book_backend_ldap_get_changes (EBookBackend *backend,
 #define LDAP_SIMPLE_PREFIX "ldap/simple-"
 #define SASL_PREFIX "sasl/"
 
-static void
-generate_cache_handler (LDAPOp *op, LDAPMessage *res)
+/* The offline cache is downloaded in a thread, using searches asked for
+ * a page at a time when the server supports it.  The contacts
+ * are built in the thread and handed to the main loop to be stored.
+ *
+ * The highest modifyTimestamp seen is kept as the cache's time, so the
+ * next refresh fetches only the entries modified since.  It then lists
+ * the DNs of all the entries, without their attributes, to find the ones
+ * removed from the directory. */
+typedef struct {
+	EBookBackendLDAP *bl;
+	gchar *since;		/* the cache's time, NULL for a full download */
+	gchar *newest;		/* the highest modifyTimestamp downloaded */
+	GHashTable *dns;	/* DNs of the entries in the directory */
+	GSList *contacts;	/* the contacts of the current page */
+	gint n_contacts;
+	gint ldap_error;
+	GTimeVal start;
+} GenerateCacheData;
+
+typedef struct {
+	EBookBackendLDAP *bl;
+	GSList *contacts;
+	gint n_contacts;	/* how many were downloaded so far */
+} GenerateCacheBatch;
+
+typedef void (*GenerateCacheEntryFunc) (GenerateCacheData *data, LDAPMessage *e);
+
+static gboolean
+generate_cache_store_batch (gpointer user_data)
 {
-	LDAPGetContactListOp *contact_list_op = (LDAPGetContactListOp *) op;
-	EBookBackendLDAP *bl = E_BOOK_BACKEND_LDAP (op->backend);
-	LDAPMessage *e;
-	gint msg_type;
+	GenerateCacheBatch *batch = user_data;
+	EBookBackendLDAP *bl = batch->bl;
 	EDataBookView *book_view;
-	GTimeVal start, end;
-	gulong diff;
+	GSList *l;
 
-	if (enable_debug) {
-		printf ("generate_cache_handler ... \n");
-		g_get_current_time (&start);
+	if (bl->priv->cache) {
+		e_file_cache_freeze_changes (E_FILE_CACHE (bl->priv->cache));
+		for (l = batch->contacts; l; l = l->next)
+			e_book_backend_cache_add_contact (bl->priv->cache, l->data);
+		e_file_cache_thaw_changes (E_FILE_CACHE (bl->priv->cache));
 	}
 
+	book_view = find_book_view (bl);
+	if (book_view) {
+		gchar *status_msg;
+
+		status_msg = g_strdup_printf (_("Downloading contacts (%d)... "), batch->n_contacts);
+		book_view_notify_status (bl, book_view, status_msg);
+		g_free (status_msg);
+	}
+
+	g_slist_foreach (batch->contacts, (GFunc) g_object_unref, NULL);
+	g_slist_free (batch->contacts);
+	g_object_unref (bl);
+	g_free (batch);
+
+	return FALSE;
+}
+
+/* Builds the filter of the entries to download, only those modified
+ * since the last refresh when there was one */
+static gchar *
+generate_cache_filter (const gchar *since)
+{
+	if (since)
+		return g_strdup_printf ("(&(cn=*)(modifyTimestamp>=%s))", since);
+
+	return g_strdup ("(cn=*)");
+}
+
+static void
+generate_cache_note_timestamp (GenerateCacheData *data, const gchar *timestamp)
+{
+	/* GeneralizedTime values of a server sort as strings */
+	if (timestamp && g_strcmp0 (timestamp, data->newest) > 0) {
+		g_free (data->newest);
+		data->newest = g_strdup (timestamp);
+	}
+}
+
+/* Removes the cached contacts whose DN isn't in dns any more, returns
+ * how many were removed */
+static gint
+generate_cache_prune (EBookBackendCache *cache, GHashTable *dns)
+{
+	GPtrArray *uids;
+	gint removed = 0;
+	guint i;
+
+	uids = e_book_backend_cache_search (cache, "(contains \"x-evolution-any-field\" \"\")");
+
+	for (i = 0; i < uids->len; i++) {
+		gchar *uid = g_ptr_array_index (uids, i);
+
+		if (uid && !g_hash_table_lookup (dns, uid)) {
+			e_book_backend_cache_remove_contact (cache, uid);
+			removed++;
+		}
+		g_free (uid);
+	}
+	g_ptr_array_free (uids, TRUE);
+
+	return removed;
+}
+
+static void
+generate_cache_add_contact (GenerateCacheData *data, LDAPMessage *e)
+{
+	EBookBackendLDAP *bl = data->bl;
+	EContact *contact;
+	gchar **values;
+
+	contact = build_contact_from_entry (bl, e, NULL, NULL);
+	data->contacts = g_slist_prepend (data->contacts, contact);
+	data->n_contacts++;
+
+	/* a full download tells the entries of the directory on the way */
+	if (!data->since)
+		g_hash_table_insert (data->dns, e_contact_get (contact, E_CONTACT_UID), GINT_TO_POINTER (1));
+
 	g_static_rec_mutex_lock (&eds_ldap_handler_lock);
-	if (!bl->priv->ldap) {
-		g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
-		ldap_op_finished (op);
-		if (enable_debug)
-			printf ("generate_cache_handler ... ldap handler is NULL \n");
-		return;
+	values = bl->priv->ldap ? ldap_get_values (bl->priv->ldap, e, "modifyTimestamp") : NULL;
+	g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
+
+	if (values) {
+		generate_cache_note_timestamp (data, values[0]);
+		ldap_value_free (values);
 	}
+}
+
+static void
+generate_cache_add_dn (GenerateCacheData *data, LDAPMessage *e)
+{
+	gchar *dn;
+
+	g_static_rec_mutex_lock (&eds_ldap_handler_lock);
+	dn = data->bl->priv->ldap ? ldap_get_dn (data->bl->priv->ldap, e) : NULL;
 	g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
 
-	book_view = find_book_view (bl);
+	if (dn) {
+		g_hash_table_insert (data->dns, g_strdup (dn), GINT_TO_POINTER (1));
+		ldap_memfree (dn);
+	}
+}
+
+/* Waits for the next message of the search msgid.  The lock is only
+ * held for a short ldap_result() at a time, so the main loop isn't kept
+ * waiting for the download; poll_ldap() may take the search's messages
+ * meanwhile, it queues them for us. */
+static gint
+generate_cache_next_message (GenerateCacheData *data, gint msgid, LDAPMessage **res)
+{
+	EBookBackendLDAPPrivate *priv = data->bl->priv;
+	struct timeval timeout;
+	gint rc;
+
+	timeout.tv_sec = 0;
+	timeout.tv_usec = LDAP_RESULT_TIMEOUT_MILLIS * 1000;
+
+	do {
+		*res = g_async_queue_try_pop (priv->generate_cache_results);
+		if (*res)
+			return ldap_msgtype (*res);
 
-	msg_type = ldap_msgtype (res);
-	if (msg_type == LDAP_RES_SEARCH_ENTRY) {
 		g_static_rec_mutex_lock (&eds_ldap_handler_lock);
-		e = ldap_first_entry (bl->priv->ldap, res);
+		if (priv->ldap)
+			rc = ldap_result (priv->ldap, msgid, LDAP_MSG_ONE, &timeout, res);
+		else
+			rc = -1;
 		g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
+	} while (rc == 0);
 
-		while (e != NULL) {
-			EContact *contact = build_contact_from_entry (bl, e, NULL, NULL);
+	if (rc == -1)
+		*res = NULL;
+
+	return rc;
+}
+
+/* Runs the search a page at a time, calling func for each entry and
+ * passing the contacts it built to the main loop after each page */
+static gint
+generate_cache_search (GenerateCacheData *data, const gchar *filter, gchar **attrs, GenerateCacheEntryFunc func)
+{
+	EBookBackendLDAPPrivate *priv = data->bl->priv;
+	gint ldap_error;
+#ifdef ENABLE_PAGED_RESULTS
+	struct berval cookie = { 0, NULL };
+#endif
+	gboolean more_pages;
+
+	do {
+		LDAPControl *page_control = NULL;
+		LDAPControl *server_controls[2] = { NULL, NULL };
+		LDAPControl **controls = NULL;
+		LDAPMessage *res;
+		gint msgid, msg_type;
+
+		more_pages = FALSE;
+
+		g_static_rec_mutex_lock (&eds_ldap_handler_lock);
+		if (!priv->ldap) {
+			g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
+			ldap_error = LDAP_SERVER_DOWN;
+			break;
+		}
+
+#ifdef ENABLE_PAGED_RESULTS
+		if (priv->paged_results_supported
+		    && ldap_create_page_control (priv->ldap, CACHE_PAGE_SIZE, &cookie, 0, &page_control) == LDAP_SUCCESS)
+			server_controls[0] = page_control;
+#endif
+
+		ldap_error = ldap_search_ext (priv->ldap,
+					      priv->ldap_rootdn,
+					      priv->ldap_scope,
+					      filter,
+					      attrs, 0,
+					      page_control ? server_controls : NULL, NULL,
+					      NULL, /* XXX timeout */
+					      LDAP_NO_LIMIT, &msgid);
+		if (ldap_error == LDAP_SUCCESS)
+			priv->generate_cache_msgid = msgid;
+
+#ifdef ENABLE_PAGED_RESULTS
+		if (page_control)
+			ldap_control_free (page_control);
+
+		if (cookie.bv_val) {
+			ber_memfree (cookie.bv_val);
+			cookie.bv_val = NULL;
+			cookie.bv_len = 0;
+		}
+#endif
+		g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
 
-			contact_list_op->contacts = g_list_prepend (contact_list_op->contacts, contact);
+		if (ldap_error != LDAP_SUCCESS)
+			break;
+
+		while ((msg_type = generate_cache_next_message (data, msgid, &res)) == LDAP_RES_SEARCH_ENTRY
+		       || msg_type == LDAP_RES_SEARCH_REFERENCE) {
+			if (msg_type == LDAP_RES_SEARCH_ENTRY)
+				func (data, res);
+			ldap_msgfree (res);
+		}
+
+		g_static_rec_mutex_lock (&eds_ldap_handler_lock);
+		priv->generate_cache_msgid = -1;
+		g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
+
+		if (msg_type != LDAP_RES_SEARCH_RESULT) {
+			ldap_error = LDAP_SERVER_DOWN;
+			if (res)
+				ldap_msgfree (res);
+		} else {
+			/* poll_ldap() may have queued entries behind our back
+			   while we were reading the result */
+			LDAPMessage *entry;
+
+			while ((entry = g_async_queue_try_pop (priv->generate_cache_results))) {
+				if (ldap_msgtype (entry) == LDAP_RES_SEARCH_ENTRY)
+					func (data, entry);
+				ldap_msgfree (entry);
+			}
 
 			g_static_rec_mutex_lock (&eds_ldap_handler_lock);
-			e = ldap_next_entry (bl->priv->ldap, e);
+			if (!priv->ldap || ldap_parse_result (priv->ldap, res, &ldap_error, NULL, NULL, NULL, &controls, 0) != LDAP_SUCCESS)
+				ldap_error = LDAP_OTHER;
+
+#ifdef ENABLE_PAGED_RESULTS
+			if (controls && ldap_error == LDAP_SUCCESS) {
+				LDAPControl *control;
+				ber_int_t estimate;
+
+				control = ldap_control_find (LDAP_CONTROL_PAGEDRESULTS, controls, NULL);
+				if (control && ldap_parse_pageresponse_control (priv->ldap, control, &estimate, &cookie) == LDAP_SUCCESS)
+					more_pages = cookie.bv_len > 0;
+			}
+#endif
+			if (controls)
+				ldap_controls_free (controls);
 			g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
+
+			ldap_msgfree (res);
 		}
-	} else {
-		GList *l;
-		gint contact_num = 0;
-		gchar *status_msg;
 
-		e_file_cache_clean (E_FILE_CACHE (bl->priv->cache));
+		if (data->contacts) {
+			GenerateCacheBatch *batch = g_new0 (GenerateCacheBatch, 1);
+
+			batch->bl = g_object_ref (data->bl);
+			batch->contacts = data->contacts;
+			batch->n_contacts = data->n_contacts;
+			data->contacts = NULL;
+
+			g_idle_add (generate_cache_store_batch, batch);
+		}
+	} while (more_pages);
+
+#ifdef ENABLE_PAGED_RESULTS
+	if (cookie.bv_val)
+		ber_memfree (cookie.bv_val);
+#endif
+
+	return ldap_error;
+}
+
+static gboolean
+generate_cache_finish (gpointer user_data)
+{
+	GenerateCacheData *data = user_data;
+	EBookBackendLDAP *bl = data->bl;
+	EDataBookView *book_view;
+
+	/* a server limit cuts the download short, keep what came */
+	if ((data->ldap_error == LDAP_SUCCESS || data->ldap_error == LDAP_SIZELIMIT_EXCEEDED) && bl->priv->cache) {
+		gint removed = 0;
 
 		e_file_cache_freeze_changes (E_FILE_CACHE (bl->priv->cache));
-		for (l = contact_list_op->contacts; l; l = g_list_next (l)) {
-			EContact *contact = l->data;
 
-			contact_num++;
-			if (book_view) {
-				status_msg = g_strdup_printf (_("Downloading contacts (%d)... "),
-								 contact_num);
-				book_view_notify_status (bl, book_view, status_msg);
-				g_free (status_msg);
-			}
-			e_book_backend_cache_add_contact (bl->priv->cache, contact);
+		if (data->ldap_error == LDAP_SUCCESS) {
+			/* drop the contacts whose entries are gone */
+			removed = generate_cache_prune (bl->priv->cache, data->dns);
+
+			if (data->newest)
+				e_book_backend_cache_set_time (bl->priv->cache, data->newest);
 		}
+
 		e_book_backend_cache_set_populated (bl->priv->cache);
 		e_file_cache_thaw_changes (E_FILE_CACHE (bl->priv->cache));
-		if (book_view)
-			e_data_book_view_notify_complete (book_view, NULL /* Success */);
-		ldap_op_finished (op);
+
 		if (enable_debug) {
+			GTimeVal end;
+			gulong diff;
+
 			g_get_current_time (&end);
 			diff = end.tv_sec * 1000 + end.tv_usec/1000;
-			diff -= start.tv_sec * 1000 + start.tv_usec/1000;
-			printf ("generate_cache_handler ... completed in %ld.%03ld seconds\n",
-								diff/1000,diff%1000);
+			diff -= data->start.tv_sec * 1000 + data->start.tv_usec/1000;
+			printf ("generate_cache ... %s refresh of %d contacts, %d removed, completed in %ld.%03ld seconds\n",
+				data->since ? "incremental" : "full", data->n_contacts, removed, diff/1000, diff%1000);
 		}
+	} else {
+		g_warning ("Failed to download the offline cache (ldap_error 0x%02x/%s)", data->ldap_error,
+			   ldap_err2string (data->ldap_error) ? ldap_err2string (data->ldap_error) : "Unknown error");
 	}
+
+	book_view = find_book_view (bl);
+	if (book_view)
+		e_data_book_view_notify_complete (book_view, NULL /* Success */);
+
+	bl->priv->generating_cache = FALSE;
+
+	g_hash_table_destroy (data->dns);
+	g_free (data->since);
+	g_free (data->newest);
+	g_free (data);
+
+	g_object_unref (bl);
+
+	return FALSE;
 }
 
-static void
-generate_cache_dtor (LDAPOp *op)
+static gpointer
+generate_cache_thread (GenerateCacheData *data)
 {
-	LDAPGetContactListOp *contact_list_op = (LDAPGetContactListOp *) op;
-	GList *l;
+	const gchar *attrs[] = { "*", "modifyTimestamp", NULL };
+	const gchar *no_attrs[] = { "1.1", NULL };	/* only the DNs */
+	gchar *filter;
 
-	for (l = contact_list_op->contacts; l; l = g_list_next (l)) {
-		g_object_unref (l->data);
-	}
+	filter = generate_cache_filter (data->since);
 
-	g_list_free (contact_list_op->contacts);
-	g_free (contact_list_op);
+	data->ldap_error = generate_cache_search (data, filter, (gchar **) attrs, generate_cache_add_contact);
+	g_free (filter);
+
+	if (data->since && data->ldap_error == LDAP_SUCCESS)
+		data->ldap_error = generate_cache_search (data, "(cn=*)", (gchar **) no_attrs, generate_cache_add_dn);
+
+	/* the reference on the backend is released in the main loop */
+	g_idle_add (generate_cache_finish, data);
+
+	return NULL;
 }
 
 static void
 generate_cache (EBookBackendLDAP *book_backend_ldap)
 {
-	LDAPGetContactListOp *contact_list_op = g_new0 (LDAPGetContactListOp, 1);
 	EBookBackendLDAPPrivate *priv;
-	gint contact_list_msgid;
-	gint ldap_error;
-	GTimeVal start, end;
-	gulong diff;
-
-	if (enable_debug) {
-		printf ("generating offline cache ... \n");
-		g_get_current_time (&start);
-	}
+	GenerateCacheData *data;
+	GError *error = NULL;
 
 	priv = book_backend_ldap->priv;
 
+	if (priv->generating_cache || !priv->cache)
+		return;
+
+	if (enable_debug)
+		printf ("generating offline cache ... \n");
+
 	g_static_rec_mutex_lock (&eds_ldap_handler_lock);
 	if (!priv->ldap) {
 		g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
-		g_free (contact_list_op);
 		if (enable_debug)
 			printf ("generating offline cache failed ... ldap handler is NULL\n");
 		return;
 	}
 	g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
 
-	do {
-		g_static_rec_mutex_lock (&eds_ldap_handler_lock);
-		ldap_error = ldap_search_ext (priv->ldap,
-					      priv->ldap_rootdn,
-					      priv->ldap_scope,
-					      "(cn=*)",
-					      NULL, 0, NULL, NULL,
-					      NULL, /* XXX timeout */
-					      LDAP_NO_LIMIT, &contact_list_msgid);
-		g_static_rec_mutex_unlock (&eds_ldap_handler_lock);
-	} while (e_book_backend_ldap_reconnect (book_backend_ldap, NULL, ldap_error));
+	data = g_new0 (GenerateCacheData, 1);
+	data->bl = g_object_ref (book_backend_ldap);
+	data->dns = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_get_current_time (&data->start);
 
-	if (ldap_error == LDAP_SUCCESS) {
-		ldap_op_add ((LDAPOp*) contact_list_op, (EBookBackend *) book_backend_ldap, NULL /* book */,
-			     NULL /* book_view */, 0 /* opid */, contact_list_msgid,
-			     generate_cache_handler, generate_cache_dtor);
-		if (enable_debug) {
-			printf ("generating offline cache invoked generate_cache_handler ");
-			g_get_current_time (&end);
-			diff = end.tv_sec * 1000 + end.tv_usec/1000;
-			diff -= start.tv_sec * 1000 + start.tv_usec/1000;
-			printf("and took %ld.%03ld seconds\n", diff/1000, diff%1000);
-		}
-	} else {
-		generate_cache_dtor ((LDAPOp *) contact_list_op);
+	/* without a time, the cache was filled before it was kept */
+	if (e_book_backend_cache_is_populated (priv->cache))
+		data->since = e_book_backend_cache_get_time (priv->cache);
+
+	priv->generating_cache = TRUE;
+
+	if (!g_thread_create ((GThreadFunc) generate_cache_thread, data, FALSE, &error)) {
+		g_warning ("%s: Cannot create thread: %s", G_STRFUNC, error ? error->message : "Unknown error");
+		if (error)
+			g_error_free (error);
+
+		priv->generating_cache = FALSE;
+		g_hash_table_destroy (data->dns);
+		g_free (data->since);
+		g_free (data);
+		g_object_unref (book_backend_ldap);
 	}
 }
 
@@ -5359,6 +5663,7 @@ e_book_backend_ldap_dispose (GObject *object)
 		g_free (bl->priv->ldap_rootdn);
 		g_free (bl->priv->ldap_search_filter);
 		g_free (bl->priv->schema_dn);
+		g_async_queue_unref (bl->priv->generate_cache_results);
 		g_free (bl->priv);
 		bl->priv = NULL;
 	}
@@ -5417,6 +5722,8 @@ e_book_backend_ldap_init (EBookBackendLDAP *backend)
 	priv->marked_for_offline     = FALSE;
 	priv->mode                   = E_DATA_BOOK_MODE_REMOTE;
 	priv->is_summary_ready	     = FALSE;
+	priv->generate_cache_msgid   = -1;
+	priv->generate_cache_results = g_async_queue_new_full ((GDestroyNotify) ldap_msgfree);
 	priv->reserved1	     = NULL;
 	priv->reserved2	     = NULL;
 	priv->reserved3	     = NULL;
@@ -5428,3 +5735,95 @@ e_book_backend_ldap_init (EBookBackendLDAP *backend)
 	if (g_getenv ("LDAP_DEBUG"))
 		enable_debug = TRUE;
 }
+
+#ifdef TEST_GENERATE_CACHE
+#include <glib/gstdio.h>
+
+/* Checks the parts of the offline cache refresh which don't need a
+ * server: the incremental filter, the newest timestamp and the pruning
+ * of the entries gone from the directory. */
+
+static gint failures = 0;
+
+static void
+check (gboolean condition, const gchar *what)
+{
+	if (!condition) {
+		g_printerr ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+static void
+test_add_contact (EBookBackendCache *cache, const gchar *dn)
+{
+	EContact *contact = e_contact_new ();
+
+	e_contact_set (contact, E_CONTACT_UID, dn);
+	e_contact_set (contact, E_CONTACT_FULL_NAME, dn);
+	e_book_backend_cache_add_contact (cache, contact);
+	g_object_unref (contact);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GenerateCacheData data = { NULL };
+	EBookBackendCache *cache;
+	GHashTable *dns;
+	gchar *filter, *filename;
+
+	g_type_init ();
+
+	filter = generate_cache_filter (NULL);
+	check (g_strcmp0 (filter, "(cn=*)") == 0, "a full download asks for every entry");
+	g_free (filter);
+
+	filter = generate_cache_filter ("20110101000000Z");
+	check (g_strcmp0 (filter, "(&(cn=*)(modifyTimestamp>=20110101000000Z))") == 0,
+	       "an incremental download asks for the modified entries");
+	g_free (filter);
+
+	generate_cache_note_timestamp (&data, "20110102000000Z");
+	generate_cache_note_timestamp (&data, "20110101120000Z");
+	generate_cache_note_timestamp (&data, NULL);
+	generate_cache_note_timestamp (&data, "20110103000000Z");
+	generate_cache_note_timestamp (&data, "20110102235959Z");
+	check (g_strcmp0 (data.newest, "20110103000000Z") == 0, "the newest timestamp is kept");
+	g_free (data.newest);
+
+	filename = g_build_filename (g_get_tmp_dir (), "test-generate-cache.xml", NULL);
+	g_unlink (filename);
+
+	cache = e_book_backend_cache_new (filename);
+	test_add_contact (cache, "cn=a,dc=example,dc=com");
+	test_add_contact (cache, "cn=b,dc=example,dc=com");
+	test_add_contact (cache, "cn=c,dc=example,dc=com");
+
+	dns = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (dns, (gpointer) "cn=a,dc=example,dc=com", GINT_TO_POINTER (1));
+	g_hash_table_insert (dns, (gpointer) "cn=c,dc=example,dc=com", GINT_TO_POINTER (1));
+	g_hash_table_insert (dns, (gpointer) "cn=d,dc=example,dc=com", GINT_TO_POINTER (1));
+
+	check (generate_cache_prune (cache, dns) == 1, "one entry is pruned");
+	check (e_book_backend_cache_check_contact (cache, "cn=a,dc=example,dc=com"), "a listed entry is kept");
+	check (!e_book_backend_cache_check_contact (cache, "cn=b,dc=example,dc=com"), "a gone entry is removed");
+	check (e_book_backend_cache_check_contact (cache, "cn=c,dc=example,dc=com"), "the last entry is kept");
+
+	check (generate_cache_prune (cache, dns) == 0, "pruning again removes nothing");
+
+	g_hash_table_destroy (dns);
+	g_object_unref (cache);
+	g_unlink (filename);
+	g_free (filename);
+
+	if (failures) {
+		g_printerr ("%d checks failed\n", failures);
+		return 1;
+	}
+
+	g_print ("Everything OK\n");
+
+	return 0;
+}
+#endif
@@ -1216,13 +1216,22 @@ e_contact_new_from_vcard  (const gchar *vcard)
 {
 	EContact *contact;
 	const gchar *file_as;
+	gchar *scanned_file_as;
 
 	g_return_val_if_fail (vcard != NULL, NULL);
 
 	contact = g_object_new (E_TYPE_CONTACT, NULL);
 	e_vcard_construct (E_VCARD (contact), vcard);
 
-	/* Generate a FILE_AS field if needed */
+	/* Generate a FILE_AS field if needed.  Most cards have one, so
+	   look for it without parsing the whole card. */
+
+	scanned_file_as = e_vcard_scan_attribute_value (vcard, EVC_X_FILE_AS);
+	if (scanned_file_as && *scanned_file_as) {
+		g_free (scanned_file_as);
+		return contact;
+	}
+	g_free (scanned_file_as);
 
 	file_as = e_contact_get_const (contact, E_CONTACT_FILE_AS);
 	if (!file_as || !*file_as) {
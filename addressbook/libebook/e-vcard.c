@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <libedataserver/e-data-server-util.h>
 #include "e-vcard.h"
 
 #define d(x)
@@ -47,6 +48,7 @@ typedef enum {
 
 struct _EVCardPrivate {
 	GList *attributes;
+	gchar *vcard; /* the string the card was created from, until it is parsed */
 };
 
 struct _EVCardAttribute {
@@ -75,6 +77,7 @@ e_vcard_dispose (GObject *object)
 
 		g_list_foreach (evc->priv->attributes, (GFunc)e_vcard_attribute_free, NULL);
 		g_list_free (evc->priv->attributes);
+		g_free (evc->priv->vcard);
 
 		g_free (evc->priv);
 		evc->priv = NULL;
@@ -653,6 +656,85 @@ parse (EVCard *evc, const gchar *str)
 	evc->priv->attributes = g_list_reverse (evc->priv->attributes);
 }
 
+/* Cards are only parsed when their attributes are first used, many
+ * are just passed on as they were read.
+ */
+static void
+e_vcard_ensure_attributes (EVCard *evc)
+{
+	gchar *str = evc->priv->vcard;
+
+	if (!str)
+		return;
+
+	/* parse () adds the attributes with e_vcard_add_attribute () */
+	evc->priv->vcard = NULL;
+	parse (evc, str);
+	g_free (str);
+}
+
+/* Returns the start of the line after the one at @p, which may be
+ * continued by folding or by a quoted-printable soft line break.
+ */
+static const gchar *
+scan_next_line (const gchar *p, gboolean quoted_printable)
+{
+	for (;;) {
+		const gchar *line = p, *eol;
+
+		for (eol = line; *eol && *eol != '\r' && *eol != '\n'; eol++)
+			;
+		for (p = eol; *p == '\r' || *p == '\n'; p++)
+			;
+
+		if (!*p)
+			return p;
+		if (*p == ' ' || *p == '\t')
+			continue;
+		if (quoted_printable && eol > line && eol[-1] == '=')
+			continue;
+
+		return p;
+	}
+}
+
+/* checks whether the attribute on the line at @p is named @attr_name,
+   and whether its value is quoted-printable, without copying anything */
+static gboolean
+scan_attribute_name (const gchar *p, const gchar *attr_name, gboolean *quoted_printable)
+{
+	const gchar *name = p;
+	gsize len = strlen (attr_name);
+	gboolean matches;
+
+	/* skip the group */
+	while (g_ascii_isalnum (*p) || *p == '-' || *p == '_')
+		p++;
+	if (*p == '.') {
+		name = ++p;
+		while (g_ascii_isalnum (*p) || *p == '-' || *p == '_')
+			p++;
+	}
+
+	matches = (gsize) (p - name) == len && !g_ascii_strncasecmp (name, attr_name, len)
+		&& (*p == ':' || *p == ';');
+
+	*quoted_printable = FALSE;
+	if (*p == ';') {
+		const gchar *qp = "quoted-printable";
+		gsize qp_len = strlen (qp);
+
+		for (; *p && *p != ':' && *p != '\r' && *p != '\n'; p++) {
+			if (!g_ascii_strncasecmp (p, qp, qp_len)) {
+				*quoted_printable = TRUE;
+				break;
+			}
+		}
+	}
+
+	return matches;
+}
+
 /**
  * e_vcard_escape_string:
  * @s: the string to escape
@@ -748,8 +830,151 @@ e_vcard_construct (EVCard *evc, const gchar *str)
 	g_return_if_fail (E_IS_VCARD (evc));
 	g_return_if_fail (str != NULL);
 
-	if (*str)
+	if (!*str)
+		return;
+
+	/* it is parsed when the attributes are needed */
+	if (!evc->priv->attributes && !evc->priv->vcard) {
+		evc->priv->vcard = g_strdup (str);
+	} else {
+		e_vcard_ensure_attributes (evc);
 		parse (evc, str);
+	}
+}
+
+static GList *
+scan_attributes (const gchar *vcard_str, const gchar *attr_name, gboolean first_only)
+{
+	GList *attrs = NULL;
+	const gchar *p;
+
+	/* the parser works on valid UTF-8 only */
+	if (!g_utf8_validate (vcard_str, -1, NULL)) {
+		EVCard *evc = e_vcard_new_from_string (vcard_str);
+		GList *l;
+
+		for (l = e_vcard_get_attributes (evc); l; l = l->next) {
+			EVCardAttribute *attr = l->data;
+
+			if (!g_ascii_strcasecmp (attr->name, attr_name)) {
+				attrs = g_list_prepend (attrs, e_vcard_attribute_copy (attr));
+				if (first_only)
+					break;
+			}
+		}
+
+		g_object_unref (evc);
+
+		return g_list_reverse (attrs);
+	}
+
+	for (p = vcard_str; *p;) {
+		gboolean quoted_printable;
+
+		if (scan_attribute_name (p, attr_name, &quoted_printable)) {
+			gchar *lp = (gchar *) p;
+			EVCardAttribute *attr = read_attribute (&lp);
+
+			if (attr) {
+				attrs = g_list_prepend (attrs, attr);
+				if (first_only)
+					break;
+			}
+		}
+
+		p = scan_next_line (p, quoted_printable);
+	}
+
+	return g_list_reverse (attrs);
+}
+
+/**
+ * e_vcard_scan_attribute:
+ * @vcard_str: a string representation of a vCard
+ * @attr_name: the name of the attribute to get
+ *
+ * Gets the first attribute named @attr_name in @vcard_str, like
+ * e_vcard_get_attribute() would.  Only that attribute is parsed, so
+ * this is much faster than creating an #EVCard when only a few
+ * attributes of many cards are needed.
+ *
+ * Returns: A newly allocated #EVCardAttribute, free it with
+ * e_vcard_attribute_free(), or %NULL if there is no such attribute.
+ *
+ * Since: 3.0
+ **/
+EVCardAttribute *
+e_vcard_scan_attribute (const gchar *vcard_str, const gchar *attr_name)
+{
+	GList *attrs;
+	EVCardAttribute *attr;
+
+	g_return_val_if_fail (vcard_str != NULL, NULL);
+	g_return_val_if_fail (attr_name != NULL, NULL);
+
+	attrs = scan_attributes (vcard_str, attr_name, TRUE);
+	attr = attrs ? attrs->data : NULL;
+	g_list_free (attrs);
+
+	return attr;
+}
+
+/**
+ * e_vcard_scan_attributes:
+ * @vcard_str: a string representation of a vCard
+ * @attr_name: the name of the attributes to get
+ *
+ * Gets all attributes named @attr_name in @vcard_str, in the order
+ * they appear in the vCard, parsing only those attributes.
+ *
+ * Returns: A newly allocated #GList of newly allocated
+ * #EVCardAttribute<!-- -->s.  Free the attributes with
+ * e_vcard_attribute_free() and the list with g_list_free().
+ *
+ * Since: 3.0
+ **/
+GList *
+e_vcard_scan_attributes (const gchar *vcard_str, const gchar *attr_name)
+{
+	g_return_val_if_fail (vcard_str != NULL, NULL);
+	g_return_val_if_fail (attr_name != NULL, NULL);
+
+	return scan_attributes (vcard_str, attr_name, FALSE);
+}
+
+/**
+ * e_vcard_scan_attribute_value:
+ * @vcard_str: a string representation of a vCard
+ * @attr_name: the name of the attribute to get
+ *
+ * Gets the value of the first attribute named @attr_name in @vcard_str,
+ * like e_vcard_attribute_get_value() on the attribute returned by
+ * e_vcard_get_attribute() would.  Only that attribute is parsed, so
+ * this is much faster than creating an #EVCard when only a few
+ * attributes of many cards are needed, like their UID.
+ *
+ * Returns: A newly allocated string, or %NULL if there is no such
+ * attribute.
+ *
+ * Since: 3.0
+ **/
+gchar *
+e_vcard_scan_attribute_value (const gchar *vcard_str, const gchar *attr_name)
+{
+	EVCardAttribute *attr;
+	gchar *value;
+
+	g_return_val_if_fail (vcard_str != NULL, NULL);
+	g_return_val_if_fail (attr_name != NULL, NULL);
+
+	attr = e_vcard_scan_attribute (vcard_str, attr_name);
+	if (!attr)
+		return NULL;
+
+	value = e_vcard_attribute_get_value (attr);
+	e_vcard_attribute_free (attr);
+
+	return value;
 }
 
 /**
@@ -795,13 +1020,50 @@ e_vcard_to_string_vcard_21  (EVCard *evc)
 	return g_strdup ("");
 }
 
+/* Whether str looks like what e_vcard_to_string_vcard_30() writes: a 3.0
+ * card with CRLF line ends and no quoted-printable values, which it would
+ * write out again unchanged */
+static gboolean
+vcard_is_normalized_30 (const gchar *str)
+{
+	static const gchar header[] = "BEGIN:VCARD" CRLF "VERSION:3.0" CRLF;
+	static const gchar footer[] = CRLF "END:VCARD";
+	const gchar *p;
+	gsize len;
+
+	if (strncmp (str, header, sizeof (header) - 1) != 0)
+		return FALSE;
+
+	/* the header is longer than the footer */
+	len = strlen (str);
+	if (strcmp (str + len - (sizeof (footer) - 1), footer) != 0)
+		return FALSE;
+
+	for (p = strchr (str, '\n'); p; p = strchr (p + 1, '\n')) {
+		if (p[-1] != '\r')
+			return FALSE;
+	}
+
+	if (e_util_strstrcase (str, "QUOTED-PRINTABLE"))
+		return FALSE;
+
+	return g_utf8_validate (str, len, NULL);
+}
+
 static gchar *
 e_vcard_to_string_vcard_30 (EVCard *evc)
 {
 	GList *l;
 	GList *v;
+	GString *str;
+
+	/* an unparsed card we wrote ourselves is still as we would write it */
+	if (evc->priv->vcard && vcard_is_normalized_30 (evc->priv->vcard))
+		return g_strdup (evc->priv->vcard);
+
+	e_vcard_ensure_attributes (evc);
 
-	GString *str = g_string_new ("");
+	str = g_string_new ("");
 
 	g_string_append (str, "BEGIN:VCARD" CRLF);
 
@@ -977,6 +1239,8 @@ e_vcard_dump_structure (EVCard *evc)
 
 	g_return_if_fail (E_IS_VCARD (evc));
 
+	e_vcard_ensure_attributes (evc);
+
 	printf ("vCard\n");
 	for (a = evc->priv->attributes; a; a = a->next) {
 		GList *p;
@@ -1097,6 +1361,8 @@ e_vcard_remove_attributes (EVCard *evc, const gchar *attr_group, const gchar *at
 	g_return_if_fail (E_IS_VCARD (evc));
 	g_return_if_fail (attr_name != NULL);
 
+	e_vcard_ensure_attributes (evc);
+
 	attr = evc->priv->attributes;
 	while (attr) {
 		GList *next_attr;
@@ -1131,6 +1397,8 @@ e_vcard_remove_attribute (EVCard *evc, EVCardAttribute *attr)
 	g_return_if_fail (E_IS_VCARD (evc));
 	g_return_if_fail (attr != NULL);
 
+	e_vcard_ensure_attributes (evc);
+
 	evc->priv->attributes = g_list_remove (evc->priv->attributes, attr);
 	e_vcard_attribute_free (attr);
 }
@@ -1150,6 +1418,8 @@ e_vcard_append_attribute (EVCard *evc, EVCardAttribute *attr)
 	g_return_if_fail (E_IS_VCARD (evc));
 	g_return_if_fail (attr != NULL);
 
+	e_vcard_ensure_attributes (evc);
+
 	evc->priv->attributes = g_list_append (evc->priv->attributes, attr);
 }
 
@@ -1220,6 +1490,8 @@ e_vcard_add_attribute (EVCard *evc, EVCardAttribute *attr)
 	g_return_if_fail (E_IS_VCARD (evc));
 	g_return_if_fail (attr != NULL);
 
+	e_vcard_ensure_attributes (evc);
+
 	evc->priv->attributes = g_list_prepend (evc->priv->attributes, attr);
 }
 
@@ -1769,6 +2041,8 @@ e_vcard_get_attributes (EVCard *evcard)
 {
 	g_return_val_if_fail (E_IS_VCARD (evcard), NULL);
 
+	e_vcard_ensure_attributes (evcard);
+
 	return evcard->priv->attributes;
 }
 
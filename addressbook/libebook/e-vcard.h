@@ -223,6 +223,9 @@ gboolean         e_vcard_attribute_has_type         (EVCardAttribute *attr, cons
 /* Utility functions. */
 gchar *            e_vcard_escape_string (const gchar *s);
 gchar *            e_vcard_unescape_string (const gchar *s);
+EVCardAttribute *e_vcard_scan_attribute (const gchar *vcard_str, const gchar *attr_name);
+GList *          e_vcard_scan_attributes (const gchar *vcard_str, const gchar *attr_name);
+gchar *            e_vcard_scan_attribute_value (const gchar *vcard_str, const gchar *attr_name);
 
 G_END_DECLS
 
@@ -177,6 +177,45 @@ e_book_backend_cache_check_contact (EBookBackendCache *cache, const gchar *uid)
 	return retval;
 }
 
+/* Returns the vCards of @cache matching @query, without building an
+   EContact for the others.  The strings belong to the cache. */
+static GSList *
+get_matching_vcards (EBookBackendCache *cache, const gchar *query)
+{
+	EBookBackendSExp *sexp;
+	GSList *l, *lcache, *vcards = NULL;
+
+	if (!query)
+		return NULL;
+
+	sexp = e_book_backend_sexp_new (query);
+	if (!sexp)
+		return NULL;
+
+	lcache = e_file_cache_get_objects (E_FILE_CACHE (cache));
+
+	for (l = lcache; l != NULL; l = g_slist_next (l)) {
+		const gchar *vcard_str = l->data;
+		gchar *uid;
+
+		if (!vcard_str || strncmp (vcard_str, "BEGIN:VCARD", 11))
+			continue;
+
+		if (!e_book_backend_sexp_match_vcard (sexp, vcard_str))
+			continue;
+
+		uid = e_vcard_scan_attribute_value (vcard_str, EVC_UID);
+		if (uid && *uid)
+			vcards = g_slist_prepend (vcards, (gpointer) vcard_str);
+		g_free (uid);
+	}
+
+	g_slist_free (lcache);
+	g_object_unref (sexp);
+
+	return g_slist_reverse (vcards);
+}
+
 /**
  * e_book_backend_cache_get_contacts:
  * @cache: an #EBookBackendCache
@@ -191,38 +230,21 @@ e_book_backend_cache_check_contact (EBookBackendCache *cache, const gchar *uid)
 GList *
 e_book_backend_cache_get_contacts (EBookBackendCache *cache, const gchar *query)
 {
-	gchar *vcard_str;
-	GSList *l, *lcache;
+	GSList *l, *vcards;
 	GList *list = NULL;
 	EContact *contact;
-	EBookBackendSExp *sexp = NULL;
-	const gchar *uid;
 
 	g_return_val_if_fail (E_IS_BOOK_BACKEND_CACHE (cache), NULL);
-	if (query) {
-		sexp = e_book_backend_sexp_new (query);
-		if (!sexp)
-			return NULL;
-	}
-
-	lcache = l = e_file_cache_get_objects (E_FILE_CACHE (cache));
 
-	for (; l != NULL; l = g_slist_next (l)) {
-		vcard_str = l->data;
-                if (vcard_str && !strncmp (vcard_str, "BEGIN:VCARD", 11)) {
-			contact = e_contact_new_from_vcard (vcard_str);
-			uid = e_contact_get_const (contact, E_CONTACT_UID);
-			if (contact && uid && *uid &&(query && e_book_backend_sexp_match_contact (sexp, contact)))
-				list = g_list_prepend (list, contact);
-			else
-				g_object_unref (contact);
-		}
+	vcards = get_matching_vcards (cache, query);
 
+	for (l = vcards; l != NULL; l = g_slist_next (l)) {
+		contact = e_contact_new_from_vcard (l->data);
+		if (contact)
+			list = g_list_prepend (list, contact);
 	}
-	if (lcache)
-		g_slist_free (lcache);
-	if (sexp)
-		g_object_unref (sexp);
+
+	g_slist_free (vcards);
 
 	return g_list_reverse (list);
 }
@@ -241,18 +263,16 @@ e_book_backend_cache_get_contacts (EBookBackendCache *cache, const gchar *query)
 GPtrArray *
 e_book_backend_cache_search (EBookBackendCache *cache, const gchar *query)
 {
-	GList *matching_contacts, *temp;
+	GSList *l, *vcards;
 	GPtrArray *ptr_array;
 
-	matching_contacts = e_book_backend_cache_get_contacts (cache, query);
+	vcards = get_matching_vcards (cache, query);
 	ptr_array = g_ptr_array_new ();
 
-	temp = matching_contacts;
-	for (; matching_contacts != NULL; matching_contacts = g_list_next (matching_contacts)) {
-		g_ptr_array_add (ptr_array, e_contact_get (matching_contacts->data, E_CONTACT_UID));
-		g_object_unref (matching_contacts->data);
-	}
-	g_list_free (temp);
+	for (l = vcards; l != NULL; l = g_slist_next (l))
+		g_ptr_array_add (ptr_array, e_vcard_scan_attribute_value (l->data, EVC_UID));
+
+	g_slist_free (vcards);
 
 	return ptr_array;
 }
@@ -32,12 +32,84 @@ typedef struct _SearchContext SearchContext;
 struct _EBookBackendSExpPrivate {
 	ESExp *search_sexp;
 	SearchContext *search_context;
+
+	/* the search context holds the matched contact, so
+	   views sharing the sexp take turns matching */
+	GMutex *lock;
 };
 
 struct _SearchContext {
 	EContact *contact;
+
+	/* the vCard being matched by e_book_backend_sexp_match_vcard(),
+	   the contact is only built from it when really needed */
+	const gchar *vcard;
 };
 
+static EContact *
+get_contact (SearchContext *ctx)
+{
+	if (!ctx->contact)
+		ctx->contact = e_contact_new_from_vcard (ctx->vcard);
+
+	return ctx->contact;
+}
+
+/* Gets the first attribute named @name, scanning the vCard text for it
+   when the contact hasn't been built.  A scanned attribute is returned
+   in @scanned too, and has to be freed by the caller. */
+static EVCardAttribute *
+get_attribute (SearchContext *ctx, const gchar *name, EVCardAttribute **scanned)
+{
+	*scanned = NULL;
+
+	/* e_contact_new_from_vcard() makes up a FILE_AS for cards without one */
+	if (ctx->contact || !g_ascii_strcasecmp (name, EVC_X_FILE_AS))
+		return e_vcard_get_attribute (E_VCARD (get_contact (ctx)), name);
+
+	*scanned = e_vcard_scan_attribute (ctx->vcard, name);
+
+	return *scanned;
+}
+
+/* Calls @compare on the first value of the first @max attributes named
+   @attr_name in @vcard, or of all of them if @max is -1, like the
+   EContact multi-valued fields do. */
+static gboolean
+compare_attributes_vcard (const gchar *vcard, const gchar *attr_name, gint max,
+			  const gchar *str,
+			  gchar *(*compare)(const gchar *, const gchar *))
+{
+	GList *attrs, *l;
+	gboolean found_it = FALSE;
+
+	attrs = e_vcard_scan_attributes (vcard, attr_name);
+
+	for (l = attrs; l && max != 0 && !found_it; l = l->next, max--) {
+		GList *v = e_vcard_attribute_get_values (l->data);
+		gchar *value;
+
+		if (!v || !v->data)
+			continue;
+
+		value = g_strstrip (g_strdup (v->data));
+		found_it = compare (value, str) != NULL;
+		g_free (value);
+	}
+
+	g_list_foreach (attrs, (GFunc) e_vcard_attribute_free, NULL);
+	g_list_free (attrs);
+
+	return found_it;
+}
+
+static gboolean
+compare_multi_vcard (const gchar *vcard, const gchar *attr_name, const gchar *str,
+		     gchar *(*compare)(const gchar *, const gchar *))
+{
+	return compare_attributes_vcard (vcard, attr_name, -1, str, compare);
+}
+
 static gboolean
 compare_im (EContact *contact, const gchar *str,
 	    gchar *(*compare)(const gchar *, const gchar *),
@@ -119,6 +191,14 @@ compare_im_groupwise (EContact *contact, const gchar *str,
 	return compare_im (contact, str, compare, E_CONTACT_IM_GROUPWISE);
 }
 
+static gboolean
+compare_email_vcard (const gchar *vcard, const gchar *attr_name, const gchar *str,
+		     gchar *(*compare)(const gchar *, const gchar *))
+{
+	/* only E_CONTACT_EMAIL_1 to E_CONTACT_EMAIL_4 are compared */
+	return compare_attributes_vcard (vcard, attr_name, 4, str, compare);
+}
+
 static gboolean
 compare_email (EContact *contact, const gchar *str,
 	       gchar *(*compare)(const gchar *, const gchar *))
@@ -155,6 +235,42 @@ compare_phone (EContact *contact, const gchar *str,
 	return rv;
 }
 
+static gboolean
+compare_value_vcard (const gchar *vcard, const gchar *attr_name, gint nth,
+		     const gchar *str,
+		     gchar *(*compare)(const gchar *, const gchar *))
+{
+	EVCardAttribute *attr;
+	gboolean rv = FALSE;
+
+	attr = e_vcard_scan_attribute (vcard, attr_name);
+	if (attr) {
+		GList *v = g_list_nth (e_vcard_attribute_get_values (attr), nth);
+
+		if (v && v->data) {
+			gchar *value = g_strstrip (g_strdup (v->data));
+
+			rv = compare (value, str) != NULL;
+			g_free (value);
+		}
+
+		e_vcard_attribute_free (attr);
+	}
+
+	return rv;
+}
+
+static gboolean
+compare_name_vcard (const gchar *vcard, const gchar *attr_name, const gchar *str,
+		    gchar *(*compare)(const gchar *, const gchar *))
+{
+	/* the same fields as compare_name(), in the same order */
+	return compare_value_vcard (vcard, EVC_FN, 0, str, compare) ||
+		compare_value_vcard (vcard, EVC_N, 0, str, compare) ||
+		compare_value_vcard (vcard, EVC_N, 1, str, compare) ||
+		compare_value_vcard (vcard, EVC_NICKNAME, 0, str, compare);
+}
+
 static gboolean
 compare_name (EContact *contact, const gchar *str,
 	      gchar *(*compare)(const gchar *, const gchar *))
@@ -210,6 +326,30 @@ compare_address (EContact *contact, const gchar *str,
 
 }
 
+static gboolean
+compare_category_vcard (const gchar *vcard, const gchar *attr_name, const gchar *str,
+			gchar *(*compare)(const gchar *, const gchar *))
+{
+	EVCardAttribute *attr;
+	GList *v;
+	gboolean ret_val = FALSE;
+
+	attr = e_vcard_scan_attribute (vcard, attr_name);
+	if (!attr)
+		return FALSE;
+
+	for (v = e_vcard_attribute_get_values (attr); v && !ret_val; v = v->next) {
+		gchar *category = g_strstrip (g_strdup (v->data ? v->data : ""));
+
+		ret_val = compare (category, str) != NULL;
+		g_free (category);
+	}
+
+	e_vcard_attribute_free (attr);
+
+	return ret_val;
+}
+
 static gboolean
 compare_category (EContact *contact, const gchar *str,
 		  gchar *(*compare)(const gchar *, const gchar *))
@@ -247,48 +387,103 @@ static struct prop_info {
 	gboolean (*list_compare)(EContact *contact, const gchar *str,
 				 gchar *(*compare)(const gchar *, const gchar *));
 
+	/* where to find the value in the vCard text, so it can be matched
+	   without building an EContact: the vcard_elem'th value of the
+	   first vcard_attr attribute, or what vcard_compare looks at */
+	const gchar *vcard_attr;
+	gint vcard_elem;
+	gboolean (*vcard_compare)(const gchar *vcard, const gchar *attr_name, const gchar *str,
+				  gchar *(*compare)(const gchar *, const gchar *));
+
 } prop_info_table[] = {
-#define NORMAL_PROP(f,q) {f, q, PROP_TYPE_NORMAL, NULL}
-#define LIST_PROP(q,c) {0, q, PROP_TYPE_LIST, c}
-
-	/* query prop,   type,              list compare function */
-	NORMAL_PROP ( E_CONTACT_FILE_AS, "file_as" ),
-	NORMAL_PROP ( E_CONTACT_UID, "id" ),
-	LIST_PROP ( "full_name", compare_name), /* not really a list, but we need to compare both full and surname */
-	NORMAL_PROP ( E_CONTACT_GIVEN_NAME, "given_name"),
-	NORMAL_PROP ( E_CONTACT_FAMILY_NAME, "family_name"),
-	NORMAL_PROP ( E_CONTACT_HOMEPAGE_URL, "url"),
-	NORMAL_PROP ( E_CONTACT_BLOG_URL, "blog_url"),
-	NORMAL_PROP ( E_CONTACT_CALENDAR_URI, "calurl"),
-	NORMAL_PROP ( E_CONTACT_FREEBUSY_URL, "fburl"),
-	NORMAL_PROP ( E_CONTACT_ICS_CALENDAR, "icscalendar"),
-	NORMAL_PROP ( E_CONTACT_VIDEO_URL, "video_url"),
-
-	NORMAL_PROP ( E_CONTACT_MAILER, "mailer"),
-	NORMAL_PROP ( E_CONTACT_ORG, "org"),
-	NORMAL_PROP ( E_CONTACT_ORG_UNIT, "org_unit"),
-	NORMAL_PROP ( E_CONTACT_OFFICE, "office"),
-	NORMAL_PROP ( E_CONTACT_TITLE, "title"),
-	NORMAL_PROP ( E_CONTACT_ROLE, "role"),
-	NORMAL_PROP ( E_CONTACT_MANAGER, "manager"),
-	NORMAL_PROP ( E_CONTACT_ASSISTANT, "assistant"),
-	NORMAL_PROP ( E_CONTACT_NICKNAME, "nickname"),
-	NORMAL_PROP ( E_CONTACT_SPOUSE, "spouse" ),
-	NORMAL_PROP ( E_CONTACT_NOTE, "note"),
-	LIST_PROP ( "im_aim",    compare_im_aim ),
-	LIST_PROP ( "im_msn",    compare_im_msn ),
-	LIST_PROP ( "im_skype",    compare_im_skype ),
-	LIST_PROP ( "im_icq",    compare_im_icq ),
-	LIST_PROP ( "im_jabber", compare_im_jabber ),
-	LIST_PROP ( "im_yahoo",  compare_im_yahoo ),
-	LIST_PROP ( "im_gadugadu",  compare_im_gadugadu ),
-	LIST_PROP ( "im_groupwise", compare_im_groupwise ),
-	LIST_PROP ( "email",     compare_email ),
-	LIST_PROP ( "phone",     compare_phone ),
-	LIST_PROP ( "address",   compare_address ),
-	LIST_PROP ( "category_list",  compare_category ),
+#define NORMAL_PROP(f,q,a,e) {f, q, PROP_TYPE_NORMAL, NULL, a, e, NULL}
+#define LIST_PROP(q,c,a,vc) {0, q, PROP_TYPE_LIST, c, a, 0, vc}
+
+	/* query prop,   type,              list compare function,   vCard attribute */
+	NORMAL_PROP ( E_CONTACT_FILE_AS, "file_as", EVC_X_FILE_AS, 0 ),
+	NORMAL_PROP ( E_CONTACT_UID, "id", EVC_UID, 0 ),
+	LIST_PROP ( "full_name", compare_name, NULL, compare_name_vcard), /* not really a list, but we need to compare both full and surname */
+	NORMAL_PROP ( E_CONTACT_GIVEN_NAME, "given_name", EVC_N, 1),
+	NORMAL_PROP ( E_CONTACT_FAMILY_NAME, "family_name", EVC_N, 0),
+	NORMAL_PROP ( E_CONTACT_HOMEPAGE_URL, "url", EVC_URL, 0),
+	NORMAL_PROP ( E_CONTACT_BLOG_URL, "blog_url", EVC_X_BLOG_URL, 0),
+	NORMAL_PROP ( E_CONTACT_CALENDAR_URI, "calurl", EVC_CALURI, 0),
+	NORMAL_PROP ( E_CONTACT_FREEBUSY_URL, "fburl", EVC_FBURL, 0),
+	NORMAL_PROP ( E_CONTACT_ICS_CALENDAR, "icscalendar", EVC_ICSCALENDAR, 0),
+	NORMAL_PROP ( E_CONTACT_VIDEO_URL, "video_url", EVC_X_VIDEO_URL, 0),
+
+	NORMAL_PROP ( E_CONTACT_MAILER, "mailer", EVC_MAILER, 0),
+	NORMAL_PROP ( E_CONTACT_ORG, "org", EVC_ORG, 0),
+	NORMAL_PROP ( E_CONTACT_ORG_UNIT, "org_unit", EVC_ORG, 1),
+	NORMAL_PROP ( E_CONTACT_OFFICE, "office", EVC_ORG, 2),
+	NORMAL_PROP ( E_CONTACT_TITLE, "title", EVC_TITLE, 0),
+	NORMAL_PROP ( E_CONTACT_ROLE, "role", EVC_ROLE, 0),
+	NORMAL_PROP ( E_CONTACT_MANAGER, "manager", EVC_X_MANAGER, 0),
+	NORMAL_PROP ( E_CONTACT_ASSISTANT, "assistant", EVC_X_ASSISTANT, 0),
+	NORMAL_PROP ( E_CONTACT_NICKNAME, "nickname", EVC_NICKNAME, 0),
+	NORMAL_PROP ( E_CONTACT_SPOUSE, "spouse", EVC_X_SPOUSE, 0 ),
+	NORMAL_PROP ( E_CONTACT_NOTE, "note", EVC_NOTE, 0),
+	LIST_PROP ( "im_aim",    compare_im_aim, EVC_X_AIM, compare_multi_vcard ),
+	LIST_PROP ( "im_msn",    compare_im_msn, EVC_X_MSN, compare_multi_vcard ),
+	LIST_PROP ( "im_skype",    compare_im_skype, EVC_X_SKYPE, compare_multi_vcard ),
+	LIST_PROP ( "im_icq",    compare_im_icq, EVC_X_ICQ, compare_multi_vcard ),
+	LIST_PROP ( "im_jabber", compare_im_jabber, EVC_X_JABBER, compare_multi_vcard ),
+	LIST_PROP ( "im_yahoo",  compare_im_yahoo, EVC_X_YAHOO, compare_multi_vcard ),
+	LIST_PROP ( "im_gadugadu",  compare_im_gadugadu, EVC_X_GADUGADU, compare_multi_vcard ),
+	LIST_PROP ( "im_groupwise", compare_im_groupwise, EVC_X_GROUPWISE, compare_multi_vcard ),
+	LIST_PROP ( "email",     compare_email, EVC_EMAIL, compare_email_vcard ),
+	/* phones and addresses are picked by their TYPE parameters */
+	LIST_PROP ( "phone",     compare_phone, NULL, NULL ),
+	LIST_PROP ( "address",   compare_address, NULL, NULL ),
+	LIST_PROP ( "category_list",  compare_category, EVC_CATEGORIES, compare_category_vcard ),
 };
 
+/* Gets the value of the normal property @info straight from the vCard
+   text, the way e_contact_get() would.  Returns %FALSE if it has to be
+   looked up in the contact instead. */
+static gboolean
+scan_prop_value (SearchContext *ctx, struct prop_info *info, gchar **value)
+{
+	EVCardAttribute *attr;
+
+	*value = NULL;
+
+	if (ctx->contact || !info->vcard_attr)
+		return FALSE;
+
+	attr = e_vcard_scan_attribute (ctx->vcard, info->vcard_attr);
+	if (attr) {
+		GList *v = g_list_nth (e_vcard_attribute_get_values (attr), info->vcard_elem);
+
+		if (v && v->data)
+			*value = g_strstrip (g_strdup (v->data));
+
+		e_vcard_attribute_free (attr);
+	}
+
+	/* e_contact_new_from_vcard() makes up a FILE_AS for cards without one */
+	if (info->field_id == E_CONTACT_FILE_AS && (!*value || !**value)) {
+		g_free (*value);
+		*value = NULL;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Compares the list property @info, scanning the vCard text unless
+   the contact has been built already. */
+static gboolean
+list_compare (SearchContext *ctx, struct prop_info *info, const gchar *str,
+	      gchar *(*compare)(const gchar *, const gchar *))
+{
+	if (!ctx->contact && info->vcard_compare)
+		return info->vcard_compare (ctx->vcard, info->vcard_attr, str, compare);
+
+	return info->list_compare (get_contact (ctx), str, compare);
+}
+
 static ESExpResult *
 entry_compare (SearchContext *ctx, struct _ESExp *f,
 	      gint argc, struct _ESExpResult **argv,
@@ -309,6 +504,13 @@ entry_compare (SearchContext *ctx, struct _ESExp *f,
 		propname = argv[0]->value.string;
 
 		any_field = !strcmp(propname, "x-evolution-any-field");
+
+		/* a non-matching card has to be looked at whole, phones and
+		   addresses included, which is cheaper to do on the contact
+		   than by scanning the vCard text for every field */
+		if (any_field)
+			get_contact (ctx);
+
 		for (i = 0; i < G_N_ELEMENTS (prop_info_table); i++) {
 			if (any_field
 			    || !strcmp (prop_info_table[i].query_prop, propname)) {
@@ -324,9 +526,13 @@ entry_compare (SearchContext *ctx, struct _ESExp *f,
 				}
 				else if (info->prop_type == PROP_TYPE_NORMAL) {
 					const gchar *prop = NULL;
+					gchar *scanned;
 					/* straight string property matches */
 
-					prop = e_contact_get_const (ctx->contact, info->field_id);
+					if (scan_prop_value (ctx, info, &scanned))
+						prop = scanned;
+					else
+						prop = e_contact_get_const (get_contact (ctx), info->field_id);
 
 					if (prop && compare (prop, argv[1]->value.string)) {
 						truth = TRUE;
@@ -334,10 +540,12 @@ entry_compare (SearchContext *ctx, struct _ESExp *f,
 					if ((!prop) && compare("", argv[1]->value.string)) {
 						truth = TRUE;
 					}
+
+					g_free (scanned);
 				}
 				else if (info->prop_type == PROP_TYPE_LIST) {
 					/* the special searches that match any of the list elements */
-					truth = info->list_compare (ctx->contact, argv[1]->value.string, compare);
+					truth = list_compare (ctx, info, argv[1]->value.string, compare);
 				}
 
 				/* if we're looking at all fields and find a match,
@@ -356,7 +564,7 @@ entry_compare (SearchContext *ctx, struct _ESExp *f,
 			EContactField fid = e_contact_field_id (propname);
 
 			if (fid >= E_CONTACT_FIELD_FIRST && fid < E_CONTACT_FIELD_LAST) {
-				const gchar *prop = e_contact_get_const (ctx->contact, fid);
+				const gchar *prop = e_contact_get_const (get_contact (ctx), fid);
 
 				if (prop && compare (prop, argv[1]->value.string)) {
 					truth = TRUE;
@@ -368,7 +576,8 @@ entry_compare (SearchContext *ctx, struct _ESExp *f,
 			} else {
 				/* it is not direct EContact known field, so try to find
 				   it in EVCard attributes */
-				EVCardAttribute *attr = e_vcard_get_attribute (E_VCARD (ctx->contact), propname);
+				EVCardAttribute *scanned;
+				EVCardAttribute *attr = get_attribute (ctx, propname, &scanned);
 				GList *l, *values = attr ? e_vcard_attribute_get_values (attr) : NULL;
 
 				for (l = values; l && !truth; l = l->next) {
@@ -380,6 +589,9 @@ entry_compare (SearchContext *ctx, struct _ESExp *f,
 						truth = TRUE;
 					}
 				}
+
+				if (scanned)
+					e_vcard_attribute_free (scanned);
 			}
 		}
 	}
@@ -701,17 +913,23 @@ func_exists (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer d
 
 				if (info->prop_type == PROP_TYPE_NORMAL) {
 					const gchar *prop = NULL;
+					gchar *scanned;
 					/* searches where the query's property
 					   maps directly to an ecard property */
 
-					prop = e_contact_get_const (ctx->contact, info->field_id);
+					if (scan_prop_value (ctx, info, &scanned))
+						prop = scanned;
+					else
+						prop = e_contact_get_const (get_contact (ctx), info->field_id);
 
 					if (prop && *prop)
 						truth = TRUE;
+
+					g_free (scanned);
 				}
 				else if (info->prop_type == PROP_TYPE_LIST) {
 				/* the special searches that match any of the list elements */
-					truth = info->list_compare (ctx->contact, "", exists_helper);
+					truth = list_compare (ctx, info, "", exists_helper);
 				}
 
 				break;
@@ -725,13 +943,14 @@ func_exists (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer d
 			EContactField fid = e_contact_field_id (propname);
 
 			if (fid >= E_CONTACT_FIELD_FIRST && fid < E_CONTACT_FIELD_LAST) {
-				const gchar *prop = e_contact_get_const (ctx->contact, fid);
+				const gchar *prop = e_contact_get_const (get_contact (ctx), fid);
 
 				if (prop && *prop)
 					truth = TRUE;
 			} else {
 				/* is is not a known EContact field, try with EVCard attributes */
-				EVCardAttribute *attr = e_vcard_get_attribute (E_VCARD (ctx->contact), propname);
+				EVCardAttribute *scanned;
+				EVCardAttribute *attr = get_attribute (ctx, propname, &scanned);
 				GList *l, *values = attr ? e_vcard_attribute_get_values (attr) : NULL;
 
 				for (l = values; l && !truth; l = l->next) {
@@ -740,6 +959,9 @@ func_exists (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer d
 					if (value && *value)
 						truth = TRUE;
 				}
+
+				if (scanned)
+					e_vcard_attribute_free (scanned);
 			}
 		}
 	}
@@ -758,12 +980,12 @@ func_exists_vcard (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpoi
 
 	if (argc == 1 && argv[0]->type == ESEXP_RES_STRING) {
 		const gchar *attr_name;
-		EVCardAttribute *attr;
+		EVCardAttribute *attr, *scanned;
 		GList *values;
 		gchar *s;
 
 		attr_name = argv[0]->value.string;
-		attr = e_vcard_get_attribute (E_VCARD (ctx->contact), attr_name);
+		attr = get_attribute (ctx, attr_name, &scanned);
 		if (attr) {
 			values = e_vcard_attribute_get_values (attr);
 			if (g_list_length (values) > 0) {
@@ -773,6 +995,9 @@ func_exists_vcard (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpoi
 				}
 			}
 		}
+
+		if (scanned)
+			e_vcard_attribute_free (scanned);
 	}
 
 	r = e_sexp_result_new (f, ESEXP_RES_BOOL);
@@ -816,16 +1041,22 @@ e_book_backend_sexp_match_contact (EBookBackendSExp *sexp, EContact *contact)
 		return FALSE;
 	}
 
+	g_mutex_lock (sexp->priv->lock);
+
 	sexp->priv->search_context->contact = g_object_ref (contact);
+	sexp->priv->search_context->vcard = NULL;
 
 	r = e_sexp_eval (sexp->priv->search_sexp);
 
 	retval = (r && r->type == ESEXP_RES_BOOL && r->value.boolean);
 
 	g_object_unref (sexp->priv->search_context->contact);
+	sexp->priv->search_context->contact = NULL;
 
 	e_sexp_result_free (sexp->priv->search_sexp, r);
 
+	g_mutex_unlock (sexp->priv->lock);
+
 	return retval;
 }
 
@@ -834,21 +1065,43 @@ e_book_backend_sexp_match_contact (EBookBackendSExp *sexp, EContact *contact)
  * @sexp: an #EBookBackendSExp
  * @vcard: a VCard string
  *
- * Checks if @vcard matches @sexp.
+ * Checks if @vcard matches @sexp.  Most fields are looked up in the
+ * @vcard text directly, an #EContact is only built from it for the
+ * fields that need one, like phones and addresses.
  *
  * Returns: %TRUE if the VCard matches, %FALSE otherwise.
  **/
 gboolean
 e_book_backend_sexp_match_vcard (EBookBackendSExp *sexp, const gchar *vcard)
 {
-	EContact *contact;
+	SearchContext *ctx;
+	ESExpResult *r;
 	gboolean retval;
 
-	contact = e_contact_new_from_vcard (vcard);
+	if (!vcard) {
+		g_warning ("null vcard passed to e_book_backend_sexp_match_vcard");
+		return FALSE;
+	}
+
+	g_mutex_lock (sexp->priv->lock);
+
+	ctx = sexp->priv->search_context;
+	ctx->contact = NULL;
+	ctx->vcard = vcard;
 
-	retval = e_book_backend_sexp_match_contact (sexp, contact);
+	r = e_sexp_eval (sexp->priv->search_sexp);
+
+	retval = (r && r->type == ESEXP_RES_BOOL && r->value.boolean);
+
+	/* the contact is built on demand only */
+	if (ctx->contact)
+		g_object_unref (ctx->contact);
+	ctx->contact = NULL;
+	ctx->vcard = NULL;
+
+	e_sexp_result_free (sexp->priv->search_sexp, r);
 
-	g_object_unref (contact);
+	g_mutex_unlock (sexp->priv->lock);
 
 	return retval;
 }
@@ -903,6 +1156,7 @@ e_book_backend_sexp_dispose (GObject *object)
 		e_sexp_unref (sexp->priv->search_sexp);
 
 		g_free (sexp->priv->search_context);
+		g_mutex_free (sexp->priv->lock);
 		g_free (sexp->priv);
 		sexp->priv = NULL;
 	}
@@ -931,5 +1185,6 @@ e_book_backend_sexp_init (EBookBackendSExp *sexp)
 	priv             = g_new0 (EBookBackendSExpPrivate, 1);
 
 	sexp->priv = priv;
-	priv->search_context = g_new (SearchContext, 1);
+	priv->search_context = g_new0 (SearchContext, 1);
+	priv->lock = g_mutex_new ();
 }
@@ -0,0 +1,1037 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-book-backend-sqlitedb.c - An SQLite store of contacts with indexed fields
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sqlite3.h>
+
+#include "libedataserver/e-sexp.h"
+#include "libedataserver/e-data-server-util.h"
+#include "e-book-backend-sexp.h"
+#include "e-book-backend-sqlitedb.h"
+#include "e-data-book.h"
+
+#define E_BOOK_BACKEND_SQLITEDB_GET_PRIVATE(obj) \
+	(G_TYPE_INSTANCE_GET_PRIVATE \
+	((obj), E_TYPE_BOOK_BACKEND_SQLITEDB, EBookBackendSqliteDBPrivate))
+
+#define SCHEMA_VERSION "1"
+#define BUSY_TIMEOUT 1000
+
+struct _EBookBackendSqliteDBPrivate {
+	sqlite3 *db;
+	gboolean store_vcard;
+
+	/* statements which have to follow each other, like a
+	   transaction, are run with this held */
+	GMutex *lock;
+};
+
+G_DEFINE_TYPE (EBookBackendSqliteDB, e_book_backend_sqlitedb, G_TYPE_OBJECT)
+
+/* Single valued fields get a column holding the value, for sorting, and
+   a column holding the value as it is compared by the EBookBackendSExp
+   functions, for searching. */
+static const struct {
+	const gchar *column;
+	EContactField field_id;
+	const gchar *query_prop;
+} columns[] = {
+	{ "uid",         E_CONTACT_UID,         "id" },
+	{ "file_as",     E_CONTACT_FILE_AS,     "file_as" },
+	{ "full_name",   E_CONTACT_FULL_NAME,   NULL },
+	{ "given_name",  E_CONTACT_GIVEN_NAME,  "given_name" },
+	{ "family_name", E_CONTACT_FAMILY_NAME, "family_name" },
+	{ "nickname",    E_CONTACT_NICKNAME,    "nickname" },
+	{ "org",         E_CONTACT_ORG,         "org" }
+};
+
+/* the columns the "full_name" property is compared with, see
+   compare_name() in e-book-backend-sexp.c */
+static const gchar *name_columns[] = {
+	"full_name", "family_name", "given_name", "nickname"
+};
+
+/* Multi valued fields go to the contact_values table, one row per value */
+static const struct {
+	const gchar *query_prop;
+	EContactField first_id;
+	EContactField last_id;
+} value_fields[] = {
+	{ "email",         E_CONTACT_EMAIL_1,         E_CONTACT_EMAIL_4 },
+	{ "phone",         E_CONTACT_FIRST_PHONE_ID,  E_CONTACT_LAST_PHONE_ID },
+	{ "category_list", E_CONTACT_CATEGORY_LIST,   E_CONTACT_CATEGORY_LIST }
+};
+
+/* Returns @value the way contains_helper() and beginswith_helper() in
+   e-book-backend-sexp.c compare it: without accents, lowercase. */
+static gchar *
+sqlitedb_key (const gchar *value)
+{
+	GString *key;
+	gchar *stripped;
+	const gchar *p;
+
+	if (!value || !g_utf8_validate (value, -1, NULL))
+		return NULL;
+
+	stripped = e_util_utf8_remove_accents (value);
+	key = g_string_sized_new (strlen (stripped));
+
+	for (p = stripped; *p; p = g_utf8_next_char (p))
+		g_string_append_unichar (key, g_unichar_tolower (g_utf8_get_char (p)));
+
+	g_free (stripped);
+
+	return g_string_free (key, FALSE);
+}
+
+static gint
+sqlitedb_collate (gpointer data, gint len1, gconstpointer str1, gint len2, gconstpointer str2)
+{
+	gchar *s1 = g_strndup (str1, len1);
+	gchar *s2 = g_strndup (str2, len2);
+	gint rv;
+
+	rv = g_utf8_collate (s1, s2);
+
+	g_free (s1);
+	g_free (s2);
+
+	return rv;
+}
+
+static gboolean
+sqlitedb_exec (EBookBackendSqliteDB *ebsdb, const gchar *stmt,
+	       gint (*callback)(gpointer data, gint ncols, gchar **values, gchar **names),
+	       gpointer data, GError **error)
+{
+	gchar *errmsg = NULL;
+	gint ret;
+
+	ret = sqlite3_exec (ebsdb->priv->db, stmt, callback, data, &errmsg);
+	if (ret != SQLITE_OK) {
+		g_propagate_error (error, e_data_book_create_error_fmt (
+			E_DATA_BOOK_STATUS_OTHER_ERROR, "SQLite error: %s",
+			errmsg ? errmsg : sqlite3_errmsg (ebsdb->priv->db)));
+		sqlite3_free (errmsg);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Runs the statements in @stmts in one transaction */
+static gboolean
+sqlitedb_exec_transaction (EBookBackendSqliteDB *ebsdb, const gchar *stmts, GError **error)
+{
+	gboolean success;
+
+	g_mutex_lock (ebsdb->priv->lock);
+
+	success = sqlitedb_exec (ebsdb, "BEGIN", NULL, NULL, error);
+	if (success) {
+		success = sqlitedb_exec (ebsdb, stmts, NULL, NULL, error)
+			&& sqlitedb_exec (ebsdb, "COMMIT", NULL, NULL, error);
+		if (!success)
+			sqlitedb_exec (ebsdb, "ROLLBACK", NULL, NULL, NULL);
+	}
+
+	g_mutex_unlock (ebsdb->priv->lock);
+
+	return success;
+}
+
+static gint
+collect_strings_cb (gpointer data, gint ncols, gchar **values, gchar **names)
+{
+	GList **list = data;
+
+	if (values[0])
+		*list = g_list_prepend (*list, g_strdup (values[0]));
+
+	return 0;
+}
+
+static gint
+get_string_cb (gpointer data, gint ncols, gchar **values, gchar **names)
+{
+	gchar **value = data;
+
+	if (!*value)
+		*value = g_strdup (values[0]);
+
+	return 0;
+}
+
+static gboolean
+create_tables (EBookBackendSqliteDB *ebsdb, GError **error)
+{
+	GString *stmt;
+	gboolean success;
+	gint i;
+
+	stmt = g_string_new (
+		"CREATE TABLE IF NOT EXISTS keys (key TEXT PRIMARY KEY, value TEXT);"
+		"CREATE TABLE IF NOT EXISTS contact_values (uid TEXT, field TEXT, value TEXT);"
+		"CREATE INDEX IF NOT EXISTS contact_values_value ON contact_values (field, value);"
+		"CREATE INDEX IF NOT EXISTS contact_values_uid ON contact_values (uid);"
+		"CREATE TABLE IF NOT EXISTS contacts (uid TEXT PRIMARY KEY");
+
+	for (i = 0; i < G_N_ELEMENTS (columns); i++) {
+		if (i > 0)
+			g_string_append_printf (stmt, ", %s TEXT", columns[i].column);
+		g_string_append_printf (stmt, ", %s_key TEXT", columns[i].column);
+	}
+	g_string_append (stmt, ", vcard TEXT);");
+
+	for (i = 0; i < G_N_ELEMENTS (columns); i++)
+		g_string_append_printf (
+			stmt, "CREATE INDEX IF NOT EXISTS contacts_%s ON contacts (%s_key);",
+			columns[i].column, columns[i].column);
+
+	g_string_append (stmt, "INSERT OR IGNORE INTO keys VALUES ('version', " SCHEMA_VERSION ");");
+
+	success = sqlitedb_exec_transaction (ebsdb, stmt->str, error);
+	g_string_free (stmt, TRUE);
+
+	return success;
+}
+
+/**
+ * e_book_backend_sqlitedb_new:
+ * @filename: the file holding the database
+ * @store_vcard: whether to keep the vCards of the contacts, or only the
+ * fields needed to search them
+ * @error: return location for a #GError, or %NULL
+ *
+ * Opens the SQLite store of contacts in @filename, creating it if needed.
+ * The store keeps the names, emails, phones and categories of the contacts
+ * in indexed columns, so searches on them don't have to look at every
+ * contact.
+ *
+ * Returns: A new #EBookBackendSqliteDB, or %NULL on error.
+ *
+ * Since: 3.0
+ **/
+EBookBackendSqliteDB *
+e_book_backend_sqlitedb_new (const gchar *filename, gboolean store_vcard, GError **error)
+{
+	EBookBackendSqliteDB *ebsdb;
+	gint ret;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	ebsdb = g_object_new (E_TYPE_BOOK_BACKEND_SQLITEDB, NULL);
+	ebsdb->priv->store_vcard = store_vcard;
+
+	ret = sqlite3_open (filename, &ebsdb->priv->db);
+	if (ret != SQLITE_OK) {
+		g_propagate_error (error, e_data_book_create_error_fmt (
+			E_DATA_BOOK_STATUS_OTHER_ERROR, "Cannot open %s: %s", filename,
+			ebsdb->priv->db ? sqlite3_errmsg (ebsdb->priv->db) : "out of memory"));
+		g_object_unref (ebsdb);
+
+		return NULL;
+	}
+
+	sqlite3_busy_timeout (ebsdb->priv->db, BUSY_TIMEOUT);
+	sqlite3_create_collation (ebsdb->priv->db, "ebook", SQLITE_UTF8, NULL, sqlitedb_collate);
+
+	if (!create_tables (ebsdb, error)) {
+		g_object_unref (ebsdb);
+		return NULL;
+	}
+
+	return ebsdb;
+}
+
+static void
+append_contact (EBookBackendSqliteDB *ebsdb, GString *stmt, EContact *contact)
+{
+	const gchar *uid;
+	gchar *sql, *vcard;
+	gint i;
+
+	uid = e_contact_get_const (contact, E_CONTACT_UID);
+	if (!uid)
+		return;
+
+	sql = sqlite3_mprintf (
+		"DELETE FROM contact_values WHERE uid = %Q;"
+		"INSERT OR REPLACE INTO contacts VALUES (%Q", uid, uid);
+	g_string_append (stmt, sql);
+	sqlite3_free (sql);
+
+	for (i = 0; i < G_N_ELEMENTS (columns); i++) {
+		const gchar *value = e_contact_get_const (contact, columns[i].field_id);
+		gchar *key = sqlitedb_key (value);
+
+		if (i > 0)
+			sql = sqlite3_mprintf (", %Q, %Q", value, key);
+		else
+			sql = sqlite3_mprintf (", %Q", key);
+		g_string_append (stmt, sql);
+		sqlite3_free (sql);
+		g_free (key);
+	}
+
+	vcard = ebsdb->priv->store_vcard ? e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30) : NULL;
+	sql = sqlite3_mprintf (", %Q);", vcard);
+	g_string_append (stmt, sql);
+	sqlite3_free (sql);
+	g_free (vcard);
+
+	for (i = 0; i < G_N_ELEMENTS (value_fields); i++) {
+		GList *values = NULL, *l;
+		EContactField field_id;
+
+		if (value_fields[i].first_id == E_CONTACT_CATEGORY_LIST) {
+			values = e_contact_get (contact, E_CONTACT_CATEGORY_LIST);
+		} else {
+			for (field_id = value_fields[i].first_id; field_id <= value_fields[i].last_id; field_id++) {
+				gchar *value = e_contact_get (contact, field_id);
+
+				if (value)
+					values = g_list_prepend (values, value);
+			}
+		}
+
+		for (l = values; l; l = l->next) {
+			gchar *key = sqlitedb_key (l->data);
+
+			if (!key)
+				continue;
+
+			sql = sqlite3_mprintf (
+				"INSERT INTO contact_values VALUES (%Q, %Q, %Q);",
+				uid, value_fields[i].query_prop, key);
+			g_string_append (stmt, sql);
+			sqlite3_free (sql);
+			g_free (key);
+		}
+
+		g_list_foreach (values, (GFunc) g_free, NULL);
+		g_list_free (values);
+	}
+}
+
+/**
+ * e_book_backend_sqlitedb_add_contacts:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @contacts: a #GList of #EContact<!-- -->s
+ * @error: return location for a #GError, or %NULL
+ *
+ * Adds @contacts to @ebsdb, replacing the contacts with the same UIDs.
+ * All of them are added in one transaction, so adding many contacts at
+ * once is much faster than adding them one by one.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ *
+ * Since: 3.0
+ **/
+gboolean
+e_book_backend_sqlitedb_add_contacts (EBookBackendSqliteDB *ebsdb, GList *contacts, GError **error)
+{
+	GString *stmt;
+	GList *l;
+	gboolean success;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), FALSE);
+
+	stmt = g_string_new ("");
+	for (l = contacts; l; l = l->next)
+		append_contact (ebsdb, stmt, l->data);
+
+	success = sqlitedb_exec_transaction (ebsdb, stmt->str, error);
+	g_string_free (stmt, TRUE);
+
+	return success;
+}
+
+/**
+ * e_book_backend_sqlitedb_remove_contacts:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @uids: a #GList of contact UIDs
+ * @error: return location for a #GError, or %NULL
+ *
+ * Removes the contacts with the given @uids from @ebsdb.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ *
+ * Since: 3.0
+ **/
+gboolean
+e_book_backend_sqlitedb_remove_contacts (EBookBackendSqliteDB *ebsdb, GList *uids, GError **error)
+{
+	GString *stmt;
+	GList *l;
+	gboolean success;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), FALSE);
+
+	stmt = g_string_new ("");
+	for (l = uids; l; l = l->next) {
+		gchar *sql = sqlite3_mprintf (
+			"DELETE FROM contacts WHERE uid = %Q;"
+			"DELETE FROM contact_values WHERE uid = %Q;",
+			l->data, l->data);
+
+		g_string_append (stmt, sql);
+		sqlite3_free (sql);
+	}
+
+	success = sqlitedb_exec_transaction (ebsdb, stmt->str, error);
+	g_string_free (stmt, TRUE);
+
+	return success;
+}
+
+/**
+ * e_book_backend_sqlitedb_clear:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @error: return location for a #GError, or %NULL
+ *
+ * Removes all contacts from @ebsdb.  The values set with
+ * e_book_backend_sqlitedb_set_key_value() are kept.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ *
+ * Since: 3.0
+ **/
+gboolean
+e_book_backend_sqlitedb_clear (EBookBackendSqliteDB *ebsdb, GError **error)
+{
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), FALSE);
+
+	return sqlitedb_exec_transaction (
+		ebsdb, "DELETE FROM contacts; DELETE FROM contact_values;", error);
+}
+
+/**
+ * e_book_backend_sqlitedb_get_vcard_string:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @uid: a contact UID
+ * @error: return location for a #GError, or %NULL
+ *
+ * Gets the vCard of the contact with the given @uid.  Only stores
+ * created with @store_vcard set keep the vCards.
+ *
+ * Returns: A newly allocated vCard string, or %NULL if the contact
+ * isn't in @ebsdb or on error.
+ *
+ * Since: 3.0
+ **/
+gchar *
+e_book_backend_sqlitedb_get_vcard_string (EBookBackendSqliteDB *ebsdb, const gchar *uid, GError **error)
+{
+	gchar *stmt, *vcard = NULL;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+
+	stmt = sqlite3_mprintf ("SELECT vcard FROM contacts WHERE uid = %Q", uid);
+	sqlitedb_exec (ebsdb, stmt, get_string_cb, &vcard, error);
+	sqlite3_free (stmt);
+
+	return vcard;
+}
+
+/* Translating queries to SQL.  Each term of the query becomes an SQL
+   condition matching either exactly the contacts the term matches, or,
+   when that's not possible, some more of them.  Those conditions can
+   still be combined with AND and OR, but not negated, and the contacts
+   they find have to be checked with the query itself. */
+
+static ESExpResult *
+func_translated (ESExp *f, gint argc, ESExpResult **argv, gpointer data)
+{
+	/* never called, the parsed query is translated instead */
+	return e_sexp_result_new (f, ESEXP_RES_UNDEFINED);
+}
+
+/* Escapes the GLOB special characters in @str */
+static gchar *
+glob_escape (const gchar *str)
+{
+	GString *escaped = g_string_new ("");
+
+	for (; *str; str++) {
+		if (*str == '*' || *str == '?' || *str == '[')
+			g_string_append_printf (escaped, "[%c]", *str);
+		else
+			g_string_append_c (escaped, *str);
+	}
+
+	return g_string_free (escaped, FALSE);
+}
+
+/* Escapes the LIKE special characters in @str, with '^' */
+static gchar *
+like_escape (const gchar *str)
+{
+	GString *escaped = g_string_new ("");
+
+	for (; *str; str++) {
+		if (*str == '%' || *str == '_' || *str == '^')
+			g_string_append_c (escaped, '^');
+		g_string_append_c (escaped, *str);
+	}
+
+	return g_string_free (escaped, FALSE);
+}
+
+/* Appends the condition for comparing @column with @key by @func.  Only
+   values which are not NULL are matched, as the list compare functions
+   of the sexp do.  Returns whether it is exact. */
+static gboolean
+append_compare (GString *sql, const gchar *func, const gchar *column, const gchar *key)
+{
+	gchar *escaped, *cond;
+	gboolean exact = TRUE;
+
+	if (!*key) {
+		if (!strcmp (func, "is"))
+			cond = sqlite3_mprintf ("%s = ''", column);
+		else
+			cond = sqlite3_mprintf ("%s IS NOT NULL", column);
+	} else if (!strcmp (func, "is")) {
+		cond = sqlite3_mprintf ("%s = %Q", column, key);
+	} else if (!strcmp (func, "beginswith")) {
+		escaped = glob_escape (key);
+		cond = sqlite3_mprintf ("%s GLOB '%q*'", column, escaped);
+		g_free (escaped);
+	} else if (!strcmp (func, "endswith")) {
+		escaped = like_escape (key);
+		cond = sqlite3_mprintf ("%s LIKE '%%%q' ESCAPE '^'", column, escaped);
+		g_free (escaped);
+	} else if (!strchr (key, ' ')) {
+		escaped = like_escape (key);
+		cond = sqlite3_mprintf ("%s LIKE '%%%q%%' ESCAPE '^'", column, escaped);
+		g_free (escaped);
+	} else {
+		/* the spaces in a contains are wildcards, which may even
+		   overlap the words around them, so just look for words */
+		gchar **words = g_strsplit (key, " ", -1);
+		GString *str = g_string_new ("1");
+		gint i;
+
+		for (i = 0; words[i]; i++) {
+			if (!*words[i])
+				continue;
+
+			escaped = like_escape (words[i]);
+			cond = sqlite3_mprintf (" AND %s LIKE '%%%q%%' ESCAPE '^'", column, escaped);
+			g_string_append (str, cond);
+			sqlite3_free (cond);
+			g_free (escaped);
+		}
+
+		g_strfreev (words);
+		cond = sqlite3_mprintf ("%s", str->str);
+		g_string_free (str, TRUE);
+		exact = FALSE;
+	}
+
+	g_string_append_printf (sql, "(%s)", cond);
+	sqlite3_free (cond);
+
+	return exact;
+}
+
+static gboolean
+compare_to_sql (GString *sql, const gchar *func, const gchar *prop, const gchar *value)
+{
+	gchar *key, *column;
+	gboolean exact = FALSE;
+	gint i;
+
+	key = sqlitedb_key (value);
+
+	/* the sexp compares the accent stripped value then, which is
+	   empty, and nothing is indexed for it */
+	if (!key || (!*key && *value)) {
+		g_free (key);
+		g_string_append (sql, "1");
+		return FALSE;
+	}
+
+	if (!strcmp (prop, "full_name")) {
+		g_string_append_c (sql, '(');
+		for (i = 0; i < G_N_ELEMENTS (name_columns); i++) {
+			column = g_strconcat (name_columns[i], "_key", NULL);
+			if (i > 0)
+				g_string_append (sql, " OR ");
+			exact = append_compare (sql, func, column, key);
+			g_free (column);
+		}
+		g_string_append_c (sql, ')');
+		g_free (key);
+
+		return exact;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (columns); i++) {
+		if (!columns[i].query_prop || strcmp (columns[i].query_prop, prop))
+			continue;
+
+		/* a missing value is compared as an empty one */
+		if (!*key && strcmp (func, "is")) {
+			g_string_append (sql, "1");
+			exact = TRUE;
+		} else {
+			column = g_strconcat (columns[i].column, "_key", NULL);
+			g_string_append_c (sql, '(');
+			exact = append_compare (sql, func, column, key);
+			if (!*key)
+				g_string_append_printf (sql, " OR %s IS NULL", column);
+			g_string_append_c (sql, ')');
+			g_free (column);
+		}
+
+		g_free (key);
+
+		return exact;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (value_fields); i++) {
+		gchar *cond;
+
+		if (strcmp (value_fields[i].query_prop, prop))
+			continue;
+
+		cond = sqlite3_mprintf (
+			"uid IN (SELECT uid FROM contact_values WHERE field = %Q AND ",
+			value_fields[i].query_prop);
+		g_string_append (sql, cond);
+		sqlite3_free (cond);
+		exact = append_compare (sql, func, "value", key);
+		g_string_append_c (sql, ')');
+		g_free (key);
+
+		return exact;
+	}
+
+	/* any other field, including x-evolution-any-field */
+	g_free (key);
+	g_string_append (sql, "1");
+
+	return FALSE;
+}
+
+static gboolean
+exists_to_sql (GString *sql, const gchar *prop)
+{
+	gint i;
+
+	if (!strcmp (prop, "full_name")) {
+		g_string_append_c (sql, '(');
+		for (i = 0; i < G_N_ELEMENTS (name_columns); i++)
+			g_string_append_printf (sql, "%s%s_key IS NOT NULL",
+						i > 0 ? " OR " : "", name_columns[i]);
+		g_string_append_c (sql, ')');
+
+		return TRUE;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (columns); i++) {
+		if (columns[i].query_prop && !strcmp (columns[i].query_prop, prop)) {
+			g_string_append_printf (sql, "(%s_key IS NOT NULL AND %s_key != '')",
+						columns[i].column, columns[i].column);
+			return TRUE;
+		}
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (value_fields); i++) {
+		if (!strcmp (value_fields[i].query_prop, prop)) {
+			gchar *cond = sqlite3_mprintf (
+				"uid IN (SELECT uid FROM contact_values WHERE field = %Q)",
+				value_fields[i].query_prop);
+
+			g_string_append (sql, cond);
+			sqlite3_free (cond);
+
+			return TRUE;
+		}
+	}
+
+	g_string_append (sql, "1");
+
+	return FALSE;
+}
+
+/* Appends the SQL condition for @term to @sql.  Returns %TRUE if it
+   matches exactly the contacts @term matches, %FALSE if it may match
+   more of them. */
+static gboolean
+term_to_sql (ESExpTerm *term, GString *sql)
+{
+	ESExpTerm **args;
+	const gchar *name;
+	gint argc, i;
+	gboolean exact = TRUE;
+
+	if (term->type == ESEXP_TERM_BOOL) {
+		g_string_append (sql, term->value.boolean ? "1" : "0");
+		return TRUE;
+	}
+
+	if (term->type != ESEXP_TERM_FUNC && term->type != ESEXP_TERM_IFUNC) {
+		g_string_append (sql, "1");
+		return FALSE;
+	}
+
+	name = term->value.func.sym->name;
+	args = term->value.func.terms;
+	argc = term->value.func.termcount;
+
+	if ((!strcmp (name, "and") || !strcmp (name, "or")) && argc > 0) {
+		g_string_append_c (sql, '(');
+		for (i = 0; i < argc; i++) {
+			if (i > 0)
+				g_string_append (sql, !strcmp (name, "and") ? " AND " : " OR ");
+			exact = term_to_sql (args[i], sql) && exact;
+		}
+		g_string_append_c (sql, ')');
+
+		return exact;
+	}
+
+	if (!strcmp (name, "not") && argc == 1) {
+		GString *arg = g_string_new ("");
+
+		/* a comparison with a NULL column is NULL, which doesn't
+		   match, while its negation has to */
+		exact = term_to_sql (args[0], arg);
+		if (exact)
+			g_string_append_printf (sql, "(NOT IFNULL (%s, 0))", arg->str);
+		else
+			g_string_append (sql, "1");
+		g_string_free (arg, TRUE);
+
+		return exact;
+	}
+
+	if ((!strcmp (name, "contains") || !strcmp (name, "is") ||
+	     !strcmp (name, "beginswith") || !strcmp (name, "endswith"))
+	    && argc == 2
+	    && args[0]->type == ESEXP_TERM_STRING
+	    && args[1]->type == ESEXP_TERM_STRING)
+		return compare_to_sql (sql, name, args[0]->value.string, args[1]->value.string);
+
+	if (!strcmp (name, "exists")
+	    && argc == 1
+	    && args[0]->type == ESEXP_TERM_STRING)
+		return exists_to_sql (sql, args[0]->value.string);
+
+	g_string_append (sql, "1");
+
+	return FALSE;
+}
+
+/* Returns the SQL condition for @query, or %NULL if it can't be parsed */
+static gchar *
+sexp_to_sql (const gchar *query, gboolean *exact)
+{
+	static const gchar *functions[] = {
+		"contains", "is", "beginswith", "endswith", "exists", "exists_vcard"
+	};
+	ESExp *sexp;
+	GString *sql;
+	gint i;
+
+	sexp = e_sexp_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (functions); i++)
+		e_sexp_add_function (sexp, 0, functions[i], func_translated, NULL);
+
+	e_sexp_input_text (sexp, query, strlen (query));
+	if (e_sexp_parse (sexp) == -1 || !sexp->tree) {
+		e_sexp_unref (sexp);
+		return NULL;
+	}
+
+	sql = g_string_new ("");
+	*exact = term_to_sql (sexp->tree, sql);
+
+	e_sexp_unref (sexp);
+
+	return g_string_free (sql, FALSE);
+}
+
+/**
+ * e_book_backend_sqlitedb_is_sql_query:
+ * @sexp: a search expression
+ *
+ * Checks if @sexp is answered by the indexes of an #EBookBackendSqliteDB
+ * alone, without checking the found contacts with @sexp.  Queries on
+ * the names, emails, phones and categories are.
+ *
+ * Returns: %TRUE if @sexp translates to SQL exactly, %FALSE otherwise.
+ *
+ * Since: 3.0
+ **/
+gboolean
+e_book_backend_sqlitedb_is_sql_query (const gchar *sexp)
+{
+	gchar *sql;
+	gboolean exact = FALSE;
+
+	g_return_val_if_fail (sexp != NULL, FALSE);
+
+	sql = sexp_to_sql (sexp, &exact);
+	g_free (sql);
+
+	return sql && exact;
+}
+
+/**
+ * e_book_backend_sqlitedb_search:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @sexp: a search expression
+ * @sort_field: the field to sort the contacts by, or 0
+ * @limit: the maximum number of contacts to return, or -1 for all
+ * @error: return location for a #GError, or %NULL
+ *
+ * Searches @ebsdb for the contacts matching @sexp.  The parts of @sexp
+ * which can be answered by the indexes are run as SQL, and the contacts
+ * found by them are checked with the rest of @sexp.  Only stores created
+ * with @store_vcard set can be searched this way.
+ *
+ * The contacts can be sorted by %E_CONTACT_UID, %E_CONTACT_FILE_AS,
+ * %E_CONTACT_FULL_NAME, %E_CONTACT_GIVEN_NAME, %E_CONTACT_FAMILY_NAME,
+ * %E_CONTACT_NICKNAME or %E_CONTACT_ORG.  They are not sorted for any
+ * other @sort_field.
+ *
+ * Returns: A #GList of newly allocated vCard strings.  Free the strings
+ * with g_free() and the list with g_list_free().
+ *
+ * Since: 3.0
+ **/
+GList *
+e_book_backend_sqlitedb_search (EBookBackendSqliteDB *ebsdb, const gchar *sexp,
+				EContactField sort_field, gint limit, GError **error)
+{
+	GString *stmt;
+	GList *vcards = NULL;
+	gchar *sql;
+	gboolean exact;
+	gint i;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), NULL);
+	g_return_val_if_fail (sexp != NULL, NULL);
+
+	sql = sexp_to_sql (sexp, &exact);
+	if (!sql) {
+		g_propagate_error (error, e_data_book_create_error (E_DATA_BOOK_STATUS_INVALID_QUERY, NULL));
+		return NULL;
+	}
+
+	stmt = g_string_new ("");
+	g_string_append_printf (stmt, "SELECT vcard FROM contacts WHERE %s", sql);
+	g_free (sql);
+
+	for (i = 0; i < G_N_ELEMENTS (columns); i++) {
+		if (sort_field && columns[i].field_id == sort_field) {
+			g_string_append_printf (stmt, " ORDER BY %s COLLATE ebook", columns[i].column);
+			break;
+		}
+	}
+
+	/* otherwise the contacts are limited after checking them */
+	if (exact && limit >= 0)
+		g_string_append_printf (stmt, " LIMIT %d", limit);
+
+	if (!sqlitedb_exec (ebsdb, stmt->str, collect_strings_cb, &vcards, error)) {
+		g_list_foreach (vcards, (GFunc) g_free, NULL);
+		g_list_free (vcards);
+		vcards = NULL;
+	}
+
+	g_string_free (stmt, TRUE);
+
+	vcards = g_list_reverse (vcards);
+
+	if (!exact && vcards) {
+		EBookBackendSExp *bsexp = e_book_backend_sexp_new (sexp);
+		GList *l, *next;
+		gint found = 0;
+
+		for (l = vcards; l; l = next) {
+			next = l->next;
+
+			if ((limit < 0 || found < limit)
+			    && e_book_backend_sexp_match_vcard (bsexp, l->data)) {
+				found++;
+				continue;
+			}
+
+			g_free (l->data);
+			vcards = g_list_delete_link (vcards, l);
+		}
+
+		g_object_unref (bsexp);
+	}
+
+	return vcards;
+}
+
+/**
+ * e_book_backend_sqlitedb_search_uids:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @sexp: a search expression
+ * @exact: return location for whether the UIDs are exactly those of the
+ * matching contacts
+ * @error: return location for a #GError, or %NULL
+ *
+ * Searches the indexes of @ebsdb for the contacts matching @sexp.  When
+ * @sexp can't be answered by the indexes alone, see
+ * e_book_backend_sqlitedb_is_sql_query(), the UIDs of some contacts not
+ * matching it are returned too, and @exact is set to %FALSE.  The caller
+ * has to check those contacts with e_book_backend_sexp_match_vcard().
+ *
+ * Returns: A #GList of newly allocated UIDs.  Free the strings with
+ * g_free() and the list with g_list_free().
+ *
+ * Since: 3.0
+ **/
+GList *
+e_book_backend_sqlitedb_search_uids (EBookBackendSqliteDB *ebsdb, const gchar *sexp,
+				     gboolean *exact, GError **error)
+{
+	GList *uids = NULL;
+	gchar *sql, *stmt;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), NULL);
+	g_return_val_if_fail (sexp != NULL, NULL);
+	g_return_val_if_fail (exact != NULL, NULL);
+
+	sql = sexp_to_sql (sexp, exact);
+	if (!sql) {
+		g_propagate_error (error, e_data_book_create_error (E_DATA_BOOK_STATUS_INVALID_QUERY, NULL));
+		return NULL;
+	}
+
+	stmt = g_strconcat ("SELECT uid FROM contacts WHERE ", sql, NULL);
+	if (!sqlitedb_exec (ebsdb, stmt, collect_strings_cb, &uids, error)) {
+		g_list_foreach (uids, (GFunc) g_free, NULL);
+		g_list_free (uids);
+		uids = NULL;
+	}
+
+	g_free (stmt);
+	g_free (sql);
+
+	return g_list_reverse (uids);
+}
+
+/**
+ * e_book_backend_sqlitedb_get_key_value:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @key: the name of the value
+ * @error: return location for a #GError, or %NULL
+ *
+ * Gets a value stored with e_book_backend_sqlitedb_set_key_value().
+ *
+ * Returns: A newly allocated string, or %NULL if @key isn't set or on
+ * error.
+ *
+ * Since: 3.0
+ **/
+gchar *
+e_book_backend_sqlitedb_get_key_value (EBookBackendSqliteDB *ebsdb, const gchar *key, GError **error)
+{
+	gchar *stmt, *value = NULL;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+
+	stmt = sqlite3_mprintf ("SELECT value FROM keys WHERE key = %Q", key);
+	sqlitedb_exec (ebsdb, stmt, get_string_cb, &value, error);
+	sqlite3_free (stmt);
+
+	return value;
+}
+
+/**
+ * e_book_backend_sqlitedb_set_key_value:
+ * @ebsdb: an #EBookBackendSqliteDB
+ * @key: the name of the value
+ * @value: the value
+ * @error: return location for a #GError, or %NULL
+ *
+ * Stores @value in @ebsdb under @key, so backends can keep things like
+ * the time of the last update along with the contacts.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise.
+ *
+ * Since: 3.0
+ **/
+gboolean
+e_book_backend_sqlitedb_set_key_value (EBookBackendSqliteDB *ebsdb, const gchar *key,
+				       const gchar *value, GError **error)
+{
+	gchar *stmt;
+	gboolean success;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SQLITEDB (ebsdb), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	stmt = sqlite3_mprintf ("INSERT OR REPLACE INTO keys VALUES (%Q, %Q)", key, value);
+	success = sqlitedb_exec (ebsdb, stmt, NULL, NULL, error);
+	sqlite3_free (stmt);
+
+	return success;
+}
+
+static void
+e_book_backend_sqlitedb_finalize (GObject *object)
+{
+	EBookBackendSqliteDBPrivate *priv;
+
+	priv = E_BOOK_BACKEND_SQLITEDB_GET_PRIVATE (object);
+
+	if (priv->db)
+		sqlite3_close (priv->db);
+
+	g_mutex_free (priv->lock);
+
+	/* Chain up to parent's finalize() method. */
+	G_OBJECT_CLASS (e_book_backend_sqlitedb_parent_class)->finalize (object);
+}
+
+static void
+e_book_backend_sqlitedb_class_init (EBookBackendSqliteDBClass *class)
+{
+	GObjectClass *object_class;
+
+	g_type_class_add_private (class, sizeof (EBookBackendSqliteDBPrivate));
+
+	object_class = G_OBJECT_CLASS (class);
+	object_class->finalize = e_book_backend_sqlitedb_finalize;
+}
+
+static void
+e_book_backend_sqlitedb_init (EBookBackendSqliteDB *ebsdb)
+{
+	ebsdb->priv = E_BOOK_BACKEND_SQLITEDB_GET_PRIVATE (ebsdb);
+	ebsdb->priv->lock = g_mutex_new ();
+}
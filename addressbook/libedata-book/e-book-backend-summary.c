@@ -46,9 +46,37 @@ G_DEFINE_TYPE (EBookBackendSummary, e_book_backend_summary, G_TYPE_OBJECT)
 
 static GObjectClass *parent_class;
 
+/* the fields which can be queried, see func_check () */
+enum {
+	SUMMARY_INDEX_FULL_NAME,
+	SUMMARY_INDEX_EMAIL,
+	SUMMARY_INDEX_FILE_AS,
+	SUMMARY_INDEX_NICKNAME,
+	N_SUMMARY_INDEXES
+};
+
+typedef struct _SummaryIndex SummaryIndex;
+
+/* The summary file starts with the magic and the header, followed by a
+   fixed size record for each item, the sorted indexes and the string
+   table.  The table holds the strings of the items and the index keys,
+   each with its terminating \0, so they are used right from the mapped
+   file.  Changes made after the file was written are appended to it as
+   log records, until the log is too long and the file is rewritten. */
+typedef struct {
+	guint32 file_version;
+	guint32 num_items;
+	guint32 summary_mtime; /* version 2.0 field */
+	guint32 strings_offset; /* version 6.0 fields */
+	guint32 strings_len;
+	guint32 index_offsets[N_SUMMARY_INDEXES];
+	guint32 log_offset;
+} EBookBackendSummaryHeader;
+
 struct _EBookBackendSummaryPrivate {
 	gchar *summary_path;
-	FILE *fp;
+	GMappedFile *mapped; /* holds the strings of the loaded items */
+	EBookBackendSummaryHeader header;
 	guint32 file_version;
 	time_t mtime;
 	gboolean upgraded;
@@ -58,6 +86,14 @@ struct _EBookBackendSummaryPrivate {
 	GPtrArray *items;
 	GHashTable *id_to_item;
 	guint32 num_items; /* used only for loading */
+	SummaryIndex *indexes[N_SUMMARY_INDEXES]; /* built on demand */
+	gboolean append_ok; /* the file has all items but those in log */
+	gsize base_len;
+	gsize log_len;
+	GByteArray *log; /* changes not appended to the file yet */
+	/* held over changes, loads, saves and searches, since searches
+	 * build the indexes and the backend searches from several threads */
+	GStaticRecMutex lock;
 #ifdef SUMMARY_STATS
 	gint size;
 #endif
@@ -78,32 +114,64 @@ typedef struct {
 	gboolean wants_html_set;
 	gboolean list;
 	gboolean list_show_addresses;
+	gboolean mapped; /* the strings are in the mapped file */
 } EBookBackendSummaryItem;
 
+#define N_ITEM_STRINGS 10
+
+static const gsize item_strings[N_ITEM_STRINGS] = {
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, id),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, nickname),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, full_name),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, given_name),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, surname),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, file_as),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, email_1),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, email_2),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, email_3),
+	G_STRUCT_OFFSET (EBookBackendSummaryItem, email_4)
+};
+
+#define ITEM_STRING(item, i) G_STRUCT_MEMBER (gchar *, (item), item_strings[i])
+
+typedef struct {
+	gchar *key; /* the value without accents, in lower case */
+	EBookBackendSummaryItem *item;
+} SummaryIndexEntry;
+
+/* The values of one queried field of all items, sorted by their keys, so
+   beginswith and is queries are answered by a binary search.  An item has
+   one entry for each of its values, e.g. up to four for email.  contains
+   queries use the entries having the rarest trigram of the searched
+   string; the trigram lists are only built by the first such query. */
+struct _SummaryIndex {
+	GArray *entries;
+	GHashTable *trigrams; /* trigram -> GArray of entry indexes */
+	gboolean keys_mapped; /* loaded from the file, not allocated */
+};
+
+static SummaryIndex *ensure_index (EBookBackendSummary *summary, gint field);
+static void summary_changed (EBookBackendSummary *summary);
+
 typedef struct {
-	/* these lengths do *not* including the terminating \0, as
-	   it's not stored on disk. */
-	guint16 id_len;
-	guint16 nickname_len;
-	guint16 full_name_len; /* version 3.0 field */
-	guint16 given_name_len;
-	guint16 surname_len;
-	guint16 file_as_len;
-	guint16 email_1_len;
-	guint16 email_2_len;
-	guint16 email_3_len;
-	guint16 email_4_len;
+	/* offsets into the string table, or NO_STRING */
+	guint32 strings[N_ITEM_STRINGS];
 	guint8  wants_html;
 	guint8  wants_html_set;
 	guint8  list;
 	guint8  list_show_addresses;
 } EBookBackendSummaryDiskItem;
 
-typedef struct {
-	guint32 file_version;
-	guint32 num_items;
-	guint32 summary_mtime; /* version 2.0 field */
-} EBookBackendSummaryHeader;
+#define NO_STRING 0xffffffff
+
+/* A log record is the operation, the length of the data and the data.
+   An added item is its four flags, then the length and bytes of each of
+   its strings, in the order of item_strings; a removal is the id. */
+#define LOG_ADD    'A'
+#define LOG_REMOVE 'R'
+
+/* the log is appended to until it is a quarter of the rest of the file */
+#define LOG_MIN_COMPACT_LEN (64 * 1024)
 
 #define PAS_SUMMARY_MAGIC "PAS-SUMMARY"
 #define PAS_SUMMARY_MAGIC_LEN 11
@@ -113,30 +181,63 @@ typedef struct {
 #define PAS_SUMMARY_FILE_VERSION_3_0 3000
 #define PAS_SUMMARY_FILE_VERSION_4_0 4000
 #define PAS_SUMMARY_FILE_VERSION_5_0 5000
+#define PAS_SUMMARY_FILE_VERSION_6_0 6000
 
-#define PAS_SUMMARY_FILE_VERSION PAS_SUMMARY_FILE_VERSION_5_0
+#define PAS_SUMMARY_FILE_VERSION PAS_SUMMARY_FILE_VERSION_6_0
+
+#define PAS_SUMMARY_RECORDS_OFFSET (PAS_SUMMARY_MAGIC_LEN + sizeof (EBookBackendSummaryHeader))
 
 static void
 free_summary_item (EBookBackendSummaryItem *item)
 {
-	g_free (item->id);
-	g_free (item->nickname);
-	g_free (item->full_name);
-	g_free (item->given_name);
-	g_free (item->surname);
-	g_free (item->file_as);
-	g_free (item->email_1);
-	g_free (item->email_2);
-	g_free (item->email_3);
-	g_free (item->email_4);
+	gint i;
+
+	if (!item->mapped) {
+		for (i = 0; i < N_ITEM_STRINGS; i++)
+			g_free (ITEM_STRING (item, i));
+	}
+
 	g_free (item);
 }
 
+static void
+summary_index_free (SummaryIndex *index)
+{
+	gint i;
+
+	if (!index->keys_mapped) {
+		for (i = 0; i < index->entries->len; i++)
+			g_free (g_array_index (index->entries, SummaryIndexEntry, i).key);
+	}
+	g_array_free (index->entries, TRUE);
+
+	if (index->trigrams)
+		g_hash_table_destroy (index->trigrams);
+
+	g_free (index);
+}
+
+/* drops the indexes after the items changed, they are rebuilt by the next query */
+static void
+clear_indexes (EBookBackendSummary *summary)
+{
+	gint i;
+
+	for (i = 0; i < N_SUMMARY_INDEXES; i++) {
+		if (summary->priv->indexes[i]) {
+			summary_index_free (summary->priv->indexes[i]);
+			summary->priv->indexes[i] = NULL;
+		}
+	}
+}
+
 static void
 clear_items (EBookBackendSummary *summary)
 {
 	gint i;
 	gint num = summary->priv->items->len;
+
+	clear_indexes (summary);
 	for (i = 0; i < num; i++) {
 		EBookBackendSummaryItem *item = g_ptr_array_remove_index_fast (summary->priv->items, 0);
 		if (item) {
@@ -146,6 +247,34 @@ clear_items (EBookBackendSummary *summary)
 	}
 }
 
+static gboolean
+summary_remove_item (EBookBackendSummary *summary, const gchar *id)
+{
+	EBookBackendSummaryItem *item;
+
+	item = g_hash_table_lookup (summary->priv->id_to_item, id);
+	if (!item)
+		return FALSE;
+
+	g_ptr_array_remove (summary->priv->items, item);
+	g_hash_table_remove (summary->priv->id_to_item, id);
+	clear_indexes (summary);
+	free_summary_item (item);
+
+	return TRUE;
+}
+
+/* adds @item, replacing the item with the same id */
+static void
+summary_insert_item (EBookBackendSummary *summary, EBookBackendSummaryItem *item)
+{
+	summary_remove_item (summary, item->id);
+
+	g_ptr_array_add (summary->priv->items, item);
+	g_hash_table_insert (summary->priv->id_to_item, item->id, item);
+	clear_indexes (summary);
+}
+
 /**
  * e_book_backend_summary_new:
  * @summary_path: a local file system path
@@ -176,8 +305,6 @@ e_book_backend_summary_dispose (GObject *object)
 	EBookBackendSummary *summary = E_BOOK_BACKEND_SUMMARY (object);
 
 	if (summary->priv) {
-		if (summary->priv->fp)
-			fclose (summary->priv->fp);
 		if (summary->priv->dirty)
 			e_book_backend_summary_save (summary);
 		else
@@ -194,6 +321,11 @@ e_book_backend_summary_dispose (GObject *object)
 
 		g_hash_table_destroy (summary->priv->id_to_item);
 
+		if (summary->priv->mapped)
+			g_mapped_file_unref (summary->priv->mapped);
+		g_byte_array_free (summary->priv->log, TRUE);
+		g_static_rec_mutex_free (&summary->priv->lock);
+
 		g_free (summary->priv);
 		summary->priv = NULL;
 	}
@@ -224,229 +356,286 @@ e_book_backend_summary_init (EBookBackendSummary *summary)
 	summary->priv = priv;
 
 	priv->summary_path = NULL;
-	priv->fp = NULL;
+	priv->mapped = NULL;
 	priv->dirty = FALSE;
 	priv->upgraded = FALSE;
 	priv->items = g_ptr_array_new ();
 	priv->id_to_item = g_hash_table_new (g_str_hash, g_str_equal);
 	priv->flush_timeout_millis = 0;
 	priv->flush_timeout = 0;
+	memset (priv->indexes, 0, sizeof (priv->indexes));
+	priv->append_ok = FALSE;
+	priv->base_len = 0;
+	priv->log_len = 0;
+	priv->log = g_byte_array_new ();
+	g_static_rec_mutex_init (&priv->lock);
 #ifdef SUMMARY_STATS
 	priv->size = 0;
 #endif
 }
 
 
-static gboolean
-e_book_backend_summary_check_magic (EBookBackendSummary *summary, FILE *fp)
+static guint32
+get_uint32 (const gchar *p)
 {
-	gchar buf[PAS_SUMMARY_MAGIC_LEN + 1];
-	gint rv;
+	guint32 value;
 
-	memset (buf, 0, sizeof (buf));
+	memcpy (&value, p, sizeof (value));
 
-	rv = fread (buf, PAS_SUMMARY_MAGIC_LEN, 1, fp);
-	if (rv != 1)
+	return g_ntohl (value);
+}
+
+static gboolean
+e_book_backend_summary_check_magic (const gchar *contents, gsize length)
+{
+	if (length < PAS_SUMMARY_MAGIC_LEN)
 		return FALSE;
-	if (strcmp (buf, PAS_SUMMARY_MAGIC))
+	if (memcmp (contents, PAS_SUMMARY_MAGIC, PAS_SUMMARY_MAGIC_LEN))
 		return FALSE;
 
 	return TRUE;
 }
 
 static gboolean
-e_book_backend_summary_load_header (EBookBackendSummary *summary, FILE *fp,
+e_book_backend_summary_load_header (const gchar *contents, gsize length,
 				 EBookBackendSummaryHeader *header)
 {
-	gint rv;
+	gint i;
 
-	rv = fread (&header->file_version, sizeof (header->file_version), 1, fp);
-	if (rv != 1)
+	if (length < PAS_SUMMARY_RECORDS_OFFSET)
 		return FALSE;
 
+	memcpy (header, contents + PAS_SUMMARY_MAGIC_LEN, sizeof (*header));
+
 	header->file_version = g_ntohl (header->file_version);
 
 	if (header->file_version < PAS_SUMMARY_FILE_VERSION) {
 		return FALSE; /* this will cause the entire summary to be rebuilt */
 	}
 
-	rv = fread (&header->num_items, sizeof (header->num_items), 1, fp);
-	if (rv != 1)
-		return FALSE;
-
 	header->num_items = g_ntohl (header->num_items);
+	header->summary_mtime = g_ntohl (header->summary_mtime);
+	header->strings_offset = g_ntohl (header->strings_offset);
+	header->strings_len = g_ntohl (header->strings_len);
+	for (i = 0; i < N_SUMMARY_INDEXES; i++)
+		header->index_offsets[i] = g_ntohl (header->index_offsets[i]);
+	header->log_offset = g_ntohl (header->log_offset);
+
+	if (PAS_SUMMARY_RECORDS_OFFSET + (guint64) header->num_items * sizeof (EBookBackendSummaryDiskItem) > length
+	    || (guint64) header->strings_offset + header->strings_len > length
+	    || header->log_offset > length)
+		return FALSE;
 
-	rv = fread (&header->summary_mtime, sizeof (header->summary_mtime), 1, fp);
-	if (rv != 1)
+	/* every string in the table is terminated */
+	if (header->strings_len && contents[header->strings_offset + header->strings_len - 1])
 		return FALSE;
-	header->summary_mtime = g_ntohl (header->summary_mtime);
 
 	return TRUE;
 }
 
-static gchar *
-read_string (FILE *fp, gint len)
+static gboolean
+e_book_backend_summary_load_item (EBookBackendSummary *summary, guint32 n,
+			       EBookBackendSummaryItem **new_item)
 {
-	gchar *buf;
-	gint rv;
+	EBookBackendSummaryPrivate *priv = summary->priv;
+	EBookBackendSummaryDiskItem disk_item;
+	EBookBackendSummaryItem *item;
+	const gchar *contents, *strings;
+	gint i;
 
-	buf = g_new0 (char, len + 1);
+	contents = g_mapped_file_get_contents (priv->mapped);
+	strings = contents + priv->header.strings_offset;
 
-	rv = fread (buf, len, 1, fp);
-	if (rv != 1) {
-		g_free (buf);
-		return NULL;
+	memcpy (&disk_item, contents + PAS_SUMMARY_RECORDS_OFFSET + n * sizeof (disk_item), sizeof (disk_item));
+
+	item = g_new0 (EBookBackendSummaryItem, 1);
+	item->mapped = TRUE;
+
+	for (i = 0; i < N_ITEM_STRINGS; i++) {
+		guint32 offset = g_ntohl (disk_item.strings[i]);
+
+		if (offset == NO_STRING)
+			continue;
+
+		if (offset >= priv->header.strings_len) {
+			free_summary_item (item);
+			return FALSE;
+		}
+
+		ITEM_STRING (item, i) = (gchar *) strings + offset;
 	}
 
-	return buf;
+	item->wants_html = disk_item.wants_html;
+	item->wants_html_set = disk_item.wants_html_set;
+	item->list = disk_item.list;
+	item->list_show_addresses = disk_item.list_show_addresses;
+
+	/* the only field that has to be there is the id */
+	if (!item->id) {
+		free_summary_item (item);
+		return FALSE;
+	}
+
+	*new_item = item;
+	return TRUE;
 }
 
-static gboolean
-e_book_backend_summary_load_item (EBookBackendSummary *summary,
-			       EBookBackendSummaryItem **new_item)
+/* uses the indexes saved with the items, which are only valid as long
+   as the items are those of the file, in the same order */
+static void
+e_book_backend_summary_load_indexes (EBookBackendSummary *summary)
+{
+	EBookBackendSummaryPrivate *priv = summary->priv;
+	const gchar *contents, *strings;
+	gsize length;
+	gint field;
+
+	contents = g_mapped_file_get_contents (priv->mapped);
+	length = g_mapped_file_get_length (priv->mapped);
+	strings = contents + priv->header.strings_offset;
+
+	for (field = 0; field < N_SUMMARY_INDEXES; field++) {
+		guint32 offset = priv->header.index_offsets[field];
+		SummaryIndex *index;
+		guint32 n, i;
+
+		if (!offset || (guint64) offset + 4 > length)
+			continue;
+
+		n = get_uint32 (contents + offset);
+		if ((guint64) offset + 4 + (guint64) n * 8 > length)
+			continue;
+
+		index = g_new0 (SummaryIndex, 1);
+		index->entries = g_array_sized_new (FALSE, FALSE, sizeof (SummaryIndexEntry), n);
+		index->keys_mapped = TRUE;
+
+		for (i = 0; i < n; i++) {
+			const gchar *p = contents + offset + 4 + i * 8;
+			guint32 key_offset = get_uint32 (p);
+			guint32 item_number = get_uint32 (p + 4);
+			SummaryIndexEntry entry;
+
+			if (key_offset >= priv->header.strings_len || item_number >= priv->items->len) {
+				summary_index_free (index);
+				index = NULL;
+				break;
+			}
+
+			entry.key = (gchar *) strings + key_offset;
+			entry.item = g_ptr_array_index (priv->items, item_number);
+			g_array_append_val (index->entries, entry);
+		}
+
+		priv->indexes[field] = index;
+	}
+}
+
+static EBookBackendSummaryItem *
+read_log_item (const gchar *p, guint32 len)
 {
 	EBookBackendSummaryItem *item;
-	gchar *buf;
-	FILE *fp = summary->priv->fp;
+	const gchar *end = p + len;
+	gint i;
 
-	if (summary->priv->file_version >= PAS_SUMMARY_FILE_VERSION_4_0) {
-		EBookBackendSummaryDiskItem disk_item;
-		gint rv = fread (&disk_item, sizeof (disk_item), 1, fp);
-		if (rv != 1)
-			return FALSE;
+	if (len < 4)
+		return NULL;
 
-		disk_item.id_len = g_ntohs (disk_item.id_len);
-		disk_item.nickname_len = g_ntohs (disk_item.nickname_len);
-		disk_item.full_name_len = g_ntohs (disk_item.full_name_len);
-		disk_item.given_name_len = g_ntohs (disk_item.given_name_len);
-		disk_item.surname_len = g_ntohs (disk_item.surname_len);
-		disk_item.file_as_len = g_ntohs (disk_item.file_as_len);
-		disk_item.email_1_len = g_ntohs (disk_item.email_1_len);
-		disk_item.email_2_len = g_ntohs (disk_item.email_2_len);
-		disk_item.email_3_len = g_ntohs (disk_item.email_3_len);
-		disk_item.email_4_len = g_ntohs (disk_item.email_4_len);
-
-		item = g_new0 (EBookBackendSummaryItem, 1);
-
-		item->wants_html = disk_item.wants_html;
-		item->wants_html_set = disk_item.wants_html_set;
-		item->list = disk_item.list;
-		item->list_show_addresses = disk_item.list_show_addresses;
-
-		if (disk_item.id_len) {
-			buf = read_string (fp, disk_item.id_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->id = buf;
-		}
+	item = g_new0 (EBookBackendSummaryItem, 1);
 
-		if (disk_item.nickname_len) {
-			buf = read_string (fp, disk_item.nickname_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->nickname = buf;
-		}
+	item->wants_html = p[0];
+	item->wants_html_set = p[1];
+	item->list = p[2];
+	item->list_show_addresses = p[3];
+	p += 4;
 
-		if (disk_item.full_name_len) {
-			buf = read_string (fp, disk_item.full_name_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->full_name = buf;
-		}
+	for (i = 0; i < N_ITEM_STRINGS; i++) {
+		guint32 str_len;
 
-		if (disk_item.given_name_len) {
-			buf = read_string (fp, disk_item.given_name_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->given_name = buf;
-		}
+		if (end - p < 4)
+			goto lose;
 
-		if (disk_item.surname_len) {
-			buf = read_string (fp, disk_item.surname_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->surname = buf;
-		}
+		str_len = get_uint32 (p);
+		p += 4;
 
-		if (disk_item.file_as_len) {
-			buf = read_string (fp, disk_item.file_as_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->file_as = buf;
-		}
+		if (str_len == NO_STRING)
+			continue;
 
-		if (disk_item.email_1_len) {
-			buf = read_string (fp, disk_item.email_1_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->email_1 = buf;
-		}
+		if (str_len > (gsize) (end - p))
+			goto lose;
 
-		if (disk_item.email_2_len) {
-			buf = read_string (fp, disk_item.email_2_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->email_2 = buf;
-		}
+		ITEM_STRING (item, i) = g_strndup (p, str_len);
+		p += str_len;
+	}
 
-		if (disk_item.email_3_len) {
-			buf = read_string (fp, disk_item.email_3_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->email_3 = buf;
-		}
+	if (item->id)
+		return item;
 
-		if (disk_item.email_4_len) {
-			buf = read_string (fp, disk_item.email_4_len);
-			if (!buf) {
-				free_summary_item (item);
-				return FALSE;
-			}
-			item->email_4 = buf;
-		}
+ lose:
+	free_summary_item (item);
+	return NULL;
+}
 
-		/* the only field that has to be there is the id */
-		if (!item->id) {
-			free_summary_item (item);
+/* applies the changes appended to the file after the items */
+static gboolean
+e_book_backend_summary_replay_log (EBookBackendSummary *summary)
+{
+	EBookBackendSummaryPrivate *priv = summary->priv;
+	const gchar *p, *end;
+
+	p = g_mapped_file_get_contents (priv->mapped) + priv->header.log_offset;
+	end = g_mapped_file_get_contents (priv->mapped) + g_mapped_file_get_length (priv->mapped);
+
+	while (p < end) {
+		EBookBackendSummaryItem *item;
+		gchar *id;
+		gchar op;
+		guint32 len;
+
+		/* a record cut short by a crash while appending it */
+		if (end - p < 5)
+			return FALSE;
+
+		op = p[0];
+		len = get_uint32 (p + 1);
+		p += 5;
+
+		if (len > (gsize) (end - p))
+			return FALSE;
+
+		switch (op) {
+		case LOG_ADD:
+			item = read_log_item (p, len);
+			if (!item)
+				return FALSE;
+			summary_insert_item (summary, item);
+			break;
+		case LOG_REMOVE:
+			id = g_strndup (p, len);
+			summary_remove_item (summary, id);
+			g_free (id);
+			break;
+		default:
 			return FALSE;
 		}
-	}
-	else {
-		/* unhandled file version */
-		return FALSE;
+
+		p += len;
 	}
 
-	*new_item = item;
 	return TRUE;
 }
 
-/* opens the file and loads the header */
+/* maps the file and loads the header */
 static gboolean
 e_book_backend_summary_open (EBookBackendSummary *summary)
 {
-	FILE *fp;
+	GMappedFile *mapped;
 	EBookBackendSummaryHeader header;
+	const gchar *contents;
+	gsize length;
 	struct stat sb;
 
-	if (summary->priv->fp)
+	if (summary->priv->mapped)
 		return TRUE;
 
 	if (g_stat (summary->priv->summary_path, &sb) == -1) {
@@ -464,208 +653,343 @@ e_book_backend_summary_open (EBookBackendSummary *summary)
 		}
 	}
 
-	fp = g_fopen (summary->priv->summary_path, "rb");
-	if (!fp) {
+	mapped = g_mapped_file_new (summary->priv->summary_path, FALSE, NULL);
+	if (!mapped) {
 		g_warning ("failed to open summary file");
 		return FALSE;
 	}
 
-	if (!e_book_backend_summary_check_magic (summary, fp)) {
+	contents = g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+
+	if (!e_book_backend_summary_check_magic (contents, length)) {
 		g_warning ("file is not a valid summary file");
-		fclose (fp);
+		g_mapped_file_unref (mapped);
 		return FALSE;
 	}
 
-	if (!e_book_backend_summary_load_header (summary, fp, &header)) {
+	if (!e_book_backend_summary_load_header (contents, length, &header)) {
 		g_warning ("failed to read summary header");
-		fclose (fp);
+		g_mapped_file_unref (mapped);
 		return FALSE;
 	}
 
+	summary->priv->header = header;
 	summary->priv->num_items = header.num_items;
 	summary->priv->file_version = header.file_version;
 	summary->priv->mtime = sb.st_mtime;
-	summary->priv->fp = fp;
+	summary->priv->mapped = mapped;
 
 	return TRUE;
 }
 
-/**
- * e_book_backend_summary_load:
- * @summary: an #EBookBackendSummary
- *
- * Attempts to load @summary from disk. The load is successful if
- * the file was located, it was in the correct format, and it was
- * not out of date.
- *
- * Returns: %TRUE if the load succeeded, %FALSE if it failed.
- **/
-gboolean
-e_book_backend_summary_load (EBookBackendSummary *summary)
+static gboolean
+summary_load (EBookBackendSummary *summary)
 {
 	EBookBackendSummaryItem *new_item;
 	gint i;
 
-	g_return_val_if_fail (summary != NULL, FALSE);
-
 	clear_items (summary);
 
+	/* nothing may be appended until the file is known to be whole */
+	summary->priv->append_ok = FALSE;
+	summary->priv->base_len = 0;
+	summary->priv->log_len = 0;
+	g_byte_array_set_size (summary->priv->log, 0);
+
+	/* the file may have been rewritten since it was mapped */
+	if (summary->priv->mapped) {
+		g_mapped_file_unref (summary->priv->mapped);
+		summary->priv->mapped = NULL;
+	}
+
 	if (!e_book_backend_summary_open (summary))
 		return FALSE;
 
 	for (i = 0; i < summary->priv->num_items; i++) {
-		if (!e_book_backend_summary_load_item (summary, &new_item)) {
+		if (!e_book_backend_summary_load_item (summary, i, &new_item)) {
 			g_warning ("error while reading summary item");
-			clear_items (summary);
-			fclose (summary->priv->fp);
-			summary->priv->fp = NULL;
-			summary->priv->dirty = FALSE;
-			return FALSE;
+			goto lose;
 		}
 
 		g_ptr_array_add (summary->priv->items, new_item);
 		g_hash_table_insert (summary->priv->id_to_item, new_item->id, new_item);
 	}
 
+	e_book_backend_summary_load_indexes (summary);
+
+	if (!e_book_backend_summary_replay_log (summary)) {
+		g_warning ("error while reading summary log");
+		goto lose;
+	}
+
+	summary->priv->append_ok = TRUE;
+	summary->priv->base_len = summary->priv->header.log_offset;
+	summary->priv->log_len = g_mapped_file_get_length (summary->priv->mapped) - summary->priv->header.log_offset;
+	g_byte_array_set_size (summary->priv->log, 0);
+
 	if (summary->priv->upgraded) {
 		e_book_backend_summary_save (summary);
 	}
 	summary->priv->dirty = FALSE;
 
 	return TRUE;
+
+ lose:
+	clear_items (summary);
+	g_mapped_file_unref (summary->priv->mapped);
+	summary->priv->mapped = NULL;
+	/* the file has to be written again as a whole */
+	summary->priv->append_ok = FALSE;
+	g_byte_array_set_size (summary->priv->log, 0);
+	summary->priv->dirty = FALSE;
+	return FALSE;
 }
 
-static gboolean
-e_book_backend_summary_save_magic (FILE *fp)
+/**
+ * e_book_backend_summary_load:
+ * @summary: an #EBookBackendSummary
+ *
+ * Attempts to load @summary from disk. The load is successful if
+ * the file was located, it was in the correct format, and it was
+ * not out of date.
+ *
+ * Returns: %TRUE if the load succeeded, %FALSE if it failed.
+ **/
+gboolean
+e_book_backend_summary_load (EBookBackendSummary *summary)
 {
-	gint rv;
-	rv = fwrite (PAS_SUMMARY_MAGIC, PAS_SUMMARY_MAGIC_LEN, 1, fp);
-	if (rv != 1)
-		return FALSE;
+	gboolean success;
 
-	return TRUE;
+	g_return_val_if_fail (summary != NULL, FALSE);
+
+	g_static_rec_mutex_lock (&summary->priv->lock);
+	success = summary_load (summary);
+	g_static_rec_mutex_unlock (&summary->priv->lock);
+
+	return success;
 }
 
-static gboolean
-e_book_backend_summary_save_header (EBookBackendSummary *summary, FILE *fp)
+static void
+log_append_uint32 (GByteArray *log, guint32 value)
 {
-	EBookBackendSummaryHeader header;
-	gint rv;
+	value = g_htonl (value);
+	g_byte_array_append (log, (guint8 *) &value, sizeof (value));
+}
 
-	header.file_version = g_htonl (PAS_SUMMARY_FILE_VERSION);
-	header.num_items = g_htonl (summary->priv->items->len);
-	header.summary_mtime = g_htonl (time (NULL));
+/* starts a log record, returns where to put its length */
+static guint
+log_begin_record (GByteArray *log, guint8 op)
+{
+	guint len_pos;
 
-	rv = fwrite (&header, sizeof (header), 1, fp);
-	if (rv != 1)
-		return FALSE;
+	g_byte_array_append (log, &op, 1);
+	len_pos = log->len;
+	log_append_uint32 (log, 0);
 
-	return TRUE;
+	return len_pos;
 }
 
-static gboolean
-save_string (const gchar *str, FILE *fp)
+static void
+log_end_record (GByteArray *log, guint len_pos)
+{
+	guint32 len = g_htonl (log->len - len_pos - 4);
+
+	memcpy (log->data + len_pos, &len, sizeof (len));
+}
+
+static void
+log_add_item (EBookBackendSummary *summary, EBookBackendSummaryItem *item)
+{
+	GByteArray *log = summary->priv->log;
+	guint8 flags[4];
+	guint len_pos;
+	gint i;
+
+	/* the file will be rewritten anyway */
+	if (!summary->priv->append_ok)
+		return;
+
+	len_pos = log_begin_record (log, LOG_ADD);
+
+	flags[0] = item->wants_html;
+	flags[1] = item->wants_html_set;
+	flags[2] = item->list;
+	flags[3] = item->list_show_addresses;
+	g_byte_array_append (log, flags, sizeof (flags));
+
+	for (i = 0; i < N_ITEM_STRINGS; i++) {
+		const gchar *str = ITEM_STRING (item, i);
+
+		if (str) {
+			log_append_uint32 (log, strlen (str));
+			g_byte_array_append (log, (const guint8 *) str, strlen (str));
+		} else {
+			log_append_uint32 (log, NO_STRING);
+		}
+	}
+
+	log_end_record (log, len_pos);
+}
+
+static void
+log_remove_item (EBookBackendSummary *summary, const gchar *id)
+{
+	GByteArray *log = summary->priv->log;
+	guint len_pos;
+
+	if (!summary->priv->append_ok)
+		return;
+
+	len_pos = log_begin_record (log, LOG_REMOVE);
+	g_byte_array_append (log, (const guint8 *) id, strlen (id));
+	log_end_record (log, len_pos);
+}
+
+/* adds @str to the string table, returning its offset */
+static guint32
+save_string (GString *strings, const gchar *str)
 {
-	gint rv;
+	guint32 offset = strings->len;
+
+	g_string_append_len (strings, str, strlen (str) + 1);
+
+	return offset;
+}
 
-	if (!str || !*str)
+static gboolean
+save_bytes (gconstpointer data, gsize len, FILE *fp)
+{
+	if (!len)
 		return TRUE;
 
-	rv = fwrite (str, strlen (str), 1, fp);
-	return (rv == 1);
+	return fwrite (data, len, 1, fp) == 1;
 }
 
+/* writes the header, the items, their indexes and the string table */
 static gboolean
-e_book_backend_summary_save_item (EBookBackendSummary *summary, FILE *fp, EBookBackendSummaryItem *item)
+e_book_backend_summary_save_items (EBookBackendSummary *summary, FILE *fp, gsize *length)
 {
-	EBookBackendSummaryDiskItem disk_item;
-	gint len;
-	gint rv;
+	EBookBackendSummaryPrivate *priv = summary->priv;
+	EBookBackendSummaryHeader header;
+	GByteArray *records, *indexes;
+	GHashTable *item_numbers;
+	GString *strings;
+	guint32 base, value;
+	gboolean success;
+	gint i, j, field;
+
+	strings = g_string_new ("");
+	records = g_byte_array_sized_new (priv->items->len * sizeof (EBookBackendSummaryDiskItem));
+	indexes = g_byte_array_new ();
+	item_numbers = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	for (i = 0; i < priv->items->len; i++) {
+		EBookBackendSummaryItem *item = g_ptr_array_index (priv->items, i);
+		EBookBackendSummaryDiskItem disk_item;
+
+		for (j = 0; j < N_ITEM_STRINGS; j++) {
+			const gchar *str = ITEM_STRING (item, j);
+
+			disk_item.strings[j] = g_htonl (str ? save_string (strings, str) : NO_STRING);
+		}
 
-	len = item->id ? strlen (item->id) : 0;
-	disk_item.id_len = g_htons (len);
+		disk_item.wants_html = item->wants_html;
+		disk_item.wants_html_set = item->wants_html_set;
+		disk_item.list = item->list;
+		disk_item.list_show_addresses = item->list_show_addresses;
 
-	len = item->nickname ? strlen (item->nickname) : 0;
-	disk_item.nickname_len = g_htons (len);
+		g_byte_array_append (records, (guint8 *) &disk_item, sizeof (disk_item));
+		g_hash_table_insert (item_numbers, item, GUINT_TO_POINTER (i));
+	}
 
-	len = item->given_name ? strlen (item->given_name) : 0;
-	disk_item.given_name_len = g_htons (len);
+	/* the indexes are sorted now, so the next load does not have to */
+	base = PAS_SUMMARY_RECORDS_OFFSET + records->len;
+	for (field = 0; field < N_SUMMARY_INDEXES; field++) {
+		SummaryIndex *index = ensure_index (summary, field);
 
-	len = item->full_name ? strlen (item->full_name) : 0;
-	disk_item.full_name_len = g_htons (len);
+		header.index_offsets[field] = g_htonl (base + indexes->len);
 
-	len = item->surname ? strlen (item->surname) : 0;
-	disk_item.surname_len = g_htons (len);
+		value = g_htonl (index->entries->len);
+		g_byte_array_append (indexes, (guint8 *) &value, sizeof (value));
 
-	len = item->file_as ? strlen (item->file_as) : 0;
-	disk_item.file_as_len = g_htons (len);
+		for (i = 0; i < index->entries->len; i++) {
+			SummaryIndexEntry *entry = &g_array_index (index->entries, SummaryIndexEntry, i);
 
-	len = item->email_1 ? strlen (item->email_1) : 0;
-	disk_item.email_1_len = g_htons (len);
+			value = g_htonl (save_string (strings, entry->key));
+			g_byte_array_append (indexes, (guint8 *) &value, sizeof (value));
+			value = g_htonl (GPOINTER_TO_UINT (g_hash_table_lookup (item_numbers, entry->item)));
+			g_byte_array_append (indexes, (guint8 *) &value, sizeof (value));
+		}
+	}
 
-	len = item->email_2 ? strlen (item->email_2) : 0;
-	disk_item.email_2_len = g_htons (len);
+	header.file_version = g_htonl (PAS_SUMMARY_FILE_VERSION);
+	header.num_items = g_htonl (priv->items->len);
+	header.summary_mtime = g_htonl (time (NULL));
+	header.strings_offset = g_htonl (base + indexes->len);
+	header.strings_len = g_htonl (strings->len);
+	header.log_offset = g_htonl (base + indexes->len + strings->len);
 
-	len = item->email_3 ? strlen (item->email_3) : 0;
-	disk_item.email_3_len = g_htons (len);
+	*length = base + indexes->len + strings->len;
 
-	len = item->email_4 ? strlen (item->email_4) : 0;
-	disk_item.email_4_len = g_htons (len);
+	success = save_bytes (PAS_SUMMARY_MAGIC, PAS_SUMMARY_MAGIC_LEN, fp)
+		&& save_bytes (&header, sizeof (header), fp)
+		&& save_bytes (records->data, records->len, fp)
+		&& save_bytes (indexes->data, indexes->len, fp)
+		&& save_bytes (strings->str, strings->len, fp);
 
-	disk_item.wants_html = item->wants_html;
-	disk_item.wants_html_set = item->wants_html_set;
-	disk_item.list = item->list;
-	disk_item.list_show_addresses = item->list_show_addresses;
+	g_hash_table_destroy (item_numbers);
+	g_byte_array_free (indexes, TRUE);
+	g_byte_array_free (records, TRUE);
+	g_string_free (strings, TRUE);
 
-	rv = fwrite (&disk_item, sizeof (disk_item), 1, fp);
-	if (rv != 1)
-		return FALSE;
+	return success;
+}
 
-	if (!save_string (item->id, fp))
-		return FALSE;
-	if (!save_string (item->nickname, fp))
-		return FALSE;
-	if (!save_string (item->full_name, fp))
-		return FALSE;
-	if (!save_string (item->given_name, fp))
-		return FALSE;
-	if (!save_string (item->surname, fp))
-		return FALSE;
-	if (!save_string (item->file_as, fp))
-		return FALSE;
-	if (!save_string (item->email_1, fp))
-		return FALSE;
-	if (!save_string (item->email_2, fp))
-		return FALSE;
-	if (!save_string (item->email_3, fp))
+/* appends the pending log records to the file */
+static gboolean
+e_book_backend_summary_append_log (EBookBackendSummary *summary)
+{
+	EBookBackendSummaryPrivate *priv = summary->priv;
+	FILE *fp;
+	gboolean success;
+
+	fp = g_fopen (priv->summary_path, "ab");
+	if (!fp)
 		return FALSE;
-	if (!save_string (item->email_4, fp))
+
+	success = save_bytes (priv->log->data, priv->log->len, fp);
+	if (fclose (fp) != 0)
+		success = FALSE;
+
+	if (!success) {
+		/* the file may end with a partial record now */
+		priv->append_ok = FALSE;
 		return FALSE;
+	}
+
+	priv->log_len += priv->log->len;
+	g_byte_array_set_size (priv->log, 0);
 
 	return TRUE;
 }
 
-/**
- * e_book_backend_summary_save:
- * @summary: an #EBookBackendSummary
- *
- * Attempts to save @summary to disk.
- *
- * Returns: %TRUE if the save succeeded, %FALSE otherwise.
- **/
-gboolean
-e_book_backend_summary_save (EBookBackendSummary *summary)
+static gboolean
+summary_save (EBookBackendSummary *summary)
 {
 	struct stat sb;
 	FILE *fp = NULL;
 	gchar *new_filename = NULL;
-	gint i;
-
-	g_return_val_if_fail (summary != NULL, FALSE);
+	gsize length;
 
 	if (!summary->priv->dirty)
 		return TRUE;
 
+	if (summary->priv->append_ok
+	    && summary->priv->log_len + summary->priv->log->len <= MAX (LOG_MIN_COMPACT_LEN, summary->priv->base_len / 4)
+	    && e_book_backend_summary_append_log (summary))
+		goto saved;
+
 	new_filename = g_strconcat (summary->priv->summary_path, ".new", NULL);
 
 	fp = g_fopen (new_filename, "wb");
@@ -674,38 +998,31 @@ e_book_backend_summary_save (EBookBackendSummary *summary)
 		goto lose;
 	}
 
-	if (!e_book_backend_summary_save_magic (fp)) {
-		g_warning ("could not write magic to new summary file");
+	if (!e_book_backend_summary_save_items (summary, fp, &length)) {
+		g_warning ("failed to write new summary file, errno = %d", errno);
 		goto lose;
 	}
 
-	if (!e_book_backend_summary_save_header (summary, fp)) {
-		g_warning ("could not write header to new summary file");
-		goto lose;
-	}
+	fclose (fp);
 
-	for (i = 0; i < summary->priv->items->len; i++) {
-		EBookBackendSummaryItem *item = g_ptr_array_index (summary->priv->items, i);
-		if (!e_book_backend_summary_save_item (summary, fp, item)) {
-			g_warning ("failed to write an item to new summary file, errno = %d", errno);
-			goto lose;
-		}
-	}
+	/* unlink the old summary and rename the new one */
+	g_unlink (summary->priv->summary_path);
+	g_rename (new_filename, summary->priv->summary_path);
 
-	fclose (fp);
+	g_free (new_filename);
+
+	summary->priv->append_ok = TRUE;
+	summary->priv->base_len = length;
+	summary->priv->log_len = 0;
+	g_byte_array_set_size (summary->priv->log, 0);
 
+ saved:
 	/* if we have a queued flush, clear it (since we just flushed) */
 	if (summary->priv->flush_timeout) {
 		g_source_remove (summary->priv->flush_timeout);
 		summary->priv->flush_timeout = 0;
 	}
 
-	/* unlink the old summary and rename the new one */
-	g_unlink (summary->priv->summary_path);
-	g_rename (new_filename, summary->priv->summary_path);
-
-	g_free (new_filename);
-
 	/* lastly, update the in memory mtime to that of the file */
 	if (g_stat (summary->priv->summary_path, &sb) == -1) {
 		g_warning ("error stat'ing saved summary");
@@ -726,6 +1043,30 @@ e_book_backend_summary_save (EBookBackendSummary *summary)
 	return FALSE;
 }
 
+/**
+ * e_book_backend_summary_save:
+ * @summary: an #EBookBackendSummary
+ *
+ * Attempts to save @summary to disk. The changes made since the last
+ * save are appended to the file, unless they make the file much bigger
+ * than needed, in which case the whole file is written again.
+ *
+ * Returns: %TRUE if the save succeeded, %FALSE otherwise.
+ **/
+gboolean
+e_book_backend_summary_save (EBookBackendSummary *summary)
+{
+	gboolean success;
+
+	g_return_val_if_fail (summary != NULL, FALSE);
+
+	g_static_rec_mutex_lock (&summary->priv->lock);
+	success = summary_save (summary);
+	g_static_rec_mutex_unlock (&summary->priv->lock);
+
+	return success;
+}
+
 /**
  * e_book_backend_summary_add_contact:
  * @summary: an #EBookBackendSummary
@@ -752,10 +1093,6 @@ e_book_backend_summary_add_contact (EBookBackendSummary *summary, EContact *cont
 		return;
 	}
 
-	/* Ensure the duplicate contacts are not added */
-	if (e_book_backend_summary_check_contact (summary, id))
-		e_book_backend_summary_remove_contact (summary, id);
-
 	new_item = g_new0 (EBookBackendSummaryItem, 1);
 
 	new_item->id         = id;
@@ -772,8 +1109,11 @@ e_book_backend_summary_add_contact (EBookBackendSummary *summary, EContact *cont
 	new_item->list_show_addresses = GPOINTER_TO_INT (e_contact_get (contact, E_CONTACT_LIST_SHOW_ADDRESSES));
 	new_item->wants_html = GPOINTER_TO_INT (e_contact_get (contact, E_CONTACT_WANTS_HTML));
 
-	g_ptr_array_add (summary->priv->items, new_item);
-	g_hash_table_insert (summary->priv->id_to_item, new_item->id, new_item);
+	g_static_rec_mutex_lock (&summary->priv->lock);
+
+	/* Ensure the duplicate contacts are not added */
+	summary_insert_item (summary, new_item);
+	log_add_item (summary, new_item);
 
 #ifdef SUMMARY_STATS
 	summary->priv->size += sizeof (EBookBackendSummaryItem);
@@ -788,7 +1128,9 @@ e_book_backend_summary_add_contact (EBookBackendSummary *summary, EContact *cont
 	summary->priv->size += new_item->email_3 ? strlen (new_item->email_3) : 0;
 	summary->priv->size += new_item->email_4 ? strlen (new_item->email_4) : 0;
 #endif
-	e_book_backend_summary_touch (summary);
+	summary_changed (summary);
+
+	g_static_rec_mutex_unlock (&summary->priv->lock);
 }
 
 /**
@@ -801,20 +1143,21 @@ e_book_backend_summary_add_contact (EBookBackendSummary *summary, EContact *cont
 void
 e_book_backend_summary_remove_contact (EBookBackendSummary *summary, const gchar *id)
 {
-	EBookBackendSummaryItem *item;
-
 	g_return_if_fail (summary != NULL);
 
-	item = g_hash_table_lookup (summary->priv->id_to_item, id);
+	g_static_rec_mutex_lock (&summary->priv->lock);
 
-	if (item) {
-		g_ptr_array_remove (summary->priv->items, item);
-		g_hash_table_remove (summary->priv->id_to_item, id);
-		free_summary_item (item);
-		e_book_backend_summary_touch (summary);
+	if (e_book_backend_summary_check_contact (summary, id)) {
+		/* before removing it, @id may be the item's */
+		log_remove_item (summary, id);
+		summary_remove_item (summary, id);
+		summary_changed (summary);
+		g_static_rec_mutex_unlock (&summary->priv->lock);
 		return;
 	}
 
+	g_static_rec_mutex_unlock (&summary->priv->lock);
+
 	g_warning ("e_book_backend_summary_remove_contact: unable to locate id `%s'", id);
 }
 
@@ -831,9 +1174,15 @@ e_book_backend_summary_remove_contact (EBookBackendSummary *summary, const gchar
 gboolean
 e_book_backend_summary_check_contact (EBookBackendSummary *summary, const gchar *id)
 {
+	gboolean found;
+
 	g_return_val_if_fail (summary != NULL, FALSE);
 
-	return g_hash_table_lookup (summary->priv->id_to_item, id) != NULL;
+	g_static_rec_mutex_lock (&summary->priv->lock);
+	found = g_hash_table_lookup (summary->priv->id_to_item, id) != NULL;
+	g_static_rec_mutex_unlock (&summary->priv->lock);
+
+	return found;
 }
 
 static gboolean
@@ -841,8 +1190,11 @@ summary_flush_func (gpointer data)
 {
 	EBookBackendSummary *summary = E_BOOK_BACKEND_SUMMARY (data);
 
+	g_static_rec_mutex_lock (&summary->priv->lock);
+
 	if (!summary->priv->dirty) {
 		summary->priv->flush_timeout = 0;
+		g_static_rec_mutex_unlock (&summary->priv->lock);
 		return FALSE;
 	}
 
@@ -851,6 +1203,7 @@ summary_flush_func (gpointer data)
 		   out with the next change, or 2) regen the summary
 		   when we next load the uri */
 		g_warning ("failed to flush summary file to disk");
+		g_static_rec_mutex_unlock (&summary->priv->lock);
 		return TRUE; /* try again after the next timeout */
 	}
 
@@ -859,9 +1212,20 @@ summary_flush_func (gpointer data)
 	/* we only want this to execute once, so return FALSE and set
 	   summary->flush_timeout to 0 */
 	summary->priv->flush_timeout = 0;
+	g_static_rec_mutex_unlock (&summary->priv->lock);
 	return FALSE;
 }
 
+static void
+summary_changed (EBookBackendSummary *summary)
+{
+	summary->priv->dirty = TRUE;
+	if (!summary->priv->flush_timeout
+	    && summary->priv->flush_timeout_millis)
+		summary->priv->flush_timeout = g_timeout_add (summary->priv->flush_timeout_millis,
+							      summary_flush_func, summary);
+}
+
 /**
  * e_book_backend_summary_touch:
  * @summary: an #EBookBackendSummary
@@ -873,11 +1237,15 @@ e_book_backend_summary_touch (EBookBackendSummary *summary)
 {
 	g_return_if_fail (summary != NULL);
 
-	summary->priv->dirty = TRUE;
-	if (!summary->priv->flush_timeout
-	    && summary->priv->flush_timeout_millis)
-		summary->priv->flush_timeout = g_timeout_add (summary->priv->flush_timeout_millis,
-							      summary_flush_func, summary);
+	g_static_rec_mutex_lock (&summary->priv->lock);
+
+	/* the change is not known, so the whole file has to be written */
+	summary->priv->append_ok = FALSE;
+	g_byte_array_set_size (summary->priv->log, 0);
+
+	summary_changed (summary);
+
+	g_static_rec_mutex_unlock (&summary->priv->lock);
 }
 
 /**
@@ -892,12 +1260,16 @@ e_book_backend_summary_touch (EBookBackendSummary *summary)
 gboolean
 e_book_backend_summary_is_up_to_date (EBookBackendSummary *summary, time_t t)
 {
+	gboolean up_to_date;
+
 	g_return_val_if_fail (summary != NULL, FALSE);
 
-	if (!e_book_backend_summary_open (summary))
-		return FALSE;
-	else
-		return summary->priv->mtime >= t;
+	g_static_rec_mutex_lock (&summary->priv->lock);
+	up_to_date = e_book_backend_summary_open (summary)
+		&& summary->priv->mtime >= t;
+	g_static_rec_mutex_unlock (&summary->priv->lock);
+
+	return up_to_date;
 }
 
 
@@ -996,155 +1368,336 @@ e_book_backend_summary_is_summary_query (EBookBackendSummary *summary, const gch
 
 
 /* the actual query mechanics */
-static ESExpResult *
-do_compare (EBookBackendSummary *summary, struct _ESExp *f, gint argc,
-	    struct _ESExpResult **argv,
-	    gchar *(*compare)(const gchar *, const gchar *))
+
+typedef enum {
+	SUMMARY_MATCH_CONTAINS,
+	SUMMARY_MATCH_IS,
+	SUMMARY_MATCH_BEGINS_WITH,
+	SUMMARY_MATCH_ENDS_WITH
+} SummaryMatch;
+
+/* Returns @value without accents and in lower case, which is how the
+   query functions always compared values, or NULL if it is not valid UTF-8. */
+static gchar *
+summary_key (const gchar *value)
 {
-	GPtrArray *result = g_ptr_array_new ();
-	ESExpResult *r;
+	GString *key;
+	gchar *stripped;
+	const gchar *p;
+
+	if (!value || !g_utf8_validate (value, -1, NULL))
+		return NULL;
+
+	stripped = e_util_utf8_remove_accents (value);
+	key = g_string_sized_new (strlen (stripped));
+
+	for (p = stripped; *p; p = g_utf8_next_char (p))
+		g_string_append_unichar (key, g_unichar_tolower (g_utf8_get_char (p)));
+
+	g_free (stripped);
+
+	return g_string_free (key, FALSE);
+}
+
+static void
+summary_index_add (SummaryIndex *index, EBookBackendSummaryItem *item, const gchar *value)
+{
+	SummaryIndexEntry entry;
+
+	entry.key = summary_key (value);
+	if (!entry.key)
+		return;
+
+	entry.item = item;
+	g_array_append_val (index->entries, entry);
+}
+
+static gint
+summary_index_entry_compare (gconstpointer a, gconstpointer b)
+{
+	return strcmp (((const SummaryIndexEntry *) a)->key, ((const SummaryIndexEntry *) b)->key);
+}
+
+static SummaryIndex *
+ensure_index (EBookBackendSummary *summary, gint field)
+{
+	SummaryIndex *index = summary->priv->indexes[field];
 	gint i;
 
-	if (argc == 2
-	    && argv[0]->type == ESEXP_RES_STRING
-	    && argv[1]->type == ESEXP_RES_STRING) {
+	if (index)
+		return index;
 
-		for (i = 0; i < summary->priv->items->len; i++) {
-			EBookBackendSummaryItem *item = g_ptr_array_index (summary->priv->items, i);
-			if (!strcmp (argv[0]->value.string, "full_name")) {
-				gchar *given = item->given_name;
-				gchar *surname = item->surname;
-				gchar *full_name = item->full_name;
-
-				if ((given && compare (given, argv[1]->value.string))
-				    || (surname && compare (surname, argv[1]->value.string))
-				    || (full_name && compare (full_name, argv[1]->value.string)))
-					g_ptr_array_add (result, item->id);
-			}
-			else if (!strcmp (argv[0]->value.string, "email")) {
-				gchar *email_1 = item->email_1;
-				gchar *email_2 = item->email_2;
-				gchar *email_3 = item->email_3;
-				gchar *email_4 = item->email_4;
-				if ((email_1 && compare (email_1, argv[1]->value.string))
-				    || (email_2 && compare (email_2, argv[1]->value.string))
-				    || (email_3 && compare (email_3, argv[1]->value.string))
-				    || (email_4 && compare (email_4, argv[1]->value.string)))
-					g_ptr_array_add (result, item->id);
-			}
-			else if (!strcmp (argv[0]->value.string, "file_as")) {
-				gchar *file_as = item->file_as;
-				if (file_as && compare (file_as, argv[1]->value.string))
-					g_ptr_array_add (result, item->id);
-			}
-			else if (!strcmp (argv[0]->value.string, "nickname")) {
-				gchar *nickname = item->nickname;
-				if (nickname && compare (nickname, argv[1]->value.string))
-					g_ptr_array_add (result, item->id);
-			}
+	index = g_new0 (SummaryIndex, 1);
+	index->entries = g_array_new (FALSE, FALSE, sizeof (SummaryIndexEntry));
+
+	for (i = 0; i < summary->priv->items->len; i++) {
+		EBookBackendSummaryItem *item = g_ptr_array_index (summary->priv->items, i);
+
+		switch (field) {
+		case SUMMARY_INDEX_FULL_NAME:
+			summary_index_add (index, item, item->given_name);
+			summary_index_add (index, item, item->surname);
+			summary_index_add (index, item, item->full_name);
+			break;
+		case SUMMARY_INDEX_EMAIL:
+			summary_index_add (index, item, item->email_1);
+			summary_index_add (index, item, item->email_2);
+			summary_index_add (index, item, item->email_3);
+			summary_index_add (index, item, item->email_4);
+			break;
+		case SUMMARY_INDEX_FILE_AS:
+			summary_index_add (index, item, item->file_as);
+			break;
+		case SUMMARY_INDEX_NICKNAME:
+			summary_index_add (index, item, item->nickname);
+			break;
 		}
 	}
 
-	r = e_sexp_result_new (f, ESEXP_RES_ARRAY_PTR);
-	r->value.ptrarray = result;
+	g_array_sort (index->entries, summary_index_entry_compare);
 
-	return r;
+	summary->priv->indexes[field] = index;
+
+	return index;
 }
 
-static gchar *
-contains_helper (const gchar *ps1, const gchar *ps2)
+/* the end of the trigram starting at @p, or NULL if less than three characters are left */
+static const gchar *
+trigram_end (const gchar *p)
 {
-	gchar *s1 = e_util_utf8_remove_accents (ps1);
-	gchar *s2 = e_util_utf8_remove_accents (ps2);
-	gchar *res;
+	gint i;
 
-	res = (gchar *) e_util_utf8_strstrcase (s1, s2);
+	for (i = 0; i < 3; i++) {
+		if (!*p)
+			return NULL;
+		p = g_utf8_next_char (p);
+	}
 
-	g_free (s1);
-	g_free (s2);
+	return p;
+}
 
-	return res;
+static void
+free_trigram_list (gpointer data)
+{
+	g_array_free (data, TRUE);
 }
 
-static ESExpResult *
-func_contains (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer data)
+static void
+ensure_trigrams (SummaryIndex *index)
 {
-	EBookBackendSummary *summary = data;
+	guint i;
+
+	if (index->trigrams)
+		return;
+
+	index->trigrams = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_trigram_list);
+
+	for (i = 0; i < index->entries->len; i++) {
+		const gchar *key = g_array_index (index->entries, SummaryIndexEntry, i).key;
+		const gchar *p, *end;
+
+		for (p = key; (end = trigram_end (p)); p = g_utf8_next_char (p)) {
+			gchar *trigram;
+			GArray *list;
+
+			trigram = g_strndup (p, end - p);
+			list = g_hash_table_lookup (index->trigrams, trigram);
+			if (!list) {
+				list = g_array_new (FALSE, FALSE, sizeof (guint));
+				g_hash_table_insert (index->trigrams, trigram, list);
+			} else {
+				g_free (trigram);
+			}
 
-	return do_compare (summary, f, argc, argv, contains_helper);
+			/* a key can have the same trigram more than once */
+			if (!list->len || g_array_index (list, guint, list->len - 1) != i)
+				g_array_append_val (list, i);
+		}
+	}
 }
 
-static gchar *
-is_helper (const gchar *ps1, const gchar *ps2)
+/* Returns the entry indexes of the rarest trigram of @key, or NULL
+   if @key is shorter than a trigram.  Sets @none when some trigram of
+   @key is in no entry, so nothing can match. */
+static GArray *
+find_trigram_candidates (SummaryIndex *index, const gchar *key, gboolean *none)
+{
+	GArray *smallest = NULL;
+	const gchar *p, *end;
+
+	*none = FALSE;
+
+	if (!trigram_end (key))
+		return NULL;
+
+	ensure_trigrams (index);
+
+	for (p = key; (end = trigram_end (p)); p = g_utf8_next_char (p)) {
+		gchar *trigram;
+		GArray *list;
+
+		trigram = g_strndup (p, end - p);
+		list = g_hash_table_lookup (index->trigrams, trigram);
+		g_free (trigram);
+
+		if (!list) {
+			*none = TRUE;
+			return NULL;
+		}
+
+		if (!smallest || list->len < smallest->len)
+			smallest = list;
+	}
+
+	return smallest;
+}
+
+/* the first entry whose key is not less than @key */
+static guint
+find_first_entry (SummaryIndex *index, const gchar *key)
 {
-	gchar *s1 = e_util_utf8_remove_accents (ps1);
-	gchar *s2 = e_util_utf8_remove_accents (ps2);
-	gchar *res;
+	guint lo = 0, hi = index->entries->len;
 
-	if (!e_util_utf8_strcasecmp (s1, s2))
-		res = (gchar *)ps1;
-	else
-		res = NULL;
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
 
-	g_free (s1);
-	g_free (s2);
+		if (strcmp (g_array_index (index->entries, SummaryIndexEntry, mid).key, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	return res;
+	return lo;
 }
 
-static ESExpResult *
-func_is (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer data)
+static gboolean
+entry_matches (const gchar *entry_key, const gchar *key, gsize key_len, SummaryMatch match)
 {
-	EBookBackendSummary *summary = data;
+	gsize entry_len;
+
+	switch (match) {
+	case SUMMARY_MATCH_CONTAINS:
+		/* both are valid UTF-8, so a byte match is a character match */
+		return strstr (entry_key, key) != NULL;
+	case SUMMARY_MATCH_IS:
+		return !strcmp (entry_key, key);
+	case SUMMARY_MATCH_BEGINS_WITH:
+		return !strncmp (entry_key, key, key_len);
+	case SUMMARY_MATCH_ENDS_WITH:
+		entry_len = strlen (entry_key);
+		return entry_len >= key_len && !strcmp (entry_key + entry_len - key_len, key);
+	}
 
-	return do_compare (summary, f, argc, argv, is_helper);
+	return FALSE;
 }
 
-static gchar *
-endswith_helper (const gchar *ps1, const gchar *ps2)
+static void
+add_match (GPtrArray *result, GHashTable *matched, SummaryIndexEntry *entry)
 {
-	gchar *s1 = e_util_utf8_remove_accents (ps1);
-	gchar *s2 = e_util_utf8_remove_accents (ps2);
-	gchar *res;
-	glong s1len = g_utf8_strlen (s1, -1);
-	glong s2len = g_utf8_strlen (s2, -1);
+	if (g_hash_table_lookup (matched, entry->item))
+		return;
+
+	g_hash_table_insert (matched, entry->item, entry->item);
+	g_ptr_array_add (result, entry->item->id);
+}
 
-	if (s1len < s2len)
-		res = NULL;
-	else
-		res = (gchar *)e_util_utf8_strstrcase (g_utf8_offset_to_pointer (s1, s1len - s2len), s2);
+static ESExpResult *
+do_compare (EBookBackendSummary *summary, struct _ESExp *f, gint argc,
+	    struct _ESExpResult **argv, SummaryMatch match)
+{
+	GPtrArray *result = g_ptr_array_new ();
+	ESExpResult *r;
+	gint field = -1;
+	gchar *key = NULL;
 
-	g_free (s1);
-	g_free (s2);
+	if (argc == 2
+	    && argv[0]->type == ESEXP_RES_STRING
+	    && argv[1]->type == ESEXP_RES_STRING) {
+		if (!strcmp (argv[0]->value.string, "full_name"))
+			field = SUMMARY_INDEX_FULL_NAME;
+		else if (!strcmp (argv[0]->value.string, "email"))
+			field = SUMMARY_INDEX_EMAIL;
+		else if (!strcmp (argv[0]->value.string, "file_as"))
+			field = SUMMARY_INDEX_FILE_AS;
+		else if (!strcmp (argv[0]->value.string, "nickname"))
+			field = SUMMARY_INDEX_NICKNAME;
+
+		key = summary_key (argv[1]->value.string);
+	}
 
-	return res;
+	if (field != -1 && key) {
+		SummaryIndex *index = ensure_index (summary, field);
+		GHashTable *matched = g_hash_table_new (g_direct_hash, g_direct_equal);
+		gsize key_len = strlen (key);
+		GArray *candidates = NULL;
+		gboolean none = FALSE;
+		guint i;
+
+		if (match == SUMMARY_MATCH_CONTAINS)
+			candidates = find_trigram_candidates (index, key, &none);
+
+		if (none) {
+			/* no value has some part of the key */
+		} else if (candidates) {
+			for (i = 0; i < candidates->len; i++) {
+				SummaryIndexEntry *entry = &g_array_index (index->entries, SummaryIndexEntry,
+									   g_array_index (candidates, guint, i));
+
+				if (entry_matches (entry->key, key, key_len, match))
+					add_match (result, matched, entry);
+			}
+		} else if (match == SUMMARY_MATCH_IS || match == SUMMARY_MATCH_BEGINS_WITH) {
+			/* the matching keys are all next to each other */
+			for (i = find_first_entry (index, key); i < index->entries->len; i++) {
+				SummaryIndexEntry *entry = &g_array_index (index->entries, SummaryIndexEntry, i);
+
+				if (!entry_matches (entry->key, key, key_len, match))
+					break;
+
+				add_match (result, matched, entry);
+			}
+		} else {
+			for (i = 0; i < index->entries->len; i++) {
+				SummaryIndexEntry *entry = &g_array_index (index->entries, SummaryIndexEntry, i);
+
+				if (entry_matches (entry->key, key, key_len, match))
+					add_match (result, matched, entry);
+			}
+		}
+
+		g_hash_table_destroy (matched);
+	}
+
+	g_free (key);
+
+	r = e_sexp_result_new (f, ESEXP_RES_ARRAY_PTR);
+	r->value.ptrarray = result;
+
+	return r;
 }
 
 static ESExpResult *
-func_endswith (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer data)
+func_contains (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer data)
 {
 	EBookBackendSummary *summary = data;
 
-	return do_compare (summary, f, argc, argv, endswith_helper);
+	return do_compare (summary, f, argc, argv, SUMMARY_MATCH_CONTAINS);
 }
 
-static gchar *
-beginswith_helper (const gchar *ps1, const gchar *ps2)
+static ESExpResult *
+func_is (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer data)
 {
-	gchar *p, *res;
-	gchar *s1 = e_util_utf8_remove_accents (ps1);
-	gchar *s2 = e_util_utf8_remove_accents (ps2);
+	EBookBackendSummary *summary = data;
 
-	if ((p = (gchar *) e_util_utf8_strstrcase (s1, s2))
-	    && (p == s1))
-		res = (gchar *)ps1;
-	else
-		res = NULL;
+	return do_compare (summary, f, argc, argv, SUMMARY_MATCH_IS);
+}
 
-	g_free (s1);
-	g_free (s2);
+static ESExpResult *
+func_endswith (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpointer data)
+{
+	EBookBackendSummary *summary = data;
 
-	return res;
+	return do_compare (summary, f, argc, argv, SUMMARY_MATCH_ENDS_WITH);
 }
 
 static ESExpResult *
@@ -1152,7 +1705,7 @@ func_beginswith (struct _ESExp *f, gint argc, struct _ESExpResult **argv, gpoint
 {
 	EBookBackendSummary *summary = data;
 
-	return do_compare (summary, f, argc, argv, beginswith_helper);
+	return do_compare (summary, f, argc, argv, SUMMARY_MATCH_BEGINS_WITH);
 }
 
 /* 'builtin' functions */
@@ -1208,6 +1761,9 @@ e_book_backend_summary_search (EBookBackendSummary *summary, const gchar *query)
 	}
 
 	retval = g_ptr_array_new ();
+
+	/* the indexes are built and read by the evaluation */
+	g_static_rec_mutex_lock (&summary->priv->lock);
 	r = e_sexp_eval (sexp);
 
 	if (r && r->type == ESEXP_RES_ARRAY_PTR && r->value.ptrarray) {
@@ -1218,6 +1774,8 @@ e_book_backend_summary_search (EBookBackendSummary *summary, const gchar *query)
 			g_ptr_array_add (retval, g_ptr_array_index (ptrarray, i));
 	}
 
+	g_static_rec_mutex_unlock (&summary->priv->lock);
+
 	e_sexp_result_free (sexp, r);
 
 	e_sexp_unref (sexp);
@@ -1242,6 +1800,8 @@ e_book_backend_summary_get_summary_vcard (EBookBackendSummary *summary, const gc
 
 	g_return_val_if_fail (summary != NULL, NULL);
 
+	g_static_rec_mutex_lock (&summary->priv->lock);
+
 	item = g_hash_table_lookup (summary->priv->id_to_item, id);
 
 	if (item) {
@@ -1263,6 +1823,8 @@ e_book_backend_summary_get_summary_vcard (EBookBackendSummary *summary, const gc
 		e_contact_set (contact, E_CONTACT_LIST_SHOW_ADDRESSES, GINT_TO_POINTER (item->list_show_addresses));
 		e_contact_set (contact, E_CONTACT_WANTS_HTML, GINT_TO_POINTER (item->wants_html));
 
+		g_static_rec_mutex_unlock (&summary->priv->lock);
+
 		vcard = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
 
 		g_object_unref (contact);
@@ -1270,6 +1832,7 @@ e_book_backend_summary_get_summary_vcard (EBookBackendSummary *summary, const gc
 		return vcard;
 	}
 	else {
+		g_static_rec_mutex_unlock (&summary->priv->lock);
 		g_warning ("in unable to locate card `%s' in summary", id);
 		return NULL;
 	}
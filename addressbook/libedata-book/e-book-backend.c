@@ -13,6 +13,7 @@
 #include "e-data-book-view.h"
 #include "e-data-book.h"
 #include "e-book-backend.h"
+#include "e-book-backend-sexp.h"
 
 #define E_BOOK_BACKEND_GET_PRIVATE(obj) \
 	(G_TYPE_INSTANCE_GET_PRIVATE \
@@ -29,6 +30,7 @@ struct _EBookBackendPrivate {
 
 	GMutex *views_mutex;
 	EList *views;
+	GHashTable *view_sexps;	/* query -> EBookBackendSExp */
 
 	gchar *cache_dir;
 };
@@ -140,6 +142,7 @@ book_backend_finalize (GObject *object)
 	g_mutex_free (priv->open_mutex);
 	g_mutex_free (priv->clients_mutex);
 	g_mutex_free (priv->views_mutex);
+	g_hash_table_destroy (priv->view_sexps);
 
 	g_free (priv->cache_dir);
 
@@ -191,6 +194,8 @@ e_book_backend_init (EBookBackend *backend)
 	backend->priv->open_mutex = g_mutex_new ();
 	backend->priv->clients_mutex = g_mutex_new ();
 	backend->priv->views_mutex = g_mutex_new ();
+	backend->priv->view_sexps = g_hash_table_new_full (
+		g_str_hash, g_str_equal, g_free, g_object_unref);
 }
 
 /**
@@ -705,6 +710,39 @@ e_book_backend_add_book_view (EBookBackend *backend,
 	g_mutex_unlock (backend->priv->views_mutex);
 }
 
+static gboolean
+view_sexp_unused_cb (gpointer key, gpointer value, gpointer user_data)
+{
+	GHashTable *queries = user_data;
+
+	return !g_hash_table_lookup (queries, key);
+}
+
+/* Drops the compiled queries no remaining view uses; the views keep
+   their own references.  Called with the views lock held. */
+static void
+prune_view_sexps (EBookBackend *backend)
+{
+	GHashTable *queries;
+	EIterator *iter;
+
+	queries = g_hash_table_new (g_str_hash, g_str_equal);
+
+	iter = e_list_get_iterator (backend->priv->views);
+	while (e_iterator_is_valid (iter)) {
+		EDataBookView *view = (EDataBookView *) e_iterator_get (iter);
+		const gchar *query = e_data_book_view_get_card_query (view);
+
+		g_hash_table_insert (queries, (gpointer) query, (gpointer) query);
+		e_iterator_next (iter);
+	}
+	g_object_unref (iter);
+
+	g_hash_table_foreach_remove (backend->priv->view_sexps, view_sexp_unused_cb, queries);
+
+	g_hash_table_destroy (queries);
+}
+
 /**
  * e_book_backend_remove_book_view:
  * @backend: an #EBookBackend
@@ -722,9 +760,51 @@ e_book_backend_remove_book_view (EBookBackend *backend,
 
 	e_list_remove (backend->priv->views, view);
 
+	prune_view_sexps (backend);
+
 	g_mutex_unlock (backend->priv->views_mutex);
 }
 
+/**
+ * e_book_backend_get_book_view_sexp:
+ * @backend: an #EBookBackend
+ * @query: the query of a book view
+ *
+ * Gets the compiled @query for a new book view on @backend.  Book views
+ * with the same query share the compiled expression, so it is parsed
+ * only once however many clients open the view.
+ *
+ * Returns: A new reference to the #EBookBackendSExp of @query, or %NULL
+ * if @query is invalid.  Unref it with g_object_unref().
+ *
+ * Since: 3.0
+ **/
+EBookBackendSExp *
+e_book_backend_get_book_view_sexp (EBookBackend *backend,
+				   const gchar *query)
+{
+	EBookBackendSExp *sexp;
+
+	g_return_val_if_fail (E_IS_BOOK_BACKEND (backend), NULL);
+	g_return_val_if_fail (query != NULL, NULL);
+
+	g_mutex_lock (backend->priv->views_mutex);
+
+	sexp = g_hash_table_lookup (backend->priv->view_sexps, query);
+	if (!sexp) {
+		sexp = e_book_backend_sexp_new (query);
+		if (sexp)
+			g_hash_table_insert (backend->priv->view_sexps, g_strdup (query), sexp);
+	}
+
+	if (sexp)
+		g_object_ref (sexp);
+
+	g_mutex_unlock (backend->priv->views_mutex);
+
+	return sexp;
+}
+
 /**
  * e_book_backend_add_client:
  * @backend: An addressbook backend.
@@ -170,6 +170,9 @@ void        e_book_backend_remove_book_view           (EBookBackend           *b
 						       EDataBookView          *view);
 
 EList      *e_book_backend_get_book_views             (EBookBackend           *backend);
+EBookBackendSExp *
+            e_book_backend_get_book_view_sexp         (EBookBackend           *backend,
+						       const gchar            *query);
 
 void        e_book_backend_notify_update              (EBookBackend           *backend,
 						       EContact               *contact);
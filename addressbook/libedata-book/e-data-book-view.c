@@ -345,8 +345,7 @@ e_data_book_view_notify_update_vcard (EDataBookView *book_view, gchar *vcard)
 {
 	EDataBookViewPrivate *priv = book_view->priv;
 	gboolean currently_in_view, want_in_view;
-	const gchar *id;
-	EContact *contact;
+	gchar *id;
 
 	if (!priv->running) {
 		g_free (vcard);
@@ -355,11 +354,11 @@ e_data_book_view_notify_update_vcard (EDataBookView *book_view, gchar *vcard)
 
 	g_mutex_lock (priv->pending_mutex);
 
-	contact = e_contact_new_from_vcard (vcard);
-	id = e_contact_get_const (contact, E_CONTACT_UID);
+	/* the card is only parsed if the query needs its attributes */
+	id = e_vcard_scan_attribute_value (vcard, EVC_UID);
 	currently_in_view = id_is_in_view (book_view, id);
 	want_in_view =
-		e_book_backend_sexp_match_contact (priv->card_sexp, contact);
+		e_book_backend_sexp_match_vcard (priv->card_sexp, vcard);
 
 	if (want_in_view) {
 		if (currently_in_view)
@@ -371,8 +370,7 @@ e_data_book_view_notify_update_vcard (EDataBookView *book_view, gchar *vcard)
 			notify_remove (book_view, id);
 	}
 
-	/* Do this last so that id is still valid when notify_ is called */
-	g_object_unref (contact);
+	g_free (id);
 	g_free (vcard);
 
 	g_mutex_unlock (priv->pending_mutex);
@@ -423,6 +421,47 @@ e_data_book_view_notify_update_prefiltered_vcard (EDataBookView *book_view, cons
 	g_mutex_unlock (priv->pending_mutex);
 }
 
+/**
+ * e_data_book_view_notify_update_prefiltered_vcards:
+ * @book_view: an #EDataBookView
+ * @ids: the UIDs of the contacts
+ * @vcards: the plain vCards of the contacts
+ * @n_vcards: the number of contacts in @ids and @vcards
+ *
+ * Like e_data_book_view_notify_update_prefiltered_vcard(), for a batch
+ * of contacts at once.  The view is locked once for the whole batch,
+ * which makes this cheaper for backends populating a view with many
+ * contacts.  The strings in @vcards are freed, the arrays themselves
+ * are not.
+ *
+ * Since: 3.0
+ **/
+void
+e_data_book_view_notify_update_prefiltered_vcards (EDataBookView *book_view, gchar **ids, gchar **vcards, guint n_vcards)
+{
+	EDataBookViewPrivate *priv = book_view->priv;
+	guint i;
+
+	if (!priv->running) {
+		for (i = 0; i < n_vcards; i++)
+			g_free (vcards[i]);
+		return;
+	}
+
+	g_mutex_lock (priv->pending_mutex);
+
+	for (i = 0; i < n_vcards; i++) {
+		if (id_is_in_view (book_view, ids[i]))
+			notify_change (book_view, vcards[i]);
+		else
+			notify_add (book_view, ids[i], vcards[i]);
+
+		g_free (vcards[i]);
+	}
+
+	g_mutex_unlock (priv->pending_mutex);
+}
+
 /**
  * e_data_book_view_notify_remove:
  * @book_view: an #EDataBookView
@@ -628,17 +667,20 @@ e_data_book_view_dispose (GObject *object)
 		priv->book = NULL;
 	}
 
+	/* only the reference of this view; the backend keeps the shared
+	   sexp until e_book_backend_remove_book_view() finds no view left
+	   with the same query text */
+	if (priv->card_sexp) {
+		g_object_unref (priv->card_sexp);
+		priv->card_sexp = NULL;
+	}
+
 	if (priv->backend) {
 		e_book_backend_remove_book_view (priv->backend, book_view);
 		g_object_unref (priv->backend);
 		priv->backend = NULL;
 	}
 
-	if (priv->card_sexp) {
-		g_object_unref (priv->card_sexp);
-		priv->card_sexp = NULL;
-	}
-
 	if (priv->idle_id) {
 		g_source_remove (priv->idle_id);
 		priv->idle_id = 0;
@@ -75,6 +75,10 @@ void         e_data_book_view_notify_update_vcard    (EDataBookView
 void         e_data_book_view_notify_update_prefiltered_vcard (EDataBookView       *book_view,
                                                                const gchar          *id,
                                                                gchar                *vcard);
+void         e_data_book_view_notify_update_prefiltered_vcards (EDataBookView      *book_view,
+                                                                gchar              **ids,
+                                                                gchar              **vcards,
+                                                                guint                n_vcards);
 
 void         e_data_book_view_notify_remove          (EDataBookView                *book_view,
 						      const gchar                   *id);
@@ -659,7 +659,7 @@ impl_Book_getBookView (EGdbusBook *object, GDBusMethodInvocation *invocation, co
 	gchar *path;
 	GError *error = NULL;
 
-	card_sexp = e_book_backend_sexp_new (search);
+	card_sexp = e_book_backend_get_book_view_sexp (backend, search);
 	if (!card_sexp) {
 		error = e_data_book_create_error (E_DATA_BOOK_STATUS_INVALID_QUERY, NULL);
 		/* Translators: The '%s' is replaced with a detailed error message */
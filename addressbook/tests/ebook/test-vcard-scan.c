@@ -0,0 +1,234 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Compares the values found by e_vcard_scan_attribute_value() and the
+ * attributes found by e_vcard_scan_attributes() with those of the parsed
+ * cards, and checks that unmodified 3.0 cards are written out as they
+ * were read, while other cards are converted. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <libebook/e-book.h>
+
+static const gchar *cards[] = {
+	"BEGIN:VCARD\r\n"
+	"VERSION:3.0\r\n"
+	"UID:pas-id-1\r\n"
+	"FN:Jane Doe\r\n"
+	"EMAIL;TYPE=WORK:jane@example.com\r\n"
+	"EMAIL;TYPE=HOME:jd@example.org\r\n"
+	"X-EVOLUTION-FILE-AS:Doe\\, Jane\r\n"
+	"END:VCARD",
+
+	/* folded lines, groups and escapes */
+	"BEGIN:VCARD\r\n"
+	"VERSION:3.0\r\n"
+	"NOTE:a long note with an\r\n"
+	" embedded UID:not-this-one\\nand a new line\r\n"
+	"item1.EMAIL;TYPE=HOME:john@\r\n"
+	" example.org\r\n"
+	"uid:pas-id-2\r\n"
+	"FN:John\\; Smith\r\n"
+	"END:VCARD",
+
+	/* quoted-printable soft line breaks */
+	"BEGIN:VCARD\n"
+	"VERSION:2.1\n"
+	"NOTE;ENCODING=QUOTED-PRINTABLE:first line=0D=0A=\n"
+	"UID:still the note\n"
+	"FN;QUOTED-PRINTABLE:J=C3=BCrgen\n"
+	"UID:pas-id-3\n"
+	"END:VCARD",
+
+	/* no UID at all */
+	"BEGIN:VCARD\r\n"
+	"VERSION:3.0\r\n"
+	"FN:Nobody\r\n"
+	"END:VCARD"
+};
+
+/* whether each of the cards is already a 3.0 card with CRLF line ends */
+static const gboolean normalized[] = {
+	TRUE, TRUE, FALSE, TRUE
+};
+
+static const gchar *names[] = {
+	EVC_UID, EVC_FN, EVC_EMAIL, EVC_NOTE, EVC_X_FILE_AS, EVC_TEL
+};
+
+static gboolean
+compare (const gchar *card, const gchar *name)
+{
+	EVCard *evc;
+	EVCardAttribute *attr;
+	gchar *scanned, *parsed;
+	gboolean same;
+
+	scanned = e_vcard_scan_attribute_value (card, name);
+
+	evc = e_vcard_new_from_string (card);
+	attr = e_vcard_get_attribute (evc, name);
+	parsed = attr ? e_vcard_attribute_get_value (attr) : NULL;
+	g_object_unref (evc);
+
+	same = g_strcmp0 (scanned, parsed) == 0;
+	if (!same)
+		g_printerr ("%s: scanned '%s', parsed '%s' in\n%s\n",
+			    name, scanned ? scanned : "(null)",
+			    parsed ? parsed : "(null)", card);
+
+	g_free (scanned);
+	g_free (parsed);
+
+	return same;
+}
+
+static gboolean
+compare_all (const gchar *card, const gchar *name)
+{
+	EVCard *evc;
+	GList *scanned, *s, *p;
+	gint n_parsed = 0;
+	gboolean same = TRUE;
+
+	scanned = e_vcard_scan_attributes (card, name);
+	evc = e_vcard_new_from_string (card);
+
+	s = scanned;
+	for (p = e_vcard_get_attributes (evc); p; p = p->next) {
+		GList *sv, *pv;
+
+		if (g_ascii_strcasecmp (e_vcard_attribute_get_name (p->data), name))
+			continue;
+
+		n_parsed++;
+		if (!s) {
+			same = FALSE;
+			break;
+		}
+
+		sv = e_vcard_attribute_get_values (s->data);
+		pv = e_vcard_attribute_get_values (p->data);
+		for (; sv && pv && same; sv = sv->next, pv = pv->next)
+			same = g_strcmp0 (sv->data, pv->data) == 0;
+		same = same && !sv && !pv;
+
+		s = s->next;
+	}
+
+	same = same && !s;
+	if (!same)
+		g_printerr ("%s: scanned attributes differ from the %d parsed in\n%s\n",
+			    name, n_parsed, card);
+
+	g_object_unref (evc);
+	g_list_foreach (scanned, (GFunc) e_vcard_attribute_free, NULL);
+	g_list_free (scanned);
+
+	return same;
+}
+
+static gboolean
+same_value (EVCard *a, EVCard *b, const gchar *name)
+{
+	EVCardAttribute *attr;
+	gchar *va, *vb;
+	gboolean same;
+
+	attr = e_vcard_get_attribute (a, name);
+	va = attr ? e_vcard_attribute_get_value (attr) : NULL;
+	attr = e_vcard_get_attribute (b, name);
+	vb = attr ? e_vcard_attribute_get_value (attr) : NULL;
+
+	same = g_strcmp0 (va, vb) == 0;
+
+	g_free (va);
+	g_free (vb);
+
+	return same;
+}
+
+/* a card which isn't 3.0 with CRLF line ends has to be converted */
+static gboolean
+check_converted (const gchar *card, const gchar *str)
+{
+	EVCard *original, *converted;
+	const gchar *p;
+	gboolean ok;
+
+	ok = g_str_has_prefix (str, "BEGIN:VCARD\r\nVERSION:3.0\r\n")
+		&& strstr (str, "VERSION:2.1") == NULL
+		&& strstr (str, "QUOTED-PRINTABLE") == NULL;
+
+	for (p = strchr (str, '\n'); p && ok; p = strchr (p + 1, '\n'))
+		ok = p > str && p[-1] == '\r';
+
+	original = e_vcard_new_from_string (card);
+	converted = e_vcard_new_from_string (str);
+	ok = ok
+		&& same_value (original, converted, EVC_FN)
+		&& same_value (original, converted, EVC_NOTE)
+		&& same_value (original, converted, EVC_UID);
+	g_object_unref (original);
+	g_object_unref (converted);
+
+	return ok;
+}
+
+static gboolean
+check_to_string (const gchar *card, gboolean is_normalized)
+{
+	EVCard *evc;
+	gchar *str;
+	gboolean ok;
+
+	evc = e_vcard_new_from_string (card);
+	str = e_vcard_to_string (evc, EVC_FORMAT_VCARD_30);
+	if (is_normalized)
+		ok = !strcmp (str, card);
+	else
+		ok = check_converted (card, str);
+	g_free (str);
+
+	/* after a change the card has to be written out again */
+	e_vcard_add_attribute_with_value (evc, e_vcard_attribute_new (NULL, EVC_TEL), "555-1234");
+	str = e_vcard_to_string (evc, EVC_FORMAT_VCARD_30);
+	ok = ok && strstr (str, "TEL:555-1234") != NULL && strstr (str, "VERSION:3.0") != NULL;
+	g_free (str);
+
+	g_object_unref (evc);
+
+	if (!ok)
+		g_printerr ("unexpected string for\n%s\n", card);
+
+	return ok;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	gint failures = 0;
+	guint i, j;
+
+	g_type_init ();
+
+	for (i = 0; i < G_N_ELEMENTS (cards); i++) {
+		for (j = 0; j < G_N_ELEMENTS (names); j++) {
+			if (!compare (cards[i], names[j]))
+				failures++;
+			if (!compare_all (cards[i], names[j]))
+				failures++;
+		}
+
+		if (!check_to_string (cards[i], normalized[i]))
+			failures++;
+	}
+
+	if (failures) {
+		g_printerr ("%d failures\n", failures);
+		return 1;
+	}
+
+	g_print ("Everything OK\n");
+
+	return 0;
+}
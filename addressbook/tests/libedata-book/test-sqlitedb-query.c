@@ -0,0 +1,181 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Checks that the queries EBookBackendSqliteDB answers with SQL find the
+ * same contacts as the EBookBackendSExp matching, in particular for keys
+ * holding quotes and the GLOB and LIKE wildcard characters. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <libebook/e-contact.h>
+#include <libedata-book/e-book-backend-sexp.h>
+#include <libedata-book/e-book-backend-sqlitedb.h>
+
+static const struct {
+	const gchar *uid;
+	const gchar *full_name;
+	const gchar *email;
+	const gchar *nickname;
+} contacts[] = {
+	{ "c1", "Jane O'Brien",  "jane_doe@example.com", NULL },
+	{ "c2", "100% Pure",     "sales@pure.example",   "pure" },
+	{ "c3", "Star*Man",      "star@example.com",     "s?ar" },
+	{ "c4", "Caret^Top",     "caret@example.com",    NULL },
+	{ "c5", "Janet Dox",     "janeXdoe@example.com", "[jd]" }
+};
+
+static const struct {
+	const gchar *query;
+	const gchar *expected;	/* the UIDs found, in order */
+} queries[] = {
+	{ "(contains \"full_name\" \"o'brien\")",           "c1" },
+	{ "(is \"full_name\" \"jane o'brien\")",            "c1" },
+	{ "(contains \"email\" \"jane_doe\")",              "c1" },
+	{ "(beginswith \"full_name\" \"100%\")",            "c2" },
+	{ "(endswith \"full_name\" \"% pure\")",            "c2" },
+	{ "(contains \"full_name\" \"0%\")",                "c2" },
+	{ "(beginswith \"full_name\" \"star*\")",           "c3" },
+	{ "(beginswith \"full_name\" \"s*\")",              "" },
+	{ "(beginswith \"nickname\" \"s?\")",               "c3" },
+	{ "(beginswith \"nickname\" \"[j\")",               "c5" },
+	{ "(contains \"full_name\" \"^t\")",                "c4" },
+	{ "(endswith \"full_name\" \"t^top\")",             "c4" },
+	{ "(is \"email\" \"sales@pure.example\")",          "c2" },
+	{ "(not (contains \"full_name\" \"jane\"))",        "c2 c3 c4" },
+	{ "(or (is \"nickname\" \"pure\") (beginswith \"email\" \"caret\"))", "c2 c4" },
+	{ "(and (exists \"nickname\") (contains \"email\" \"example.com\"))", "c3 c5" }
+};
+
+static gint
+compare_uids (gconstpointer a, gconstpointer b)
+{
+	return strcmp (a, b);
+}
+
+static gchar *
+join_uids (GList *uids)
+{
+	GString *str = g_string_new ("");
+	GList *l;
+
+	uids = g_list_sort (uids, compare_uids);
+	for (l = uids; l; l = l->next) {
+		if (str->len)
+			g_string_append_c (str, ' ');
+		g_string_append (str, l->data);
+	}
+
+	return g_string_free (str, FALSE);
+}
+
+/* the UIDs of the contacts the sexp itself matches */
+static gchar *
+match_uids (GList *all, const gchar *query)
+{
+	EBookBackendSExp *sexp;
+	GList *l, *uids = NULL;
+	gchar *str;
+
+	sexp = e_book_backend_sexp_new (query);
+	for (l = all; l; l = l->next) {
+		if (e_book_backend_sexp_match_contact (sexp, l->data))
+			uids = g_list_prepend (uids, e_contact_get (l->data, E_CONTACT_UID));
+	}
+	g_object_unref (sexp);
+
+	str = join_uids (uids);
+	g_list_foreach (uids, (GFunc) g_free, NULL);
+	g_list_free (uids);
+
+	return str;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	EBookBackendSqliteDB *ebsdb;
+	GList *all = NULL;
+	gchar *filename;
+	GError *error = NULL;
+	gint failures = 0;
+	guint i;
+
+	g_type_init ();
+	g_thread_init (NULL);
+
+	filename = g_build_filename (g_get_tmp_dir (), "test-sqlitedb-query.db", NULL);
+	g_unlink (filename);
+
+	ebsdb = e_book_backend_sqlitedb_new (filename, FALSE, &error);
+	if (!ebsdb) {
+		g_printerr ("Cannot create %s: %s\n", filename, error->message);
+		return 1;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (contacts); i++) {
+		EContact *contact = e_contact_new ();
+
+		e_contact_set (contact, E_CONTACT_UID, contacts[i].uid);
+		e_contact_set (contact, E_CONTACT_FULL_NAME, contacts[i].full_name);
+		e_contact_set (contact, E_CONTACT_EMAIL_1, contacts[i].email);
+		if (contacts[i].nickname)
+			e_contact_set (contact, E_CONTACT_NICKNAME, contacts[i].nickname);
+
+		all = g_list_append (all, contact);
+	}
+
+	if (!e_book_backend_sqlitedb_add_contacts (ebsdb, all, &error)) {
+		g_printerr ("Cannot add the contacts: %s\n", error->message);
+		return 1;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (queries); i++) {
+		const gchar *query = queries[i].query;
+		gboolean exact = FALSE;
+		GList *uids;
+		gchar *found, *matched;
+
+		if (!e_book_backend_sqlitedb_is_sql_query (query)) {
+			g_printerr ("%s: not answered by SQL\n", query);
+			failures++;
+		}
+
+		uids = e_book_backend_sqlitedb_search_uids (ebsdb, query, &exact, &error);
+		if (error) {
+			g_printerr ("%s: %s\n", query, error->message);
+			g_clear_error (&error);
+			failures++;
+			continue;
+		}
+
+		found = join_uids (uids);
+		matched = match_uids (all, query);
+
+		if (!exact || strcmp (found, queries[i].expected) || strcmp (found, matched)) {
+			g_printerr ("%s: found '%s'%s, expected '%s', the sexp matches '%s'\n",
+				    query, found, exact ? "" : " (inexact)",
+				    queries[i].expected, matched);
+			failures++;
+		}
+
+		g_free (found);
+		g_free (matched);
+		g_list_foreach (uids, (GFunc) g_free, NULL);
+		g_list_free (uids);
+	}
+
+	g_list_foreach (all, (GFunc) g_object_unref, NULL);
+	g_list_free (all);
+	g_object_unref (ebsdb);
+	g_unlink (filename);
+	g_free (filename);
+
+	if (failures) {
+		g_printerr ("%d failures\n", failures);
+		return 1;
+	}
+
+	g_print ("Everything OK\n");
+
+	return 0;
+}
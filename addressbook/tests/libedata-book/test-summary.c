@@ -0,0 +1,200 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Checks that EBookBackendSummary reads back what it saved, replays the
+ * changes it appended to the file, and refuses a file whose last change
+ * was cut short, writing it again as a whole afterwards. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <libebook/e-contact.h>
+#include <libedata-book/e-book-backend-summary.h>
+
+static const struct {
+	const gchar *uid;
+	const gchar *full_name;
+	const gchar *email;
+	const gchar *nickname;
+} contacts[] = {
+	{ "c1", "Jane Doe",      "jane@example.com",  NULL },
+	{ "c2", "John Smith",    "john@example.com",  "johnny" },
+	{ "c3", "Janet Jackson", "janet@example.org", NULL },
+	{ "c4", "Bob Builder",   "bob@example.com",   "bob" }
+};
+
+static gsize
+file_size (const gchar *filename)
+{
+	struct stat st;
+
+	if (g_stat (filename, &st) != 0)
+		return 0;
+
+	return st.st_size;
+}
+
+static void
+add_contact (EBookBackendSummary *summary, gint n)
+{
+	EContact *contact = e_contact_new ();
+
+	e_contact_set (contact, E_CONTACT_UID, contacts[n].uid);
+	e_contact_set (contact, E_CONTACT_FULL_NAME, contacts[n].full_name);
+	e_contact_set (contact, E_CONTACT_EMAIL_1, contacts[n].email);
+	if (contacts[n].nickname)
+		e_contact_set (contact, E_CONTACT_NICKNAME, contacts[n].nickname);
+
+	e_book_backend_summary_add_contact (summary, contact);
+	g_object_unref (contact);
+}
+
+static gint
+compare_ids (gconstpointer a, gconstpointer b)
+{
+	return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* the ids found by @query, sorted and joined with spaces */
+static gchar *
+search (EBookBackendSummary *summary, const gchar *query)
+{
+	GPtrArray *ids;
+	GString *str = g_string_new ("");
+	guint i;
+
+	ids = e_book_backend_summary_search (summary, query);
+	if (!ids)
+		return g_string_free (str, FALSE);
+
+	g_ptr_array_sort (ids, compare_ids);
+	for (i = 0; i < ids->len; i++) {
+		if (str->len)
+			g_string_append_c (str, ' ');
+		g_string_append (str, ids->pdata[i]);
+	}
+	g_ptr_array_free (ids, TRUE);
+
+	return g_string_free (str, FALSE);
+}
+
+static void
+assert_search (EBookBackendSummary *summary, const gchar *query, const gchar *expected)
+{
+	gchar *found = search (summary, query);
+
+	g_assert_cmpstr (found, ==, expected);
+	g_free (found);
+}
+
+static void
+test_save_load (const gchar *filename)
+{
+	EBookBackendSummary *summary;
+	gint i;
+
+	summary = e_book_backend_summary_new (filename, 0);
+	g_assert (!e_book_backend_summary_load (summary));
+	for (i = 0; i < 3; i++)
+		add_contact (summary, i);
+	g_assert (e_book_backend_summary_save (summary));
+	g_object_unref (summary);
+
+	summary = e_book_backend_summary_new (filename, 0);
+	g_assert (e_book_backend_summary_load (summary));
+	g_assert (e_book_backend_summary_check_contact (summary, "c1"));
+	g_assert (e_book_backend_summary_check_contact (summary, "c3"));
+	g_assert (!e_book_backend_summary_check_contact (summary, "c4"));
+
+	g_assert (e_book_backend_summary_is_summary_query (summary, "(contains \"full_name\" \"jan\")"));
+	g_assert (e_book_backend_summary_is_summary_query (summary, "(is \"email\" \"jane@example.com\")"));
+	g_assert (!e_book_backend_summary_is_summary_query (summary, "(contains \"phone\" \"555\")"));
+
+	assert_search (summary, "(contains \"full_name\" \"jan\")", "c1 c3");
+	assert_search (summary, "(is \"email\" \"john@example.com\")", "c2");
+	assert_search (summary, "(beginswith \"nickname\" \"john\")", "c2");
+	assert_search (summary, "(endswith \"email\" \".org\")", "c3");
+	g_object_unref (summary);
+}
+
+static void
+test_log (const gchar *filename)
+{
+	EBookBackendSummary *summary;
+	gsize size;
+
+	size = file_size (filename);
+
+	summary = e_book_backend_summary_new (filename, 0);
+	g_assert (e_book_backend_summary_load (summary));
+	add_contact (summary, 3);
+	e_book_backend_summary_remove_contact (summary, "c1");
+	g_assert (e_book_backend_summary_save (summary));
+	g_object_unref (summary);
+
+	/* the changes were appended, the items were not written again */
+	g_assert (file_size (filename) > size);
+
+	summary = e_book_backend_summary_new (filename, 0);
+	g_assert (e_book_backend_summary_load (summary));
+	g_assert (!e_book_backend_summary_check_contact (summary, "c1"));
+	g_assert (e_book_backend_summary_check_contact (summary, "c4"));
+	assert_search (summary, "(contains \"full_name\" \"jan\")", "c3");
+	assert_search (summary, "(is \"nickname\" \"bob\")", "c4");
+	assert_search (summary, "(contains \"email\" \"example.com\")", "c2 c4");
+	g_object_unref (summary);
+}
+
+static void
+test_truncated (const gchar *filename)
+{
+	EBookBackendSummary *summary;
+	gchar *contents = NULL;
+	gsize length = 0;
+	gint i;
+
+	/* loaded fine once, so appending was allowed */
+	summary = e_book_backend_summary_new (filename, 0);
+	g_assert (e_book_backend_summary_load (summary));
+
+	/* the last change was cut short by a crash */
+	g_assert (g_file_get_contents (filename, &contents, &length, NULL));
+	g_assert (length > 1);
+	g_assert (g_file_set_contents (filename, contents, length - 1, NULL));
+	g_free (contents);
+
+	g_assert (!e_book_backend_summary_load (summary));
+	g_assert (!e_book_backend_summary_check_contact (summary, "c2"));
+
+	/* rebuilt by the backend, which has to rewrite the file */
+	for (i = 0; i < G_N_ELEMENTS (contacts); i++)
+		add_contact (summary, i);
+	g_assert (e_book_backend_summary_save (summary));
+	g_object_unref (summary);
+
+	summary = e_book_backend_summary_new (filename, 0);
+	g_assert (e_book_backend_summary_load (summary));
+	for (i = 0; i < G_N_ELEMENTS (contacts); i++)
+		g_assert (e_book_backend_summary_check_contact (summary, contacts[i].uid));
+	assert_search (summary, "(contains \"full_name\" \"jan\")", "c1 c3");
+	g_object_unref (summary);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	gchar *filename;
+
+	g_type_init ();
+
+	filename = g_build_filename (g_get_tmp_dir (), "test-summary.summary", NULL);
+
+	g_unlink (filename);
+	test_save_load (filename);
+	test_log (filename);
+	test_truncated (filename);
+
+	g_unlink (filename);
+	g_free (filename);
+
+	return 0;
+}
@@ -274,9 +274,7 @@ resolve_tzid (const gchar *tzid, gpointer user_data)
 {
 	icaltimezone *zone;
 
-	zone = (!strcmp (tzid, "UTC"))
-		? icaltimezone_get_utc_timezone ()
-		: icaltimezone_get_builtin_timezone_from_tzid (tzid);
+	zone = time_get_builtin_timezone_from_tzid (tzid);
 
 	if (!zone)
 		zone = e_cal_backend_internal_get_timezone (E_CAL_BACKEND (user_data), tzid);
@@ -25,6 +25,7 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -36,6 +37,7 @@
 #include "libedataserver/e-data-server-util.h"
 #include "libedataserver/e-xml-hash-utils.h"
 #include "libedataserver/e-debug-log.h"
+#include "libebackend/e-change-log.h"
 #include <libecal/e-cal-recur.h>
 #include <libecal/e-cal-time-util.h>
 #include <libecal/e-cal-util.h>
@@ -59,6 +61,11 @@ typedef struct {
 	ECalComponent *full_object;
 	GHashTable *recurrences;
 	GList *recurrences_list;
+
+	/* Text of the components not parsed yet, see ensure_object(), and
+	 * the earliest time they can occur at */
+	gchar *raw;
+	time_t raw_start;
 } ECalBackendFileObject;
 
 /* Private part of the ECalBackendFile structure */
@@ -91,6 +98,18 @@ struct _ECalBackendFilePrivate {
 
 	EIntervalTree *interval_tree;
 
+	/* Secondary indexes for the keys of e_cal_backend_sexp_get_index_keys().
+	 * The first maps each key to a GHashTable set of the ECalComponents
+	 * having it, the second each indexed ECalComponent to a GSList of
+	 * its keys; it holds a reference on the component.
+	 */
+	GHashTable *index;
+	GHashTable *index_comp_keys;
+
+	/* Set of the ECalBackendFileObjects whose components are still
+	 * kept as text, the calendar file being loaded lazily */
+	GHashTable *lazy_objects;
+
 	GList *comp;
 
 	/* The calendar's default timezone, used for resolving DATE and
@@ -116,6 +135,22 @@ struct _ECalBackendFilePrivate {
 
 	/* timeour id for refresh type "2" */
 	guint refresh_timeout_id;
+
+	/* Change log appended to instead of rewriting the whole file, see
+	 * save_file_when_idle(); log_uids is NULL unless the source has the
+	 * "incremental-save" property set to "1".
+	 */
+	GHashTable *log_uids;		/* UIDs changed since the last save */
+	GHashTable *log_tzids;		/* TZIDs of the timezones already saved */
+	gboolean log_rewrite;		/* there is a change the log cannot hold */
+	gboolean log_compacting;
+	guint log_generation;		/* increased whenever the file is rewritten */
+	goffset log_size;
+	goffset file_size;		/* size of the file at the last full save */
+
+	/* The objects changed since the calendar was opened, so that
+	 * get_changes() compares only those; NULL until it's open */
+	EChangeLog *change_log;
 };
 
 
@@ -132,6 +167,10 @@ e_cal_backend_file_add_timezone (ECalBackendSync *backend, EDataCal *cal, const
 
 static void free_refresh_data (ECalBackendFile *cbfile);
 
+static gboolean add_timezone (icalcomponent *icalcomp, icaltimezone *tzone);
+
+static ECalBackendFileObject *lookup_object (ECalBackendFile *cbfile, const gchar *uid);
+
 static icaltimezone *
 e_cal_backend_file_internal_get_timezone (ECalBackend *backend, const gchar *tzid);
 
@@ -148,10 +187,443 @@ free_object_data (gpointer data)
 		g_object_unref (obj_data->full_object);
 	g_hash_table_destroy (obj_data->recurrences);
 	g_list_free (obj_data->recurrences_list);
+	g_free (obj_data->raw);
 
 	g_free (obj_data);
 }
 
+/* Returns the whole calendar as a string, including the components
+ * which were not parsed yet */
+static gchar *
+get_calendar_string (ECalBackendFilePrivate *priv)
+{
+	GHashTableIter iter;
+	gpointer key;
+	GString *str;
+	gchar *cal, *end;
+
+	cal = icalcomponent_as_ical_string_r (priv->icalcomp);
+	if (!priv->lazy_objects || !g_hash_table_size (priv->lazy_objects))
+		return cal;
+
+	end = g_strrstr (cal, "END:VCALENDAR");
+	g_return_val_if_fail (end != NULL, cal);
+
+	str = g_string_new_len (cal, end - cal);
+
+	g_hash_table_iter_init (&iter, priv->lazy_objects);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		ECalBackendFileObject *obj_data = key;
+
+		g_string_append (str, obj_data->raw);
+	}
+
+	g_string_append (str, end);
+	g_free (cal);
+
+	return g_string_free (str, FALSE);
+}
+
+/* Change log.
+ *
+ * When the source has "incremental-save" set to "1", saving appends a
+ * record with the current state of each changed UID (or timezone) to
+ * the file "<path>.log" instead of rewriting the whole calendar.  Each
+ * record is a line "U <uid length> <data length>" or "Z <tzid length>
+ * <data length>" followed by the UID or TZID, the data and a newline.
+ * The data of a "U" record is a VCALENDAR with all the components of
+ * the UID, an empty one when it was removed; that of a "Z" record a
+ * VTIMEZONE.  Because the records hold full states they can be replayed
+ * any number of times, which lets the log be folded into the file in a
+ * separate thread, see log_compact().
+ */
+
+#define LOG_COMPACT_MIN_SIZE (1024 * 1024)
+
+typedef struct {
+	ECalBackendFile *cbfile;
+	gchar *contents;
+	gchar *compact_path;
+	guint generation;
+	goffset log_offset;
+	gsize size;
+	gboolean success;
+} LogCompactData;
+
+static gchar *
+get_log_path (ECalBackendFilePrivate *priv)
+{
+	return g_strconcat (priv->path, ".log", NULL);
+}
+
+static goffset
+get_file_size (const gchar *path)
+{
+	struct stat st;
+
+	if (g_stat (path, &st) != 0)
+		return 0;
+
+	return st.st_size;
+}
+
+static void
+log_mark_uid (ECalBackendFile *cbfile, const gchar *uid)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+
+	if (priv->change_log && uid)
+		e_change_log_touch (priv->change_log, uid);
+
+	if (!priv->log_uids || !uid)
+		return;
+
+	g_hash_table_insert (priv->log_uids, g_strdup (uid), GINT_TO_POINTER (1));
+}
+
+/* Makes the next save write the timezone with tzid again */
+static void
+log_mark_tzid (ECalBackendFile *cbfile, const gchar *tzid)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+
+	if (priv->log_tzids && tzid)
+		g_hash_table_remove (priv->log_tzids, tzid);
+}
+
+/* Remembers the timezones of the calendar as saved */
+static void
+log_collect_tzids (ECalBackendFilePrivate *priv)
+{
+	icalcomponent *subcomp;
+
+	if (!priv->log_tzids)
+		return;
+
+	g_hash_table_remove_all (priv->log_tzids);
+
+	for (subcomp = icalcomponent_get_first_component (priv->icalcomp, ICAL_VTIMEZONE_COMPONENT);
+	     subcomp;
+	     subcomp = icalcomponent_get_next_component (priv->icalcomp, ICAL_VTIMEZONE_COMPONENT)) {
+		icalproperty *prop;
+
+		prop = icalcomponent_get_first_property (subcomp, ICAL_TZID_PROPERTY);
+		if (prop)
+			g_hash_table_insert (priv->log_tzids, g_strdup (icalproperty_get_tzid (prop)), GINT_TO_POINTER (1));
+	}
+}
+
+/* The change log is valid as long as the calendar file and its log
+ * are as they were when it was closed */
+static gchar *
+change_log_get_stamp (ECalBackendFilePrivate *priv)
+{
+	struct stat st_file, st_log;
+	gchar *log_path;
+
+	log_path = get_log_path (priv);
+	if (g_stat (priv->path, &st_file) != 0)
+		st_file.st_mtime = 0;
+	if (g_stat (log_path, &st_log) != 0)
+		st_log.st_mtime = 0;
+	g_free (log_path);
+
+	return g_strdup_printf ("%ld %ld", (glong) st_file.st_mtime, (glong) st_log.st_mtime);
+}
+
+static void
+change_log_open (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	gchar *filename, *stamp;
+
+	if (priv->change_log || !priv->path)
+		return;
+
+	filename = g_strconcat (priv->path, ".changes.log", NULL);
+	stamp = change_log_get_stamp (priv);
+	priv->change_log = e_change_log_new (filename, stamp);
+	g_free (stamp);
+	g_free (filename);
+}
+
+static void
+change_log_close (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	gchar *stamp;
+
+	if (!priv->change_log)
+		return;
+
+	stamp = change_log_get_stamp (priv);
+	e_change_log_set_stamp (priv->change_log, stamp);
+	g_free (stamp);
+
+	e_change_log_destroy (priv->change_log);
+	priv->change_log = NULL;
+}
+
+/* Starts logging changes instead of rewriting the whole file on save */
+static void
+log_enable (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+
+	if (priv->log_uids)
+		return;
+
+	priv->log_uids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	priv->log_tzids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	log_collect_tzids (priv);
+}
+
+static void
+log_disable (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+
+	if (priv->log_uids) {
+		g_hash_table_destroy (priv->log_uids);
+		priv->log_uids = NULL;
+	}
+
+	if (priv->log_tzids) {
+		g_hash_table_destroy (priv->log_tzids);
+		priv->log_tzids = NULL;
+	}
+}
+
+/* Called after the whole calendar has been written to the file */
+static void
+log_reset (ECalBackendFile *cbfile, gsize file_size)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	gchar *log_path;
+
+	log_path = get_log_path (priv);
+	g_unlink (log_path);
+	g_free (log_path);
+
+	priv->log_rewrite = FALSE;
+	priv->log_size = 0;
+	priv->file_size = file_size;
+	priv->log_generation++;
+
+	if (priv->log_uids)
+		g_hash_table_remove_all (priv->log_uids);
+	log_collect_tzids (priv);
+}
+
+static void
+log_append_record (GString *buf, gchar kind, const gchar *key, const gchar *data)
+{
+	g_string_append_printf (buf, "%c %" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT "\n", kind, strlen (key), strlen (data));
+	g_string_append (buf, key);
+	g_string_append (buf, data);
+	g_string_append_c (buf, '\n');
+}
+
+static void
+append_component_string (GString *buf, ECalComponent *comp)
+{
+	gchar *str;
+
+	str = icalcomponent_as_ical_string_r (e_cal_component_get_icalcomponent (comp));
+	g_string_append (buf, str);
+	g_free (str);
+}
+
+/* Appends the changes since the last save to the log */
+static gboolean
+log_append_changes (ECalBackendFile *cbfile, GError **error)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	GHashTableIter iter;
+	gpointer key;
+	icalcomponent *subcomp;
+	GString *buf, *data;
+	GFile *file;
+	GFileOutputStream *stream;
+	gchar *log_path;
+	gboolean success;
+
+	buf = g_string_new (NULL);
+	data = g_string_new (NULL);
+
+	/* timezones go first, the components being replayed may use them */
+	for (subcomp = icalcomponent_get_first_component (priv->icalcomp, ICAL_VTIMEZONE_COMPONENT);
+	     subcomp;
+	     subcomp = icalcomponent_get_next_component (priv->icalcomp, ICAL_VTIMEZONE_COMPONENT)) {
+		icalproperty *prop;
+		const gchar *tzid;
+		gchar *str;
+
+		prop = icalcomponent_get_first_property (subcomp, ICAL_TZID_PROPERTY);
+		if (!prop)
+			continue;
+
+		tzid = icalproperty_get_tzid (prop);
+		if (!tzid || g_hash_table_lookup (priv->log_tzids, tzid))
+			continue;
+
+		str = icalcomponent_as_ical_string_r (subcomp);
+		log_append_record (buf, 'Z', tzid, str);
+		g_free (str);
+
+		g_hash_table_insert (priv->log_tzids, g_strdup (tzid), GINT_TO_POINTER (1));
+	}
+
+	g_hash_table_iter_init (&iter, priv->log_uids);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		ECalBackendFileObject *obj_data;
+
+		g_string_assign (data, "BEGIN:VCALENDAR\r\n");
+
+		obj_data = g_hash_table_lookup (priv->comp_uid_hash, key);
+		if (obj_data) {
+			GList *l;
+
+			if (obj_data->raw)
+				g_string_append (data, obj_data->raw);
+
+			if (obj_data->full_object)
+				append_component_string (data, obj_data->full_object);
+
+			for (l = obj_data->recurrences_list; l; l = l->next)
+				append_component_string (data, l->data);
+		}
+
+		g_string_append (data, "END:VCALENDAR\r\n");
+
+		log_append_record (buf, 'U', key, data->str);
+	}
+
+	g_string_free (data, TRUE);
+	g_hash_table_remove_all (priv->log_uids);
+
+	if (!buf->len) {
+		g_string_free (buf, TRUE);
+		return TRUE;
+	}
+
+	log_path = get_log_path (priv);
+	file = g_file_new_for_path (log_path);
+	g_free (log_path);
+
+	stream = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, error);
+	g_object_unref (file);
+
+	success = stream != NULL &&
+		g_output_stream_write_all (G_OUTPUT_STREAM (stream), buf->str, buf->len, NULL, NULL, error) &&
+		g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error);
+
+	if (stream)
+		g_object_unref (stream);
+
+	if (success)
+		priv->log_size += buf->len;
+
+	g_string_free (buf, TRUE);
+
+	return success;
+}
+
+/* Replaces the file with the one written by log_compact_thread() and drops
+ * the part of the log it contains, unless the file was rewritten meanwhile */
+static gboolean
+log_compact_done (gpointer user_data)
+{
+	LogCompactData *data = user_data;
+	ECalBackendFilePrivate *priv = data->cbfile->priv;
+
+	g_static_rec_mutex_lock (&priv->idle_save_rmutex);
+
+	priv->log_compacting = FALSE;
+
+	if (data->success && data->generation == priv->log_generation && priv->path && !priv->read_only) {
+		gchar *log_path, *log_contents = NULL;
+		gsize log_length = 0;
+
+		log_path = get_log_path (priv);
+
+		if (g_file_get_contents (log_path, &log_contents, &log_length, NULL) &&
+		    (goffset) log_length >= data->log_offset) {
+			priv->refresh_skip++;
+			if (g_rename (data->compact_path, priv->path) == 0) {
+				/* the records appended while writing the file stay;
+				 * should this fail they are just replayed again */
+				if (log_length == data->log_offset)
+					g_unlink (log_path);
+				else
+					g_file_set_contents (log_path, log_contents + data->log_offset, log_length - data->log_offset, NULL);
+
+				priv->log_size = log_length - data->log_offset;
+				priv->file_size = data->size;
+				priv->log_generation++;
+			} else
+				priv->refresh_skip--;
+		}
+
+		g_free (log_contents);
+		g_free (log_path);
+	}
+
+	g_unlink (data->compact_path);
+
+	g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
+
+	g_object_unref (data->cbfile);
+	g_free (data->compact_path);
+	g_free (data);
+
+	return FALSE;
+}
+
+static gpointer
+log_compact_thread (gpointer user_data)
+{
+	LogCompactData *data = user_data;
+
+	data->success = g_file_set_contents (data->compact_path, data->contents, data->size, NULL);
+
+	g_free (data->contents);
+	data->contents = NULL;
+
+	g_idle_add (log_compact_done, data);
+
+	return NULL;
+}
+
+/* Writes the whole calendar in a separate thread when the log gets too big */
+static void
+log_compact (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	LogCompactData *data;
+
+	if (priv->log_compacting || priv->log_size < MAX (LOG_COMPACT_MIN_SIZE, priv->file_size / 4))
+		return;
+
+	data = g_new0 (LogCompactData, 1);
+	data->cbfile = g_object_ref (cbfile);
+	data->contents = get_calendar_string (priv);
+	data->size = strlen (data->contents);
+	data->compact_path = g_strconcat (priv->path, ".compact", NULL);
+	data->generation = priv->log_generation;
+	data->log_offset = priv->log_size;
+
+	if (!g_thread_create (log_compact_thread, data, FALSE, NULL)) {
+		g_object_unref (data->cbfile);
+		g_free (data->contents);
+		g_free (data->compact_path);
+		g_free (data);
+		return;
+	}
+
+	priv->log_compacting = TRUE;
+}
+
 /* Saves the calendar data */
 static gboolean
 save_file_when_idle (gpointer user_data)
@@ -162,6 +634,7 @@ save_file_when_idle (gpointer user_data)
 	GFileOutputStream *stream;
 	gchar *tmp, *backup_uristr;
 	gchar *buf;
+	gsize size;
 	ECalBackendFile *cbfile = user_data;
 
 	priv = cbfile->priv;
@@ -176,6 +649,21 @@ save_file_when_idle (gpointer user_data)
 		return FALSE;
 	}
 
+	if (priv->log_uids && !priv->log_rewrite) {
+		if (log_append_changes (cbfile, &e)) {
+			priv->is_dirty = FALSE;
+			priv->dirty_idle_id = 0;
+
+			log_compact (cbfile);
+
+			g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
+			return FALSE;
+		}
+
+		/* write the whole file instead */
+		g_clear_error (&e);
+	}
+
 	file = g_file_new_for_path (priv->path);
 	if (!file)
 		goto error_malformed_uri;
@@ -210,8 +698,9 @@ save_file_when_idle (gpointer user_data)
 		goto error;
 	}
 
-	buf = icalcomponent_as_ical_string_r (priv->icalcomp);
-	g_output_stream_write_all (G_OUTPUT_STREAM (stream), buf, strlen (buf) * sizeof (gchar), NULL, NULL, &e);
+	buf = get_calendar_string (priv);
+	size = strlen (buf);
+	g_output_stream_write_all (G_OUTPUT_STREAM (stream), buf, size * sizeof (gchar), NULL, NULL, &e);
 	g_free (buf);
 
 	if (e) {
@@ -238,6 +727,9 @@ save_file_when_idle (gpointer user_data)
 	if (e)
 		goto error;
 
+	/* the file now holds everything the log did */
+	log_reset (cbfile, size);
+
 	priv->is_dirty = FALSE;
 	priv->dirty_idle_id = 0;
 
@@ -292,6 +784,34 @@ free_calendar_components (GHashTable *comp_uid_hash, icalcomponent *top_icomp)
 		icalcomponent_free (top_icomp);
 }
 
+static void
+free_index_keys (GSList *keys)
+{
+	g_slist_foreach (keys, (GFunc) g_free, NULL);
+	g_slist_free (keys);
+}
+
+static void
+create_index (ECalBackendFilePrivate *priv)
+{
+	priv->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+	priv->index_comp_keys = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, (GDestroyNotify) free_index_keys);
+}
+
+static void
+free_index (ECalBackendFilePrivate *priv)
+{
+	if (priv->index) {
+		g_hash_table_destroy (priv->index);
+		priv->index = NULL;
+	}
+
+	if (priv->index_comp_keys) {
+		g_hash_table_destroy (priv->index_comp_keys);
+		priv->index_comp_keys = NULL;
+	}
+}
+
 static void
 free_calendar_data (ECalBackendFile *cbfile)
 {
@@ -302,6 +822,13 @@ free_calendar_data (ECalBackendFile *cbfile)
 	e_intervaltree_destroy (priv->interval_tree);
 	priv->interval_tree = NULL;
 
+	free_index (priv);
+
+	if (priv->lazy_objects) {
+		g_hash_table_destroy (priv->lazy_objects);
+		priv->lazy_objects = NULL;
+	}
+
 	free_calendar_components (priv->comp_uid_hash, priv->icalcomp);
 	priv->comp_uid_hash = NULL;
 	priv->icalcomp = NULL;
@@ -325,6 +852,7 @@ e_cal_backend_file_dispose (GObject *object)
 	if (priv->is_dirty)
 		save_file_when_idle (cbfile);
 
+	change_log_close (cbfile);
 	free_calendar_data (cbfile);
 
 	source = e_cal_backend_get_source (E_CAL_BACKEND (cbfile));
@@ -356,6 +884,7 @@ e_cal_backend_file_finalize (GObject *object)
 	}
 
 	free_refresh_data (cbfile);
+	log_disable (cbfile);
 
 	if (priv->refresh_lock)
 		g_mutex_free (priv->refresh_lock);
@@ -393,12 +922,9 @@ e_cal_backend_file_finalize (GObject *object)
 static ECalComponent *
 lookup_component (ECalBackendFile *cbfile, const gchar *uid)
 {
-	ECalBackendFilePrivate *priv;
 	ECalBackendFileObject *obj_data;
 
-	priv = cbfile->priv;
-
-	obj_data = g_hash_table_lookup (priv->comp_uid_hash, uid);
+	obj_data = lookup_object (cbfile, uid);
 	return obj_data ? obj_data->full_object : NULL;
 }
 
@@ -458,10 +984,8 @@ resolve_tzid (const gchar *tzid, gpointer user_data)
 
 	if (!tzid || !tzid[0])
 		return NULL;
-        else if (!strcmp (tzid, "UTC"))
-		return icaltimezone_get_utc_timezone ();
 
-	zone = icaltimezone_get_builtin_timezone_from_tzid (tzid);
+	zone = time_get_builtin_timezone_from_tzid (tzid);
 
 	if (!zone)
 		zone = icalcomponent_get_timezone (vcalendar_comp, tzid);
@@ -501,6 +1025,8 @@ check_dup_uid (ECalBackendFile *cbfile, ECalComponent *comp)
 	 * CREATED/DTSTAMP/LAST-MODIFIED.
 	 */
 
+	/* the component may be in the file already */
+	priv->log_rewrite = TRUE;
 	save (cbfile);
 }
 
@@ -565,6 +1091,175 @@ remove_component_from_intervaltree (ECalBackendFile *cbfile, ECalComponent *comp
 	return res;
 }
 
+static void
+remove_component_from_index (ECalBackendFile *cbfile, ECalComponent *comp)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	GSList *keys, *l;
+
+	keys = g_hash_table_lookup (priv->index_comp_keys, comp);
+	if (!keys)
+		return;
+
+	for (l = keys; l; l = l->next) {
+		GHashTable *set = g_hash_table_lookup (priv->index, l->data);
+
+		if (set) {
+			g_hash_table_remove (set, comp);
+			if (g_hash_table_size (set) == 0)
+				g_hash_table_remove (priv->index, l->data);
+		}
+	}
+
+	g_hash_table_remove (priv->index_comp_keys, comp);
+}
+
+/* Adds component to the secondary indexes used to pre-filter queries */
+static void
+add_component_to_index (ECalBackendFile *cbfile, ECalComponent *comp)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	GSList *keys, *l;
+
+	remove_component_from_index (cbfile, comp);
+
+	keys = e_cal_backend_sexp_get_component_index_keys (comp);
+	for (l = keys; l; l = l->next) {
+		GHashTable *set = g_hash_table_lookup (priv->index, l->data);
+
+		if (!set) {
+			set = g_hash_table_new (g_direct_hash, g_direct_equal);
+			g_hash_table_insert (priv->index, g_strdup (l->data), set);
+		}
+
+		g_hash_table_insert (set, comp, comp);
+	}
+
+	g_hash_table_insert (priv->index_comp_keys, g_object_ref (comp), keys);
+}
+
+/* Parses the components of obj_data which were kept as text when the
+ * calendar was loaded, see parse_ics_file_lazily() */
+static void
+ensure_object (ECalBackendFile *cbfile, ECalBackendFileObject *obj_data)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	icalcomponent *vcalendar, *subcomp;
+	GSList *subcomps = NULL, *l;
+	gchar *text;
+
+	if (!obj_data->raw)
+		return;
+
+	g_hash_table_remove (priv->lazy_objects, obj_data);
+
+	text = g_strconcat ("BEGIN:VCALENDAR\r\n", obj_data->raw, "END:VCALENDAR\r\n", NULL);
+	g_free (obj_data->raw);
+	obj_data->raw = NULL;
+
+	vcalendar = icalparser_parse_string (text);
+	g_free (text);
+
+	if (!vcalendar)
+		return;
+
+	for (subcomp = icalcomponent_get_first_component (vcalendar, ICAL_ANY_COMPONENT);
+	     subcomp;
+	     subcomp = icalcomponent_get_next_component (vcalendar, ICAL_ANY_COMPONENT))
+		subcomps = g_slist_prepend (subcomps, subcomp);
+
+	subcomps = g_slist_reverse (subcomps);
+
+	for (l = subcomps; l; l = l->next) {
+		ECalComponent *comp;
+
+		subcomp = l->data;
+
+		/* like scan_vcalendar() does, keep even the components
+		 * which cannot be used in the file */
+		icalcomponent_remove_component (vcalendar, subcomp);
+		icalcomponent_add_component (priv->icalcomp, subcomp);
+
+		comp = e_cal_component_new ();
+		if (!e_cal_component_set_icalcomponent (comp, subcomp)) {
+			g_object_unref (comp);
+			continue;
+		}
+
+		if (e_cal_component_is_instance (comp)) {
+			gchar *rid;
+
+			rid = e_cal_component_get_recurid_as_string (comp);
+			if (g_hash_table_lookup (obj_data->recurrences, rid)) {
+				g_free (rid);
+				g_object_unref (comp);
+				continue;
+			}
+
+			g_hash_table_insert (obj_data->recurrences, rid, comp);
+			obj_data->recurrences_list = g_list_append (obj_data->recurrences_list, comp);
+		} else if (!obj_data->full_object) {
+			obj_data->full_object = comp;
+		} else {
+			g_object_unref (comp);
+			continue;
+		}
+
+		add_component_to_intervaltree (cbfile, comp);
+		add_component_to_index (cbfile, comp);
+		priv->comp = g_list_prepend (priv->comp, comp);
+	}
+
+	g_slist_free (subcomps);
+	icalcomponent_free (vcalendar);
+}
+
+/* Looks up the object with the given UID, parsing it if necessary */
+static ECalBackendFileObject *
+lookup_object (ECalBackendFile *cbfile, const gchar *uid)
+{
+	ECalBackendFileObject *obj_data;
+
+	obj_data = g_hash_table_lookup (cbfile->priv->comp_uid_hash, uid);
+	if (obj_data)
+		ensure_object (cbfile, obj_data);
+
+	return obj_data;
+}
+
+/* Parses the objects which may occur before end, or all of them when
+ * end is -1 */
+static void
+ensure_objects_in_range (ECalBackendFile *cbfile, time_t end)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	GHashTableIter iter;
+	gpointer key;
+	GSList *objects = NULL, *l;
+
+	if (!priv->lazy_objects || !g_hash_table_size (priv->lazy_objects))
+		return;
+
+	g_hash_table_iter_init (&iter, priv->lazy_objects);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		ECalBackendFileObject *obj_data = key;
+
+		if (end == -1 || obj_data->raw_start <= end)
+			objects = g_slist_prepend (objects, obj_data);
+	}
+
+	for (l = objects; l; l = l->next)
+		ensure_object (cbfile, l->data);
+
+	g_slist_free (objects);
+}
+
+static void
+ensure_all_objects (ECalBackendFile *cbfile)
+{
+	ensure_objects_in_range (cbfile, -1);
+}
+
 /* Tries to add an icalcomponent to the file backend.  We only store the objects
  * of the types we support; all others just remain in the toplevel component so
  * that we don't lose them.
@@ -585,7 +1280,7 @@ add_component (ECalBackendFile *cbfile, ECalComponent *comp, gboolean add_to_top
 		return;
 	}
 
-	obj_data = g_hash_table_lookup (priv->comp_uid_hash, uid);
+	obj_data = lookup_object (cbfile, uid);
 	if (e_cal_component_is_instance (comp)) {
 		gchar *rid;
 
@@ -624,89 +1319,394 @@ add_component (ECalBackendFile *cbfile, ECalComponent *comp, gboolean add_to_top
 			obj_data->full_object = comp;
 			obj_data->recurrences = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
 
-			g_hash_table_insert (priv->comp_uid_hash, g_strdup (uid), obj_data);
-			add_component_to_intervaltree (cbfile, comp);
+			g_hash_table_insert (priv->comp_uid_hash, g_strdup (uid), obj_data);
+			add_component_to_intervaltree (cbfile, comp);
+		}
+	}
+
+	add_component_to_index (cbfile, comp);
+	priv->comp = g_list_prepend (priv->comp, comp);
+
+	/* check_dup_uid() may have changed it */
+	e_cal_component_get_uid (comp, &uid);
+	log_mark_uid (cbfile, uid);
+
+	/* Put the object in the toplevel component if required */
+
+	if (add_to_toplevel) {
+		icalcomponent *icalcomp;
+
+		icalcomp = e_cal_component_get_icalcomponent (comp);
+		g_assert (icalcomp != NULL);
+
+		icalcomponent_add_component (priv->icalcomp, icalcomp);
+	}
+}
+
+/* g_hash_table_foreach_remove() callback to remove recurrences from the calendar */
+static gboolean
+remove_recurrence_cb (gpointer key, gpointer value, gpointer data)
+{
+	GList *l;
+	icalcomponent *icalcomp;
+	ECalBackendFilePrivate *priv;
+	ECalComponent *comp = value;
+	ECalBackendFile *cbfile = data;
+
+	priv = cbfile->priv;
+
+	/* remove the recurrence from the top-level calendar */
+	icalcomp = e_cal_component_get_icalcomponent (comp);
+	g_assert (icalcomp != NULL);
+
+	if (!remove_component_from_intervaltree (cbfile, comp)) {
+		g_message (G_STRLOC " Could not remove component from interval tree!");
+		}
+	remove_component_from_index (cbfile, comp);
+	icalcomponent_remove_component (priv->icalcomp, icalcomp);
+
+	/* remove it from our mapping */
+	l = g_list_find (priv->comp, comp);
+	priv->comp = g_list_delete_link (priv->comp, l);
+
+	return TRUE;
+}
+
+/* Removes a component from the backend's hash and lists.  Does not perform
+ * notification on the clients.  Also removes the component from the toplevel
+ * icalcomponent.
+ */
+static void
+remove_component (ECalBackendFile *cbfile, const gchar *uid, ECalBackendFileObject *obj_data)
+{
+	ECalBackendFilePrivate *priv;
+	icalcomponent *icalcomp;
+	GList *l;
+
+	priv = cbfile->priv;
+
+	/* Remove the icalcomp from the toplevel */
+	if (obj_data->full_object) {
+		icalcomp = e_cal_component_get_icalcomponent (obj_data->full_object);
+		g_assert (icalcomp != NULL);
+
+		icalcomponent_remove_component (priv->icalcomp, icalcomp);
+
+		/* Remove it from our mapping */
+		l = g_list_find (priv->comp, obj_data->full_object);
+		g_assert (l != NULL);
+		priv->comp = g_list_delete_link (priv->comp, l);
+
+		if (!remove_component_from_intervaltree (cbfile, obj_data->full_object)) {
+			g_message (G_STRLOC " Could not remove component from interval tree!");
+		}
+		remove_component_from_index (cbfile, obj_data->full_object);
+	}
+
+	/* remove the recurrences also */
+	g_hash_table_foreach_remove (obj_data->recurrences, (GHRFunc) remove_recurrence_cb, cbfile);
+
+	log_mark_uid (cbfile, uid);
+	g_hash_table_remove (priv->comp_uid_hash, uid);
+
+	save (cbfile);
+}
+
+/* A component found by parse_ics_file_lazily() */
+typedef struct {
+	gchar *uid;
+	gchar *text;
+	time_t start;
+	gboolean is_instance;
+	gboolean parse;	/* needs to be parsed now */
+} LazyComponent;
+
+static void
+free_lazy_component (LazyComponent *lc)
+{
+	g_free (lc->uid);
+	g_free (lc->text);
+	g_free (lc);
+}
+
+/* Returns the start of the content line following the one at line */
+static const gchar *
+next_content_line (const gchar *line, const gchar *end)
+{
+	const gchar *p = line;
+
+	while (p < end) {
+		p = memchr (p, '\n', end - p);
+		if (!p)
+			return end;
+
+		p++;
+
+		/* folded lines continue with a space or a tab */
+		if (p < end && *p != ' ' && *p != '\t')
+			break;
+	}
+
+	return MIN (p, end);
+}
+
+static gboolean
+line_has_name (const gchar *line, const gchar *next, const gchar *name)
+{
+	gsize len = strlen (name);
+
+	return (gsize) (next - line) > len && g_ascii_strncasecmp (line, name, len) == 0 &&
+		(line[len] == ':' || line[len] == ';');
+}
+
+/* Returns the unfolded value of the content line, without parameters */
+static gchar *
+get_line_value (const gchar *line, const gchar *next)
+{
+	GString *value;
+	const gchar *p;
+	gboolean in_quotes = FALSE;
+
+	for (p = line; p < next; p++) {
+		if (*p == '"')
+			in_quotes = !in_quotes;
+		else if (*p == ':' && !in_quotes)
+			break;
+	}
+
+	value = g_string_new (NULL);
+
+	for (p++; p < next; p++) {
+		if (*p == '\r')
+			continue;
+
+		if (*p == '\n') {
+			/* skip the space or tab of the folding too */
+			p++;
+			continue;
+		}
+
+		g_string_append_c (value, *p);
+	}
+
+	return g_string_free (value, FALSE);
+}
+
+static gboolean
+line_is_blank (const gchar *line, const gchar *next)
+{
+	for (; line < next; line++) {
+		if (!g_ascii_isspace (*line))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+line_begins_component (const gchar *line, const gchar *next, const gchar *begin_end, const gchar *kind)
+{
+	gchar *value;
+	gboolean res;
+
+	if (!line_has_name (line, next, begin_end))
+		return FALSE;
+
+	if (!kind)
+		return TRUE;
+
+	value = get_line_value (line, next);
+	res = g_ascii_strcasecmp (g_strstrip (value), kind) == 0;
+	g_free (value);
+
+	return res;
+}
+
+/* Earliest UTC time the DTSTART at line can be, whatever timezone it is in */
+static time_t
+get_lazy_start (const gchar *line, const gchar *next)
+{
+	struct icaltimetype tt;
+	gchar *value;
+	time_t start;
+
+	value = g_strstrip (get_line_value (line, next));
+	tt = icaltime_from_string (value);
+
+	if (icaltime_is_null_time (tt) || !icaltime_is_valid_time (tt)) {
+		g_free (value);
+		return (time_t) 0;
+	}
+
+	start = icaltime_as_timet_with_zone (tt, icaltimezone_get_utc_timezone ());
+
+	/* floating, DATE or with a TZID, no timezone is a day off UTC */
+	if (!*value || value[strlen (value) - 1] != 'Z')
+		start -= 24 * 60 * 60;
+
+	g_free (value);
+
+	return start;
+}
+
+/* Loads the iCalendar file without parsing the events, tasks and journals
+ * it contains: only their UID, RECURRENCE-ID and DTSTART are read, the
+ * text of the components is returned in lazy_comps, and the rest of the
+ * file is parsed.  Files this cannot split are parsed completely. */
+static icalcomponent *
+parse_ics_file_lazily (const gchar *filename, GSList **lazy_comps)
+{
+	gchar *contents = NULL;
+	gsize length = 0;
+	const gchar *line, *next, *end, *comp_start = NULL;
+	GString *rest;
+	GHashTable *masters;
+	LazyComponent *lc = NULL;
+	icalcomponent *icalcomp = NULL;
+	gint depth = 0, n_vcalendars = 0;
+	gboolean failed = FALSE;
+
+	*lazy_comps = NULL;
+
+	if (!g_file_get_contents (filename, &contents, &length, NULL))
+		return NULL;
+
+	rest = g_string_sized_new (4096);
+	masters = g_hash_table_new (g_str_hash, g_str_equal);
+	end = contents + length;
+
+	for (line = contents; line < end && !failed; line = next) {
+		next = next_content_line (line, end);
+
+		if (lc) {
+			/* inside a component kept as text */
+			if (line_begins_component (line, next, "BEGIN", NULL)) {
+				depth++;
+			} else if (line_begins_component (line, next, "END", NULL)) {
+				depth--;
+				if (depth == 1) {
+					lc->text = g_strndup (comp_start, next - comp_start);
+
+					/* duplicated UIDs are changed by scan_vcalendar() */
+					if (!lc->uid || (!lc->is_instance && g_hash_table_lookup (masters, lc->uid)))
+						lc->parse = TRUE;
+					else if (!lc->is_instance)
+						g_hash_table_insert (masters, lc->uid, lc->uid);
+
+					if (lc->parse)
+						g_string_append (rest, lc->text);
+
+					*lazy_comps = g_slist_prepend (*lazy_comps, lc);
+					lc = NULL;
+				}
+			} else if (depth == 2) {
+				if (line_has_name (line, next, "UID")) {
+					g_free (lc->uid);
+					lc->uid = get_line_value (line, next);
+
+					/* escaped UIDs are left to libical */
+					if (strchr (lc->uid, '\\'))
+						lc->parse = TRUE;
+				} else if (line_has_name (line, next, "RECURRENCE-ID")) {
+					lc->is_instance = TRUE;
+				} else if (line_has_name (line, next, "DTSTART")) {
+					lc->start = get_lazy_start (line, next);
+				}
+			}
+
+			continue;
 		}
-	}
 
-	priv->comp = g_list_prepend (priv->comp, comp);
+		if (line_begins_component (line, next, "BEGIN", NULL)) {
+			if (depth == 0 && (n_vcalendars++ > 0 || !line_begins_component (line, next, "BEGIN", "VCALENDAR"))) {
+				failed = TRUE;
+			} else if (depth == 1 && (line_begins_component (line, next, "BEGIN", "VEVENT") ||
+						  line_begins_component (line, next, "BEGIN", "VTODO") ||
+						  line_begins_component (line, next, "BEGIN", "VJOURNAL"))) {
+				lc = g_new0 (LazyComponent, 1);
+				comp_start = line;
+				depth++;
+				continue;
+			}
 
-	/* Put the object in the toplevel component if required */
+			depth++;
+		} else if (line_begins_component (line, next, "END", NULL)) {
+			depth--;
+			if (depth < 0)
+				failed = TRUE;
+		} else if (depth == 0 && !line_is_blank (line, next)) {
+			failed = TRUE;
+		}
 
-	if (add_to_toplevel) {
-		icalcomponent *icalcomp;
+		g_string_append_len (rest, line, next - line);
+	}
 
-		icalcomp = e_cal_component_get_icalcomponent (comp);
-		g_assert (icalcomp != NULL);
+	g_free (contents);
+	g_hash_table_destroy (masters);
 
-		icalcomponent_add_component (priv->icalcomp, icalcomp);
-	}
-}
+	if (!failed && !lc && depth == 0 && n_vcalendars == 1)
+		icalcomp = icalparser_parse_string (rest->str);
 
-/* g_hash_table_foreach_remove() callback to remove recurrences from the calendar */
-static gboolean
-remove_recurrence_cb (gpointer key, gpointer value, gpointer data)
-{
-	GList *l;
-	icalcomponent *icalcomp;
-	ECalBackendFilePrivate *priv;
-	ECalComponent *comp = value;
-	ECalBackendFile *cbfile = data;
+	g_string_free (rest, TRUE);
 
-	priv = cbfile->priv;
+	if (lc)
+		free_lazy_component (lc);
 
-	/* remove the recurrence from the top-level calendar */
-	icalcomp = e_cal_component_get_icalcomponent (comp);
-	g_assert (icalcomp != NULL);
+	if (!icalcomp || icalcomponent_isa (icalcomp) != ICAL_VCALENDAR_COMPONENT) {
+		if (icalcomp)
+			icalcomponent_free (icalcomp);
 
-	if (!remove_component_from_intervaltree (cbfile, comp)) {
-		g_message (G_STRLOC " Could not remove component from interval tree!");
-		}
-	icalcomponent_remove_component (priv->icalcomp, icalcomp);
+		g_slist_foreach (*lazy_comps, (GFunc) free_lazy_component, NULL);
+		g_slist_free (*lazy_comps);
+		*lazy_comps = NULL;
 
-	/* remove it from our mapping */
-	l = g_list_find (priv->comp, comp);
-	priv->comp = g_list_delete_link (priv->comp, l);
+		return e_cal_util_parse_ics_file (filename);
+	}
 
-	return TRUE;
+	*lazy_comps = g_slist_reverse (*lazy_comps);
+
+	return icalcomp;
 }
 
-/* Removes a component from the backend's hash and lists.  Does not perform
- * notification on the clients.  Also removes the component from the toplevel
- * icalcomponent.
- */
+/* Adds the components returned by parse_ics_file_lazily() as text,
+ * to be parsed by ensure_object() when first needed */
 static void
-remove_component (ECalBackendFile *cbfile, const gchar *uid, ECalBackendFileObject *obj_data)
+add_lazy_components (ECalBackendFile *cbfile, GSList *lazy_comps)
 {
-	ECalBackendFilePrivate *priv;
-	icalcomponent *icalcomp;
-	GList *l;
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	GSList *l;
 
-	priv = cbfile->priv;
+	if (!priv->lazy_objects)
+		priv->lazy_objects = g_hash_table_new (g_direct_hash, g_direct_equal);
 
-	/* Remove the icalcomp from the toplevel */
-	if (obj_data->full_object) {
-		icalcomp = e_cal_component_get_icalcomponent (obj_data->full_object);
-		g_assert (icalcomp != NULL);
+	for (l = lazy_comps; l; l = l->next) {
+		LazyComponent *lc = l->data;
+		ECalBackendFileObject *obj_data;
 
-		icalcomponent_remove_component (priv->icalcomp, icalcomp);
+		if (lc->parse)
+			continue;
 
-		/* Remove it from our mapping */
-		l = g_list_find (priv->comp, obj_data->full_object);
-		g_assert (l != NULL);
-		priv->comp = g_list_delete_link (priv->comp, l);
+		obj_data = g_hash_table_lookup (priv->comp_uid_hash, lc->uid);
+		if (!obj_data) {
+			obj_data = g_new0 (ECalBackendFileObject, 1);
+			obj_data->recurrences = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+			obj_data->raw_start = lc->start;
 
-		if (!remove_component_from_intervaltree (cbfile, obj_data->full_object)) {
-			g_message (G_STRLOC " Could not remove component from interval tree!");
+			g_hash_table_insert (priv->comp_uid_hash, g_strdup (lc->uid), obj_data);
+			g_hash_table_insert (priv->lazy_objects, obj_data, obj_data);
 		}
-	}
-
-	/* remove the recurrences also */
-	g_hash_table_foreach_remove (obj_data->recurrences, (GHRFunc) remove_recurrence_cb, cbfile);
 
-	g_hash_table_remove (priv->comp_uid_hash, uid);
+		if (obj_data->raw) {
+			gchar *raw = g_strconcat (obj_data->raw, lc->text, NULL);
 
-	save (cbfile);
+			g_free (obj_data->raw);
+			obj_data->raw = raw;
+			obj_data->raw_start = MIN (obj_data->raw_start, lc->start);
+		} else {
+			obj_data->raw = lc->text;
+			lc->text = NULL;
+		}
+	}
 }
 
 /* Scans the toplevel VCALENDAR component and stores the objects it finds */
@@ -715,17 +1715,19 @@ scan_vcalendar (ECalBackendFile *cbfile)
 {
 	ECalBackendFilePrivate *priv;
 	icalcompiter iter;
+	GSList *icalcomps = NULL, *l;
 
 	priv = cbfile->priv;
 	g_assert (priv->icalcomp != NULL);
 	g_assert (priv->comp_uid_hash != NULL);
 
+	/* add_component() may parse lazy objects, which ensure_object()
+	 * moves into the toplevel component; those are added already */
 	for (iter = icalcomponent_begin_component (priv->icalcomp, ICAL_ANY_COMPONENT);
 	     icalcompiter_deref (&iter) != NULL;
 	     icalcompiter_next (&iter)) {
 		icalcomponent *icalcomp;
 		icalcomponent_kind kind;
-		ECalComponent *comp;
 
 		icalcomp = icalcompiter_deref (&iter);
 
@@ -736,13 +1738,25 @@ scan_vcalendar (ECalBackendFile *cbfile)
 		      || kind == ICAL_VJOURNAL_COMPONENT))
 			continue;
 
+		icalcomps = g_slist_prepend (icalcomps, icalcomp);
+	}
+
+	icalcomps = g_slist_reverse (icalcomps);
+
+	for (l = icalcomps; l; l = l->next) {
+		ECalComponent *comp;
+
 		comp = e_cal_component_new ();
 
-		if (!e_cal_component_set_icalcomponent (comp, icalcomp))
+		if (!e_cal_component_set_icalcomponent (comp, l->data)) {
+			g_object_unref (comp);
 			continue;
+		}
 
 		add_component (cbfile, comp, FALSE);
 	}
+
+	g_slist_free (icalcomps);
 }
 
 static gchar *
@@ -953,18 +1967,143 @@ free_refresh_data (ECalBackendFile *cbfile)
 	g_mutex_unlock (priv->refresh_lock);
 }
 
+static void
+log_replay_uid (ECalBackendFile *cbfile, const gchar *uid, const gchar *data)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	ECalBackendFileObject *obj_data;
+	icalcomponent *vcalendar, *subcomp;
+	icalcomponent_kind kind;
+
+	obj_data = g_hash_table_lookup (priv->comp_uid_hash, uid);
+	if (obj_data && obj_data->raw) {
+		/* replaced before it was ever parsed */
+		g_hash_table_remove (priv->lazy_objects, obj_data);
+		g_hash_table_remove (priv->comp_uid_hash, uid);
+	} else if (obj_data) {
+		remove_component (cbfile, uid, obj_data);
+	}
+
+	vcalendar = icalparser_parse_string (data);
+	if (!vcalendar)
+		return;
+
+	kind = e_cal_backend_get_kind (E_CAL_BACKEND (cbfile));
+
+	for (subcomp = icalcomponent_get_first_component (vcalendar, kind);
+	     subcomp;
+	     subcomp = icalcomponent_get_next_component (vcalendar, kind)) {
+		ECalComponent *comp;
+		icalcomponent *clone;
+
+		comp = e_cal_component_new ();
+		clone = icalcomponent_new_clone (subcomp);
+
+		if (e_cal_component_set_icalcomponent (comp, clone)) {
+			add_component (cbfile, comp, TRUE);
+		} else {
+			icalcomponent_free (clone);
+			g_object_unref (comp);
+		}
+	}
+
+	icalcomponent_free (vcalendar);
+}
+
+static void
+log_replay_timezone (ECalBackendFile *cbfile, const gchar *data)
+{
+	icalcomponent *tz_comp;
+	icaltimezone *zone;
+
+	tz_comp = icalparser_parse_string (data);
+	if (!tz_comp)
+		return;
+
+	if (icalcomponent_isa (tz_comp) != ICAL_VTIMEZONE_COMPONENT) {
+		icalcomponent_free (tz_comp);
+		return;
+	}
+
+	zone = icaltimezone_new ();
+	if (icaltimezone_set_component (zone, tz_comp))
+		add_timezone (cbfile->priv->icalcomp, zone);
+	icaltimezone_free (zone, 1);
+}
+
+/* Applies the change log left by a previous session, see log_append_changes() */
+static void
+log_replay (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	gchar *log_path, *contents = NULL, *p, *end;
+	gsize length = 0;
+
+	priv->log_size = 0;
+	priv->file_size = get_file_size (priv->path);
+
+	log_path = get_log_path (priv);
+	if (!g_file_get_contents (log_path, &contents, &length, NULL)) {
+		g_free (log_path);
+		return;
+	}
+
+	g_free (log_path);
+
+	p = contents;
+	end = contents + length;
+
+	while (p < end) {
+		gchar kind, *nl, *key, *data;
+		gulong key_len, data_len;
+
+		nl = memchr (p, '\n', end - p);
+		if (!nl || sscanf (p, "%c %lu %lu", &kind, &key_len, &data_len) != 3)
+			break;
+
+		nl++;
+		if (key_len > (gsize) (end - nl) || data_len >= (gsize) (end - nl) - key_len || nl[key_len + data_len] != '\n')
+			break;
+
+		key = g_strndup (nl, key_len);
+		data = g_strndup (nl + key_len, data_len);
+
+		if (kind == 'U')
+			log_replay_uid (cbfile, key, data);
+		else if (kind == 'Z')
+			log_replay_timezone (cbfile, data);
+
+		g_free (key);
+		g_free (data);
+
+		p = nl + key_len + data_len + 1;
+	}
+
+	priv->log_size = p - contents;
+	g_free (contents);
+
+	/* the log is only appended to while it is intact, everything else
+	 * writes it into the file and removes it */
+	if (p < end)
+		priv->log_rewrite = TRUE;
+
+	if (length > 0)
+		save (cbfile);
+}
+
 /* Parses an open iCalendar file and loads it into the backend */
 static void
 open_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 {
 	ECalBackendFilePrivate *priv;
 	icalcomponent *icalcomp;
+	GSList *lazy_comps = NULL;
 
 	priv = cbfile->priv;
 
 	free_refresh_data (cbfile);
 
-	icalcomp = e_cal_util_parse_ics_file (uristr);
+	icalcomp = parse_ics_file_lazily (uristr, &lazy_comps);
 	if (!icalcomp) {
 		g_propagate_error (perror, e_data_cal_create_error_fmt (OtherError, "Cannot parse ISC file '%s'", uristr));
 		return;
@@ -988,7 +2127,13 @@ open_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 
 	priv->comp_uid_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_object_data);
 	priv->interval_tree = e_intervaltree_new ();
+	create_index (priv);
+	add_lazy_components (cbfile, lazy_comps);
 	scan_vcalendar (cbfile);
+	log_replay (cbfile);
+
+	g_slist_foreach (lazy_comps, (GFunc) free_lazy_component, NULL);
+	g_slist_free (lazy_comps);
 
 	prepare_refresh_data (cbfile);
 }
@@ -1100,6 +2245,7 @@ reload_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 	ECalBackendFilePrivate *priv;
 	icalcomponent *icalcomp, *icalcomp_old;
 	GHashTable *comp_uid_hash_old;
+	EChangeLog *change_log;
 
 	priv = cbfile->priv;
 
@@ -1120,6 +2266,9 @@ reload_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 		return;
 	}
 
+	/* all the old objects are compared with the new ones */
+	ensure_all_objects (cbfile);
+
 	/* Keep old data for comparison - free later */
 
 	icalcomp_old = priv->icalcomp;
@@ -1128,7 +2277,10 @@ reload_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 	comp_uid_hash_old = priv->comp_uid_hash;
 	priv->comp_uid_hash = NULL;
 
-	/* Load new calendar */
+	/* Load new calendar, the changes of the other writers are not logged */
+
+	change_log = priv->change_log;
+	priv->change_log = NULL;
 
 	free_calendar_data (cbfile);
 
@@ -1136,6 +2288,7 @@ reload_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 
 	priv->comp_uid_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_object_data);
 	priv->interval_tree = e_intervaltree_new ();
+	create_index (priv);
 	scan_vcalendar (cbfile);
 
 	priv->path = uri_to_path (E_CAL_BACKEND (cbfile));
@@ -1144,6 +2297,11 @@ reload_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 
 	notify_changes (cbfile, comp_uid_hash_old, priv->comp_uid_hash);
 
+	/* the clients compare all the objects again */
+	priv->change_log = change_log;
+	if (priv->change_log)
+		e_change_log_reset (priv->change_log);
+
 	/* Free old data */
 
 	free_calendar_components (comp_uid_hash_old, icalcomp_old);
@@ -1175,9 +2333,12 @@ create_cal (ECalBackendFile *cbfile, const gchar *uristr, GError **perror)
 	/* Create our internal data */
 	priv->comp_uid_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, free_object_data);
 	priv->interval_tree = e_intervaltree_new ();
+	create_index (priv);
 
 	priv->path = uri_to_path (E_CAL_BACKEND (cbfile));
 
+	/* write the file itself, not a log */
+	priv->log_rewrite = TRUE;
 	save (cbfile);
 
 	g_free (priv->custom_file);
@@ -1382,7 +2543,20 @@ e_cal_backend_file_open (ECalBackendSync *backend, EDataCal *cal, gboolean only_
 			}
 		}
 
+		if (!priv->read_only && !priv->refresh_cond) {
+			ESource *source = e_cal_backend_get_source (E_CAL_BACKEND (backend));
+			const gchar *value = source ? e_source_get_property (source, "incremental-save") : NULL;
+
+			/* a file reloaded on changes is not logged, the log would
+			 * override the changes of the other writers */
+			if (value && g_str_equal (value, "1"))
+				log_enable (cbfile);
+		}
+
+		change_log_open (cbfile);
+
 		if (priv->default_zone && add_timezone (priv->icalcomp, priv->default_zone)) {
+			log_mark_tzid (cbfile, icaltimezone_get_tzid (priv->default_zone));
 			save (cbfile);
 		}
 	}
@@ -1422,6 +2596,11 @@ e_cal_backend_file_remove (ECalBackendSync *backend, EDataCal *cal, GError **per
 		goto done;
 	}
 
+	if (priv->change_log) {
+		e_change_log_destroy (priv->change_log);
+		priv->change_log = NULL;
+	}
+
 	/* remove all files in the directory */
 	dirname = g_path_get_dirname (str_uri);
 	dir = g_dir_open (dirname, 0, &error);
@@ -1549,7 +2728,7 @@ e_cal_backend_file_get_object (ECalBackendSync *backend, EDataCal *cal, const gc
 
 	g_static_rec_mutex_lock (&priv->idle_save_rmutex);
 
-	obj_data = g_hash_table_lookup (priv->comp_uid_hash, uid);
+	obj_data = lookup_object (cbfile, uid);
 	if (!obj_data) {
 		g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 		g_propagate_error (error, EDC_ERROR (ObjectNotFound));
@@ -1691,8 +2870,37 @@ typedef struct {
 	ECalBackendSExp *obj_sexp;
 	ECalBackend *backend;
 	icaltimezone *default_zone;
+	EDataCalView *view;
 } MatchObjectData;
 
+/* Matches the component against the query.  Matching components are passed
+ * to the view right away when there is one, so the first results reach the
+ * client while the rest are still being matched; otherwise they are
+ * prepended to obj_list, which the caller has to reverse.  Nothing is
+ * matched any more once the view was stopped.
+ */
+static void
+add_matched_component (MatchObjectData *match_data, ECalComponent *comp)
+{
+	gchar *str;
+
+	if (match_data->view && e_data_cal_view_is_stopped (match_data->view))
+		return;
+
+	if (match_data->search_needed &&
+	    !e_cal_backend_sexp_match_comp (match_data->obj_sexp, comp, match_data->backend))
+		return;
+
+	str = e_cal_component_get_as_string (comp);
+
+	if (match_data->view) {
+		e_data_cal_view_notify_component_added (match_data->view, comp, str);
+		g_free (str);
+	} else {
+		match_data->obj_list = g_list_prepend (match_data->obj_list, str);
+	}
+}
+
 static void
 match_object_sexp_to_component (gpointer value, gpointer data)
 {
@@ -1713,11 +2921,7 @@ match_object_sexp_to_component (gpointer value, gpointer data)
 
 	g_return_if_fail (priv != NULL);
 
-	if ((!match_data->search_needed) ||
-	    (e_cal_backend_sexp_match_comp (match_data->obj_sexp, comp, match_data->backend))) {
-		match_data->obj_list = g_list_append (match_data->obj_list,
-						      e_cal_component_get_as_string (comp));
-	}
+	add_matched_component (match_data, comp);
 }
 
 static void
@@ -1726,11 +2930,7 @@ match_recurrence_sexp (gpointer key, gpointer value, gpointer data)
 	ECalComponent *comp = value;
 	MatchObjectData *match_data = data;
 
-	if ((!match_data->search_needed) ||
-	    (e_cal_backend_sexp_match_comp (match_data->obj_sexp, comp, match_data->backend))) {
-		match_data->obj_list = g_list_append (match_data->obj_list,
-						      e_cal_component_get_as_string (comp));
-	}
+	add_matched_component (match_data, comp);
 }
 
 static void
@@ -1739,13 +2939,8 @@ match_object_sexp (gpointer key, gpointer value, gpointer data)
 	ECalBackendFileObject *obj_data = value;
 	MatchObjectData *match_data = data;
 
-	if (obj_data->full_object) {
-		if ((!match_data->search_needed) ||
-		    (e_cal_backend_sexp_match_comp (match_data->obj_sexp, obj_data->full_object, match_data->backend))) {
-			match_data->obj_list = g_list_append (match_data->obj_list,
-							      e_cal_component_get_as_string (obj_data->full_object));
-		}
-	}
+	if (obj_data->full_object)
+		add_matched_component (match_data, obj_data->full_object);
 
 	/* match also recurrences */
 	g_hash_table_foreach (obj_data->recurrences,
@@ -1753,6 +2948,66 @@ match_object_sexp (gpointer key, gpointer value, gpointer data)
 			      match_data);
 }
 
+/* Collects the components which have to be matched against the query
+ * from the smallest index set of its index keys or from the interval tree,
+ * whichever is smaller.  They are not referenced, so the caller has to hold
+ * idle_save_rmutex while using them.  Returns FALSE if neither can be used
+ * and all components have to be matched.
+ */
+static gboolean
+get_query_candidates (ECalBackendFile *cbfile, ECalBackendSExp *sexp, GPtrArray *candidates)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+	GHashTable *smallest = NULL;
+	const GSList *k;
+	time_t occur_start = -1, occur_end = -1;
+	gboolean in_range;
+
+	in_range = e_cal_backend_sexp_evaluate_occur_times (sexp, &occur_start, &occur_end);
+
+	/* the objects not parsed yet are neither in the interval tree nor
+	 * in the indexes, and only those occuring in the range can match */
+	if (in_range)
+		ensure_objects_in_range (cbfile, occur_end);
+	else
+		ensure_all_objects (cbfile);
+
+	k = priv->index ? e_cal_backend_sexp_get_index_keys (sexp) : NULL;
+	for (; k; k = k->next) {
+		GHashTable *set = g_hash_table_lookup (priv->index, k->data);
+
+		/* no component has this key, so none can match */
+		if (!set)
+			return TRUE;
+
+		if (!smallest || g_hash_table_size (set) < g_hash_table_size (smallest))
+			smallest = set;
+	}
+
+	if (in_range) {
+		guint n_in_window;
+
+		n_in_window = e_intervaltree_search_array (priv->interval_tree, occur_start, occur_end, candidates);
+		if (!smallest || n_in_window <= g_hash_table_size (smallest))
+			return TRUE;
+
+		g_ptr_array_set_size (candidates, 0);
+	}
+
+	if (smallest) {
+		GHashTableIter iter;
+		gpointer comp;
+
+		g_hash_table_iter_init (&iter, smallest);
+		while (g_hash_table_iter_next (&iter, &comp, NULL))
+			g_ptr_array_add (candidates, comp);
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 /* Get_objects_in_range handler for the file backend */
 static void
 e_cal_backend_file_get_object_list (ECalBackendSync *backend, EDataCal *cal, const gchar *sexp, GList **objects, GError **perror)
@@ -1760,9 +3015,8 @@ e_cal_backend_file_get_object_list (ECalBackendSync *backend, EDataCal *cal, con
 	ECalBackendFile *cbfile;
 	ECalBackendFilePrivate *priv;
 	MatchObjectData match_data;
-	time_t occur_start = -1, occur_end = -1;
-	gboolean prunning_by_time;
-	GList* objs_occuring_in_tw;
+	gboolean prefiltered;
+	GPtrArray *candidates;
 	cbfile = E_CAL_BACKEND_FILE (backend);
 	priv = cbfile->priv;
 
@@ -1773,6 +3027,7 @@ e_cal_backend_file_get_object_list (ECalBackendSync *backend, EDataCal *cal, con
 	match_data.obj_list = NULL;
 	match_data.backend = E_CAL_BACKEND (backend);
 	match_data.default_zone = priv->default_zone;
+	match_data.view = NULL;
 
 	if (!strcmp (sexp, "#t"))
 		match_data.search_needed = FALSE;
@@ -1785,31 +3040,22 @@ e_cal_backend_file_get_object_list (ECalBackendSync *backend, EDataCal *cal, con
 
 	g_static_rec_mutex_lock (&priv->idle_save_rmutex);
 
-	prunning_by_time = e_cal_backend_sexp_evaluate_occur_times (match_data.obj_sexp,
-									    &occur_start,
-									    &occur_end);
+	candidates = g_ptr_array_new ();
+	prefiltered = get_query_candidates (cbfile, match_data.obj_sexp, candidates);
 
-	objs_occuring_in_tw =  NULL;
-
-	if (!prunning_by_time) {
+	if (!prefiltered) {
 		g_hash_table_foreach (priv->comp_uid_hash, (GHFunc) match_object_sexp,
 				      &match_data);
 	} else {
-		objs_occuring_in_tw = e_intervaltree_search (priv->interval_tree,
-							    occur_start, occur_end);
-
-		g_list_foreach (objs_occuring_in_tw, (GFunc) match_object_sexp_to_component,
-			       &match_data);
+		g_ptr_array_foreach (candidates, (GFunc) match_object_sexp_to_component,
+				     &match_data);
 	}
 
 	g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 
-	*objects = match_data.obj_list;
+	*objects = g_list_reverse (match_data.obj_list);
 
-	if (objs_occuring_in_tw) {
-		g_list_foreach (objs_occuring_in_tw, (GFunc)g_object_unref, NULL);
-		g_list_free (objs_occuring_in_tw);
-	}
+	g_ptr_array_free (candidates, TRUE);
 
 	g_object_unref (match_data.obj_sexp);
 }
@@ -1829,9 +3075,9 @@ e_cal_backend_file_start_query (ECalBackend *backend, EDataCalView *query)
 	ECalBackendFile *cbfile;
 	ECalBackendFilePrivate *priv;
 	MatchObjectData match_data;
-	time_t occur_start = -1, occur_end = -1;
-	gboolean prunning_by_time;
-	GList* objs_occuring_in_tw;
+	gboolean prefiltered;
+	GPtrArray *candidates;
+	guint i;
 	cbfile = E_CAL_BACKEND_FILE (backend);
 	priv = cbfile->priv;
 
@@ -1844,6 +3090,7 @@ e_cal_backend_file_start_query (ECalBackend *backend, EDataCalView *query)
 	match_data.backend = backend;
 	match_data.default_zone = priv->default_zone;
 	match_data.obj_sexp = e_data_cal_view_get_object_sexp (query);
+	match_data.view = query;
 
 	if (!strcmp (match_data.query, "#t"))
 		match_data.search_needed = FALSE;
@@ -1854,97 +3101,164 @@ e_cal_backend_file_start_query (ECalBackend *backend, EDataCalView *query)
 		g_error_free (error);
 		return;
 	}
-	prunning_by_time = e_cal_backend_sexp_evaluate_occur_times (match_data.obj_sexp,
-									    &occur_start,
-									    &occur_end);
-
-	objs_occuring_in_tw = NULL;
 
 	g_static_rec_mutex_lock (&priv->idle_save_rmutex);
 
-	if (!prunning_by_time) {
-		/* full scan */
-		g_hash_table_foreach (priv->comp_uid_hash, (GHFunc) match_object_sexp,
-				      &match_data);
+	candidates = g_ptr_array_new ();
+	prefiltered = get_query_candidates (cbfile, match_data.obj_sexp, candidates);
+
+	if (!prefiltered) {
+		GHashTableIter iter;
+		gpointer key, value;
+
+		/* full scan, until the view is stopped */
+		g_hash_table_iter_init (&iter, priv->comp_uid_hash);
+		while (g_hash_table_iter_next (&iter, &key, &value) &&
+		       !e_data_cal_view_is_stopped (query))
+			match_object_sexp (key, value, &match_data);
 
 		e_debug_log(FALSE, E_DEBUG_LOG_DOMAIN_CAL_QUERIES,  "---;%p;QUERY-ITEMS;%s;%s;%d", query,
 			    e_data_cal_view_get_text (query), G_OBJECT_TYPE_NAME (backend),
 			    g_hash_table_size (priv->comp_uid_hash));
 	} else {
-		/* matches objects in new "interval tree" way */
-		/* events occuring in time window */
-		objs_occuring_in_tw = e_intervaltree_search (priv->interval_tree, occur_start, occur_end);
-
-		g_list_foreach (objs_occuring_in_tw, (GFunc) match_object_sexp_to_component,
-			       &match_data);
+		/* only match the objects occuring in the time window, or
+		   having all the index keys of the query */
+		for (i = 0; i < candidates->len && !e_data_cal_view_is_stopped (query); i++)
+			match_object_sexp_to_component (
+				g_ptr_array_index (candidates, i), &match_data);
 
 		e_debug_log(FALSE, E_DEBUG_LOG_DOMAIN_CAL_QUERIES,  "---;%p;QUERY-ITEMS;%s;%s;%d", query,
 			    e_data_cal_view_get_text (query), G_OBJECT_TYPE_NAME (backend),
-			    g_list_length (objs_occuring_in_tw));
+			    candidates->len);
 	}
 
 	g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 
-	/* notify listeners of all objects */
-	if (match_data.obj_list) {
-		e_data_cal_view_notify_objects_added (query, (const GList *) match_data.obj_list);
-
-		/* free memory */
-		g_list_foreach (match_data.obj_list, (GFunc) g_free, NULL);
-		g_list_free (match_data.obj_list);
-	}
-
-	if (objs_occuring_in_tw) {
-		g_list_foreach (objs_occuring_in_tw, (GFunc)g_object_unref, NULL);
-		g_list_free (objs_occuring_in_tw);
-	}
+	g_ptr_array_free (candidates, TRUE);
 	g_object_unref (match_data.obj_sexp);
 
 	e_data_cal_view_notify_done (query, NULL /* Success */);
 }
 
-static gboolean
-free_busy_instance (ECalComponent *comp,
-		    time_t        instance_start,
-		    time_t        instance_end,
-		    gpointer      data)
-{
-	icalcomponent *vfb = data;
-	icalproperty *prop;
-	icalparameter *param;
-	struct icalperiodtype ipt;
-	icaltimezone *utc_zone;
+typedef struct {
+	time_t start;
+	time_t end;
+} BusyPeriod;
+
+static gboolean
+add_busy_period (ECalComponent *comp,
+		 time_t         instance_start,
+		 time_t         instance_end,
+		 gpointer       data)
+{
+	GArray *periods = data;
+	BusyPeriod period;
+
+	period.start = instance_start;
+	period.end = instance_end;
+	g_array_append_val (periods, period);
+
+	return TRUE;
+}
+
+static gint
+compare_busy_periods (gconstpointer a, gconstpointer b)
+{
+	const BusyPeriod *pa = a, *pb = b;
+
+	if (pa->start != pb->start)
+		return pa->start < pb->start ? -1 : 1;
+	if (pa->end != pb->end)
+		return pa->end < pb->end ? -1 : 1;
+
+	return 0;
+}
+
+/* Collects the instances of all opaque components occuring between start
+ * and end with a single search of the interval tree, and merges them into
+ * a sorted array of disjoint BusyPeriods.  The busy time doesn't depend on
+ * the user asking for it, so it is computed once for all the users of a
+ * get_free_busy request.
+ */
+static GArray *
+get_busy_periods (ECalBackendFile *cbfile, time_t start, time_t end)
+{
+	ECalBackendFilePrivate *priv;
+	GPtrArray *candidates;
+	GArray *periods;
+	BusyPeriod *period, *last;
+	guint i, n_merged;
+
+	priv = cbfile->priv;
+
+	periods = g_array_new (FALSE, FALSE, sizeof (BusyPeriod));
+	candidates = g_ptr_array_new ();
+
+	ensure_objects_in_range (cbfile, end);
+	e_intervaltree_search_array (priv->interval_tree, start, end, candidates);
+
+	for (i = 0; i < candidates->len; i++) {
+		ECalComponent *comp = g_ptr_array_index (candidates, i);
+		icalcomponent *icalcomp, *vcalendar_comp;
+		icalproperty *prop;
+
+		icalcomp = e_cal_component_get_icalcomponent (comp);
+		if (!icalcomp)
+			continue;
+
+		/* If the event is TRANSPARENT, skip it. */
+		prop = icalcomponent_get_first_property (icalcomp,
+							 ICAL_TRANSP_PROPERTY);
+		if (prop) {
+			icalproperty_transp transp_val = icalproperty_get_transp (prop);
+			if (transp_val == ICAL_TRANSP_TRANSPARENT ||
+			    transp_val == ICAL_TRANSP_TRANSPARENTNOCONFLICT)
+				continue;
+		}
+
+		vcalendar_comp = icalcomponent_get_parent (icalcomp);
+		e_cal_backend_generate_instances (E_CAL_BACKEND (cbfile), comp, start, end,
+						  add_busy_period,
+						  periods,
+						  resolve_tzid,
+						  vcalendar_comp,
+						  priv->default_zone);
+	}
 
-	utc_zone = icaltimezone_get_utc_timezone ();
+	g_ptr_array_free (candidates, TRUE);
 
-	ipt.start = icaltime_from_timet_with_zone (instance_start, FALSE, utc_zone);
-	ipt.end = icaltime_from_timet_with_zone (instance_end, FALSE, utc_zone);
-	ipt.duration = icaldurationtype_null_duration ();
+	if (periods->len < 2)
+		return periods;
 
-        /* add busy information to the vfb component */
-	prop = icalproperty_new (ICAL_FREEBUSY_PROPERTY);
-	icalproperty_set_freebusy (prop, ipt);
+	/* sweep over the periods in order of their start, extending the last
+	 * merged period as long as the next one starts before it ends */
+	g_array_sort (periods, compare_busy_periods);
 
-	param = icalparameter_new_fbtype (ICAL_FBTYPE_BUSY);
-	icalproperty_add_parameter (prop, param);
+	n_merged = 1;
+	for (i = 1; i < periods->len; i++) {
+		period = &g_array_index (periods, BusyPeriod, i);
+		last = &g_array_index (periods, BusyPeriod, n_merged - 1);
 
-	icalcomponent_add_property (vfb, prop);
+		if (period->start <= last->end) {
+			if (period->end > last->end)
+				last->end = period->end;
+		} else {
+			g_array_index (periods, BusyPeriod, n_merged) = *period;
+			n_merged++;
+		}
+	}
+	g_array_set_size (periods, n_merged);
 
-	return TRUE;
+	return periods;
 }
 
 static icalcomponent *
 create_user_free_busy (ECalBackendFile *cbfile, const gchar *address, const gchar *cn,
-		       time_t start, time_t end)
+		       time_t start, time_t end, GArray *periods)
 {
-	ECalBackendFilePrivate *priv;
-	GList *l;
 	icalcomponent *vfb;
 	icaltimezone *utc_zone;
-	ECalBackendSExp *obj_sexp;
-	gchar *query, *iso_start, *iso_end;
-
-	priv = cbfile->priv;
+	guint i;
 
 	/* create the (unique) VFREEBUSY object that we'll return */
 	vfb = icalcomponent_new_vfreebusy ();
@@ -1964,50 +3278,25 @@ create_user_free_busy (ECalBackendFile *cbfile, const gchar *address, const gcha
 	icalcomponent_set_dtstart (vfb, icaltime_from_timet_with_zone (start, FALSE, utc_zone));
 	icalcomponent_set_dtend (vfb, icaltime_from_timet_with_zone (end, FALSE, utc_zone));
 
-	/* add all objects in the given interval */
-	iso_start = isodate_from_time_t (start);
-	iso_end = isodate_from_time_t (end);
-	query = g_strdup_printf ("occur-in-time-range? (make-time \"%s\") (make-time \"%s\")",
-				 iso_start, iso_end);
-	obj_sexp = e_cal_backend_sexp_new (query);
-	g_free (query);
-	g_free (iso_start);
-	g_free (iso_end);
-
-	if (!obj_sexp)
-		return vfb;
-
-	for (l = priv->comp; l; l = l->next) {
-		ECalComponent *comp = l->data;
-		icalcomponent *icalcomp, *vcalendar_comp;
+	/* add busy information to the vfb component */
+	for (i = 0; i < periods->len; i++) {
+		BusyPeriod *period = &g_array_index (periods, BusyPeriod, i);
 		icalproperty *prop;
+		icalparameter *param;
+		struct icalperiodtype ipt;
 
-		icalcomp = e_cal_component_get_icalcomponent (comp);
-		if (!icalcomp)
-			continue;
+		ipt.start = icaltime_from_timet_with_zone (period->start, FALSE, utc_zone);
+		ipt.end = icaltime_from_timet_with_zone (period->end, FALSE, utc_zone);
+		ipt.duration = icaldurationtype_null_duration ();
 
-		/* If the event is TRANSPARENT, skip it. */
-		prop = icalcomponent_get_first_property (icalcomp,
-							 ICAL_TRANSP_PROPERTY);
-		if (prop) {
-			icalproperty_transp transp_val = icalproperty_get_transp (prop);
-			if (transp_val == ICAL_TRANSP_TRANSPARENT ||
-			    transp_val == ICAL_TRANSP_TRANSPARENTNOCONFLICT)
-				continue;
-		}
+		prop = icalproperty_new (ICAL_FREEBUSY_PROPERTY);
+		icalproperty_set_freebusy (prop, ipt);
 
-		if (!e_cal_backend_sexp_match_comp (obj_sexp, l->data, E_CAL_BACKEND (cbfile)))
-			continue;
+		param = icalparameter_new_fbtype (ICAL_FBTYPE_BUSY);
+		icalproperty_add_parameter (prop, param);
 
-		vcalendar_comp = icalcomponent_get_parent (icalcomp);
-		e_cal_recur_generate_instances (comp, start, end,
-						free_busy_instance,
-						vfb,
-						resolve_tzid,
-						vcalendar_comp,
-						priv->default_zone);
+		icalcomponent_add_property (vfb, prop);
 	}
-	g_object_unref (obj_sexp);
 
 	return vfb;
 }
@@ -2022,6 +3311,7 @@ e_cal_backend_file_get_free_busy (ECalBackendSync *backend, EDataCal *cal, GList
 	gchar *address, *name;
 	icalcomponent *vfb;
 	gchar *calobj;
+	GArray *periods;
 	GList *l;
 
 	cbfile = E_CAL_BACKEND_FILE (backend);
@@ -2035,9 +3325,11 @@ e_cal_backend_file_get_free_busy (ECalBackendSync *backend, EDataCal *cal, GList
 
 	*freebusy = NULL;
 
+	periods = get_busy_periods (cbfile, start, end);
+
 	if (users == NULL) {
 		if (e_cal_backend_mail_account_get_default (&address, &name)) {
-			vfb = create_user_free_busy (cbfile, address, name, start, end);
+			vfb = create_user_free_busy (cbfile, address, name, start, end, periods);
 			calobj = icalcomponent_as_ical_string_r (vfb);
 			*freebusy = g_list_append (*freebusy, calobj);
 			icalcomponent_free (vfb);
@@ -2048,7 +3340,7 @@ e_cal_backend_file_get_free_busy (ECalBackendSync *backend, EDataCal *cal, GList
 		for (l = users; l != NULL; l = l->next ) {
 			address = l->data;
 			if (e_cal_backend_mail_account_is_valid (address, &name)) {
-				vfb = create_user_free_busy (cbfile, address, name, start, end);
+				vfb = create_user_free_busy (cbfile, address, name, start, end, periods);
 				calobj = icalcomponent_as_ical_string_r (vfb);
 				*freebusy = g_list_append (*freebusy, calobj);
 				icalcomponent_free (vfb);
@@ -2057,6 +3349,8 @@ e_cal_backend_file_get_free_busy (ECalBackendSync *backend, EDataCal *cal, GList
 		}
 	}
 
+	g_array_free (periods, TRUE);
+
 	g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 }
 
@@ -2068,27 +3362,70 @@ typedef struct
 	EXmlHash *ehash;
 } ECalBackendFileComputeChangesData;
 
+/* Builds the component reported as deleted for uid */
+static gchar *
+compute_changes_deleted_object (icalcomponent_kind kind, const gchar *uid)
+{
+	ECalComponent *comp;
+	gchar *calobj;
+
+	comp = e_cal_component_new ();
+	if (kind == ICAL_VTODO_COMPONENT)
+		e_cal_component_set_new_vtype (comp, E_CAL_COMPONENT_TODO);
+	else
+		e_cal_component_set_new_vtype (comp, E_CAL_COMPONENT_EVENT);
+
+	e_cal_component_set_uid (comp, uid);
+	calobj = e_cal_component_get_as_string (comp);
+
+	g_object_unref (comp);
+
+	return calobj;
+}
+
 static gboolean
 e_cal_backend_file_compute_changes_foreach_key (const gchar *key, gpointer value, gpointer data)
 {
 	ECalBackendFileComputeChangesData *be_data = data;
 
 	if (!lookup_component (be_data->backend, key)) {
-		ECalComponent *comp;
+		be_data->deletes = g_list_prepend (be_data->deletes, compute_changes_deleted_object (be_data->kind, key));
+		return TRUE;
+	}
+	return FALSE;
+}
 
-		comp = e_cal_component_new ();
-		if (be_data->kind == ICAL_VTODO_COMPONENT)
-			e_cal_component_set_new_vtype (comp, E_CAL_COMPONENT_TODO);
-		else
-			e_cal_component_set_new_vtype (comp, E_CAL_COMPONENT_EVENT);
+/* Compares comp with the client's hash, returns whether it changed */
+static gboolean
+compute_changes_compare (EXmlHash *ehash, ECalComponent *comp, GList **adds, GList **modifies)
+{
+	const gchar *uid;
+	gchar *calobj;
+	gboolean changed = TRUE;
 
-		e_cal_component_set_uid (comp, key);
-		be_data->deletes = g_list_prepend (be_data->deletes, e_cal_component_get_as_string (comp));
+	e_cal_component_get_uid (comp, &uid);
+	calobj = e_cal_component_get_as_string (comp);
 
-		g_object_unref (comp);
-		return TRUE;
+	g_assert (calobj != NULL);
+
+	/* check what type of change has occurred, if any */
+	switch (e_xmlhash_compare (ehash, uid, calobj)) {
+	case E_XMLHASH_STATUS_SAME:
+		changed = FALSE;
+		break;
+	case E_XMLHASH_STATUS_NOT_FOUND:
+		*adds = g_list_prepend (*adds, g_strdup (calobj));
+		e_xmlhash_add (ehash, uid, calobj);
+		break;
+	case E_XMLHASH_STATUS_DIFFERENT:
+		*modifies = g_list_prepend (*modifies, g_strdup (calobj));
+		e_xmlhash_add (ehash, uid, calobj);
+		break;
 	}
-	return FALSE;
+
+	g_free (calobj);
+
+	return changed;
 }
 
 static void
@@ -2101,6 +3438,8 @@ e_cal_backend_file_compute_changes (ECalBackendFile *cbfile, const gchar *change
 	ECalBackendFileComputeChangesData be_data;
 	GList *i;
 	gchar *unescaped_uri;
+	gboolean known_client, changed = FALSE;
+	guint64 client_sequence = 0, sequence = 0;
 
 	priv = cbfile->priv;
 
@@ -2108,6 +3447,7 @@ e_cal_backend_file_compute_changes (ECalBackendFile *cbfile, const gchar *change
 	unescaped_uri = g_uri_unescape_string (priv->path, "");
 	filename = g_strdup_printf ("%s-%s.db", unescaped_uri, change_id);
 	g_free (unescaped_uri);
+	known_client = g_file_test (filename, G_FILE_TEST_EXISTS);
 	if (!(ehash = e_xmlhash_new (filename))) {
 		g_free (filename);
 		g_propagate_error (perror, EDC_ERROR (OtherError));
@@ -2118,46 +3458,65 @@ e_cal_backend_file_compute_changes (ECalBackendFile *cbfile, const gchar *change
 
 	g_static_rec_mutex_lock (&priv->idle_save_rmutex);
 
-	/* Calculate adds and modifies */
-	for (i = priv->comp; i != NULL; i = i->next) {
-		const gchar *uid;
-		gchar *calobj;
+	be_data.backend = cbfile;
+	be_data.kind = e_cal_backend_get_kind (E_CAL_BACKEND (cbfile));
+	be_data.deletes = NULL;
+	be_data.ehash = ehash;
+
+	if (priv->change_log) {
+		sequence = e_change_log_get_sequence (priv->change_log);
+		known_client = known_client && e_change_log_get_client_sequence (priv->change_log, change_id, &client_sequence);
+	} else {
+		known_client = FALSE;
+	}
 
-		e_cal_component_get_uid (i->data, &uid);
-		calobj = e_cal_component_get_as_string (i->data);
+	if (known_client) {
+		GSList *uids, *l;
 
-		g_assert (calobj != NULL);
+		/* only the objects changed since the client's last call */
+		uids = e_change_log_get_changed_uids (priv->change_log, client_sequence);
 
-		/* check what type of change has occurred, if any */
-		switch (e_xmlhash_compare (ehash, uid, calobj)) {
-		case E_XMLHASH_STATUS_SAME:
-			break;
-		case E_XMLHASH_STATUS_NOT_FOUND:
-			*adds = g_list_prepend (*adds, g_strdup (calobj));
-			e_xmlhash_add (ehash, uid, calobj);
-			break;
-		case E_XMLHASH_STATUS_DIFFERENT:
-			*modifies = g_list_prepend (*modifies, g_strdup (calobj));
-			e_xmlhash_add (ehash, uid, calobj);
-			break;
+		for (l = uids; l; l = l->next) {
+			const gchar *uid = l->data;
+			ECalBackendFileObject *obj_data;
+
+			obj_data = lookup_object (cbfile, uid);
+			if (obj_data) {
+				if (obj_data->full_object)
+					changed |= compute_changes_compare (ehash, obj_data->full_object, adds, modifies);
+				for (i = obj_data->recurrences_list; i; i = i->next)
+					changed |= compute_changes_compare (ehash, i->data, adds, modifies);
+			} else if (e_xmlhash_compare (ehash, uid, "") != E_XMLHASH_STATUS_NOT_FOUND) {
+				be_data.deletes = g_list_prepend (be_data.deletes, compute_changes_deleted_object (be_data.kind, uid));
+				e_xmlhash_remove (ehash, uid);
+			}
+
+			g_free (l->data);
 		}
 
-		g_free (calobj);
-	}
+		g_slist_free (uids);
+	} else {
+		ensure_all_objects (cbfile);
 
-	/* Calculate deletions */
-	be_data.backend = cbfile;
-	be_data.kind = e_cal_backend_get_kind (E_CAL_BACKEND (cbfile));
-	be_data.deletes = NULL;
-	be_data.ehash = ehash;
+		/* Calculate adds and modifies */
+		for (i = priv->comp; i != NULL; i = i->next)
+			changed |= compute_changes_compare (ehash, i->data, adds, modifies);
 
-	e_xmlhash_foreach_key_remove (ehash, (EXmlHashRemoveFunc)e_cal_backend_file_compute_changes_foreach_key, &be_data);
+		/* Calculate deletions */
+		e_xmlhash_foreach_key_remove (ehash, (EXmlHashRemoveFunc)e_cal_backend_file_compute_changes_foreach_key, &be_data);
+	}
 
 	*deletes = be_data.deletes;
 
-	e_xmlhash_write (ehash);
+	/* the hash is written once at least, so the client is known the
+	 * next time */
+	if (changed || be_data.deletes || !known_client)
+		e_xmlhash_write (ehash);
 	e_xmlhash_destroy (ehash);
 
+	if (priv->change_log)
+		e_change_log_set_client_sequence (priv->change_log, change_id, sequence);
+
 	g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 }
 
@@ -2383,6 +3742,7 @@ remove_object_instance_cb (gpointer key, gpointer value, gpointer user_data)
 			icalcomponent_remove_component (rrdata->cbfile->priv->icalcomp,
 							e_cal_component_get_icalcomponent (instance));
 			rrdata->cbfile->priv->comp = g_list_remove (rrdata->cbfile->priv->comp, instance);
+			remove_component_from_index (rrdata->cbfile, instance);
 
 			rrdata->obj_data->recurrences_list = g_list_remove (rrdata->obj_data->recurrences_list, instance);
 
@@ -2435,13 +3795,15 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 	comp_uid = icalcomponent_get_uid (icalcomp);
 
 	/* Get the object from our cache */
-	if (!(obj_data = g_hash_table_lookup (priv->comp_uid_hash, comp_uid))) {
+	if (!(obj_data = lookup_object (cbfile, comp_uid))) {
 		icalcomponent_free (icalcomp);
 		g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 		g_propagate_error (error, EDC_ERROR (ObjectNotFound));
 		return;
 	}
 
+	log_mark_uid (cbfile, comp_uid);
+
 	/* Create the cal component */
 	comp = e_cal_component_new ();
 	e_cal_component_set_icalcomponent (comp, icalcomp);
@@ -2466,12 +3828,14 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 				icalcomponent_remove_component (priv->icalcomp,
 							e_cal_component_get_icalcomponent (obj_data->full_object));
 				priv->comp = g_list_remove (priv->comp, obj_data->full_object);
+				remove_component_from_index (cbfile, obj_data->full_object);
 
 				g_object_unref (obj_data->full_object);
 			}
 
 			/* add the new object */
 			obj_data->full_object = comp;
+			add_component_to_index (cbfile, comp);
 
 			icalcomponent_add_component (priv->icalcomp,
 						     e_cal_component_get_icalcomponent (obj_data->full_object));
@@ -2496,6 +3860,7 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 							e_cal_component_get_icalcomponent (recurrence));
 			priv->comp = g_list_remove (priv->comp, recurrence);
 			obj_data->recurrences_list = g_list_remove (obj_data->recurrences_list, recurrence);
+			remove_component_from_index (cbfile, recurrence);
 			g_hash_table_remove (obj_data->recurrences, rid);
 		}
 
@@ -2507,6 +3872,7 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 					     e_cal_component_get_icalcomponent (comp));
 		priv->comp = g_list_append (priv->comp, comp);
 		obj_data->recurrences_list = g_list_append (obj_data->recurrences_list, comp);
+		add_component_to_index (cbfile, comp);
 		rid = NULL;
 		break;
 	case CALOBJ_MOD_THISANDPRIOR :
@@ -2542,6 +3908,7 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 							e_cal_component_get_icalcomponent (recurrence));
 			priv->comp = g_list_remove (priv->comp, recurrence);
 			obj_data->recurrences_list = g_list_remove (obj_data->recurrences_list, recurrence);
+			remove_component_from_index (cbfile, recurrence);
 			g_hash_table_remove (obj_data->recurrences, rid);
 		} else {
 			if (old_object && obj_data->full_object)
@@ -2571,6 +3938,7 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 					     e_cal_component_get_icalcomponent (comp));
 		priv->comp = g_list_append (priv->comp, comp);
 		obj_data->recurrences_list = g_list_append (obj_data->recurrences_list, comp);
+		add_component_to_index (cbfile, comp);
 		rid = NULL;
 		break;
 	case CALOBJ_MOD_ALL :
@@ -2606,6 +3974,7 @@ e_cal_backend_file_modify_object (ECalBackendSync *backend, EDataCal *cal, const
 					icalcomponent_add_component (priv->icalcomp, e_cal_component_get_icalcomponent (c));
 					priv->comp = g_list_append (priv->comp, c);
 					obj_data->recurrences_list = g_list_append (obj_data->recurrences_list, c);
+					add_component_to_index (cbfile, c);
 				}
 			}
 
@@ -2629,16 +3998,24 @@ remove_instance (ECalBackendFile *cbfile, ECalBackendFileObject *obj_data, const
 	gchar *hash_rid;
 	ECalComponent *comp;
 	struct icaltimetype current;
+	const gchar *uid = NULL;
 
 	if (!rid || !*rid)
 		return;
 
+	comp = obj_data->full_object ? obj_data->full_object : obj_data->recurrences_list ? obj_data->recurrences_list->data : NULL;
+	if (comp) {
+		e_cal_component_get_uid (comp, &uid);
+		log_mark_uid (cbfile, uid);
+	}
+
 	if (g_hash_table_lookup_extended (obj_data->recurrences, rid, (gpointer *)&hash_rid, (gpointer *)&comp)) {
 		/* remove the component from our data */
 		icalcomponent_remove_component (cbfile->priv->icalcomp,
 						e_cal_component_get_icalcomponent (comp));
 		cbfile->priv->comp = g_list_remove (cbfile->priv->comp, comp);
 		obj_data->recurrences_list = g_list_remove (obj_data->recurrences_list, comp);
+		remove_component_from_index (cbfile, comp);
 		g_hash_table_remove (obj_data->recurrences, rid);
 	}
 
@@ -2714,13 +4091,15 @@ e_cal_backend_file_remove_object (ECalBackendSync *backend, EDataCal *cal,
 
 	g_static_rec_mutex_lock (&priv->idle_save_rmutex);
 
-	obj_data = g_hash_table_lookup (priv->comp_uid_hash, uid);
+	obj_data = lookup_object (cbfile, uid);
 	if (!obj_data) {
 		g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 		g_propagate_error (error, EDC_ERROR (ObjectNotFound));
 		return;
 	}
 
+	log_mark_uid (cbfile, uid);
+
 	if (rid && *rid)
 		recur_id = rid;
 
@@ -2803,7 +4182,7 @@ cancel_received_object (ECalBackendFile *cbfile, icalcomponent *icalcomp, gchar
 	*new_object = NULL;
 
 	/* Find the old version of the component. */
-	obj_data = g_hash_table_lookup (priv->comp_uid_hash, icalcomponent_get_uid (icalcomp));
+	obj_data = lookup_object (cbfile, icalcomponent_get_uid (icalcomp));
 	if (!obj_data)
 		return FALSE;
 
@@ -3060,7 +4439,7 @@ e_cal_backend_file_receive_objects (ECalBackendSync *backend, EDataCal *cal, con
 			/* handle attachments */
 			if (!is_declined && e_cal_component_has_attachments (comp))
 				fetch_attachments (backend, comp);
-			obj_data = g_hash_table_lookup (priv->comp_uid_hash, uid);
+			obj_data = lookup_object (cbfile, uid);
 			if (obj_data) {
 				if (obj_data->full_object)
 					old_object = e_cal_component_get_as_string (obj_data->full_object);
@@ -3416,6 +4795,7 @@ test_query_by_scanning_all_objects (ECalBackendFile* cbfile, const gchar *sexp,
 	match_data.obj_list = NULL;
 	match_data.default_zone = priv->default_zone;
 	match_data.backend = E_CAL_BACKEND (cbfile);
+	match_data.view = NULL;
 
 	if (!strcmp (sexp, "#t"))
 		match_data.search_needed = FALSE;
@@ -3432,12 +4812,14 @@ test_query_by_scanning_all_objects (ECalBackendFile* cbfile, const gchar *sexp,
 		exit (-1);
 	}
 
+	ensure_all_objects (cbfile);
+
 	g_hash_table_foreach (priv->comp_uid_hash, (GHFunc) match_object_sexp,
 			&match_data);
 
 	g_static_rec_mutex_unlock (&priv->idle_save_rmutex);
 
-	*objects = match_data.obj_list;
+	*objects = g_list_reverse (match_data.obj_list);
 
 	g_object_unref (match_data.obj_sexp);
 }
@@ -3701,3 +5083,404 @@ err0:
 }
 #endif
 
+
+#ifdef TEST_LAZY_LOAD
+/* Loads a calendar with a duplicated UID and detached instances, so the
+ * duplicate, which is parsed at once, makes scan_vcalendar() parse the
+ * lazy object having its UID, and checks every component is added once. */
+
+static const gchar *test_calendar =
+	"BEGIN:VCALENDAR\r\n"
+	"PRODID:-//test-lazy-load//EN\r\n"
+	"VERSION:2.0\r\n"
+	"BEGIN:VEVENT\r\n"
+	"UID:lazy-dup\r\n"
+	"DTSTAMP:20110101T000000Z\r\n"
+	"DTSTART:20110103T100000Z\r\n"
+	"DTEND:20110103T110000Z\r\n"
+	"RRULE:FREQ=DAILY;COUNT=5\r\n"
+	"SUMMARY:master\r\n"
+	"END:VEVENT\r\n"
+	"BEGIN:VEVENT\r\n"
+	"UID:lazy-dup\r\n"
+	"DTSTAMP:20110101T000000Z\r\n"
+	"RECURRENCE-ID:20110104T100000Z\r\n"
+	"DTSTART:20110104T120000Z\r\n"
+	"DTEND:20110104T130000Z\r\n"
+	"SUMMARY:instance 1\r\n"
+	"END:VEVENT\r\n"
+	"BEGIN:VEVENT\r\n"
+	"UID:lazy-dup\r\n"
+	"DTSTAMP:20110101T000000Z\r\n"
+	"DTSTART:20110110T100000Z\r\n"
+	"DTEND:20110110T110000Z\r\n"
+	"SUMMARY:duplicate\r\n"
+	"END:VEVENT\r\n"
+	"BEGIN:VEVENT\r\n"
+	"UID:lazy-dup\r\n"
+	"DTSTAMP:20110101T000000Z\r\n"
+	"RECURRENCE-ID:20110105T100000Z\r\n"
+	"DTSTART:20110105T120000Z\r\n"
+	"DTEND:20110105T130000Z\r\n"
+	"SUMMARY:instance 2\r\n"
+	"END:VEVENT\r\n"
+	"BEGIN:VEVENT\r\n"
+	"UID:lazy-other\r\n"
+	"DTSTAMP:20110101T000000Z\r\n"
+	"DTSTART:20110201T100000Z\r\n"
+	"DTEND:20110201T110000Z\r\n"
+	"SUMMARY:other\r\n"
+	"END:VEVENT\r\n"
+	"END:VCALENDAR\r\n";
+
+static gint failures = 0;
+
+static void
+check (gboolean condition, const gchar *what)
+{
+	if (!condition) {
+		g_printerr ("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	ECalBackendFile *cbfile;
+	ECalBackendFilePrivate *priv;
+	ECalBackendFileObject *obj_data;
+	icalcomponent *subcomp;
+	const gchar *uid;
+	gchar *filename;
+	GList *l;
+	GHashTable *icalcomps;
+	gint n_events = 0, n_duplicates = 0;
+	GError *error = NULL;
+
+	g_type_init ();
+	g_thread_init (NULL);
+
+	filename = g_build_filename (g_get_tmp_dir (), "test-lazy-load.ics", NULL);
+	if (!g_file_set_contents (filename, test_calendar, -1, &error)) {
+		g_printerr ("Cannot write %s: %s\n", filename, error->message);
+		return 1;
+	}
+
+	cbfile = g_object_new (E_TYPE_CAL_BACKEND_FILE, NULL);
+	priv = cbfile->priv;
+
+	open_cal (cbfile, filename, &error);
+	if (error) {
+		g_printerr ("Cannot open %s: %s\n", filename, error->message);
+		return 1;
+	}
+
+	ensure_all_objects (cbfile);
+
+	/* the master, the two instances, the renamed duplicate and the other */
+	check (g_list_length (priv->comp) == 5, "five components are loaded");
+	check (g_hash_table_size (priv->comp_uid_hash) == 3, "three UIDs are loaded");
+
+	obj_data = g_hash_table_lookup (priv->comp_uid_hash, "lazy-dup");
+	check (obj_data && obj_data->full_object, "the first master keeps its UID");
+	if (obj_data && obj_data->full_object) {
+		e_cal_component_get_uid (obj_data->full_object, &uid);
+		check (g_strcmp0 (uid, "lazy-dup") == 0, "the hashed master was not renamed");
+		check (g_list_length (obj_data->recurrences_list) == 2, "both instances are loaded");
+	}
+
+	/* every component of the file is wrapped exactly once */
+	icalcomps = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (l = priv->comp; l; l = l->next) {
+		icalcomponent *icalcomp = e_cal_component_get_icalcomponent (l->data);
+
+		if (g_hash_table_lookup (icalcomps, icalcomp))
+			n_duplicates++;
+		g_hash_table_insert (icalcomps, icalcomp, icalcomp);
+	}
+
+	for (subcomp = icalcomponent_get_first_component (priv->icalcomp, ICAL_VEVENT_COMPONENT);
+	     subcomp;
+	     subcomp = icalcomponent_get_next_component (priv->icalcomp, ICAL_VEVENT_COMPONENT)) {
+		n_events++;
+		check (g_hash_table_lookup (icalcomps, subcomp) != NULL, "each event has a component");
+	}
+	g_hash_table_destroy (icalcomps);
+
+	check (n_duplicates == 0, "no event is wrapped twice");
+	check (n_events == 5, "the toplevel component holds five events");
+
+	/* don't write the renamed duplicate back */
+	if (priv->dirty_idle_id) {
+		g_source_remove (priv->dirty_idle_id);
+		priv->dirty_idle_id = 0;
+	}
+	priv->is_dirty = FALSE;
+
+	g_object_unref (cbfile);
+	g_unlink (filename);
+	g_free (filename);
+
+	if (failures) {
+		g_printerr ("%d checks failed\n", failures);
+		return 1;
+	}
+
+	g_print ("Everything OK\n");
+
+	return 0;
+}
+#endif
+
+#ifdef TEST_CHANGE_LOG
+/* Checks the "incremental-save" log: the changes are appended to it and
+ * replayed when the calendar is opened again, a truncated last record is
+ * ignored and makes the whole file be written again, and a compaction
+ * keeps the records appended while it ran, unless the file was rewritten
+ * meanwhile, in which case the compacted file is dropped. */
+
+static const gchar *test_calendar =
+	"BEGIN:VCALENDAR\r\n"
+	"PRODID:-//test-change-log//EN\r\n"
+	"VERSION:2.0\r\n"
+	"BEGIN:VEVENT\r\n"
+	"UID:log-1\r\n"
+	"DTSTAMP:20110101T000000Z\r\n"
+	"DTSTART:20110301T100000Z\r\n"
+	"DTEND:20110301T110000Z\r\n"
+	"SUMMARY:first\r\n"
+	"END:VEVENT\r\n"
+	"END:VCALENDAR\r\n";
+
+static ECalBackendFile *
+open_test_cal (const gchar *dirname, const gchar *filename)
+{
+	ECalBackendFile *cbfile;
+	GError *error = NULL;
+
+	cbfile = g_object_new (E_TYPE_CAL_BACKEND_FILE, "kind", ICAL_VEVENT_COMPONENT, NULL);
+	e_cal_backend_set_cache_dir (E_CAL_BACKEND (cbfile), dirname);
+
+	open_cal (cbfile, filename, &error);
+	if (error) {
+		g_printerr ("Cannot open %s: %s\n", filename, error->message);
+		g_error_free (error);
+		g_object_unref (cbfile);
+		return NULL;
+	}
+
+	/* as e_cal_backend_file_open() does for "incremental-save" */
+	log_enable (cbfile);
+
+	return cbfile;
+}
+
+/* Runs the save scheduled by save() now */
+static void
+flush (ECalBackendFile *cbfile)
+{
+	ECalBackendFilePrivate *priv = cbfile->priv;
+
+	if (priv->dirty_idle_id) {
+		g_source_remove (priv->dirty_idle_id);
+		priv->dirty_idle_id = 0;
+	}
+
+	if (priv->is_dirty)
+		save_file_when_idle (cbfile);
+}
+
+static void
+wait_for_compaction (ECalBackendFile *cbfile)
+{
+	while (cbfile->priv->log_compacting)
+		g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+add_event (ECalBackendFile *cbfile, const gchar *uid, const gchar *description)
+{
+	ECalComponent *comp;
+	icalcomponent *icalcomp;
+
+	icalcomp = icalcomponent_new_vevent ();
+	icalcomponent_set_uid (icalcomp, uid);
+	icalcomponent_set_summary (icalcomp, uid);
+	icalcomponent_set_dtstart (icalcomp, icaltime_from_string ("20110302T100000Z"));
+	icalcomponent_set_dtend (icalcomp, icaltime_from_string ("20110302T110000Z"));
+	if (description)
+		icalcomponent_set_description (icalcomp, description);
+
+	comp = e_cal_component_new ();
+	e_cal_component_set_icalcomponent (comp, icalcomp);
+
+	add_component (cbfile, comp, TRUE);
+	save (cbfile);
+}
+
+static void
+remove_event (ECalBackendFile *cbfile, const gchar *uid)
+{
+	ECalBackendFileObject *obj_data;
+
+	obj_data = lookup_object (cbfile, uid);
+	if (obj_data)
+		remove_component (cbfile, uid, obj_data);
+}
+
+static gboolean
+has_event (ECalBackendFile *cbfile, const gchar *uid)
+{
+	return lookup_component (cbfile, uid) != NULL;
+}
+
+static gboolean
+file_contains (const gchar *filename, const gchar *text)
+{
+	gchar *contents = NULL;
+	gboolean found;
+
+	if (!g_file_get_contents (filename, &contents, NULL, NULL))
+		return FALSE;
+
+	found = strstr (contents, text) != NULL;
+	g_free (contents);
+
+	return found;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	ECalBackendFile *cbfile;
+	gchar *dirname, *filename, *log_path, *compact_path;
+	gchar *contents = NULL, *rewritten = NULL, *big;
+	gsize length = 0;
+	GError *error = NULL;
+
+	g_type_init ();
+	g_thread_init (NULL);
+
+	dirname = g_build_filename (g_get_tmp_dir (), "test-change-log", NULL);
+	filename = g_build_filename (dirname, "calendar.ics", NULL);
+	log_path = g_strconcat (filename, ".log", NULL);
+	compact_path = g_strconcat (filename, ".compact", NULL);
+
+	g_mkdir_with_parents (dirname, 0700);
+	g_unlink (log_path);
+	g_unlink (compact_path);
+	if (!g_file_set_contents (filename, test_calendar, -1, &error)) {
+		g_printerr ("Cannot write %s: %s\n", filename, error->message);
+		return 1;
+	}
+
+	/* the changes go to the log, the file stays as it was */
+	cbfile = open_test_cal (dirname, filename);
+	if (!cbfile)
+		return 1;
+
+	add_event (cbfile, "log-2", NULL);
+	remove_event (cbfile, "log-1");
+	flush (cbfile);
+
+	g_assert (g_file_get_contents (filename, &contents, NULL, NULL) && g_str_equal (contents, test_calendar));
+	g_assert (g_file_test (log_path, G_FILE_TEST_EXISTS));
+	g_free (contents);
+	g_object_unref (cbfile);
+
+	/* and are replayed on reopening */
+	cbfile = open_test_cal (dirname, filename);
+	if (!cbfile)
+		return 1;
+
+	g_assert (!has_event (cbfile, "log-1"));
+	g_assert (has_event (cbfile, "log-2"));
+	flush (cbfile);
+	g_assert (g_file_test (log_path, G_FILE_TEST_EXISTS));
+
+	add_event (cbfile, "log-3", NULL);
+	flush (cbfile);
+	g_object_unref (cbfile);
+
+	/* a crash cut the last record short */
+	g_assert (g_file_get_contents (log_path, &contents, &length, NULL) && length > 1);
+	g_assert (g_file_set_contents (log_path, contents, length - 1, NULL));
+	g_free (contents);
+
+	cbfile = open_test_cal (dirname, filename);
+	if (!cbfile)
+		return 1;
+
+	g_assert (has_event (cbfile, "log-2") && !has_event (cbfile, "log-1"));
+	g_assert (!has_event (cbfile, "log-3"));
+	g_assert (cbfile->priv->log_rewrite);
+	flush (cbfile);
+	g_assert (!g_file_test (log_path, G_FILE_TEST_EXISTS));
+	g_assert (file_contains (filename, "UID:log-2"));
+
+	/* a change appended while the log is compacted stays in the log */
+	big = g_strnfill (LOG_COMPACT_MIN_SIZE, 'x');
+
+	add_event (cbfile, "log-big-1", big);
+	flush (cbfile);
+	g_assert (cbfile->priv->log_compacting);
+
+	add_event (cbfile, "log-4", NULL);
+	flush (cbfile);
+	wait_for_compaction (cbfile);
+
+	g_assert (!g_file_test (compact_path, G_FILE_TEST_EXISTS));
+	g_assert (file_contains (filename, "UID:log-big-1"));
+	g_assert (!file_contains (filename, "UID:log-4"));
+	g_assert (file_contains (log_path, "log-4") && !file_contains (log_path, "log-big-1"));
+	g_assert (cbfile->priv->log_size == get_file_size (log_path));
+	g_object_unref (cbfile);
+
+	cbfile = open_test_cal (dirname, filename);
+	if (!cbfile)
+		return 1;
+
+	g_assert (has_event (cbfile, "log-big-1") && has_event (cbfile, "log-4"));
+	flush (cbfile);
+
+	/* a compaction which started before the file was rewritten is dropped */
+	add_event (cbfile, "log-big-2", big);
+	flush (cbfile);
+	g_assert (cbfile->priv->log_compacting);
+
+	add_event (cbfile, "log-5", NULL);
+	cbfile->priv->log_rewrite = TRUE;
+	flush (cbfile);
+	g_assert (!g_file_test (log_path, G_FILE_TEST_EXISTS));
+	g_assert (g_file_get_contents (filename, &rewritten, NULL, NULL));
+
+	wait_for_compaction (cbfile);
+	g_assert (!g_file_test (compact_path, G_FILE_TEST_EXISTS));
+	g_assert (g_file_get_contents (filename, &contents, NULL, NULL) && g_strcmp0 (contents, rewritten) == 0);
+	g_assert (!g_file_test (log_path, G_FILE_TEST_EXISTS));
+	g_free (contents);
+	g_free (rewritten);
+	g_object_unref (cbfile);
+
+	cbfile = open_test_cal (dirname, filename);
+	if (!cbfile)
+		return 1;
+
+	g_assert (has_event (cbfile, "log-big-2") && has_event (cbfile, "log-5") && has_event (cbfile, "log-4"));
+	flush (cbfile);
+	g_object_unref (cbfile);
+
+	g_free (big);
+	g_unlink (log_path);
+	g_unlink (compact_path);
+	g_unlink (filename);
+	g_rmdir (dirname);
+	g_free (compact_path);
+	g_free (log_path);
+	g_free (filename);
+	g_free (dirname);
+
+	return 0;
+}
+#endif
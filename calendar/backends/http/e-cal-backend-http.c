@@ -281,9 +281,7 @@ resolve_tzid (const gchar *tzid, gpointer user_data)
 {
 	icaltimezone *zone;
 
-	zone = (!strcmp (tzid, "UTC"))
-		? icaltimezone_get_utc_timezone ()
-		: icaltimezone_get_builtin_timezone_from_tzid (tzid);
+	zone = time_get_builtin_timezone_from_tzid (tzid);
 
 	if (!zone)
 		zone = e_cal_backend_internal_get_timezone (E_CAL_BACKEND (user_data), tzid);
@@ -1231,12 +1229,12 @@ create_user_free_busy (ECalBackendHttp *cbhttp, const gchar *address, const gcha
 		vcalendar_comp = icalcomponent_get_parent (icalcomp);
 		if (!vcalendar_comp)
 			vcalendar_comp = icalcomp;
-		e_cal_recur_generate_instances (comp, start, end,
-						free_busy_instance,
-						vfb,
-						resolve_tzid,
-						vcalendar_comp,
-						(icaltimezone *)e_cal_backend_store_get_default_timezone (store));
+		e_cal_backend_generate_instances (E_CAL_BACKEND (cbhttp), comp, start, end,
+						  free_busy_instance,
+						  vfb,
+						  resolve_tzid,
+						  vcalendar_comp,
+						  (icaltimezone *)e_cal_backend_store_get_default_timezone (store));
 	}
 	g_object_unref (obj_sexp);
 
@@ -322,6 +322,12 @@ static GArray*	cal_obj_generate_set_monthly	(RecurData	*recur_data,
 static GArray*	cal_obj_generate_set_default	(RecurData	*recur_data,
 						 ECalRecurVTable *vtable,
 						 CalObjTime	*occ);
+static gboolean	cal_obj_recurrence_is_simple	(ECalRecurrence	*recur);
+static void	cal_obj_generate_set_simple	(RecurData	*recur_data,
+						 CalObjTime	*occ,
+						 CalObjTime	*event_start,
+						 CalObjTime	*event_end,
+						 GArray		*occs);
 
 static ECalRecurVTable* cal_obj_get_vtable	(icalrecurrencetype_frequency recur_type);
 static void	cal_obj_initialize_recur_data	(RecurData	*recur_data,
@@ -1143,7 +1149,7 @@ generate_instances_for_chunk (ECalComponent	*comp,
 	gint i;
 	time_t start_time, end_time;
 	struct icaltimetype start_tt, end_tt;
-	gboolean cb_status = TRUE, rule_finished, finished = TRUE;
+	gboolean cb_status = TRUE, rule_finished, finished = TRUE, sorted;
 
 #if 0
 	g_print ("In generate_instances_for_chunk rrules: %p\n"
@@ -1174,7 +1180,10 @@ generate_instances_for_chunk (ECalComponent	*comp,
 			g_array_append_vals (occs, event_start, 1);
 	}
 
-	/* Expand each of the recurrence rules. */
+	/* Expand each of the recurrence rules. A single simple rule with no
+	   RDATEs gives us the occurrences already sorted, and all after the
+	   DTSTART added above, so we don't need to sort them again. */
+	sorted = rrules && !rrules->next && !rdates;
 	for (elem = rrules; elem; elem = elem->next) {
 		icalproperty *prop;
 		ECalRecurrence *r;
@@ -1183,6 +1192,9 @@ generate_instances_for_chunk (ECalComponent	*comp,
 		r = e_cal_recur_from_icalproperty (prop, FALSE, zone,
 						 convert_end_date);
 
+		if (!cal_obj_recurrence_is_simple (r))
+			sorted = FALSE;
+
 		tmp_occs = cal_obj_expand_recurrence (event_start, zone, r,
 						      chunk_start,
 						      chunk_end,
@@ -1292,7 +1304,8 @@ generate_instances_for_chunk (ECalComponent	*comp,
 	}
 
 	/* Sort all the arrays. */
-	cal_obj_sort_occurrences (occs);
+	if (!sorted)
+		cal_obj_sort_occurrences (occs);
 	cal_obj_sort_occurrences (ex_occs);
 
 	qsort (rdate_periods->data, rdate_periods->len,
@@ -1319,7 +1332,7 @@ generate_instances_for_chunk (ECalComponent	*comp,
 		start_tt.hour   = occ->hour;
 		start_tt.minute = occ->minute;
 		start_tt.second = occ->second;
-		start_time = icaltime_as_timet_with_zone (start_tt, zone);
+		start_time = time_from_icaltimetype_with_zone (start_tt, zone);
 
 		if (start_time == -1) {
 			g_warning ("time_t out of range");
@@ -1362,7 +1375,7 @@ generate_instances_for_chunk (ECalComponent	*comp,
 		end_tt.hour   = occ->hour;
 		end_tt.minute = occ->minute;
 		end_tt.second = occ->second;
-		end_time = icaltime_as_timet_with_zone (end_tt, zone);
+		end_time = time_from_icaltimetype_with_zone (end_tt, zone);
 
 		if (end_time == -1) {
 			g_warning ("time_t out of range");
@@ -1486,6 +1499,8 @@ cal_object_compute_duration (CalObjTime *start,
    clip the generated occurrences to the interval, i.e. if the interval
    starts part way through the year this function still returns all the
    occurrences for the year. Clipping is done later.
+   For the simple rules accepted by cal_obj_recurrence_is_simple () the
+   array is sorted and holds nothing before the event start.
    The finished flag is set to FALSE if there are more occurrences to generate
    after the given interval.*/
 static GArray*
@@ -1502,6 +1517,7 @@ cal_obj_expand_recurrence		(CalObjTime	  *event_start,
 	CalObjTime occ, *cotime;
 	GArray *all_occs, *occs;
 	gint len;
+	gboolean simple;
 
 	/* This is the resulting array of CalObjTime elements. */
 	all_occs = g_array_new (FALSE, FALSE, sizeof (CalObjTime));
@@ -1514,6 +1530,7 @@ cal_obj_expand_recurrence		(CalObjTime	  *event_start,
 
 	/* Calculate some useful data such as some fast lookup tables. */
 	cal_obj_initialize_recur_data (&recur_data, recur, event_start);
+	simple = cal_obj_recurrence_is_simple (recur);
 
 	/* Compute the event_end, if the recur's enddate is set. */
 	if (recur->enddate > 0) {
@@ -1543,47 +1560,57 @@ cal_obj_expand_recurrence		(CalObjTime	  *event_start,
 	/* Loop until the event ends or we go past the end of the required
 	   interval. */
 	for (;;) {
-		/* Generate the set of occurrences for this period. */
-		switch (recur->freq) {
-		case ICAL_YEARLY_RECURRENCE:
-			occs = cal_obj_generate_set_yearly (&recur_data,
-							    vtable, &occ);
-			break;
-		case ICAL_MONTHLY_RECURRENCE:
-			occs = cal_obj_generate_set_monthly (&recur_data,
-							     vtable, &occ);
-			break;
-		default:
-			occs = cal_obj_generate_set_default (&recur_data,
-							     vtable, &occ);
-			break;
-		}
+		if (simple) {
+			/* The set is computed directly, already sorted and
+			   clipped to the event start and end. */
+			cal_obj_generate_set_simple (&recur_data, &occ,
+						     event_start, event_end,
+						     all_occs);
+		} else {
+			/* Generate the set of occurrences for this period. */
+			switch (recur->freq) {
+			case ICAL_YEARLY_RECURRENCE:
+				occs = cal_obj_generate_set_yearly (
+					&recur_data, vtable, &occ);
+				break;
+			case ICAL_MONTHLY_RECURRENCE:
+				occs = cal_obj_generate_set_monthly (
+					&recur_data, vtable, &occ);
+				break;
+			default:
+				occs = cal_obj_generate_set_default (
+					&recur_data, vtable, &occ);
+				break;
+			}
 
-		/* Sort the occurrences and remove duplicates. */
-		cal_obj_sort_occurrences (occs);
-		cal_obj_remove_duplicates_and_invalid_dates (occs);
-
-		/* Apply the BYSETPOS property. */
-		occs = cal_obj_bysetpos_filter (recur, occs);
-
-		/* Remove any occs after event_end. */
-		len = occs->len - 1;
-		if (event_end) {
-			while (len >= 0) {
-				cotime = &g_array_index (occs, CalObjTime,
-							 len);
-				if (cal_obj_time_compare_func (cotime,
-							       event_end) <= 0)
-					break;
-				len--;
+			/* Sort the occurrences and remove duplicates. */
+			cal_obj_sort_occurrences (occs);
+			cal_obj_remove_duplicates_and_invalid_dates (occs);
+
+			/* Apply the BYSETPOS property. */
+			occs = cal_obj_bysetpos_filter (recur, occs);
+
+			/* Remove any occs after event_end. */
+			len = occs->len - 1;
+			if (event_end) {
+				while (len >= 0) {
+					cotime = &g_array_index (occs,
+								 CalObjTime,
+								 len);
+					if (cal_obj_time_compare_func (
+						    cotime, event_end) <= 0)
+						break;
+					len--;
+				}
 			}
-		}
 
-		/* Add the occurrences onto the main array. */
-		if (len >= 0)
-			g_array_append_vals (all_occs, occs->data, len + 1);
+			/* Add the occurrences onto the main array. */
+			if (len >= 0)
+				g_array_append_vals (all_occs, occs->data,
+						     len + 1);
 
-		g_array_free (occs, TRUE);
+			g_array_free (occs, TRUE);
+		}
 
 		/* Skip to the next period, or exit the loop if finished. */
 		if ((*vtable->find_next_position) (&occ, event_end,
@@ -1810,6 +1837,121 @@ cal_obj_generate_set_default	(RecurData *recur_data,
 	return occs;
 }
 
+/* Returns TRUE if the rule is one of the common shapes we can expand without
+   the generic filters, i.e. a DAILY rule, a WEEKLY rule with at most a plain
+   BYDAY, or a MONTHLY rule with at most a single BYMONTHDAY. */
+static gboolean
+cal_obj_recurrence_is_simple (ECalRecurrence *recur)
+{
+	GList *elem;
+	gint dayno;
+
+	if (recur->interval < 1)
+		return FALSE;
+
+	if (recur->bymonth || recur->byweekno || recur->byyearday
+	    || recur->byhour || recur->byminute || recur->bysecond
+	    || recur->bysetpos)
+		return FALSE;
+
+	switch (recur->freq) {
+	case ICAL_DAILY_RECURRENCE:
+		return !recur->bymonthday && !recur->byday;
+	case ICAL_WEEKLY_RECURRENCE:
+		if (recur->bymonthday)
+			return FALSE;
+
+		/* The byday list holds pairs of weekday and week number. */
+		for (elem = recur->byday; elem; elem = elem->next->next) {
+			if (GPOINTER_TO_INT (elem->next->data) != 0)
+				return FALSE;
+		}
+		return TRUE;
+	case ICAL_MONTHLY_RECURRENCE:
+		if (recur->byday)
+			return FALSE;
+		if (!recur->bymonthday)
+			return TRUE;
+		if (recur->bymonthday->next)
+			return FALSE;
+
+		dayno = GPOINTER_TO_INT (recur->bymonthday->data);
+		return dayno != 0 && dayno >= -31 && dayno <= 31;
+	default:
+		return FALSE;
+	}
+}
+
+/* Appends the occurrences of a simple rule for the period starting at occ to
+   the occs array, in order. This gives the same times as the generic set
+   functions followed by sorting, removing duplicates and invalid dates and
+   clipping to event_end, except that times before event_start are skipped
+   too, since they are thrown away later anyway. */
+static void
+cal_obj_generate_set_simple	(RecurData  *recur_data,
+				 CalObjTime *occ,
+				 CalObjTime *event_start,
+				 CalObjTime *event_end,
+				 GArray	    *occs)
+{
+	ECalRecurrence *recur = recur_data->recur;
+	CalObjTime cotime;
+	gint offset, weekday, days_in_month, dayno;
+
+	cotime = *occ;
+
+	switch (recur->freq) {
+	case ICAL_WEEKLY_RECURRENCE:
+		if (!recur->byday)
+			break;
+
+		/* The period always keeps the weekday of the event start, so
+		   we can step back to the start of the week and walk through
+		   it, which also drops repeated weekdays. */
+		cal_obj_time_add_days (&cotime, -recur_data->weekday_offset);
+		for (offset = 0; offset < 7; offset++) {
+			if (offset > 0)
+				cal_obj_time_add_days (&cotime, 1);
+
+			weekday = (offset + recur->week_start_day) % 7;
+			if (!recur_data->weekdays[weekday])
+				continue;
+			if (cal_obj_time_compare_func (&cotime, event_start) < 0)
+				continue;
+			if (event_end && cal_obj_time_compare_func (
+				    &cotime, event_end) > 0)
+				return;
+
+			g_array_append_val (occs, cotime);
+		}
+		return;
+	case ICAL_MONTHLY_RECURRENCE:
+		/* Days that don't exist in this month are moved to the last
+		   day of the month, as the generic code does. */
+		days_in_month = time_days_in_month (cotime.year, cotime.month);
+		if (recur->bymonthday) {
+			dayno = GPOINTER_TO_INT (recur->bymonthday->data);
+			if (dayno < 0)
+				dayno += days_in_month + 1;
+			if (dayno < 1 || dayno > days_in_month)
+				dayno = days_in_month;
+			cotime.day = dayno;
+		} else if (cotime.day > days_in_month) {
+			cotime.day = days_in_month;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (cal_obj_time_compare_func (&cotime, event_start) < 0)
+		return;
+	if (event_end && cal_obj_time_compare_func (&cotime, event_end) > 0)
+		return;
+
+	g_array_append_val (occs, cotime);
+}
+
 /* Returns the function table corresponding to the recurrence frequency. */
 static ECalRecurVTable* cal_obj_get_vtable (icalrecurrencetype_frequency recur_type)
 {
@@ -3739,7 +3881,7 @@ cal_object_time_from_time	(CalObjTime	*cotime,
 	struct icaltimetype tt;
 
 	if (zone)
-		tt = icaltime_from_timet_with_zone (t, FALSE, zone);
+		tt = time_to_icaltimetype_with_zone (t, FALSE, zone);
 	else
 		tt = icaltime_from_timet (t, FALSE);
 
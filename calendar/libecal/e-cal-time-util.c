@@ -730,3 +730,352 @@ tm_to_icaltimetype (struct tm *tm, gboolean is_date)
 	return itt;
 }
 
+
+/**************************************************************************
+ * Cached timezone lookups and conversions.
+ *
+ * Resolving a TZID to a builtin timezone and converting times with
+ * libical's timezone functions both walk lists of timezones or changes,
+ * and backends do that for every instance they expand. So we keep the
+ * builtin timezones we have looked up, and for each of them the UTC
+ * offsets of the years we have converted times in.
+ **************************************************************************/
+
+/* The years we keep the UTC offsets for, i.e. those time_t can hold. */
+#define TZ_CACHE_MIN_YEAR	1970
+#define TZ_CACHE_MAX_YEAR	2037
+
+/* If a year has more changes than this, we don't cache it. */
+#define TZ_CACHE_MAX_CHANGES	8
+
+#define SECONDS_PER_DAY		(24 * 60 * 60)
+
+typedef struct {
+	time_t utc;		/* The first second with the new offset. */
+	gint offset;
+} TzCacheChange;
+
+typedef struct {
+	gboolean filled;
+	gint start_offset;	/* The offset at the start of the UTC year. */
+	guint n_changes;	/* More than TZ_CACHE_MAX_CHANGES if unusable. */
+	TzCacheChange changes[TZ_CACHE_MAX_CHANGES];
+} TzCacheYear;
+
+typedef struct {
+	TzCacheYear years[TZ_CACHE_MAX_YEAR - TZ_CACHE_MIN_YEAR + 1];
+} TzCacheZone;
+
+static GStaticMutex tz_cache_lock = G_STATIC_MUTEX_INIT;
+
+/* TZID -> builtin icaltimezone, or NULL if it is not a builtin TZID. */
+static GHashTable *tz_cache_tzids = NULL;
+
+/* builtin icaltimezone -> TzCacheZone. The builtin timezones are never
+   freed, so unlike the timezones of calendars it is safe to key them by
+   their address. */
+static GHashTable *tz_cache_zones = NULL;
+
+/* Returns the number of days from 1 Jan 1970 to the given date, in the
+   proleptic Gregorian calendar. Month is 1 to 12. */
+static gint
+tz_cache_days_from_civil (gint year, gint month, gint day)
+{
+	gint era, yoe, doy, doe;
+
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/* The inverse of tz_cache_days_from_civil (). */
+static void
+tz_cache_civil_from_days (gint days, gint *year, gint *month, gint *day)
+{
+	gint era, doe, yoe, doy, mp;
+
+	days += 719468;
+	era = (days >= 0 ? days : days - 146096) / 146097;
+	doe = days - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+
+	*day = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
+
+static gint
+tz_cache_floor_days (time_t t)
+{
+	if (t >= 0)
+		return t / SECONDS_PER_DAY;
+
+	return -((-t + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
+}
+
+static gint
+tz_cache_get_offset_from_libical (icaltimezone *zone, time_t t)
+{
+	struct icaltimetype tt;
+
+	tt = icaltime_from_timet_with_zone (t, FALSE,
+					    icaltimezone_get_utc_timezone ());
+
+	return icaltimezone_get_utc_offset_of_utc_time (zone, &tt, NULL);
+}
+
+/* Finds the offsets used in the given UTC year by checking the offset at
+   the start of each day, and then bisecting the days where it changes. */
+static void
+tz_cache_fill_year (icaltimezone *zone, TzCacheYear *cy, gint year)
+{
+	time_t start, end, t, lo, hi, mid;
+	gint prev, offset;
+
+	start = (time_t) tz_cache_days_from_civil (year, 1, 1) * SECONDS_PER_DAY;
+	end = (time_t) tz_cache_days_from_civil (year + 1, 1, 1) * SECONDS_PER_DAY;
+
+	cy->filled = TRUE;
+	cy->n_changes = 0;
+	cy->start_offset = prev = tz_cache_get_offset_from_libical (zone, start);
+
+	for (t = start + SECONDS_PER_DAY; t <= end; t += SECONDS_PER_DAY) {
+		offset = tz_cache_get_offset_from_libical (zone, t);
+		if (offset == prev)
+			continue;
+
+		lo = t - SECONDS_PER_DAY;
+		hi = t;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (tz_cache_get_offset_from_libical (zone, mid) == prev)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		/* A change at the very start of the next year belongs to
+		   that year. */
+		if (hi >= end)
+			break;
+
+		if (cy->n_changes < TZ_CACHE_MAX_CHANGES) {
+			cy->changes[cy->n_changes].utc = hi;
+			cy->changes[cy->n_changes].offset = offset;
+		}
+		cy->n_changes++;
+
+		prev = offset;
+	}
+}
+
+/* Gets the offset of the zone at the given UTC time from the cache, filling
+   the year in if needed. Returns FALSE if the zone is not cached, or the
+   time is outside the cached years. */
+static gboolean
+tz_cache_get_offset (icaltimezone *zone, time_t t, gint *offset)
+{
+	TzCacheZone *cz;
+	TzCacheYear *cy, filled;
+	gint year, month, day;
+	gboolean found = FALSE;
+	guint i;
+
+	tz_cache_civil_from_days (tz_cache_floor_days (t), &year, &month, &day);
+	if (year < TZ_CACHE_MIN_YEAR || year > TZ_CACHE_MAX_YEAR)
+		return FALSE;
+
+	g_static_mutex_lock (&tz_cache_lock);
+
+	/* The zones are never freed, so cz stays valid while unlocked. */
+	cz = tz_cache_zones ? g_hash_table_lookup (tz_cache_zones, zone) : NULL;
+	if (!cz) {
+		g_static_mutex_unlock (&tz_cache_lock);
+		return FALSE;
+	}
+
+	cy = &cz->years[year - TZ_CACHE_MIN_YEAR];
+	if (!cy->filled) {
+		/* Filling a year takes hundreds of libical calls, so other
+		   threads are not kept waiting for it. Should two threads
+		   fill the same year, they compute the same table. */
+		g_static_mutex_unlock (&tz_cache_lock);
+		tz_cache_fill_year (zone, &filled, year);
+		g_static_mutex_lock (&tz_cache_lock);
+
+		if (!cy->filled)
+			*cy = filled;
+	}
+
+	if (cy->n_changes <= TZ_CACHE_MAX_CHANGES) {
+		*offset = cy->start_offset;
+		for (i = 0; i < cy->n_changes && cy->changes[i].utc <= t; i++)
+			*offset = cy->changes[i].offset;
+		found = TRUE;
+	}
+
+	g_static_mutex_unlock (&tz_cache_lock);
+
+	return found;
+}
+
+/**
+ * time_get_builtin_timezone_from_tzid:
+ * @tzid: A TZID.
+ *
+ * Looks up the builtin timezone with the given TZID, like
+ * icaltimezone_get_builtin_timezone_from_tzid(), but remembers the result,
+ * so repeated lookups of the same TZID are cheap. "UTC" gives the UTC
+ * timezone. This can be called from any thread.
+ *
+ * Conversions with time_from_icaltimetype_with_zone() and
+ * time_to_icaltimetype_with_zone() are faster for the timezones returned
+ * by this function.
+ *
+ * Returns: The builtin timezone, or NULL if @tzid is not a builtin TZID.
+ *
+ * Since: 3.0
+ **/
+icaltimezone *
+time_get_builtin_timezone_from_tzid (const gchar *tzid)
+{
+	gpointer zone = NULL;
+
+	if (!tzid || !*tzid)
+		return NULL;
+
+	if (!strcmp (tzid, "UTC"))
+		return icaltimezone_get_utc_timezone ();
+
+	g_static_mutex_lock (&tz_cache_lock);
+
+	if (!tz_cache_tzids) {
+		tz_cache_tzids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		tz_cache_zones = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	}
+
+	if (!g_hash_table_lookup_extended (tz_cache_tzids, tzid, NULL, &zone)) {
+		zone = icaltimezone_get_builtin_timezone_from_tzid (tzid);
+		g_hash_table_insert (tz_cache_tzids, g_strdup (tzid), zone);
+
+		if (zone && !g_hash_table_lookup (tz_cache_zones, zone))
+			g_hash_table_insert (tz_cache_zones, zone, g_new0 (TzCacheZone, 1));
+	}
+
+	g_static_mutex_unlock (&tz_cache_lock);
+
+	return zone;
+}
+
+/**
+ * time_from_icaltimetype_with_zone:
+ * @tt: A local time.
+ * @zone: The timezone of @tt, or NULL for a floating time.
+ *
+ * Converts a local time in the given timezone into a time_t value. The
+ * result is the same as icaltime_as_timet_with_zone() gives, but for the
+ * timezones returned by time_get_builtin_timezone_from_tzid() it is computed
+ * from cached UTC offsets, except close to the changes of the offset.
+ *
+ * Returns: The time_t value.
+ *
+ * Since: 3.0
+ **/
+time_t
+time_from_icaltimetype_with_zone (struct icaltimetype tt, icaltimezone *zone)
+{
+	time_t local;
+	gint guess, offset, before, after;
+
+	/* Leave anything unusual to libical, which normalizes the fields. */
+	if (tt.is_utc
+	    || tt.year < TZ_CACHE_MIN_YEAR || tt.year > TZ_CACHE_MAX_YEAR
+	    || tt.month < 1 || tt.month > 12
+	    || tt.day < 1 || tt.day > time_days_in_month (tt.year, tt.month - 1)
+	    || tt.hour < 0 || tt.hour > 23
+	    || tt.minute < 0 || tt.minute > 59
+	    || tt.second < 0 || tt.second > 59)
+		return icaltime_as_timet_with_zone (tt, zone);
+
+	local = (time_t) tz_cache_days_from_civil (tt.year, tt.month, tt.day) * SECONDS_PER_DAY
+		+ tt.hour * 3600 + tt.minute * 60 + tt.second;
+
+	if (!zone || zone == icaltimezone_get_utc_timezone ())
+		return local;
+
+	/* The local time is only unambiguous if the offset doesn't change
+	   around the UTC time we get, otherwise it may be in a gap or an
+	   overlap, and libical decides what it means. Offsets can jump by a
+	   whole day, so we look two days around it. */
+	if (tz_cache_get_offset (zone, local, &guess)
+	    && tz_cache_get_offset (zone, local - guess, &offset)
+	    && tz_cache_get_offset (zone, local - offset - 2 * SECONDS_PER_DAY, &before)
+	    && tz_cache_get_offset (zone, local - offset + 2 * SECONDS_PER_DAY, &after)
+	    && before == offset && after == offset)
+		return local - offset;
+
+	return icaltime_as_timet_with_zone (tt, zone);
+}
+
+/**
+ * time_to_icaltimetype_with_zone:
+ * @t: A time_t value.
+ * @is_date: Whether to return a DATE value.
+ * @zone: The timezone to convert to, or NULL to get the UTC time as a
+ * floating time.
+ *
+ * Converts a time_t value into a local time in the given timezone, like
+ * icaltime_from_timet_with_zone(), using cached UTC offsets for the timezones
+ * returned by time_get_builtin_timezone_from_tzid(). Only the date and time
+ * fields and is_date are set in the result.
+ *
+ * Returns: The local time.
+ *
+ * Since: 3.0
+ **/
+struct icaltimetype
+time_to_icaltimetype_with_zone (time_t t, gboolean is_date, icaltimezone *zone)
+{
+	struct icaltimetype tt, result;
+	time_t local;
+	gint offset = 0, days, secs;
+	gboolean found = TRUE;
+
+	if (zone && zone != icaltimezone_get_utc_timezone ())
+		found = tz_cache_get_offset (zone, t, &offset);
+
+	result = icaltime_null_time ();
+
+	if (!found) {
+		tt = icaltime_from_timet_with_zone (t, is_date, zone);
+		result.year = tt.year;
+		result.month = tt.month;
+		result.day = tt.day;
+		result.hour = tt.hour;
+		result.minute = tt.minute;
+		result.second = tt.second;
+		result.is_date = tt.is_date;
+
+		return result;
+	}
+
+	local = t + offset;
+	days = tz_cache_floor_days (local);
+	secs = local - (time_t) days * SECONDS_PER_DAY;
+
+	tz_cache_civil_from_days (days, &result.year, &result.month, &result.day);
+	result.is_date = is_date;
+	if (!is_date) {
+		result.hour = secs / 3600;
+		result.minute = (secs / 60) % 60;
+		result.second = secs % 60;
+	}
+
+	return result;
+}
@@ -117,6 +117,15 @@ struct tm icaltimetype_to_tm_with_zone (struct icaltimetype *itt,
 					icaltimezone *to_zone);
 struct icaltimetype tm_to_icaltimetype (struct tm *tm, gboolean is_date);
 
+/* Cached lookups of builtin timezones, and conversions between time_t and
+   local times using cached UTC offsets. These can be used from any thread. */
+icaltimezone *time_get_builtin_timezone_from_tzid (const gchar *tzid);
+time_t	time_from_icaltimetype_with_zone (struct icaltimetype tt,
+					  icaltimezone *zone);
+struct icaltimetype time_to_icaltimetype_with_zone (time_t t,
+						    gboolean is_date,
+						    icaltimezone *zone);
+
 G_END_DECLS
 
 #endif
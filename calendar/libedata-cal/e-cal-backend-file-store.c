@@ -22,6 +22,7 @@
 #include <string.h>
 #include "e-cal-backend-file-store.h"
 #include "libebackend/e-file-cache.h"
+#include "libecal/e-cal-time-util.h"
 #include <glib/gstdio.h>
 #include "libecal/e-cal-util.c" 
 
@@ -613,9 +614,7 @@ resolve_tzid (const gchar *tzid, gpointer user_data)
 {
 	icaltimezone *zone;
 
-	zone = (!strcmp (tzid, "UTC"))
-		? icaltimezone_get_utc_timezone ()
-		: icaltimezone_get_builtin_timezone_from_tzid (tzid);
+	zone = time_get_builtin_timezone_from_tzid (tzid);
 
 	if (!zone)
 		zone = (icaltimezone *) e_cal_backend_store_get_timezone (E_CAL_BACKEND_STORE (user_data), tzid);
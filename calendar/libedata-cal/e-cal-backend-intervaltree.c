@@ -32,21 +32,18 @@
 
 #define d(x) x
 
-#define _TIME_MIN	((time_t) 0)		/* Min valid time_t	*/
-#define _TIME_MAX	((time_t) INT_MAX)	/* Max valid time_t	*/
-#define DIRECTION_GO_LEFT 0
-#define DIRECTION_GO_RIGHT 1
-
 G_DEFINE_TYPE (EIntervalTree, e_intervaltree, G_TYPE_OBJECT)
 
 #define E_INTERVALTREE_GET_PRIVATE(obj) \
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), E_TYPE_INTERVALTREE, EIntervalTreePrivate))
 
-typedef struct _EIntervalNode EIntervalNode;
+/* rebuild when this many nodes were inserted or removed since the last
+ * rebuild, relative to the size of the sorted part */
+#define REBUILD_INSERTED(n_sorted) (64 + (n_sorted) / 32)
+#define REBUILD_REMOVED(n_sorted) (64 + (n_sorted) / 4)
 
-static EIntervalNode*
-intervaltree_node_next (EIntervalTree *tree, EIntervalNode *x);
+typedef struct _EIntervalNode EIntervalNode;
 
 struct _EIntervalNode
 {
@@ -54,42 +51,32 @@ struct _EIntervalNode
 	time_t start;
 	/* end of the interval */
 	time_t end;
-	/* maximum value of any interval stored in subtree rooted at node */
+	/* maximum end of any interval stored in the subtree rooted at node */
 	time_t max;
-	/* minimum value of any interval stored in subtree rooted at node */
-	time_t min;
-	/* color of the node (red or black) */
-	gboolean red;
 
+	/* NULL for nodes removed since the last rebuild */
 	ECalComponent *comp;
-
-	/* left child */
-	EIntervalNode* left;
-	/* right child */
-	EIntervalNode* right;
-	EIntervalNode* parent;
+	/* key of the node in id_node_hash */
+	gchar *key;
 };
 
 struct _EIntervalTreePrivate
 {
-	EIntervalNode *root;
-	EIntervalNode *nil;
+	/* The first n_sorted nodes are sorted by start and form an implicit
+	 * balanced tree: the root of each range of nodes is its middle node,
+	 * the left and right halves are its subtrees.  Nodes inserted since
+	 * the last rebuild follow unsorted; removed nodes of the sorted part
+	 * stay in place until the next rebuild.
+	 */
+	GArray *nodes;
+	guint n_sorted;
+	guint n_removed;
+
+	/* component key -> GUINT_TO_POINTER (index in nodes) */
 	GHashTable *id_node_hash;
 	GStaticRecMutex mutex;
 };
 
-static inline gint
-get_direction (EIntervalNode *x, time_t z_start, time_t z_end)
-{
-	if (x->start == z_start)
-		return x->end > z_end;
-
-	if (x->start > z_start)
-		return DIRECTION_GO_LEFT;
-	else
-		return DIRECTION_GO_RIGHT;
-}
-
 static inline gchar *
 component_key (const gchar *uid, const gchar *rid)
 {
@@ -126,160 +113,134 @@ compare_intervals (time_t x_start, time_t x_end, time_t y_start, time_t y_end)
 	return 0;
 }
 
-/**
- * left_rotate:
- * @tree: interval tree
- * @x: Node, where will be applied the operation
- * 
- * Carry out left rotation on the node @x in tree @tree.
- * Caller should hold the lock
- **/
-static void
-left_rotate (EIntervalTree *tree, EIntervalNode *x)
+static gint
+compare_nodes (gconstpointer a, gconstpointer b)
 {
-	EIntervalTreePrivate *priv;
-	EIntervalNode *y;
-	EIntervalNode *nil;
+	const EIntervalNode *x = a, *y = b;
 
-	g_return_if_fail (tree != NULL);
-	g_return_if_fail (x != NULL);
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
 
-	priv = tree->priv;
-	nil = priv->nil;
-	y = x->right;
-	x->right = y->left;
+	if (x->end != y->end)
+		return x->end < y->end ? -1 : 1;
+
+	return 0;
+}
 
-	if (y->left != nil)
-		y->left->parent = x;
+/* Computes the max field of the subtree of nodes[lo, hi), hi > lo */
+static time_t
+intervaltree_build (EIntervalNode *nodes, guint lo, guint hi)
+{
+	guint mid = lo + (hi - lo) / 2;
+	time_t max = nodes[mid].end;
 
-	y->parent = x->parent;
+	if (lo < mid)
+		max = MAX (max, intervaltree_build (nodes, lo, mid));
 
-	/* instead of checking if x->parent is the root as in the book, we */
-	/* count on the root sentinel to implicitly take care of this case */
-	if (x == x->parent->left)
-		x->parent->left = y;
-	else
-		x->parent->right = y;
+	if (mid + 1 < hi)
+		max = MAX (max, intervaltree_build (nodes, mid + 1, hi));
 
-	y->left = x;
-	x->parent = y;
+	nodes[mid].max = max;
 
-	/* update max and min field */
-	x->max = MAX (x->left->max, MAX (x->end, x->right->max));
-	y->max = MAX (x->max, MAX (y->end, y->right->max));
-	x->min = MIN (x->left->min, x->start);
-	y->min = MIN (x->min, y->start);
+	return max;
 }
 
 /**
- * right_rotate:
+ * intervaltree_rebuild:
  * @tree: interval tree
- * @y: Node, where will be applied the operation
- * 
- * Carry out right rotation on the node @y in tree @tree.
+ *
+ * Drops the removed nodes, sorts the inserted ones into place and
+ * recomputes the implicit tree.  Inserting many intervals and then
+ * rebuilding once is how a whole calendar is loaded.
  * Caller should hold the lock
  **/
 static void
-right_rotate (EIntervalTree *tree, EIntervalNode *y)
+intervaltree_rebuild (EIntervalTree *tree)
 {
-	EIntervalTreePrivate *priv;
-	EIntervalNode *x;
-	EIntervalNode *nil;
-
-	g_return_if_fail (tree != NULL);
-	g_return_if_fail (y != NULL);
-
-	priv = tree->priv;
-	nil = priv->nil;
-	x = y->left;
-	y->left = x->right;
-
-	if (nil != x->right)
-		x->right->parent = y;
+	EIntervalTreePrivate *priv = tree->priv;
+	EIntervalNode *nodes;
+	guint i, j;
 
-	x->parent = y->parent;
+	nodes = (EIntervalNode *) priv->nodes->data;
+	for (i = j = 0; i < priv->nodes->len; i++) {
+		if (!nodes[i].comp)
+			continue;
 
-	if (y == y->parent->left)
-		y->parent->left = x;
-	else
-		y->parent->right = x;
+		if (i != j)
+			nodes[j] = nodes[i];
+		j++;
+	}
 
-	x->right = y;
-	y->parent = x;
+	g_array_set_size (priv->nodes, j);
+	g_array_sort (priv->nodes, compare_nodes);
 
-	/* update max and min field */
-	y->max = MAX (y->left->max, MAX (y->right->max, y->end));
-	x->max = MAX (x->left->max, MAX (y->max, x->end));
-	y->min = MIN (y->left->min, y->start);
-	x->min = MIN (x->left->min, x->start);
-}
+	nodes = (EIntervalNode *) priv->nodes->data;
+	for (i = 0; i < priv->nodes->len; i++)
+		g_hash_table_insert (priv->id_node_hash, nodes[i].key, GUINT_TO_POINTER (i));
 
-static void
-fixup_min_max_fields (EIntervalTree *tree, EIntervalNode *node)
-{
-	EIntervalTreePrivate *priv = tree->priv;
-	while (node != priv->root)
-	{
-		node->max = MAX (node->end, MAX (node->left->max, node->right->max));
-		node->min = MIN (node->start, node->left->min);
+	if (priv->nodes->len > 0)
+		intervaltree_build (nodes, 0, priv->nodes->len);
 
-		node = node->parent;
-	}
+	priv->n_sorted = priv->nodes->len;
+	priv->n_removed = 0;
 }
 
 /* Caller should hold the lock */
-static void
-binary_tree_insert (EIntervalTree *tree, EIntervalNode *z)
+static gboolean
+intervaltree_remove_node (EIntervalTree *tree, const gchar *key)
 {
 	EIntervalTreePrivate *priv = tree->priv;
-	EIntervalNode *x;
-	EIntervalNode *y;
-	EIntervalNode *nil = priv->nil;
+	EIntervalNode *node;
+	gpointer orig_key, value;
+	guint i, last;
 
-	g_return_if_fail (tree != NULL);
-	g_return_if_fail (z != NULL);
+	if (!g_hash_table_lookup_extended (priv->id_node_hash, key, &orig_key, &value))
+		return FALSE;
 
-	z->left = z->right = nil;
-	y = priv->root;
-	x = priv->root->left;
+	g_hash_table_remove (priv->id_node_hash, key);
 
-	while ( x != nil)
-	{
-		y = x;
+	i = GPOINTER_TO_UINT (value);
+	node = &g_array_index (priv->nodes, EIntervalNode, i);
+
+	g_object_unref (node->comp);
+	g_free (node->key);
+
+	if (i < priv->n_sorted) {
+		/* leave a hole, the implicit tree stays valid */
+		node->comp = NULL;
+		node->key = NULL;
+		priv->n_removed++;
+	} else {
+		/* not sorted yet, move the last node in its place */
+		last = priv->nodes->len - 1;
+		if (i != last) {
+			*node = g_array_index (priv->nodes, EIntervalNode, last);
+			g_hash_table_insert (priv->id_node_hash, node->key, GUINT_TO_POINTER (i));
+		}
 
-		if (get_direction (x, z->start, z->end) == DIRECTION_GO_LEFT)
-			x = x->left;
-		else
-			x = x->right;
+		g_array_set_size (priv->nodes, last);
 	}
 
-	z->parent = y;
-
-	if ( (y == priv->root) || (get_direction (y, z->start, z->end) == DIRECTION_GO_LEFT))
-		y->left = z;
-	else
-		y->right = z;
-
-	/* update min and max fields */
-	y->min = MIN (y->left->min, y->start);
-	y->max = MAX (y->left->max, MAX (y->end, y->right->max));
+	return TRUE;
 }
 
 /**
  * e_intervaltree_insert:
  * @tree: interval tree
- * @key: the key to insert.
+ * @start: start of the interval
+ * @end: end of the interval
  * @comp: Component
- * 
+ *
+ * Inserts @comp into @tree, replacing any component with the same
+ * UID and RECURRENCE-ID.  The tree holds a reference on @comp.
+ *
  * Since: 2.32
  **/
 gboolean
 e_intervaltree_insert (EIntervalTree *tree, time_t start, time_t end, ECalComponent *comp)
 {
 	EIntervalTreePrivate *priv;
-	EIntervalNode *y;
-	EIntervalNode *x;
-	EIntervalNode *newNode;
+	EIntervalNode node;
 	const gchar *uid;
 	gchar *rid;
 
@@ -293,234 +254,109 @@ e_intervaltree_insert (EIntervalTree *tree, time_t start, time_t end, ECalCompon
 
 	e_cal_component_get_uid (comp, &uid);
 	rid = e_cal_component_get_recurid_as_string (comp);
-	e_intervaltree_remove (tree, uid, rid);
-
-	x = g_new (EIntervalNode, 1);
-	x->min = x->start = start;
-	x->max = x->end = end;
-	x->comp = g_object_ref (comp);
-
-	binary_tree_insert (tree, x);
-	newNode = x;
-	x->red = TRUE;
-
-	fixup_min_max_fields (tree, x->parent);
-	while (x->parent->red)
-	{ /* use sentinel instead of checking for root */
-		if (x->parent == x->parent->parent->left)
-		{
-			y = x->parent->parent->right;
-
-			if (y->red)
-			{
-				x->parent->red = FALSE;
-				y->red = FALSE;
-				x->parent->parent->red = TRUE;
-				x = x->parent->parent;
-			}
-			else
-			{
-				if (x == x->parent->right)
-				{
-					x = x ->parent;
-					left_rotate (tree, x);
-				}
-
-				x->parent->red = FALSE;
-				x->parent->parent->red = TRUE;
-				right_rotate (tree, x->parent->parent);
-			}
-		}
-		else
-		{ /* case for x->parent == x->parent->parent->right */
-			y = x->parent->parent->left;
-
-			if (y->red)
-			{
-				x->parent->red = FALSE;
-				y->red = FALSE;
-				x->parent->parent->red = TRUE;
-				x = x->parent->parent;
-			}
-			else
-			{
-				if (x == x->parent->left)
-				{
-					x = x->parent;
-					right_rotate (tree, x);
-				}
-
-				x->parent->red = FALSE;
-				x->parent->parent->red = TRUE;
-				left_rotate (tree, x->parent->parent);
-			}
-		}
-	}
 
-	priv->root->left->red = FALSE;
-	g_hash_table_insert (priv->id_node_hash, component_key (uid, rid), newNode);
+	node.start = start;
+	node.max = node.end = end;
+	node.comp = g_object_ref (comp);
+	node.key = component_key (uid, rid);
 	g_free (rid);
 
+	intervaltree_remove_node (tree, node.key);
+
+	g_array_append_val (priv->nodes, node);
+	g_hash_table_insert (priv->id_node_hash, node.key, GUINT_TO_POINTER (priv->nodes->len - 1));
+
 	g_static_rec_mutex_unlock (&priv->mutex);
 
 	return TRUE;
 }
 
-static EIntervalNode*
-intervaltree_node_next (EIntervalTree *tree, EIntervalNode *x)
+/**
+ * e_intervaltree_destroy:
+ * @tree: an #EIntervalTree
+ *
+ * Since: 2.32
+ **/
+void
+e_intervaltree_destroy (EIntervalTree *tree)
 {
-	EIntervalTreePrivate *priv;
-	EIntervalNode *y, *nil, *root;
+	g_return_if_fail (tree != NULL);
 
-	g_return_val_if_fail (tree != NULL, NULL);
-	g_return_val_if_fail (x != NULL, NULL);
+	g_object_unref (tree);
+}
 
-	priv = tree->priv;
-	g_return_val_if_fail (x != priv->nil, NULL);
+static void
+intervaltree_search_sorted (EIntervalNode *nodes, guint lo, guint hi,
+			    time_t start, time_t end, GPtrArray *result)
+{
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		EIntervalNode *node = &nodes[mid];
 
-	nil = priv->nil;
-	root = priv->root;
+		/* nothing in this subtree ends at or after start */
+		if (node->max < start)
+			return;
 
-	if (nil != (y = x->right))
-	{
-		/* find out minimum of right subtree of x (assignment to y is ok) */
-		while (y->left != nil)
-			y = y->left;
+		if (lo < mid)
+			intervaltree_search_sorted (nodes, lo, mid, start, end, result);
 
-		return y;
-	}
+		/* this node and all of its right subtree start after end */
+		if (node->start > end)
+			return;
 
-	y = x->parent;
+		if (node->comp && compare_intervals (node->start, node->end, start, end) == 0)
+			g_ptr_array_add (result, node->comp);
 
-	while (x == y->right)
-	{
-		x = y;
-		y = y->parent;
+		lo = mid + 1;
 	}
-
-	if (y == root)
-		return nil;
-
-	return y;
 }
 
 /**
- * e_intervaltree_destroy:
- * @tree: an #EIntervalTree
+ * e_intervaltree_search_array:
+ * @tree: interval tree
+ * @start: start of the interval
+ * @end: end of the interval
+ * @result: array to append the components to
  *
- * Since: 2.32
+ * Appends the components whose intervals overlap the given interval to
+ * @result.  Unlike e_intervaltree_search() the components are not
+ * referenced; they belong to @tree and the caller has to ensure they are
+ * not removed from it while it uses them.
+ *
+ * Returns: the number of components appended.
+ *
+ * Since: 3.0
  **/
-void
-e_intervaltree_destroy (EIntervalTree *tree)
+guint
+e_intervaltree_search_array (EIntervalTree *tree, time_t start, time_t end, GPtrArray *result)
 {
 	EIntervalTreePrivate *priv;
-	EIntervalNode *node;
-	GList *stack_start = NULL, *pos;
+	EIntervalNode *nodes;
+	guint i, len;
 
-	g_return_if_fail (tree != NULL);
+	g_return_val_if_fail (tree != NULL, 0);
+	g_return_val_if_fail (result != NULL, 0);
 
 	priv = tree->priv;
-	stack_start = pos = g_list_insert (stack_start, priv->root->left, -1);
+	g_static_rec_mutex_lock (&priv->mutex);
 
-	while (pos != NULL)
-	{
-		node = (EIntervalNode*) pos->data;
+	if (priv->nodes->len - priv->n_sorted > REBUILD_INSERTED (priv->n_sorted) ||
+	    priv->n_removed > REBUILD_REMOVED (priv->n_sorted))
+		intervaltree_rebuild (tree);
 
-		if (node != priv->nil)
-		{
-			pos = g_list_insert (pos, node->left, -1);
-			pos = g_list_insert (pos, node->right, -1);
+	len = result->len;
+	nodes = (EIntervalNode *) priv->nodes->data;
 
-			g_object_unref (node->comp);
-			g_free (node);
-		}
+	intervaltree_search_sorted (nodes, 0, priv->n_sorted, start, end, result);
 
-		pos = pos->next;
+	for (i = priv->n_sorted; i < priv->nodes->len; i++) {
+		if (compare_intervals (nodes[i].start, nodes[i].end, start, end) == 0)
+			g_ptr_array_add (result, nodes[i].comp);
 	}
 
-	g_list_free (stack_start);
-	g_object_unref (tree);
-}
-
-/* Caller should hold the lock */
-static void
-e_intervaltree_fixup_deletion (EIntervalTree *tree, EIntervalNode *x)
-{
-	EIntervalTreePrivate *priv = tree->priv;
-	EIntervalNode *root = priv->root->left;
-	EIntervalNode *w;
-
-	while ( (!x->red) && (root != x))
-	{
-		if (x == x->parent->left)
-		{
-			w = x->parent->right;
-
-			if (w->red)
-			{
-				w->red = FALSE;
-				x->parent->red = TRUE;
-				left_rotate (tree, x->parent);
-				w = x->parent->right;
-			}
-
-			if ((!w->right->red) && (!w->left->red))
-			{
-				w->red = TRUE;
-				x = x->parent;
-			}
-			else
-			{
-				if (!w->right->red)
-				{
-					w->left->red = FALSE;
-					w->red = TRUE;
-					right_rotate (tree, w);
-					w = x->parent->right;
-				}
-
-				w->red = x->parent->red;
-				x->parent->red = FALSE;
-				w->right->red = FALSE;
-				left_rotate (tree, x->parent);
-				x = root; /* this is to exit while loop */
-			}
-		} else {
-			w = x->parent->left;
-
-			if (w->red)
-			{
-				w->red = FALSE;
-				x->parent->red = TRUE;
-				right_rotate (tree, x->parent);
-				w = x->parent->left;
-			}
-
-			if ((!w->right->red) && (!w->left->red))
-			{
-				w->red = TRUE;
-				x = x->parent;
-			}
-			else
-			{
-				if (!w->left->red)
-				{
-					w->right->red = FALSE;
-					w->red = TRUE;
-					left_rotate (tree, w);
-					w = x->parent->left;
-				}
-
-				w->red = x->parent->red;
-				x->parent->red = FALSE;
-				w->left->red = FALSE;
-				right_rotate (tree, x->parent);
-				x = root; /* this is to exit while loop */
-			}
-		}
-	}
+	g_static_rec_mutex_unlock (&priv->mutex);
 
-	x->red = 0;
+	return result->len - len;
 }
 
 /**
@@ -536,114 +372,48 @@ e_intervaltree_fixup_deletion (EIntervalTree *tree, EIntervalNode *x)
 GList*
 e_intervaltree_search (EIntervalTree *tree, time_t start, time_t end)
 {
-	EIntervalTreePrivate *priv;
-	EIntervalNode *node;
+	GPtrArray *comps;
 	GList *list = NULL;
-	GList *stack_start = NULL, *pos;
+	guint i;
 
 	g_return_val_if_fail (tree != NULL, NULL);
 
-	priv = tree->priv;
-	g_static_rec_mutex_lock (&priv->mutex);
-
-	stack_start = pos = g_list_insert (stack_start, priv->root->left, -1);
-
-	while (pos != NULL)
-	{
-		node = (EIntervalNode*) pos->data;
+	comps = g_ptr_array_new ();
 
-		if (node != priv->nil)
-		{
-			if (compare_intervals (node->start, node->end, start, end) == 0)
-			{
-				list = g_list_insert (list, node->comp, -1);
-				g_object_ref (node->comp);
-			}
+	g_static_rec_mutex_lock (&tree->priv->mutex);
 
-			if (compare_intervals (node->left->min, node->left->max, start, end) == 0)
-				pos = g_list_insert (pos, node->left, -1);
+	e_intervaltree_search_array (tree, start, end, comps);
 
-			if (compare_intervals (node->right->min, node->right->max, start, end) == 0)
-				pos = g_list_insert (pos, node->right, -1);
-		}
+	for (i = comps->len; i > 0; i--)
+		list = g_list_prepend (list, g_object_ref (comps->pdata[i - 1]));
 
-		pos = pos->next;
-	}
+	g_static_rec_mutex_unlock (&tree->priv->mutex);
 
-	g_list_free (stack_start);
-
-	g_static_rec_mutex_unlock (&priv->mutex);
+	g_ptr_array_free (comps, TRUE);
 
 	return list;
 }
 
 #ifdef E_INTERVALTREE_DEBUG
-static void
-e_intervaltree_node_dump (EIntervalTree *tree, EIntervalNode *node, gint indent)
-{
-	/*
-	gchar start_time[32] = {0}, end_time[32] = {0};
-	struct tm tm_start_time, tm_end_time;
-
-	localtime_r (&node->start, &tm_start_time);
-	localtime_r (&node->end, &tm_end_time);
-	strftime(start_time, sizeof (start_time), "%Y-%m-%d T%H:%M:%S", &tm_start_time);
-	strftime(end_time, sizeof (end_time), "%Y-%m-%d T%H:%M:%S", &tm_end_time);
-	g_print ("%*s[%s - %s]\n", indent, "", start_time, end_time);
-	*/
-	EIntervalTreePrivate *priv = tree->priv;
-	if (node != priv->nil)
-		g_print ("%*s[%ld - %ld] [%ld - %ld] red %d\n", indent, "", node->start,
-				node->end, node->min, node->max, node->red);
-	else
-	{
-		g_print ("%*s[ - ]\n", indent, ""); 
-		return;
-	}
-
-	e_intervaltree_node_dump (tree, node->left, indent + 2);
-	e_intervaltree_node_dump (tree, node->right, indent + 2);
-}
-
 void
 e_intervaltree_dump (EIntervalTree *tree)
 {
 	EIntervalTreePrivate *priv = tree->priv;
-	if (priv->root)
-		  e_intervaltree_node_dump (tree, priv->root, 0);
-}
-#endif
-
-/**
-  * Caller should hold the lock.	
- **/
-static EIntervalNode *
-e_intervaltree_search_component (EIntervalTree *tree,
-				 const gchar *searched_uid,
-				 const gchar *searched_rid)
-{
-	EIntervalTreePrivate *priv;
-	EIntervalNode *node;
-	gchar *key;
+	guint i;
 
-	g_return_val_if_fail (tree != NULL, NULL);
-	g_return_val_if_fail (searched_uid != NULL, NULL);
+	for (i = 0; i < priv->nodes->len; i++) {
+		EIntervalNode *node = &g_array_index (priv->nodes, EIntervalNode, i);
 
-	priv = tree->priv;
-	if (!searched_uid)
-	{
-		g_warning ("Searching the interval tree, the component "
-			   " does not have a valid UID skipping it\n");
+		if (i == priv->n_sorted)
+			g_print ("-- not sorted yet --\n");
 
-		return NULL;
+		if (node->comp)
+			g_print ("%u [%ld - %ld] max %ld\n", i, node->start, node->end, node->max);
+		else
+			g_print ("%u [ - ]\n", i);
 	}
-
-	key = component_key (searched_uid, searched_rid);
-	node = g_hash_table_lookup (priv->id_node_hash, key);
-	g_free (key);
-
-	return node;
 }
+#endif
 
 /**
  * e_intervaltree_remove:
@@ -657,88 +427,22 @@ e_intervaltree_remove (EIntervalTree *tree,
 		       const gchar *rid)
 {
 	EIntervalTreePrivate *priv;
-	EIntervalNode *y;
-	EIntervalNode *x;
-	EIntervalNode *z;
-	EIntervalNode *nil, *root;
+	gboolean removed;
 	gchar *key;
 
 	g_return_val_if_fail (tree != NULL, FALSE);
+	g_return_val_if_fail (uid != NULL, FALSE);
 
 	priv = tree->priv;
-	nil = priv->nil;
-	root = priv->root;
 	g_static_rec_mutex_lock (&priv->mutex);
 
-	z = e_intervaltree_search_component (tree, uid, rid);
-
-	if (!z || z == nil) {
-		g_static_rec_mutex_unlock (&priv->mutex);
-		return FALSE;
-	}
-
-	y = ((z->left == nil) || (z->right == nil)) ? z : intervaltree_node_next (tree, z);
-	x = (y->left == nil) ? y->right : y->left;
-	/* y is to be spliced out. x is it's only child */
-
-	x->parent = y->parent;
-
-	if (root == x->parent)
-		root->left = x;
-	else
-	{
-		if (y == y->parent->left)
-			y->parent->left = x;
-		else
-			y->parent->right = x;
-	}
-
-	if (y != z)
-	{
-		/* y (the succesor of z) is the node to be spliced out */
-		g_return_val_if_fail (y != priv->nil, FALSE);
-
-		y->max = _TIME_MIN;
-		y->min = _TIME_MAX;
-		y->left = z->left;
-		y->right = z->right;
-		y->parent = z->parent;
-		z->left->parent = z->right->parent = y;
-
-		if (z == z->parent->left)
-			z->parent->left = y;
-		else
-			z->parent->right = y;
-
-		fixup_min_max_fields (tree, x->parent);
-
-		if (!(y->red))
-		{
-			y->red = z->red;
-			e_intervaltree_fixup_deletion (tree, x);
-		}
-		else
-			y->red = z->red;
-	}
-	else
-	{
-		/* z is the node to be spliced out */
-
-		fixup_min_max_fields (tree, x->parent);
-
-		if (!(y->red))
-			e_intervaltree_fixup_deletion (tree, x);
-	}
-
 	key = component_key (uid, rid);
-	g_hash_table_remove (priv->id_node_hash, key);
+	removed = intervaltree_remove_node (tree, key);
 	g_free (key);
 
-	g_object_unref (z->comp);
-	g_free (z);
 	g_static_rec_mutex_unlock (&priv->mutex);
 
-	return TRUE;
+	return removed;
 }
 
 static void
@@ -746,14 +450,20 @@ e_intervaltree_finalize (GObject *object)
 {
 	EIntervalTreePrivate *priv = E_INTERVALTREE_GET_PRIVATE (object);
 
-	if (priv->root) {
-		g_free (priv->root);
-		priv->root = NULL;
-	}
+	if (priv->nodes) {
+		guint i;
 
-	if (priv->nil) {
-		g_free (priv->nil);
-		priv->nil = NULL;
+		for (i = 0; i < priv->nodes->len; i++) {
+			EIntervalNode *node = &g_array_index (priv->nodes, EIntervalNode, i);
+
+			if (node->comp) {
+				g_object_unref (node->comp);
+				g_free (node->key);
+			}
+		}
+
+		g_array_free (priv->nodes, TRUE);
+		priv->nodes = NULL;
 	}
 
 	if (priv->id_node_hash) {
@@ -778,27 +488,17 @@ static void
 e_intervaltree_init (EIntervalTree *tree)
 {
 	EIntervalTreePrivate *priv;
-	EIntervalNode *root, *nil;
 
 	tree->priv = E_INTERVALTREE_GET_PRIVATE (tree);
 	priv = tree->priv;
 
-	priv->nil = nil = g_new (EIntervalNode, 1);
-	nil->parent = nil->left = nil->right = nil;
-	nil->red = FALSE;
-	nil->start = nil->end = nil->max = _TIME_MIN;
-	nil->min = _TIME_MAX;
-
-	priv->root = root = g_new (EIntervalNode, 1);
-	root->parent = root->left = root->right = nil;
-	root->red = FALSE;
-	root->start = _TIME_MAX;
-	root->end = 0;
-	root->max = _TIME_MAX;
-	root->min = _TIME_MIN;
+	priv->nodes = g_array_new (FALSE, FALSE, sizeof (EIntervalNode));
+	priv->n_sorted = 0;
+	priv->n_removed = 0;
 
 	g_static_rec_mutex_init (&priv->mutex);
-	priv->id_node_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	/* the keys belong to the nodes */
+	priv->id_node_hash = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 /**
@@ -39,11 +39,10 @@ G_BEGIN_DECLS
 
 /* #undef E_INTERVALTREE_DEBUG */
 /*
- * Implementation of the interval node as described in Introduction to Algorithms
- * book by Cormen et al, chapter 14.3.
- *
- * Basically, the interval tree is the red-black tree, the node key is the start
- * of the interval.
+ * Interval tree stored in a contiguous array: the intervals are kept sorted
+ * by their start, and each range of the array is an implicit subtree rooted
+ * at its middle element, which records the maximum end of the range.  Nodes
+ * inserted since the last search are appended and sorted in on demand.
  */
 
 typedef struct _EIntervalTree EIntervalTree;
@@ -78,6 +77,8 @@ void e_intervaltree_destroy (EIntervalTree *tree);
 
 GList*
 e_intervaltree_search (EIntervalTree *tree, time_t start, time_t end);
+
+guint e_intervaltree_search_array (EIntervalTree *tree, time_t start, time_t end, GPtrArray *result);
 #ifdef E_INTERVALTREE_DEBUG
 void e_intervaltree_dump (EIntervalTree *tree);
 #endif
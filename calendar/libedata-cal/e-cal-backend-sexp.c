@@ -39,6 +39,7 @@ struct _ECalBackendSExpPrivate {
 	ESExp *search_sexp;
 	gchar *text;
 	SearchContext *search_context;
+	GSList *index_keys;
 };
 
 struct _SearchContext {
@@ -335,7 +336,7 @@ resolve_tzid (const gchar *tzid, gpointer user_data)
 
 	if (!tzid || !tzid[0])
 		return NULL;
-        else if (!strcmp (tzid, "UTC"))
+	else if (!strcmp (tzid, "UTC"))
 		return icaltimezone_get_utc_timezone ();
 
 	return e_cal_backend_internal_get_timezone (ctx->backend, tzid);
@@ -387,10 +388,10 @@ func_occur_in_time_range (ESExp *esexp, gint argc, ESExpResult **argv, gpointer
 		default_zone = icaltimezone_get_utc_timezone ();
 
 	ctx->occurs = FALSE;
-	e_cal_recur_generate_instances (ctx->comp, start, end,
-					(ECalRecurInstanceFn) check_instance_time_range_cb,
-					ctx, resolve_tzid, ctx,
-					default_zone);
+	e_cal_backend_generate_instances (ctx->backend, ctx->comp, start, end,
+					  (ECalRecurInstanceFn) check_instance_time_range_cb,
+					  ctx, resolve_tzid, ctx,
+					  default_zone);
 
 	result = e_sexp_result_new (esexp, ESEXP_RES_BOOL);
 	result->value.boolean = ctx->occurs;
@@ -1292,6 +1293,207 @@ e_cal_backend_sexp_evaluate_occur_times (ECalBackendSExp *sexp, time_t *start, t
 	return e_sexp_evaluate_occur_times (sexp->priv->search_sexp, start, end);
 }
 
+/* Index keys name component properties which a backend can keep in a
+ * secondary index.  The strings produced for an expression and for a
+ * component must agree with the corresponding search functions above.
+ */
+
+static gchar *
+index_key_uid (const gchar *uid)
+{
+	GString *key;
+	const gchar *p;
+
+	if (!g_utf8_validate (uid, -1, NULL))
+		return NULL;
+
+	/* lower the case the same way func_uid() compares */
+	key = g_string_new ("uid:");
+	for (p = uid; *p; p = g_utf8_next_char (p))
+		g_string_append_unichar (key, g_unichar_tolower (g_utf8_get_char (p)));
+
+	return g_string_free (key, FALSE);
+}
+
+static const gchar *
+index_key_status (icalproperty_status status)
+{
+	/* see matches_status() */
+	switch (status) {
+	case ICAL_STATUS_NONE:
+		return "status:NOT STARTED";
+	case ICAL_STATUS_COMPLETED:
+		return "status:COMPLETED";
+	case ICAL_STATUS_CANCELLED:
+		return "status:CANCELLED";
+	case ICAL_STATUS_INPROCESS:
+		return "status:IN PROGRESS";
+	default:
+		return NULL;
+	}
+}
+
+static gboolean
+term_is_func (ESExpTerm *t, const gchar *name)
+{
+	return (t->type == ESEXP_TERM_FUNC || t->type == ESEXP_TERM_IFUNC)
+		&& t->value.func.sym != NULL
+		&& strcmp (t->value.func.sym->name, name) == 0;
+}
+
+static GSList *
+collect_index_keys (ESExpTerm *t, GSList *keys)
+{
+	ESExpTerm **argv;
+	gint argc, i;
+
+	if (t->type != ESEXP_TERM_FUNC && t->type != ESEXP_TERM_IFUNC)
+		return keys;
+
+	argc = t->value.func.termcount;
+	argv = t->value.func.terms;
+
+	if (term_is_func (t, "and")) {
+		/* every operand has to hold */
+		for (i = 0; i < argc; i++)
+			keys = collect_index_keys (argv[i], keys);
+	} else if (term_is_func (t, "uid?")) {
+		if (argc == 1 && argv[0]->type == ESEXP_TERM_STRING) {
+			gchar *key = index_key_uid (argv[0]->value.string);
+
+			if (key)
+				keys = g_slist_prepend (keys, key);
+		}
+	} else if (term_is_func (t, "has-categories?")) {
+		if (argc == 1 && argv[0]->type == ESEXP_TERM_BOOL)
+			return g_slist_prepend (keys, g_strdup ("unfiled"));
+
+		for (i = 0; i < argc; i++)
+			if (argv[i]->type != ESEXP_TERM_STRING)
+				return keys;
+
+		for (i = 0; i < argc; i++)
+			keys = g_slist_prepend (keys, g_strconcat ("category:", argv[i]->value.string, NULL));
+	} else if (term_is_func (t, "is-completed?")) {
+		if (argc == 0)
+			keys = g_slist_prepend (keys, g_strdup ("completed:yes"));
+	} else if (term_is_func (t, "not")) {
+		if (argc == 1 && term_is_func (argv[0], "is-completed?")
+		    && argv[0]->value.func.termcount == 0)
+			keys = g_slist_prepend (keys, g_strdup ("completed:no"));
+	} else if (term_is_func (t, "contains?")) {
+		const gchar *field, *str;
+
+		if (argc != 2 || argv[0]->type != ESEXP_TERM_STRING || argv[1]->type != ESEXP_TERM_STRING)
+			return keys;
+
+		field = argv[0]->value.string;
+		str = argv[1]->value.string;
+
+		if (strcmp (field, "priority") == 0) {
+			if (g_str_equal (str, "HIGH") || g_str_equal (str, "NORMAL") || g_str_equal (str, "LOW"))
+				keys = g_slist_prepend (keys, g_strconcat ("priority:", str, NULL));
+		} else if (strcmp (field, "status") == 0) {
+			if (g_str_equal (str, "NOT STARTED") || g_str_equal (str, "COMPLETED")
+			    || g_str_equal (str, "CANCELLED") || g_str_equal (str, "IN PROGRESS"))
+				keys = g_slist_prepend (keys, g_strconcat ("status:", str, NULL));
+		}
+	}
+
+	return keys;
+}
+
+/**
+ * e_cal_backend_sexp_get_index_keys:
+ * @sexp: An #ECalBackendSExp object.
+ *
+ * Returns the index keys which every component matching @sexp has, as
+ * returned by e_cal_backend_sexp_get_component_index_keys().  They are
+ * taken from the uid?, has-categories?, is-completed? and the status and
+ * priority contains? tests which the whole expression depends on.
+ *
+ * A backend keeping an index of these keys only needs to match the
+ * components which have all of them, instead of all its components.
+ *
+ * Returns: A list of strings owned by @sexp, or %NULL if the expression
+ * cannot be answered from an index.
+ *
+ * Since: 3.0
+ */
+const GSList *
+e_cal_backend_sexp_get_index_keys (ECalBackendSExp *sexp)
+{
+	g_return_val_if_fail (E_IS_CAL_BACKEND_SEXP (sexp), NULL);
+
+	return sexp->priv->index_keys;
+}
+
+/**
+ * e_cal_backend_sexp_get_component_index_keys:
+ * @comp: An #ECalComponent.
+ *
+ * Computes the index keys of @comp, for backends which keep an index of
+ * their components to answer the keys of e_cal_backend_sexp_get_index_keys().
+ *
+ * Returns: A newly allocated list of newly allocated strings.  Free it
+ * with g_slist_foreach (keys, (GFunc) g_free, NULL) and g_slist_free().
+ *
+ * Since: 3.0
+ */
+GSList *
+e_cal_backend_sexp_get_component_index_keys (ECalComponent *comp)
+{
+	GSList *keys = NULL, *categories, *l;
+	const gchar *uid = NULL, *key;
+	struct icaltimetype *completed = NULL;
+	icalproperty_status status;
+	gint *priority = NULL;
+
+	g_return_val_if_fail (E_IS_CAL_COMPONENT (comp), NULL);
+
+	e_cal_component_get_uid (comp, &uid);
+	if (uid) {
+		gchar *uid_key = index_key_uid (uid);
+
+		if (uid_key)
+			keys = g_slist_prepend (keys, uid_key);
+	}
+
+	e_cal_component_get_categories_list (comp, &categories);
+	for (l = categories; l; l = l->next)
+		keys = g_slist_prepend (keys, g_strconcat ("category:", l->data, NULL));
+	if (!categories)
+		keys = g_slist_prepend (keys, g_strdup ("unfiled"));
+	e_cal_component_free_categories_list (categories);
+
+	e_cal_component_get_completed (comp, &completed);
+	keys = g_slist_prepend (keys, g_strdup (completed ? "completed:yes" : "completed:no"));
+	if (completed)
+		e_cal_component_free_icaltimetype (completed);
+
+	/* see matches_priority() */
+	e_cal_component_get_priority (comp, &priority);
+	if (priority && *priority) {
+		if (*priority <= 4)
+			key = "priority:HIGH";
+		else if (*priority == 5)
+			key = "priority:NORMAL";
+		else
+			key = "priority:LOW";
+
+		keys = g_slist_prepend (keys, g_strdup (key));
+	}
+	if (priority)
+		e_cal_component_free_priority (priority);
+
+	e_cal_component_get_status (comp, &status);
+	key = index_key_status (status);
+	if (key)
+		keys = g_slist_prepend (keys, g_strdup (key));
+
+	return keys;
+}
+
 /**
  * e_cal_backend_sexp_match_comp:
  * @sexp: An #ESExp object.
@@ -1398,9 +1600,12 @@ e_cal_backend_sexp_new (const gchar *text)
 
 	if (esexp_error == -1) {
 		g_object_unref (sexp);
-		sexp = NULL;
+		return NULL;
 	}
 
+	if (sexp->priv->search_sexp->tree)
+		sexp->priv->index_keys = collect_index_keys (sexp->priv->search_sexp->tree, NULL);
+
 	return sexp;
 }
 
@@ -1435,6 +1640,9 @@ e_cal_backend_sexp_dispose (GObject *object)
 
 		g_free (sexp->priv->text);
 
+		g_slist_foreach (sexp->priv->index_keys, (GFunc) g_free, NULL);
+		g_slist_free (sexp->priv->index_keys);
+
 		g_free (sexp->priv->search_context);
 		g_free (sexp->priv);
 		sexp->priv = NULL;
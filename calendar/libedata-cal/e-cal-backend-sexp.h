@@ -63,6 +63,9 @@ gboolean         e_cal_backend_sexp_match_comp   (ECalBackendSExp *sexp,
 						  ECalComponent   *comp,
 						  ECalBackend     *backend);
 
+const GSList    *e_cal_backend_sexp_get_index_keys           (ECalBackendSExp *sexp);
+GSList          *e_cal_backend_sexp_get_component_index_keys (ECalComponent   *comp);
+
 /* Default implementations of time functions for use by subclasses */
 
 ESExpResult *e_cal_backend_sexp_func_time_now       (ESExp *esexp, gint argc, ESExpResult **argv, gpointer data);
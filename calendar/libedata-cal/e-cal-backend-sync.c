@@ -12,6 +12,7 @@
 
 #include "e-cal-backend-sync.h"
 #include <libical/icaltz-util.h>
+#include <libecal/e-cal-time-util.h>
 
 G_DEFINE_TYPE (ECalBackendSync, e_cal_backend_sync, E_TYPE_CAL_BACKEND)
 
@@ -860,7 +861,7 @@ _e_cal_backend_internal_get_timezone (ECalBackend *backend, const gchar *tzid)
 	if (!tzid || !*tzid)
 		return NULL;
 
-	zone = icaltimezone_get_builtin_timezone_from_tzid (tzid);
+	zone = time_get_builtin_timezone_from_tzid (tzid);
 
 	if (!zone) {
 		const gchar *s, *slash1 = NULL, *slash2 = NULL;
@@ -67,6 +67,12 @@ struct _ECalBackendPrivate {
 	 * we do not send multiple notifications with the same percent
 	 * value */
 	gint last_percent_notified;
+
+	/* Occurrences of recurring components, UID -> GHashTable of
+	 * revision key -> RecurCacheEntry */
+	GMutex *recur_cache_lock;
+	GHashTable *recur_cache;
+	guint recur_cache_n_entries;
 };
 
 /* Property IDs */
@@ -87,6 +93,7 @@ enum {
 static guint signals[LAST_SIGNAL];
 
 static void e_cal_backend_remove_client_private (ECalBackend *backend, EDataCal *cal, gboolean weak_unref);
+static void clear_recur_cache (ECalBackend *backend);
 
 G_DEFINE_TYPE (ECalBackend, e_cal_backend, G_TYPE_OBJECT);
 
@@ -273,6 +280,9 @@ cal_backend_finalize (GObject *object)
 	g_mutex_free (priv->clients_mutex);
 	g_mutex_free (priv->queries_mutex);
 
+	g_hash_table_destroy (priv->recur_cache);
+	g_mutex_free (priv->recur_cache_lock);
+
 	g_free (priv->uri);
 	g_free (priv->cache_dir);
 
@@ -371,6 +381,11 @@ e_cal_backend_init (ECalBackend *backend)
 		(EListCopyFunc) NULL,
 		(EListFreeFunc) NULL, NULL);
 	backend->priv->queries_mutex = g_mutex_new ();
+
+	backend->priv->recur_cache = g_hash_table_new_full (
+		g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify) g_hash_table_destroy);
+	backend->priv->recur_cache_lock = g_mutex_new ();
 }
 
 /**
@@ -1080,6 +1095,9 @@ e_cal_backend_receive_objects (ECalBackend *backend, EDataCal *cal, EServerMetho
 
 	g_assert (CLASS (backend)->receive_objects != NULL);
 	(* CLASS (backend)->receive_objects) (backend, cal, context, calobj);
+
+	/* the objects may come with timezones */
+	clear_recur_cache (backend);
 }
 
 /**
@@ -1139,6 +1157,8 @@ e_cal_backend_set_default_zone (ECalBackend *backend, EDataCal *cal, EServerMeth
 	g_return_if_fail (tzobj != NULL);
 
 	(* CLASS (backend)->set_default_zone) (backend, cal, context, tzobj);
+
+	clear_recur_cache (backend);
 }
 
 /**
@@ -1157,6 +1177,10 @@ e_cal_backend_add_timezone (ECalBackend *backend, EDataCal *cal, EServerMethodCo
 	g_return_if_fail (CLASS (backend)->add_timezone != NULL);
 
 	(* CLASS (backend)->add_timezone) (backend, cal, context, tzobj);
+
+	/* occurrences generated before may have fallen back to the
+	 * default timezone, or used another definition of it */
+	clear_recur_cache (backend);
 }
 
 /**
@@ -1191,6 +1215,296 @@ e_cal_backend_internal_get_timezone (ECalBackend *backend, const gchar *tzid)
 	return (* CLASS (backend)->internal_get_timezone) (backend, tzid);
 }
 
+/* Occurrences of recurring components are cached per UID and revision, see
+ * e_cal_backend_generate_instances() */
+#define RECUR_CACHE_MAX_ENTRIES   2048
+#define RECUR_CACHE_MAX_INSTANCES 10000
+
+typedef struct {
+	time_t start;
+	time_t end;
+} RecurInstance;
+
+typedef struct {
+	/* the window the instances were generated for */
+	time_t start;
+	time_t end;
+
+	/* RecurInstance sorted by start */
+	GArray *instances;
+} RecurCacheEntry;
+
+static void
+free_recur_cache_entry (RecurCacheEntry *entry)
+{
+	g_array_free (entry->instances, TRUE);
+	g_free (entry);
+}
+
+/* Returns a key for the revision of comp: its properties which the
+ * occurrences depend on, serialized, and the default timezone used to
+ * generate them */
+static gchar *
+get_recur_cache_key (ECalComponent *comp, icaltimezone *default_timezone)
+{
+	static const icalproperty_kind kinds[] = {
+		ICAL_DTSTART_PROPERTY,
+		ICAL_DTEND_PROPERTY,
+		ICAL_DUE_PROPERTY,
+		ICAL_DURATION_PROPERTY,
+		ICAL_RECURRENCEID_PROPERTY,
+		ICAL_RRULE_PROPERTY,
+		ICAL_RDATE_PROPERTY,
+		ICAL_EXRULE_PROPERTY,
+		ICAL_EXDATE_PROPERTY
+	};
+	icalcomponent *icalcomp;
+	icalproperty *prop;
+	GString *key;
+	guint i;
+
+	icalcomp = e_cal_component_get_icalcomponent (comp);
+	key = g_string_new (default_timezone ? icaltimezone_get_tzid (default_timezone) : "");
+	g_string_append_c (key, '\n');
+
+	for (i = 0; i < G_N_ELEMENTS (kinds); i++) {
+		for (prop = icalcomponent_get_first_property (icalcomp, kinds[i]);
+		     prop;
+		     prop = icalcomponent_get_next_property (icalcomp, kinds[i])) {
+			gchar *str = icalproperty_as_ical_string_r (prop);
+
+			g_string_append (key, str);
+			g_free (str);
+		}
+	}
+
+	return g_string_free (key, FALSE);
+}
+
+static gboolean
+add_recur_instance_cb (ECalComponent *comp, time_t instance_start, time_t instance_end, gpointer data)
+{
+	GArray *instances = data;
+	RecurInstance instance;
+
+	instance.start = instance_start;
+	instance.end = instance_end;
+	g_array_append_val (instances, instance);
+
+	/* too many to be worth keeping */
+	return instances->len <= RECUR_CACHE_MAX_INSTANCES;
+}
+
+static gint
+compare_recur_instances (gconstpointer a, gconstpointer b)
+{
+	const RecurInstance *ia = a, *ib = b;
+
+	if (ia->start != ib->start)
+		return ia->start < ib->start ? -1 : 1;
+	if (ia->end != ib->end)
+		return ia->end < ib->end ? -1 : 1;
+
+	return 0;
+}
+
+/* Drops all the kept occurrences, for when a timezone they were
+ * generated in may have changed */
+static void
+clear_recur_cache (ECalBackend *backend)
+{
+	ECalBackendPrivate *priv = backend->priv;
+
+	g_mutex_lock (priv->recur_cache_lock);
+
+	g_hash_table_remove_all (priv->recur_cache);
+	priv->recur_cache_n_entries = 0;
+
+	g_mutex_unlock (priv->recur_cache_lock);
+}
+
+static void
+invalidate_recur_cache (ECalBackend *backend, const gchar *uid)
+{
+	ECalBackendPrivate *priv = backend->priv;
+	GHashTable *revisions;
+
+	if (!uid)
+		return;
+
+	g_mutex_lock (priv->recur_cache_lock);
+
+	revisions = g_hash_table_lookup (priv->recur_cache, uid);
+	if (revisions) {
+		priv->recur_cache_n_entries -= g_hash_table_size (revisions);
+		g_hash_table_remove (priv->recur_cache, uid);
+	}
+
+	g_mutex_unlock (priv->recur_cache_lock);
+}
+
+/**
+ * e_cal_backend_generate_instances:
+ * @backend: an #ECalBackend
+ * @comp: A calendar component object.
+ * @start: Range start time.
+ * @end: Range end time.
+ * @cb: Callback function.
+ * @cb_data: Closure data for the callback function.
+ * @tz_cb: Callback for retrieving timezones.
+ * @tz_cb_data: Closure data for the timezone callback.
+ * @default_timezone: Default timezone to use when a timezone cannot be
+ * found.
+ *
+ * Like e_cal_recur_generate_instances(), but the occurrences of recurring
+ * components are kept by the backend, for the revision of @comp given by
+ * its UID and its start, end, recurrence and exception properties, so that
+ * asking for them again, in the same or a part of the time range, does not
+ * expand the recurrence rules again. Asking for a range reaching beyond the
+ * one kept only expands the part which is missing. The occurrences of a
+ * component are dropped when the backend notifies its modification or
+ * removal, and all of them when a timezone is added or received, or the
+ * default timezone is set.
+ *
+ * @tz_cb must resolve the timezones like the backend's
+ * internal_get_timezone method does.
+ *
+ * Since: 3.0
+ **/
+void
+e_cal_backend_generate_instances (ECalBackend *backend,
+				  ECalComponent *comp,
+				  time_t start,
+				  time_t end,
+				  ECalRecurInstanceFn cb,
+				  gpointer cb_data,
+				  ECalRecurResolveTimezoneFn tz_cb,
+				  gpointer tz_cb_data,
+				  icaltimezone *default_timezone)
+{
+	ECalBackendPrivate *priv;
+	RecurCacheEntry *entry;
+	GHashTable *revisions;
+	GArray *instances;
+	const gchar *uid = NULL;
+	gchar *key;
+	time_t cached_start = 0, cached_end = 0;
+	gboolean cached = FALSE, store = TRUE;
+	guint i;
+
+	g_return_if_fail (E_IS_CAL_BACKEND (backend));
+	g_return_if_fail (comp != NULL);
+	g_return_if_fail (cb != NULL);
+
+	priv = backend->priv;
+
+	e_cal_component_get_uid (comp, &uid);
+
+	/* single occurrences are cheap, and open ranges cannot be kept */
+	if (!uid || start == -1 || end == -1 || start >= end ||
+	    !(e_cal_component_has_recurrences (comp) || e_cal_component_has_exceptions (comp))) {
+		e_cal_recur_generate_instances (comp, start, end, cb, cb_data, tz_cb, tz_cb_data, default_timezone);
+		return;
+	}
+
+	key = get_recur_cache_key (comp, default_timezone);
+	instances = g_array_new (FALSE, FALSE, sizeof (RecurInstance));
+
+	g_mutex_lock (priv->recur_cache_lock);
+
+	revisions = g_hash_table_lookup (priv->recur_cache, uid);
+	entry = revisions ? g_hash_table_lookup (revisions, key) : NULL;
+
+	/* extend the kept range when it touches the new one */
+	if (entry && start <= entry->end && end >= entry->start) {
+		cached = TRUE;
+		cached_start = entry->start;
+		cached_end = entry->end;
+		g_array_append_vals (instances, entry->instances->data, entry->instances->len);
+	}
+
+	g_mutex_unlock (priv->recur_cache_lock);
+
+	/* expanding resolves timezones through the backend, so do it
+	 * without holding the lock; the ranges overlap the kept one by
+	 * a second so that no occurrence on its bounds is missed */
+	if (!cached) {
+		e_cal_recur_generate_instances (comp, start, end, add_recur_instance_cb, instances, tz_cb, tz_cb_data, default_timezone);
+		cached_start = start;
+		cached_end = end;
+	} else if (start < cached_start || end > cached_end) {
+		if (start < cached_start)
+			e_cal_recur_generate_instances (comp, start, cached_start + 1, add_recur_instance_cb, instances, tz_cb, tz_cb_data, default_timezone);
+		if (end > cached_end && instances->len <= RECUR_CACHE_MAX_INSTANCES)
+			e_cal_recur_generate_instances (comp, cached_end - 1, end, add_recur_instance_cb, instances, tz_cb, tz_cb_data, default_timezone);
+
+		cached_start = MIN (start, cached_start);
+		cached_end = MAX (end, cached_end);
+
+		g_array_sort (instances, compare_recur_instances);
+
+		/* drop the occurrences found twice */
+		for (i = 1; i < instances->len; i++) {
+			if (compare_recur_instances (&g_array_index (instances, RecurInstance, i - 1),
+						     &g_array_index (instances, RecurInstance, i)) == 0)
+				g_array_remove_index (instances, i--);
+		}
+	} else {
+		/* all kept already */
+		store = FALSE;
+	}
+
+	if (instances->len > RECUR_CACHE_MAX_INSTANCES) {
+		g_array_free (instances, TRUE);
+		g_free (key);
+
+		e_cal_recur_generate_instances (comp, start, end, cb, cb_data, tz_cb, tz_cb_data, default_timezone);
+		return;
+	}
+
+	if (store) {
+		RecurCacheEntry *new_entry;
+
+		new_entry = g_new0 (RecurCacheEntry, 1);
+		new_entry->start = cached_start;
+		new_entry->end = cached_end;
+		new_entry->instances = g_array_sized_new (FALSE, FALSE, sizeof (RecurInstance), instances->len);
+		g_array_append_vals (new_entry->instances, instances->data, instances->len);
+
+		g_mutex_lock (priv->recur_cache_lock);
+
+		if (priv->recur_cache_n_entries >= RECUR_CACHE_MAX_ENTRIES) {
+			g_hash_table_remove_all (priv->recur_cache);
+			priv->recur_cache_n_entries = 0;
+		}
+
+		revisions = g_hash_table_lookup (priv->recur_cache, uid);
+		if (!revisions) {
+			revisions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) free_recur_cache_entry);
+			g_hash_table_insert (priv->recur_cache, g_strdup (uid), revisions);
+		}
+
+		if (!g_hash_table_lookup (revisions, key))
+			priv->recur_cache_n_entries++;
+		g_hash_table_insert (revisions, key, new_entry);
+		key = NULL;
+
+		g_mutex_unlock (priv->recur_cache_lock);
+	}
+
+	g_free (key);
+
+	for (i = 0; i < instances->len; i++) {
+		RecurInstance *instance = &g_array_index (instances, RecurInstance, i);
+
+		if (instance->start < end && instance->end > start &&
+		    !(*cb) (comp, instance->start, instance->end, cb_data))
+			break;
+	}
+
+	g_array_free (instances, TRUE);
+}
+
 /**
  * e_cal_backend_set_notification_proxy:
  * @backend: an #ECalBackend
@@ -1228,6 +1542,7 @@ e_cal_backend_notify_object_created (ECalBackend *backend, const gchar *calobj)
 	EList *queries;
 	EIterator *iter;
 	EDataCalView *query;
+	ECalComponent *comp;
 
 	priv = backend->priv;
 
@@ -1236,6 +1551,11 @@ e_cal_backend_notify_object_created (ECalBackend *backend, const gchar *calobj)
 		return;
 	}
 
+	/* parse it once for all the views, not once per view */
+	comp = e_cal_component_new_from_string (calobj);
+	if (!comp)
+		return;
+
 	queries = e_cal_backend_get_queries (backend);
 	iter = e_list_get_iterator (queries);
 
@@ -1243,41 +1563,36 @@ e_cal_backend_notify_object_created (ECalBackend *backend, const gchar *calobj)
 		query = QUERY (e_iterator_get (iter));
 
 		g_object_ref (query);
-		if (e_data_cal_view_object_matches (query, calobj))
-			e_data_cal_view_notify_objects_added_1 (query, calobj);
+		if (e_data_cal_view_component_matches (query, comp))
+			e_data_cal_view_notify_component_added (query, comp, calobj);
 		g_object_unref (query);
 
 		e_iterator_next (iter);
 	}
 	g_object_unref (iter);
+	g_object_unref (comp);
 }
 
+/* old_comp and comp are the parsed old_object and object, either may be NULL */
 static void
-match_query_and_notify (EDataCalView *query, const gchar *old_object, const gchar *object)
+match_query_and_notify (EDataCalView *query,
+			ECalComponent *old_comp, const ECalComponentId *old_id,
+			ECalComponent *comp, const gchar *object)
 {
 	gboolean old_match = FALSE, new_match = FALSE;
 
-	if (old_object)
-		old_match = e_data_cal_view_object_matches (query, old_object);
+	if (old_comp)
+		old_match = e_data_cal_view_component_matches (query, old_comp);
+
+	if (comp)
+		new_match = e_data_cal_view_component_matches (query, comp);
 
-	new_match = e_data_cal_view_object_matches (query, object);
 	if (old_match && new_match)
 		e_data_cal_view_notify_objects_modified_1 (query, object);
 	else if (new_match)
-		e_data_cal_view_notify_objects_added_1 (query, object);
-	else if (old_match) {
-		ECalComponent *comp = NULL;
-
-		comp = e_cal_component_new_from_string (old_object);
-		if (comp) {
-			ECalComponentId *id = e_cal_component_get_id (comp);
-
-			e_data_cal_view_notify_objects_removed_1 (query, id);
-
-			e_cal_component_free_id (id);
-			g_object_unref (comp);
-		}
-	}
+		e_data_cal_view_notify_component_added (query, comp, object);
+	else if (old_match && old_id)
+		e_data_cal_view_notify_objects_removed_1 (query, old_id);
 }
 
 /**
@@ -1403,6 +1718,8 @@ e_cal_backend_notify_object_modified (ECalBackend *backend,
 	EList *queries;
 	EIterator *iter;
 	EDataCalView *query;
+	ECalComponent *old_comp = NULL, *comp;
+	ECalComponentId *old_id = NULL;
 
 	priv = backend->priv;
 
@@ -1411,6 +1728,23 @@ e_cal_backend_notify_object_modified (ECalBackend *backend,
 		return;
 	}
 
+	/* parse both versions once for all the views */
+	if (old_object) {
+		old_comp = e_cal_component_new_from_string (old_object);
+		if (old_comp)
+			old_id = e_cal_component_get_id (old_comp);
+	}
+	comp = e_cal_component_new_from_string (object);
+
+	if (old_id)
+		invalidate_recur_cache (backend, old_id->uid);
+	if (comp) {
+		const gchar *uid = NULL;
+
+		e_cal_component_get_uid (comp, &uid);
+		invalidate_recur_cache (backend, uid);
+	}
+
 	queries = e_cal_backend_get_queries (backend);
 	iter = e_list_get_iterator (queries);
 
@@ -1418,12 +1752,19 @@ e_cal_backend_notify_object_modified (ECalBackend *backend,
 		query = QUERY (e_iterator_get (iter));
 
 		g_object_ref (query);
-		match_query_and_notify (query, old_object, object);
+		match_query_and_notify (query, old_comp, old_id, comp, object);
 		g_object_unref (query);
 
 		e_iterator_next (iter);
 	}
 	g_object_unref (iter);
+
+	if (old_id)
+		e_cal_component_free_id (old_id);
+	if (old_comp)
+		g_object_unref (old_comp);
+	if (comp)
+		g_object_unref (comp);
 }
 
 /**
@@ -1449,6 +1790,8 @@ e_cal_backend_notify_object_removed (ECalBackend *backend, const ECalComponentId
 	EList *queries;
 	EIterator *iter;
 	EDataCalView *query;
+	ECalComponent *old_comp = NULL, *comp = NULL;
+	ECalComponentId *old_id = NULL;
 
 	priv = backend->priv;
 
@@ -1457,6 +1800,18 @@ e_cal_backend_notify_object_removed (ECalBackend *backend, const ECalComponentId
 		return;
 	}
 
+	if (id)
+		invalidate_recur_cache (backend, id->uid);
+
+	/* parse both versions once for all the views */
+	if (old_object) {
+		old_comp = e_cal_component_new_from_string (old_object);
+		if (old_comp && object)
+			old_id = e_cal_component_get_id (old_comp);
+	}
+	if (object)
+		comp = e_cal_component_new_from_string (object);
+
 	queries = e_cal_backend_get_queries (backend);
 	iter = e_list_get_iterator (queries);
 
@@ -1468,16 +1823,23 @@ e_cal_backend_notify_object_removed (ECalBackend *backend, const ECalComponentId
 		if (object == NULL) {
 			/* if object == NULL, it means the object has been completely
 			   removed from the backend */
-			if (!old_object || e_data_cal_view_object_matches (query, old_object))
+			if (!old_object || (old_comp && e_data_cal_view_component_matches (query, old_comp)))
 				e_data_cal_view_notify_objects_removed_1 (query, id);
 		} else
-			match_query_and_notify (query, old_object, object);
+			match_query_and_notify (query, old_comp, old_id, comp, object);
 
 		g_object_unref (query);
 
 		e_iterator_next (iter);
 	}
 	g_object_unref (iter);
+
+	if (old_id)
+		e_cal_component_free_id (old_id);
+	if (old_comp)
+		g_object_unref (old_comp);
+	if (comp)
+		g_object_unref (comp);
 }
 
 /**
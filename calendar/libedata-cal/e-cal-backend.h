@@ -165,6 +165,11 @@ void e_cal_backend_get_free_busy (ECalBackend *backend, EDataCal *cal, EServerMe
 icaltimezone* e_cal_backend_internal_get_default_timezone (ECalBackend *backend);
 icaltimezone* e_cal_backend_internal_get_timezone (ECalBackend *backend, const gchar *tzid);
 
+void e_cal_backend_generate_instances (ECalBackend *backend, ECalComponent *comp, time_t start, time_t end,
+				       ECalRecurInstanceFn cb, gpointer cb_data,
+				       ECalRecurResolveTimezoneFn tz_cb, gpointer tz_cb_data,
+				       icaltimezone *default_timezone);
+
 void e_cal_backend_set_notification_proxy (ECalBackend *backend, ECalBackend *proxy);
 void e_cal_backend_notify_object_created  (ECalBackend *backend, const gchar *calobj);
 void e_cal_backend_notify_object_modified (ECalBackend *backend, const gchar *old_object, const gchar *object);
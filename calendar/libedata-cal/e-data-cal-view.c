@@ -37,7 +37,14 @@
 
 static void ensure_pending_flush_timeout (EDataCalView *view);
 
-#define THRESHOLD_ITEMS   32	/* how many items can be hold in a cache, before propagated to UI */
+/* Pending notifications are sent when they reach the current batch size in
+   bytes. It starts small, so the first results reach the client quickly, and
+   grows while results come in faster than the batches are sent, so big
+   queries are sent in few large messages instead of many tiny ones. */
+#define BATCH_MIN_BYTES    (16 * 1024)
+#define BATCH_MAX_BYTES    (1024 * 1024)
+#define BATCH_MAX_ITEMS    4096	/* also bounds batches of small items, like removes */
+#define BATCH_FAST_USECS   (250 * 1000)	/* batches filled quicker than this are grown */
 #define THRESHOLD_SECONDS  2	/* how long to wait until notifications are propagated to UI; in seconds */
 
 struct _EDataCalViewPrivate {
@@ -57,6 +64,13 @@ struct _EDataCalViewPrivate {
 	GArray *changes;
 	GArray *removes;
 
+	/* Sizes of the pending notifications, and the current batch size */
+	gsize adds_bytes;
+	gsize changes_bytes;
+	gsize removes_bytes;
+	gsize batch_bytes;
+	gint64 last_flush;
+
 	GHashTable *ids;
 
 	GMutex *pending_mutex;
@@ -168,6 +182,7 @@ send_pending_adds (EDataCalView *view)
 
 	e_gdbus_cal_view_emit_objects_added (view->priv->gdbus_object, (const gchar * const *) priv->adds->data);
 	reset_array (priv->adds);
+	priv->adds_bytes = 0;
 }
 
 static void
@@ -180,6 +195,7 @@ send_pending_changes (EDataCalView *view)
 
 	e_gdbus_cal_view_emit_objects_modified (view->priv->gdbus_object, (const gchar * const *) priv->changes->data);
 	reset_array (priv->changes);
+	priv->changes_bytes = 0;
 }
 
 static void
@@ -193,6 +209,34 @@ send_pending_removes (EDataCalView *view)
 	/* TODO: send ECalComponentIds as a list of pairs */
 	e_gdbus_cal_view_emit_objects_removed (view->priv->gdbus_object, (const gchar * const *) priv->removes->data);
 	reset_array (priv->removes);
+	priv->removes_bytes = 0;
+}
+
+/* Adjusts the batch size after pending notifications were sent, either
+   because the batch was full or from the flush timeout.  A batch filling up
+   soon after the previous one means the backend produces results faster than
+   we send them, so the next batch may be bigger; a flush from the timeout
+   means results trickle in, so go back to small batches. */
+static void
+adapt_batch_size (EDataCalView *view, gboolean full)
+{
+	EDataCalViewPrivate *priv = view->priv;
+	gint64 now;
+
+	now = g_get_monotonic_time ();
+
+	if (!full)
+		priv->batch_bytes = MAX (priv->batch_bytes / 2, BATCH_MIN_BYTES);
+	else if (now - priv->last_flush < BATCH_FAST_USECS)
+		priv->batch_bytes = MIN (priv->batch_bytes * 2, BATCH_MAX_BYTES);
+
+	priv->last_flush = now;
+}
+
+static gboolean
+batch_is_full (EDataCalView *view, GArray *array, gsize bytes)
+{
+	return bytes >= view->priv->batch_bytes || array->len >= BATCH_MAX_ITEMS;
 }
 
 static gboolean
@@ -209,6 +253,8 @@ pending_flush_timeout_cb (gpointer data)
 	send_pending_changes (view);
 	send_pending_removes (view);
 
+	adapt_batch_size (view, FALSE);
+
 	g_mutex_unlock (priv->pending_mutex);
 
 	return FALSE;
@@ -225,8 +271,9 @@ ensure_pending_flush_timeout (EDataCalView *view)
 	priv->flush_id = g_timeout_add (e_data_cal_view_is_done (view) ? 10 : (THRESHOLD_SECONDS * 1000), pending_flush_timeout_cb, view);
 }
 
+/* takes ownership of obj, and of id if given; otherwise the id is parsed from obj */
 static void
-notify_add (EDataCalView *view, gchar *obj)
+notify_add (EDataCalView *view, gchar *obj, ECalComponentId *id)
 {
 	EDataCalViewPrivate *priv = view->priv;
 	ECalComponent *comp;
@@ -234,16 +281,21 @@ notify_add (EDataCalView *view, gchar *obj)
 	send_pending_changes (view);
 	send_pending_removes (view);
 
-	if (priv->adds->len == THRESHOLD_ITEMS) {
-		send_pending_adds (view);
+	/* before obj is queued, a full batch frees it when it's sent */
+	if (!id) {
+		comp = e_cal_component_new_from_string (obj);
+		id = e_cal_component_get_id (comp);
+		g_object_unref (comp);
 	}
+	g_hash_table_insert (priv->ids, id, GUINT_TO_POINTER (1));
+
 	g_array_append_val (priv->adds, obj);
+	priv->adds_bytes += strlen (obj);
 
-	comp = e_cal_component_new_from_string (obj);
-	g_hash_table_insert (priv->ids,
-			     e_cal_component_get_id (comp),
-			     GUINT_TO_POINTER (1));
-	g_object_unref (comp);
+	if (batch_is_full (view, priv->adds, priv->adds_bytes)) {
+		send_pending_adds (view);
+		adapt_batch_size (view, TRUE);
+	}
 
 	ensure_pending_flush_timeout (view);
 }
@@ -256,12 +308,14 @@ notify_change (EDataCalView *view, gchar *obj)
 	send_pending_adds (view);
 	send_pending_removes (view);
 
-	if (priv->changes->len == THRESHOLD_ITEMS) {
+	g_array_append_val (priv->changes, obj);
+	priv->changes_bytes += strlen (obj);
+
+	if (batch_is_full (view, priv->changes, priv->changes_bytes)) {
 		send_pending_changes (view);
+		adapt_batch_size (view, TRUE);
 	}
 
-	g_array_append_val (priv->changes, obj);
-
 	ensure_pending_flush_timeout (view);
 }
 
@@ -274,16 +328,18 @@ notify_remove (EDataCalView *view, ECalComponentId *id)
 	send_pending_adds (view);
 	send_pending_changes (view);
 
-	if (priv->removes->len == THRESHOLD_ITEMS) {
-		send_pending_removes (view);
-	}
-
 	/* TODO: store ECalComponentId instead of just uid*/
 	uid = e_util_utf8_make_valid (id->uid);
 	g_array_append_val (priv->removes, uid);
+	priv->removes_bytes += strlen (uid);
 
 	g_hash_table_remove (priv->ids, id);
 
+	if (batch_is_full (view, priv->removes, priv->removes_bytes)) {
+		send_pending_removes (view);
+		adapt_batch_size (view, TRUE);
+	}
+
 	ensure_pending_flush_timeout (view);
 }
 
@@ -406,9 +462,15 @@ e_data_cal_view_init (EDataCalView *query)
 	priv->done = FALSE;
 	priv->sexp = NULL;
 
-	priv->adds = g_array_sized_new (TRUE, TRUE, sizeof (gchar *), THRESHOLD_ITEMS);
-	priv->changes = g_array_sized_new (TRUE, TRUE, sizeof (gchar *), THRESHOLD_ITEMS);
-	priv->removes = g_array_sized_new (TRUE, TRUE, sizeof (gchar *), THRESHOLD_ITEMS);
+	priv->adds = g_array_new (TRUE, TRUE, sizeof (gchar *));
+	priv->changes = g_array_new (TRUE, TRUE, sizeof (gchar *));
+	priv->removes = g_array_new (TRUE, TRUE, sizeof (gchar *));
+
+	priv->adds_bytes = 0;
+	priv->changes_bytes = 0;
+	priv->removes_bytes = 0;
+	priv->batch_bytes = BATCH_MIN_BYTES;
+	priv->last_flush = 0;
 
 	priv->ids = g_hash_table_new_full (id_hash, id_equal, (GDestroyNotify)e_cal_component_free_id, NULL);
 
@@ -526,6 +588,34 @@ e_data_cal_view_object_matches (EDataCalView *query, const gchar *object)
 	return e_cal_backend_sexp_match_object (priv->sexp, object, priv->backend);
 }
 
+/**
+ * e_data_cal_view_component_matches:
+ * @query: A query object.
+ * @component: Component to match.
+ *
+ * Compares the given @component to the expression used for the given
+ * query.  Use this instead of e_data_cal_view_object_matches() when the
+ * same object is matched against several queries, so it is only parsed
+ * once.
+ *
+ * Returns: TRUE if the component matches the expression, FALSE if not.
+ *
+ * Since: 3.0
+ */
+gboolean
+e_data_cal_view_component_matches (EDataCalView *query, ECalComponent *component)
+{
+	EDataCalViewPrivate *priv;
+
+	g_return_val_if_fail (query != NULL, FALSE);
+	g_return_val_if_fail (IS_QUERY (query), FALSE);
+	g_return_val_if_fail (E_IS_CAL_COMPONENT (component), FALSE);
+
+	priv = query->priv;
+
+	return e_cal_backend_sexp_match_comp (priv->sexp, component, priv->backend);
+}
+
 /**
  * e_data_cal_view_get_matched_objects:
  * @query: A query object.
@@ -621,7 +711,7 @@ e_data_cal_view_notify_objects_added (EDataCalView *view, const GList *objects)
 	g_mutex_lock (priv->pending_mutex);
 
 	for (l = objects; l; l = l->next) {
-		notify_add (view, e_util_utf8_make_valid (l->data));
+		notify_add (view, e_util_utf8_make_valid (l->data), NULL);
 	}
 
 	g_mutex_unlock (priv->pending_mutex);
@@ -646,6 +736,34 @@ e_data_cal_view_notify_objects_added_1 (EDataCalView *view, const gchar *object)
 	e_data_cal_view_notify_objects_added (view, &l);
 }
 
+/**
+ * e_data_cal_view_notify_component_added:
+ * @view: A query object.
+ * @component: The component that has been added.
+ * @object: iCalendar representation of @component.
+ *
+ * Notifies all the query listeners of the addition of a single object,
+ * like e_data_cal_view_notify_objects_added_1(), but takes the ID from
+ * the already parsed @component instead of parsing @object again.
+ *
+ * Since: 3.0
+ */
+void
+e_data_cal_view_notify_component_added (EDataCalView *view, ECalComponent *component, const gchar *object)
+{
+	EDataCalViewPrivate *priv;
+
+	g_return_if_fail (view && E_IS_DATA_CAL_VIEW (view));
+	g_return_if_fail (E_IS_CAL_COMPONENT (component));
+	g_return_if_fail (object);
+
+	priv = view->priv;
+
+	g_mutex_lock (priv->pending_mutex);
+	notify_add (view, e_util_utf8_make_valid (object), e_cal_component_get_id (component));
+	g_mutex_unlock (priv->pending_mutex);
+}
+
 /**
  * e_data_cal_view_notify_objects_modified:
  * @query: A query object.
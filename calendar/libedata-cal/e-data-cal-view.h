@@ -59,6 +59,7 @@ guint e_data_cal_view_register_gdbus_object (EDataCalView *query, GDBusConnectio
 const gchar           *e_data_cal_view_get_text (EDataCalView *query);
 ECalBackendSExp      *e_data_cal_view_get_object_sexp (EDataCalView *query);
 gboolean              e_data_cal_view_object_matches (EDataCalView *query, const gchar *object);
+gboolean              e_data_cal_view_component_matches (EDataCalView *query, ECalComponent *component);
 
 GList                *e_data_cal_view_get_matched_objects (EDataCalView *query);
 gboolean              e_data_cal_view_is_started (EDataCalView *query);
@@ -69,6 +70,9 @@ void                  e_data_cal_view_notify_objects_added (EDataCalView       *
 							    const GList *objects);
 void                  e_data_cal_view_notify_objects_added_1 (EDataCalView       *query,
 							      const gchar *object);
+void                  e_data_cal_view_notify_component_added (EDataCalView       *query,
+							      ECalComponent *component,
+							      const gchar *object);
 void                  e_data_cal_view_notify_objects_modified (EDataCalView       *query,
 							       const GList *objects);
 void                  e_data_cal_view_notify_objects_modified_1 (EDataCalView       *query,
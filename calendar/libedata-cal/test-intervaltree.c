@@ -31,6 +31,8 @@
 #define NUM_INTERVALS_CLOSED  100
 #define NUM_INTERVALS_OPEN  100
 #define NUM_SEARCHES  500
+#define NUM_BENCH_INTERVALS  100000
+#define NUM_BENCH_SEARCHES  1000
 #define _TIME_MIN	((time_t) 0)		/* Min valid time_t	*/
 #define _TIME_MAX	((time_t) INT_MAX)	/* Max valid time_t	*/
 
@@ -228,9 +230,11 @@ random_test (void)
 	EInterval *interval = NULL;
 	EIntervalTree *tree;
 	GList *l1, *l2, *next;
+	GPtrArray *array;
 	gint num_deleted = 0;
 
 	tree = e_intervaltree_new ();
+	array = g_ptr_array_new ();
 
 	for (i = 0; i < NUM_INTERVALS_CLOSED; i++)
 	{
@@ -298,6 +302,15 @@ random_test (void)
 			exit (-1);
 		}
 
+		/* the array variant finds the same components */
+		g_ptr_array_set_size (array, 0);
+		e_intervaltree_search_array (tree, start, end, array);
+		if (array->len != g_list_length (l1))
+		{
+			g_message (G_STRLOC ": search_array found %d, search %d", array->len, g_list_length (l1));
+			exit (-1);
+		}
+
 		/* g_print ("OK\n"); */
 		g_list_foreach (l1, (GFunc)g_object_unref, NULL);
 		g_list_foreach (l2, (GFunc)unref_comp, NULL);
@@ -410,10 +423,85 @@ random_test (void)
 	}
 
 	e_intervaltree_destroy (tree);
+	g_ptr_array_free (array, TRUE);
 	g_list_foreach (list, (GFunc)unref_comp, NULL);
 	g_list_free (list);
 }
 
+static void
+bench_test (void)
+{
+	/*
+	 * Times searches of month windows in a calendar of five years of
+	 * events, as opening month views does, with both search functions.
+	 * Only run when asked for with --bench, it takes too long for
+	 * every check.
+	 */
+	EIntervalTree *tree;
+	GPtrArray *array;
+	GTimer *timer;
+	GList *l;
+	time_t start, end, windows[NUM_BENCH_SEARCHES];
+	gint i, found_list = 0, found_array = 0;
+
+	tree = e_intervaltree_new ();
+	array = g_ptr_array_new ();
+	timer = g_timer_new ();
+
+	for (i = 0; i < NUM_BENCH_INTERVALS; i++)
+	{
+		ECalComponent *comp;
+
+		start = g_rand_int_range (myrand, 0, 5 * 365) * 86400 + g_rand_int_range (myrand, 0, 86400);
+		end = start + g_rand_int_range (myrand, 0, 4 * 3600);
+		comp = create_test_component (start, end);
+		e_intervaltree_insert (tree, start, end, comp);
+		g_object_unref (comp);
+	}
+
+	g_print ("Inserted %d intervals in %.3fs\n", NUM_BENCH_INTERVALS, g_timer_elapsed (timer, NULL));
+
+	/* the first search sorts the tree */
+	g_timer_start (timer);
+	e_intervaltree_search_array (tree, 0, 0, array);
+	g_print ("Built the tree in %.3fs\n", g_timer_elapsed (timer, NULL));
+
+	for (i = 0; i < NUM_BENCH_SEARCHES; i++)
+		windows[i] = g_rand_int_range (myrand, 0, 5 * 365 - 31) * 86400;
+
+	g_timer_start (timer);
+	for (i = 0; i < NUM_BENCH_SEARCHES; i++)
+	{
+		start = windows[i];
+		end = start + 31 * 86400;
+
+		l = e_intervaltree_search (tree, start, end);
+		found_list += g_list_length (l);
+		g_list_foreach (l, (GFunc)g_object_unref, NULL);
+		g_list_free (l);
+	}
+	g_print ("%d month searches (list): %.3fs, %d found\n",
+		 NUM_BENCH_SEARCHES, g_timer_elapsed (timer, NULL), found_list);
+
+	g_timer_start (timer);
+	for (i = 0; i < NUM_BENCH_SEARCHES; i++)
+	{
+		start = windows[i];
+		end = start + 31 * 86400;
+
+		g_ptr_array_set_size (array, 0);
+		found_array += e_intervaltree_search_array (tree, start, end, array);
+	}
+	g_print ("%d month searches (array): %.3fs, %d found\n",
+		 NUM_BENCH_SEARCHES, g_timer_elapsed (timer, NULL), found_array);
+
+	g_assert (found_list == found_array);
+
+	g_timer_destroy (timer);
+	g_ptr_array_free (array, TRUE);
+	e_intervaltree_destroy (tree);
+}
+
 static void
 mem_test (void)
 {
@@ -461,6 +549,8 @@ main (gint argc, gchar **argv)
 	myrand = g_rand_new ();
 	mem_test ();
 	random_test ();
+	if (argc > 1 && strcmp (argv[1], "--bench") == 0)
+		bench_test ();
 	g_print ("Everything OK\n");
 
 	return 0;
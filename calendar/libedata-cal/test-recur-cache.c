@@ -0,0 +1,224 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Checks that the occurrences e_cal_backend_generate_instances() keeps
+ * are not used once the recurrence of a component changes without its
+ * LAST-MODIFIED or SEQUENCE changing, nor once a timezone it uses is
+ * added to the backend. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <libecal/e-cal-component.h>
+#include <libecal/e-cal-recur.h>
+#include "e-cal-backend.h"
+
+/* a backend which only knows the timezones added to it */
+typedef struct {
+	ECalBackend parent;
+	GHashTable *zones;
+} TestBackend;
+
+typedef struct {
+	ECalBackendClass parent_class;
+} TestBackendClass;
+
+static GType test_backend_get_type (void);
+
+G_DEFINE_TYPE (TestBackend, test_backend, E_TYPE_CAL_BACKEND)
+
+static void
+test_backend_add_timezone (ECalBackend *backend, EDataCal *cal, EServerMethodContext context, const gchar *tzobj)
+{
+	TestBackend *test = (TestBackend *) backend;
+	icalcomponent *icalcomp;
+	icaltimezone *zone;
+
+	icalcomp = icalparser_parse_string (tzobj);
+	g_return_if_fail (icalcomp != NULL);
+
+	zone = icaltimezone_new ();
+	icaltimezone_set_component (zone, icalcomp);
+	g_hash_table_insert (test->zones, g_strdup (icaltimezone_get_tzid (zone)), zone);
+}
+
+static void
+test_backend_finalize (GObject *object)
+{
+	g_hash_table_destroy (((TestBackend *) object)->zones);
+
+	G_OBJECT_CLASS (test_backend_parent_class)->finalize (object);
+}
+
+static void
+test_backend_class_init (TestBackendClass *class)
+{
+	G_OBJECT_CLASS (class)->finalize = test_backend_finalize;
+	E_CAL_BACKEND_CLASS (class)->add_timezone = test_backend_add_timezone;
+}
+
+static void
+free_zone (icaltimezone *zone)
+{
+	icaltimezone_free (zone, TRUE);
+}
+
+static void
+test_backend_init (TestBackend *test)
+{
+	test->zones = g_hash_table_new_full (
+		g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify) free_zone);
+}
+
+static icaltimezone *
+resolve_tzid (const gchar *tzid, gpointer data)
+{
+	TestBackend *test = data;
+
+	return g_hash_table_lookup (test->zones, tzid);
+}
+
+static const gchar *test_zone =
+	"BEGIN:VTIMEZONE\r\n"
+	"TZID:Test/Zone\r\n"
+	"BEGIN:STANDARD\r\n"
+	"DTSTART:19700101T000000\r\n"
+	"TZOFFSETFROM:+0500\r\n"
+	"TZOFFSETTO:+0500\r\n"
+	"END:STANDARD\r\n"
+	"END:VTIMEZONE\r\n";
+
+static ECalComponent *
+create_event (const gchar *dtstart, const gchar *rrule)
+{
+	ECalComponent *comp;
+	gchar *str;
+
+	str = g_strdup_printf (
+		"BEGIN:VEVENT\r\n"
+		"UID:test-recur-cache\r\n"
+		"DTSTAMP:20110101T000000Z\r\n"
+		"LAST-MODIFIED:20110101T000000Z\r\n"
+		"SEQUENCE:1\r\n"
+		"%s\r\n"
+		"DURATION:PT1H\r\n"
+		"RRULE:%s\r\n"
+		"END:VEVENT\r\n",
+		dtstart, rrule);
+	comp = e_cal_component_new_from_string (str);
+	g_free (str);
+
+	return comp;
+}
+
+static gboolean
+add_instance_cb (ECalComponent *comp, time_t start, time_t end, gpointer data)
+{
+	g_array_append_val ((GArray *) data, start);
+
+	return TRUE;
+}
+
+/* the starts of the occurrences, both from the backend and expanded
+ * directly, which have to match */
+static GArray *
+generate (TestBackend *test, ECalComponent *comp, time_t start, time_t end, gint *failures)
+{
+	GArray *cached, *direct;
+	guint i;
+
+	cached = g_array_new (FALSE, FALSE, sizeof (time_t));
+	direct = g_array_new (FALSE, FALSE, sizeof (time_t));
+
+	e_cal_backend_generate_instances (
+		E_CAL_BACKEND (test), comp, start, end,
+		add_instance_cb, cached, resolve_tzid, test,
+		icaltimezone_get_utc_timezone ());
+	e_cal_recur_generate_instances (
+		comp, start, end, add_instance_cb, direct,
+		resolve_tzid, test, icaltimezone_get_utc_timezone ());
+
+	if (cached->len != direct->len) {
+		g_printerr ("the backend found %u occurrences instead of %u\n", cached->len, direct->len);
+		(*failures)++;
+	} else {
+		for (i = 0; i < cached->len; i++) {
+			if (g_array_index (cached, time_t, i) != g_array_index (direct, time_t, i)) {
+				g_printerr ("occurrence %u starts at %ld instead of %ld\n", i,
+					    (glong) g_array_index (cached, time_t, i),
+					    (glong) g_array_index (direct, time_t, i));
+				(*failures)++;
+				break;
+			}
+		}
+	}
+
+	g_array_free (direct, TRUE);
+
+	return cached;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	TestBackend *test;
+	ESource *source;
+	ECalComponent *comp;
+	GArray *before, *after;
+	time_t start = 1293840000;	/* 2011-01-01 */
+	time_t end = 1296518400;	/* 2011-02-01 */
+	gint failures = 0;
+
+	g_type_init ();
+	g_thread_init (NULL);
+
+	source = e_source_new ("test", "test-recur-cache");
+	e_source_set_absolute_uri (source, "test://test-recur-cache");
+	test = g_object_new (
+		test_backend_get_type (),
+		"kind", (gulong) ICAL_VEVENT_COMPONENT,
+		"source", source, NULL);
+
+	/* the rule changes, but neither LAST-MODIFIED nor SEQUENCE */
+	comp = create_event ("DTSTART:20110103T100000Z", "FREQ=DAILY;COUNT=5");
+	before = generate (test, comp, start, end, &failures);
+	g_object_unref (comp);
+
+	comp = create_event ("DTSTART:20110103T100000Z", "FREQ=DAILY;COUNT=3");
+	after = generate (test, comp, start, end, &failures);
+	g_object_unref (comp);
+
+	if (before->len != 5 || after->len != 3) {
+		g_printerr ("found %u and %u occurrences instead of 5 and 3\n", before->len, after->len);
+		failures++;
+	}
+	g_array_free (before, TRUE);
+	g_array_free (after, TRUE);
+
+	/* the timezone is unknown at first, so UTC is used instead */
+	comp = create_event ("DTSTART;TZID=Test/Zone:20110103T100000", "FREQ=WEEKLY;COUNT=4");
+	before = generate (test, comp, start, end, &failures);
+
+	e_cal_backend_add_timezone (E_CAL_BACKEND (test), NULL, NULL, test_zone);
+	after = generate (test, comp, start, end, &failures);
+	g_object_unref (comp);
+
+	if (before->len != 4 || after->len != 4 ||
+	    g_array_index (before, time_t, 0) - g_array_index (after, time_t, 0) != 5 * 3600) {
+		g_printerr ("the occurrences did not move to the added timezone\n");
+		failures++;
+	}
+	g_array_free (before, TRUE);
+	g_array_free (after, TRUE);
+
+	g_object_unref (test);
+	g_object_unref (source);
+
+	if (failures) {
+		g_printerr ("%d failures\n", failures);
+		return 1;
+	}
+
+	g_print ("Everything OK\n");
+
+	return 0;
+}
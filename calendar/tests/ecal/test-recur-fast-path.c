@@ -0,0 +1,210 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Compares the instances generated for simple DAILY, WEEKLY and MONTHLY
+ * rules, which e_cal_recur_generate_instances() expands directly, with the
+ * instances of the same rules expanded by the generic code. We force the
+ * generic code by adding BYHOUR, BYMINUTE and BYSECOND parts which match the
+ * DTSTART, so they don't change the recurrence set. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <libecal/e-cal-component.h>
+#include <libecal/e-cal-recur.h>
+#include <libecal/e-cal-time-util.h>
+
+static const gchar *rules[] = {
+	"FREQ=DAILY",
+	"FREQ=DAILY;INTERVAL=3;COUNT=40",
+	"FREQ=DAILY;INTERVAL=2;UNTIL=20110321T000000Z",
+	"FREQ=WEEKLY",
+	"FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE,FR",
+	"FREQ=WEEKLY;BYDAY=SU,MO;WKST=SU",
+	"FREQ=WEEKLY;BYDAY=TU,TU,SA;COUNT=25",
+	"FREQ=WEEKLY;INTERVAL=3;BYDAY=MO;UNTIL=20120101T000000Z",
+	"FREQ=MONTHLY",
+	"FREQ=MONTHLY;INTERVAL=5;COUNT=12",
+	"FREQ=MONTHLY;BYMONTHDAY=-1",
+	"FREQ=MONTHLY;BYMONTHDAY=-31",
+	"FREQ=MONTHLY;INTERVAL=2;BYMONTHDAY=30;COUNT=10",
+	"FREQ=MONTHLY;BYMONTHDAY=5",
+	NULL
+};
+
+static const gchar *dtstarts[] = {
+	"DTSTART;TZID=Europe/London:20100131T093000\r\n"
+	"DTEND;TZID=Europe/London:20100131T103000\r\n",
+	"DTSTART;TZID=America/New_York:20100310T013000\r\n"
+	"DTEND;TZID=America/New_York:20100310T023000\r\n",
+	"DTSTART;TZID=Europe/London:20100328T010000\r\n"
+	"DURATION:PT1H\r\n",
+	"DTSTART:20100228T235959\r\n"
+	"DTEND:20100301T001500\r\n",
+	"DTSTART;VALUE=DATE:20100330\r\n"
+	"DTEND;VALUE=DATE:20100331\r\n",
+	NULL
+};
+
+static const gchar *extras[] = {
+	"",
+	"EXDATE;TZID=Europe/London:20100202T093000\r\n"
+	"EXDATE;VALUE=DATE:20100415\r\n",
+	"RDATE;TZID=Europe/London:20100205T120000\r\n",
+	NULL
+};
+
+static const time_t ranges[][2] = {
+	{ 1262304000, 1356998400 },	/* 2010-01-01 - 2013-01-01 */
+	{ 1267401600, 1270080000 },	/* 2010-03-01 - 2010-04-01 */
+	{ 1293753600, 1293926400 },	/* 2010-12-31 - 2011-01-02 */
+	{ 1325376000, 1325462400 }	/* 2012-01-01 - 2012-01-02 */
+};
+
+static icaltimezone *
+resolve_tzid (const gchar *tzid, gpointer data)
+{
+	if (!tzid || !*tzid)
+		return NULL;
+
+	if (!strcmp (tzid, "UTC"))
+		return icaltimezone_get_utc_timezone ();
+
+	return icaltimezone_get_builtin_timezone (tzid);
+}
+
+static gboolean
+add_instance (ECalComponent *comp, time_t start, time_t end, gpointer data)
+{
+	GArray *instances = data;
+
+	g_array_append_val (instances, start);
+	g_array_append_val (instances, end);
+
+	return TRUE;
+}
+
+static ECalComponent *
+create_component (const gchar *dtstart, const gchar *rrule, const gchar *extra)
+{
+	ECalComponent *comp;
+	gchar *str;
+
+	str = g_strconcat ("BEGIN:VEVENT\r\n"
+			   "UID:test-recur-fast-path\r\n",
+			   dtstart,
+			   "RRULE:", rrule, "\r\n",
+			   extra,
+			   "END:VEVENT\r\n",
+			   NULL);
+	comp = e_cal_component_new_from_string (str);
+	g_free (str);
+
+	return comp;
+}
+
+/* Adds BYHOUR, BYMINUTE and BYSECOND parts matching the DTSTART to the
+   rule, so it is no longer expanded by the fast path. */
+static void
+force_generic_rule (ECalComponent *comp)
+{
+	icalcomponent *icalcomp;
+	icalproperty *prop;
+	struct icalrecurrencetype recur;
+	struct icaltimetype dtstart;
+
+	icalcomp = e_cal_component_get_icalcomponent (comp);
+	dtstart = icalcomponent_get_dtstart (icalcomp);
+	prop = icalcomponent_get_first_property (icalcomp,
+						 ICAL_RRULE_PROPERTY);
+	recur = icalproperty_get_rrule (prop);
+
+	recur.by_hour[0] = dtstart.hour;
+	recur.by_hour[1] = ICAL_RECURRENCE_ARRAY_MAX;
+	recur.by_minute[0] = dtstart.minute;
+	recur.by_minute[1] = ICAL_RECURRENCE_ARRAY_MAX;
+	recur.by_second[0] = dtstart.second;
+	recur.by_second[1] = ICAL_RECURRENCE_ARRAY_MAX;
+
+	icalproperty_set_rrule (prop, recur);
+	e_cal_component_rescan (comp);
+}
+
+static GArray *
+generate (ECalComponent *comp, time_t start, time_t end)
+{
+	GArray *instances;
+
+	instances = g_array_new (FALSE, FALSE, sizeof (time_t));
+	e_cal_recur_generate_instances (comp, start, end,
+					add_instance, instances,
+					resolve_tzid, NULL,
+					icaltimezone_get_utc_timezone ());
+
+	return instances;
+}
+
+static gboolean
+compare (const gchar *dtstart, const gchar *rrule, const gchar *extra)
+{
+	ECalComponent *fast, *generic;
+	GArray *fast_instances, *generic_instances;
+	gboolean same = TRUE;
+	guint i;
+
+	fast = create_component (dtstart, rrule, extra);
+	generic = create_component (dtstart, rrule, extra);
+	force_generic_rule (generic);
+
+	for (i = 0; i < G_N_ELEMENTS (ranges) && same; i++) {
+		fast_instances = generate (fast, ranges[i][0], ranges[i][1]);
+		generic_instances = generate (generic, ranges[i][0],
+					      ranges[i][1]);
+
+		if (fast_instances->len != generic_instances->len
+		    || memcmp (fast_instances->data, generic_instances->data,
+			       fast_instances->len * sizeof (time_t))) {
+			g_printerr ("Mismatch for RRULE:%s with\n%s%s"
+				    "in range %ld - %ld: %u instances, "
+				    "expected %u\n",
+				    rrule, dtstart, extra,
+				    (glong) ranges[i][0],
+				    (glong) ranges[i][1],
+				    fast_instances->len / 2,
+				    generic_instances->len / 2);
+			same = FALSE;
+		}
+
+		g_array_free (fast_instances, TRUE);
+		g_array_free (generic_instances, TRUE);
+	}
+
+	g_object_unref (fast);
+	g_object_unref (generic);
+
+	return same;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	gint i, j, k, failures = 0;
+
+	g_type_init ();
+
+	for (i = 0; rules[i]; i++) {
+		for (j = 0; dtstarts[j]; j++) {
+			for (k = 0; extras[k]; k++) {
+				if (!compare (dtstarts[j], rules[i], extras[k]))
+					failures++;
+			}
+		}
+	}
+
+	if (failures) {
+		g_printerr ("%d mismatches\n", failures);
+		return 1;
+	}
+
+	g_print ("Everything OK\n");
+
+	return 0;
+}
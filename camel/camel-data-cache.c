@@ -25,10 +25,13 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
@@ -38,6 +41,7 @@
 #include "camel-stream-fs.h"
 #include "camel-stream-mem.h"
 #include "camel-file-utils.h"
+#include "camel-url.h"
 
 #define d(x)
 
@@ -49,6 +53,12 @@
    once an hour should be enough */
 #define CAMEL_DATA_CACHE_CYCLE_TIME (60*60)
 
+/* packed segments stop taking new entries once they reach this size */
+#define CAMEL_DATA_CACHE_SEGMENT_SIZE (16*1024*1024)
+
+#define CAMEL_DATA_CACHE_INDEX_MAGIC "CamelDataCachePack"
+#define CAMEL_DATA_CACHE_INDEX_VERSION (1)
+
 #define CAMEL_DATA_CACHE_GET_PRIVATE(obj) \
 	(G_TYPE_INSTANCE_GET_PRIVATE \
 	((obj), CAMEL_TYPE_DATA_CACHE, CamelDataCachePrivate))
@@ -62,6 +72,52 @@ struct _CamelDataCachePrivate {
 	time_t expire_access;
 
 	time_t expire_last[1 << CAMEL_DATA_CACHE_BITS];
+
+	gboolean packed;
+	GMutex *pack_lock;
+	GHashTable *packs;	/* path -> DataCachePack */
+};
+
+/* index log records */
+enum {
+	PACK_RECORD_ADD = 1,
+	PACK_RECORD_REMOVE
+};
+
+typedef struct _DataCacheEntry DataCacheEntry;
+typedef struct _DataCacheSegment DataCacheSegment;
+typedef struct _DataCachePack DataCachePack;
+
+struct _DataCacheEntry {
+	gchar *key;
+	guint32 segment;
+	off_t offset;
+	gsize length;
+	time_t added;
+	time_t accessed;
+};
+
+struct _DataCacheSegment {
+	guint32 id;
+	off_t size;		/* bytes in the segment file */
+	off_t live;		/* bytes still used by entries */
+};
+
+/* The packed store for one sub-cache path.  Items are written to
+   new/ as plain files while their streams are in use, then appended
+   to the current seg-XXXXXXXX file.  The index is a log of add and
+   remove records, rewritten when it gets much longer than the number
+   of entries. */
+struct _DataCachePack {
+	gchar *dir;
+	GHashTable *entries;	/* key -> DataCacheEntry */
+	GHashTable *segments;	/* id -> DataCacheSegment */
+	GHashTable *pending;	/* keys with a file in new/ */
+	guint32 current;	/* the segment new items are appended to */
+	FILE *log;		/* the index, open for appending */
+	guint log_records;
+	gboolean dirty;		/* access times changed since the index was written */
+	time_t expire_last;
 };
 
 enum {
@@ -71,6 +127,597 @@ enum {
 
 G_DEFINE_TYPE (CamelDataCache, camel_data_cache, CAMEL_TYPE_OBJECT)
 
+static gchar *
+data_cache_pack_segment_path (DataCachePack *pack,
+                              guint32 id)
+{
+	return g_strdup_printf ("%s/seg-%08x", pack->dir, id);
+}
+
+static gchar *
+data_cache_pack_file_path (DataCachePack *pack,
+                           const gchar *subdir,
+                           const gchar *key)
+{
+	gchar *tmp, *real;
+
+	tmp = camel_file_util_safe_filename (key);
+	real = g_strdup_printf ("%s/%s/%s", pack->dir, subdir, tmp);
+	g_free (tmp);
+
+	return real;
+}
+
+static void
+data_cache_entry_free (DataCacheEntry *entry)
+{
+	g_free (entry->key);
+	g_slice_free (DataCacheEntry, entry);
+}
+
+static DataCacheSegment *
+data_cache_pack_segment (DataCachePack *pack,
+                         guint32 id)
+{
+	DataCacheSegment *seg;
+
+	seg = g_hash_table_lookup (pack->segments, GUINT_TO_POINTER (id));
+	if (seg == NULL) {
+		seg = g_new0 (DataCacheSegment, 1);
+		seg->id = id;
+		g_hash_table_insert (pack->segments, GUINT_TO_POINTER (id), seg);
+	}
+
+	return seg;
+}
+
+/* drops a segment once nothing in it is used, unless we're still appending to it */
+static void
+data_cache_pack_check_segment (DataCachePack *pack,
+                               DataCacheSegment *seg)
+{
+	gchar *segpath;
+
+	if (seg->live > 0 || seg->id == pack->current)
+		return;
+
+	segpath = data_cache_pack_segment_path (pack, seg->id);
+	g_unlink (segpath);
+	g_free (segpath);
+
+	g_hash_table_remove (pack->segments, GUINT_TO_POINTER (seg->id));
+}
+
+static void
+data_cache_pack_drop (DataCachePack *pack,
+                      DataCacheEntry *entry)
+{
+	DataCacheSegment *seg;
+	gsize length = entry->length;
+
+	seg = g_hash_table_lookup (pack->segments, GUINT_TO_POINTER (entry->segment));
+	g_hash_table_remove (pack->entries, entry->key);
+
+	if (seg != NULL) {
+		seg->live -= length;
+		data_cache_pack_check_segment (pack, seg);
+	}
+}
+
+static gint
+data_cache_pack_encode_record (FILE *out,
+                               guint32 op,
+                               DataCacheEntry *entry)
+{
+	if (camel_file_util_encode_uint32 (out, op) == -1
+	    || camel_file_util_encode_string (out, entry->key) == -1)
+		return -1;
+
+	if (op == PACK_RECORD_REMOVE)
+		return 0;
+
+	if (camel_file_util_encode_uint32 (out, entry->segment) == -1
+	    || camel_file_util_encode_off_t (out, entry->offset) == -1
+	    || camel_file_util_encode_gsize (out, entry->length) == -1
+	    || camel_file_util_encode_time_t (out, entry->added) == -1
+	    || camel_file_util_encode_time_t (out, entry->accessed) == -1)
+		return -1;
+
+	return 0;
+}
+
+static void
+data_cache_pack_write_index (DataCachePack *pack)
+{
+	GHashTableIter iter;
+	gpointer value;
+	gchar *path, *tmp;
+	FILE *out;
+	gint ret;
+
+	if (pack->log != NULL) {
+		fclose (pack->log);
+		pack->log = NULL;
+	}
+
+	path = g_strdup_printf ("%s/index", pack->dir);
+	tmp = g_strdup_printf ("%s/index~", pack->dir);
+
+	out = g_fopen (tmp, "wb");
+	if (out != NULL) {
+		ret = camel_file_util_encode_string (out, CAMEL_DATA_CACHE_INDEX_MAGIC);
+		if (ret == 0)
+			ret = camel_file_util_encode_uint32 (out, CAMEL_DATA_CACHE_INDEX_VERSION);
+
+		g_hash_table_iter_init (&iter, pack->entries);
+		while (ret == 0 && g_hash_table_iter_next (&iter, NULL, &value))
+			ret = data_cache_pack_encode_record (out, PACK_RECORD_ADD, value);
+
+		if (fclose (out) != 0)
+			ret = -1;
+
+		if (ret == 0 && g_rename (tmp, path) == 0) {
+			pack->log_records = g_hash_table_size (pack->entries);
+			pack->dirty = FALSE;
+		} else {
+			g_unlink (tmp);
+		}
+	}
+
+	/* if we couldn't rewrite it, keep appending to the old one */
+	pack->log = g_fopen (path, "ab");
+
+	g_free (path);
+	g_free (tmp);
+}
+
+static void
+data_cache_pack_log (DataCachePack *pack,
+                     guint32 op,
+                     DataCacheEntry *entry)
+{
+	if (pack->log == NULL) {
+		pack->dirty = TRUE;
+		return;
+	}
+
+	if (data_cache_pack_encode_record (pack->log, op, entry) == -1
+	    || fflush (pack->log) != 0) {
+		/* the log is probably truncated now, write it all out again later */
+		fclose (pack->log);
+		pack->log = NULL;
+		pack->dirty = TRUE;
+		return;
+	}
+
+	pack->log_records++;
+}
+
+static void
+data_cache_pack_load_index (DataCachePack *pack)
+{
+	DataCacheEntry *entry;
+	gchar *path, *magic = NULL, *key;
+	guint32 version, op;
+	gboolean valid = FALSE;
+	FILE *in;
+
+	path = g_strdup_printf ("%s/index", pack->dir);
+	in = g_fopen (path, "rb");
+	g_free (path);
+
+	if (in == NULL) {
+		/* a new pack, make sure the index gets its header */
+		pack->dirty = TRUE;
+		return;
+	}
+
+	if (camel_file_util_decode_string (in, &magic) == 0
+	    && strcmp (magic, CAMEL_DATA_CACHE_INDEX_MAGIC) == 0
+	    && camel_file_util_decode_uint32 (in, &version) == 0
+	    && version == CAMEL_DATA_CACHE_INDEX_VERSION)
+		valid = TRUE;
+
+	/* a truncated last record just means we lost that one update */
+	while (valid && camel_file_util_decode_uint32 (in, &op) == 0) {
+		if (camel_file_util_decode_string (in, &key) == -1)
+			break;
+
+		pack->log_records++;
+
+		if (op == PACK_RECORD_REMOVE) {
+			g_hash_table_remove (pack->entries, key);
+			g_free (key);
+			continue;
+		}
+
+		entry = g_slice_new0 (DataCacheEntry);
+		entry->key = key;
+		if (op != PACK_RECORD_ADD
+		    || camel_file_util_decode_uint32 (in, &entry->segment) == -1
+		    || camel_file_util_decode_off_t (in, &entry->offset) == -1
+		    || camel_file_util_decode_gsize (in, &entry->length) == -1
+		    || camel_file_util_decode_time_t (in, &entry->added) == -1
+		    || camel_file_util_decode_time_t (in, &entry->accessed) == -1) {
+			data_cache_entry_free (entry);
+			pack->dirty = TRUE;
+			break;
+		}
+
+		/* replace, so the key of the older entry goes with it */
+		g_hash_table_replace (pack->entries, entry->key, entry);
+	}
+
+	if (!valid)
+		pack->dirty = TRUE;
+
+	g_free (magic);
+	fclose (in);
+}
+
+static gboolean
+data_cache_pack_check_entry (gpointer key,
+                             DataCacheEntry *entry,
+                             DataCachePack *pack)
+{
+	DataCacheSegment *seg;
+
+	seg = g_hash_table_lookup (pack->segments, GUINT_TO_POINTER (entry->segment));
+	if (seg == NULL || entry->offset + entry->length > seg->size) {
+		pack->dirty = TRUE;
+		return TRUE;
+	}
+
+	seg->live += entry->length;
+
+	return FALSE;
+}
+
+static gboolean
+data_cache_pack_check_unused (gpointer key,
+                              DataCacheSegment *seg,
+                              DataCachePack *pack)
+{
+	gchar *segpath;
+
+	if (seg->live > 0 || seg->id == pack->current)
+		return FALSE;
+
+	segpath = data_cache_pack_segment_path (pack, seg->id);
+	g_unlink (segpath);
+	g_free (segpath);
+
+	return TRUE;
+}
+
+static DataCachePack *
+data_cache_pack_new (const gchar *dir)
+{
+	DataCachePack *pack;
+	DataCacheSegment *seg;
+	const gchar *dname;
+	gchar *path, *key;
+	struct stat st;
+	guint32 id;
+	GDir *gdir;
+
+	pack = g_slice_new0 (DataCachePack);
+	pack->dir = g_strdup (dir);
+	pack->entries = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) data_cache_entry_free);
+	pack->segments = g_hash_table_new_full (
+		g_direct_hash, g_direct_equal,
+		(GDestroyNotify) NULL,
+		(GDestroyNotify) g_free);
+	pack->pending = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) NULL);
+
+	data_cache_pack_load_index (pack);
+
+	/* find the segments, and how much of each is still used */
+	gdir = g_dir_open (dir, 0, NULL);
+	while (gdir != NULL && (dname = g_dir_read_name (gdir)) != NULL) {
+		if (strncmp (dname, "seg-", 4) != 0
+		    || sscanf (dname + 4, "%08x", &id) != 1)
+			continue;
+
+		path = g_strdup_printf ("%s/%s", dir, dname);
+		if (g_stat (path, &st) == 0) {
+			seg = data_cache_pack_segment (pack, id);
+			seg->size = st.st_size;
+			if (id > pack->current)
+				pack->current = id;
+		}
+		g_free (path);
+	}
+	if (gdir != NULL)
+		g_dir_close (gdir);
+
+	g_hash_table_foreach_remove (
+		pack->entries, (GHRFunc) data_cache_pack_check_entry, pack);
+	g_hash_table_foreach_remove (
+		pack->segments, (GHRFunc) data_cache_pack_check_unused, pack);
+
+	seg = g_hash_table_lookup (pack->segments, GUINT_TO_POINTER (pack->current));
+	if (seg != NULL && seg->size >= CAMEL_DATA_CACHE_SEGMENT_SIZE)
+		pack->current++;
+
+	/* items still waiting to be packed, maybe from a previous run */
+	path = g_strdup_printf ("%s/new", dir);
+	gdir = g_dir_open (path, 0, NULL);
+	while (gdir != NULL && (dname = g_dir_read_name (gdir)) != NULL) {
+		key = g_strdup (dname);
+		camel_url_decode (key);
+		g_hash_table_insert (pack->pending, key, GINT_TO_POINTER (1));
+	}
+	if (gdir != NULL)
+		g_dir_close (gdir);
+	g_free (path);
+
+	if (pack->dirty || pack->log_records > 2 * g_hash_table_size (pack->entries) + 64)
+		data_cache_pack_write_index (pack);
+	else {
+		path = g_strdup_printf ("%s/index", dir);
+		pack->log = g_fopen (path, "ab");
+		g_free (path);
+	}
+
+	return pack;
+}
+
+static void
+data_cache_pack_free (DataCachePack *pack)
+{
+	if (pack->dirty)
+		data_cache_pack_write_index (pack);
+
+	if (pack->log != NULL)
+		fclose (pack->log);
+
+	g_hash_table_destroy (pack->entries);
+	g_hash_table_destroy (pack->segments);
+	g_hash_table_destroy (pack->pending);
+	g_free (pack->dir);
+
+	g_slice_free (DataCachePack, pack);
+}
+
+/* appends an item to the current segment, replacing any older copy */
+static gboolean
+data_cache_pack_store (DataCachePack *pack,
+                       const gchar *key,
+                       const gchar *data,
+                       gsize length,
+                       time_t added,
+                       time_t accessed)
+{
+	DataCacheSegment *seg;
+	DataCacheEntry *entry, *old;
+	gchar *segpath;
+	off_t offset;
+	gint fd;
+
+	seg = data_cache_pack_segment (pack, pack->current);
+	if (seg->size >= CAMEL_DATA_CACHE_SEGMENT_SIZE) {
+		pack->current++;
+		data_cache_pack_check_segment (pack, seg);
+		seg = data_cache_pack_segment (pack, pack->current);
+	}
+
+	segpath = data_cache_pack_segment_path (pack, seg->id);
+	fd = g_open (segpath, O_WRONLY | O_CREAT | O_APPEND | O_BINARY, 0600);
+	g_free (segpath);
+
+	if (fd == -1)
+		return FALSE;
+
+	/* whatever a failed append left behind is simply never used */
+	offset = lseek (fd, 0, SEEK_END);
+	if (offset == -1 || camel_write (fd, data, length, NULL, NULL) == -1) {
+		if (offset != -1)
+			seg->size = MAX (seg->size, lseek (fd, 0, SEEK_END));
+		close (fd);
+		return FALSE;
+	}
+
+	if (close (fd) == -1)
+		return FALSE;
+
+	seg->size = offset + length;
+	seg->live += length;
+
+	/* key may belong to the entry being replaced */
+	entry = g_slice_new0 (DataCacheEntry);
+	entry->key = g_strdup (key);
+	entry->segment = seg->id;
+	entry->offset = offset;
+	entry->length = length;
+	entry->added = added;
+	entry->accessed = accessed;
+
+	old = g_hash_table_lookup (pack->entries, entry->key);
+	if (old != NULL)
+		data_cache_pack_drop (pack, old);
+
+	g_hash_table_insert (pack->entries, entry->key, entry);
+	data_cache_pack_log (pack, PACK_RECORD_ADD, entry);
+
+	return TRUE;
+}
+
+static GByteArray *
+data_cache_pack_read (DataCachePack *pack,
+                      DataCacheEntry *entry)
+{
+	GByteArray *buffer;
+	gchar *segpath;
+	gsize done = 0;
+	gssize n;
+	gint fd;
+
+	segpath = data_cache_pack_segment_path (pack, entry->segment);
+	fd = g_open (segpath, O_RDONLY | O_BINARY, 0);
+	g_free (segpath);
+
+	if (fd == -1)
+		return NULL;
+
+	if (lseek (fd, entry->offset, SEEK_SET) != entry->offset) {
+		close (fd);
+		return NULL;
+	}
+
+	buffer = g_byte_array_sized_new (entry->length);
+	g_byte_array_set_size (buffer, entry->length);
+	while (done < entry->length) {
+		n = camel_read (fd, (gchar *) buffer->data + done, entry->length - done, NULL, NULL);
+		if (n <= 0) {
+			g_byte_array_free (buffer, TRUE);
+			close (fd);
+			return NULL;
+		}
+		done += n;
+	}
+
+	close (fd);
+
+	return buffer;
+}
+
+/* removes an item for good, rather than replacing it */
+static void
+data_cache_pack_forget (DataCachePack *pack,
+                        DataCacheEntry *entry)
+{
+	gchar *extracted;
+
+	extracted = data_cache_pack_file_path (pack, "files", entry->key);
+	g_unlink (extracted);
+	g_free (extracted);
+
+	data_cache_pack_log (pack, PACK_RECORD_REMOVE, entry);
+	data_cache_pack_drop (pack, entry);
+}
+
+/* moves finished items from new/ into the current segment */
+static void
+data_cache_pack_flush (CamelDataCache *cdc,
+                       DataCachePack *pack)
+{
+	GHashTableIter iter;
+	GSList *done = NULL, *link;
+	CamelStream *stream;
+	gpointer key;
+	gchar *real, *contents;
+	gsize length;
+	time_t now;
+
+	now = time (NULL);
+
+	g_hash_table_iter_init (&iter, pack->pending);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		real = data_cache_pack_file_path (pack, "new", key);
+
+		/* still being written, or read */
+		stream = camel_object_bag_peek (cdc->priv->busy_bag, real);
+		if (stream != NULL) {
+			g_object_unref (stream);
+			g_free (real);
+			continue;
+		}
+
+		if (g_file_get_contents (real, &contents, &length, NULL)) {
+			/* empty files are treated as missing, as with unpacked caches */
+			if (length == 0 || data_cache_pack_store (pack, key, contents, length, now, now)) {
+				g_unlink (real);
+				done = g_slist_prepend (done, key);
+			}
+			g_free (contents);
+		} else if (g_access (real, F_OK) == -1)
+			done = g_slist_prepend (done, key);
+
+		g_free (real);
+	}
+
+	for (link = done; link != NULL; link = g_slist_next (link))
+		g_hash_table_remove (pack->pending, link->data);
+	g_slist_free (done);
+}
+
+static void
+data_cache_pack_flush_cb (const gchar *path,
+                          DataCachePack *pack,
+                          CamelDataCache *cdc)
+{
+	data_cache_pack_flush (cdc, pack);
+}
+
+/* expires old items, and copies the rest out of mostly unused segments */
+static void
+data_cache_pack_expire (CamelDataCache *cdc,
+                        DataCachePack *pack)
+{
+	GHashTableIter iter;
+	GSList *list = NULL, *link;
+	DataCacheSegment *seg;
+	DataCacheEntry *entry;
+	GByteArray *buffer;
+	gpointer value;
+	time_t now;
+
+	now = time (NULL);
+	if (pack->expire_last + CAMEL_DATA_CACHE_CYCLE_TIME >= now)
+		return;
+	pack->expire_last = now;
+
+	g_hash_table_iter_init (&iter, pack->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		entry = value;
+		if ((cdc->priv->expire_age != -1 && entry->added + cdc->priv->expire_age < now)
+		    || (cdc->priv->expire_access != -1 && entry->accessed + cdc->priv->expire_access < now))
+			list = g_slist_prepend (list, entry);
+	}
+
+	for (link = list; link != NULL; link = g_slist_next (link))
+		data_cache_pack_forget (pack, link->data);
+	g_slist_free (list);
+	list = NULL;
+
+	/* anything in a segment which is more than half garbage gets moved */
+	g_hash_table_iter_init (&iter, pack->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		entry = value;
+		seg = g_hash_table_lookup (pack->segments, GUINT_TO_POINTER (entry->segment));
+		if (seg != NULL && seg->id != pack->current && seg->live * 2 < seg->size)
+			list = g_slist_prepend (list, g_strdup (entry->key));
+	}
+
+	for (link = list; link != NULL; link = g_slist_next (link)) {
+		entry = g_hash_table_lookup (pack->entries, link->data);
+		if (entry == NULL)
+			continue;
+
+		buffer = data_cache_pack_read (pack, entry);
+		if (buffer == NULL)
+			data_cache_pack_forget (pack, entry);
+		else if (!data_cache_pack_store (pack, entry->key, (gchar *) buffer->data,
+						 buffer->len, entry->added, entry->accessed))
+			data_cache_pack_forget (pack, entry);
+
+		if (buffer != NULL)
+			g_byte_array_free (buffer, TRUE);
+	}
+	g_slist_foreach (list, (GFunc) g_free, NULL);
+	g_slist_free (list);
+
+	if (pack->log_records > 2 * g_hash_table_size (pack->entries) + 64)
+		data_cache_pack_write_index (pack);
+}
+
 static void
 data_cache_set_property (GObject *object,
                          guint property_id,
@@ -112,6 +759,11 @@ data_cache_finalize (GObject *object)
 
 	priv = CAMEL_DATA_CACHE_GET_PRIVATE (object);
 
+	g_hash_table_foreach (
+		priv->packs, (GHFunc) data_cache_pack_flush_cb, object);
+	g_hash_table_destroy (priv->packs);
+	g_mutex_free (priv->pack_lock);
+
 	camel_object_bag_destroy (priv->busy_bag);
 	g_free (priv->path);
 
@@ -157,6 +809,11 @@ camel_data_cache_init (CamelDataCache *data_cache)
 	data_cache->priv->busy_bag = busy_bag;
 	data_cache->priv->expire_age = -1;
 	data_cache->priv->expire_access = -1;
+	data_cache->priv->pack_lock = g_mutex_new ();
+	data_cache->priv->packs = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) data_cache_pack_free);
 }
 
 /**
@@ -219,8 +876,14 @@ camel_data_cache_set_path (CamelDataCache *cdc,
 	g_return_if_fail (CAMEL_IS_DATA_CACHE (cdc));
 	g_return_if_fail (path != NULL);
 
+	g_mutex_lock (cdc->priv->pack_lock);
+	g_hash_table_foreach (
+		cdc->priv->packs, (GHFunc) data_cache_pack_flush_cb, cdc);
+	g_hash_table_remove_all (cdc->priv->packs);
+
 	g_free (cdc->priv->path);
 	cdc->priv->path = g_strdup (path);
+	g_mutex_unlock (cdc->priv->pack_lock);
 
 	g_object_notify (G_OBJECT (cdc), "path");
 }
@@ -267,6 +930,66 @@ camel_data_cache_set_expire_access (CamelDataCache *cdc, time_t when)
 	cdc->priv->expire_access = when;
 }
 
+/**
+ * camel_data_cache_set_packed:
+ * @cdc: a #CamelDataCache
+ * @packed: whether to pack items into segment files
+ *
+ * Sets whether items are stored as one file each, or appended to a
+ * few large segment files per path with an index of where each item
+ * lives.  Packing is better suited to caches of many small items,
+ * since it uses far fewer inodes and directory entries, and expiry
+ * works on the index instead of stat()ing every file.
+ *
+ * Items cached before packing was turned on are moved into the
+ * segments as they are looked up.  Items added while packed are not
+ * visible if packing is turned off again.
+ *
+ * A stream returned by camel_data_cache_get() for a packed item holds
+ * a copy of it, so writing to that stream does not change the cache.
+ * camel_data_cache_get_filename() copies a packed item out to a file
+ * of its own.
+ *
+ * Since: 3.0
+ **/
+void
+camel_data_cache_set_packed (CamelDataCache *cdc,
+                             gboolean packed)
+{
+	g_return_if_fail (CAMEL_IS_DATA_CACHE (cdc));
+
+	g_mutex_lock (cdc->priv->pack_lock);
+
+	if (!packed) {
+		g_hash_table_foreach (
+			cdc->priv->packs, (GHFunc) data_cache_pack_flush_cb, cdc);
+		g_hash_table_remove_all (cdc->priv->packs);
+	}
+
+	cdc->priv->packed = packed;
+
+	g_mutex_unlock (cdc->priv->pack_lock);
+}
+
+/**
+ * camel_data_cache_get_packed:
+ * @cdc: a #CamelDataCache
+ *
+ * Returns whether items are packed into segment files.
+ * See camel_data_cache_set_packed().
+ *
+ * Returns: whether the cache is packed
+ *
+ * Since: 3.0
+ **/
+gboolean
+camel_data_cache_get_packed (CamelDataCache *cdc)
+{
+	g_return_val_if_fail (CAMEL_IS_DATA_CACHE (cdc), FALSE);
+
+	return cdc->priv->packed;
+}
+
 static void
 data_cache_expire (CamelDataCache *cdc, const gchar *path, const gchar *keep, time_t now)
 {
@@ -342,6 +1065,266 @@ data_cache_path (CamelDataCache *cdc, gint create, const gchar *path, const gcha
 	return real;
 }
 
+/* must be called with pack_lock held */
+static DataCachePack *
+data_cache_get_pack (CamelDataCache *cdc,
+                     const gchar *path,
+                     gboolean create)
+{
+	DataCachePack *pack;
+	gchar *dir, *newdir;
+
+	pack = g_hash_table_lookup (cdc->priv->packs, path);
+	if (pack == NULL) {
+		dir = g_strdup_printf ("%s/%s/pack", cdc->priv->path, path);
+		newdir = g_strdup_printf ("%s/new", dir);
+
+		if ((create || g_access (dir, F_OK) == 0)
+		    && g_mkdir_with_parents (newdir, 0700) == 0) {
+			pack = data_cache_pack_new (dir);
+			g_hash_table_insert (cdc->priv->packs, g_strdup (path), pack);
+		}
+
+		g_free (newdir);
+		g_free (dir);
+	}
+
+	if (pack != NULL) {
+		data_cache_pack_flush (cdc, pack);
+		if (cdc->priv->expire_age != -1 || cdc->priv->expire_access != -1)
+			data_cache_pack_expire (cdc, pack);
+	}
+
+	return pack;
+}
+
+static CamelStream *
+data_cache_packed_add (CamelDataCache *cdc,
+                       const gchar *path,
+                       const gchar *key,
+                       GError **error)
+{
+	DataCachePack *pack;
+	DataCacheEntry *entry;
+	CamelStream *stream;
+	gchar *real;
+
+	g_mutex_lock (cdc->priv->pack_lock);
+
+	pack = data_cache_get_pack (cdc, path, TRUE);
+	if (pack == NULL) {
+		g_mutex_unlock (cdc->priv->pack_lock);
+		g_set_error (
+			error, CAMEL_ERROR, CAMEL_ERROR_GENERIC,
+			_("Unable to create cache path"));
+		return NULL;
+	}
+
+	/* the new item replaces any packed or unpacked copy */
+	entry = g_hash_table_lookup (pack->entries, key);
+	if (entry != NULL)
+		data_cache_pack_forget (pack, entry);
+
+	real = data_cache_path (cdc, FALSE, path, key);
+	g_unlink (real);
+	g_free (real);
+
+	real = data_cache_pack_file_path (pack, "new", key);
+	do {
+		stream = camel_object_bag_reserve (cdc->priv->busy_bag, real);
+		if (stream) {
+			g_unlink (real);
+			camel_object_bag_remove (cdc->priv->busy_bag, stream);
+			g_object_unref (stream);
+		}
+	} while (stream != NULL);
+
+	stream = camel_stream_fs_new_with_name (
+		real, O_RDWR|O_CREAT|O_TRUNC, 0600, error);
+	if (stream) {
+		camel_object_bag_add (cdc->priv->busy_bag, real, stream);
+		g_hash_table_insert (pack->pending, g_strdup (key), GINT_TO_POINTER (1));
+	} else
+		camel_object_bag_abort (cdc->priv->busy_bag, real);
+
+	g_free (real);
+
+	g_mutex_unlock (cdc->priv->pack_lock);
+
+	return stream;
+}
+
+static CamelStream *
+data_cache_packed_get (CamelDataCache *cdc,
+                       const gchar *path,
+                       const gchar *key,
+                       GError **error)
+{
+	DataCachePack *pack;
+	DataCacheEntry *entry;
+	CamelStream *stream;
+	GByteArray *buffer = NULL;
+	gchar *real, *legacy, *contents;
+	gsize length;
+	struct stat st;
+
+	g_mutex_lock (cdc->priv->pack_lock);
+
+	pack = data_cache_get_pack (cdc, path, FALSE);
+	if (pack == NULL) {
+		/* nothing has been packed here yet, but there may be old files */
+		legacy = data_cache_path (cdc, FALSE, path, key);
+		if (g_stat (legacy, &st) == 0 && st.st_size > 0)
+			pack = data_cache_get_pack (cdc, path, TRUE);
+		g_free (legacy);
+
+		if (pack == NULL) {
+			g_mutex_unlock (cdc->priv->pack_lock);
+			return NULL;
+		}
+	}
+
+	real = data_cache_pack_file_path (pack, "new", key);
+	stream = camel_object_bag_reserve (cdc->priv->busy_bag, real);
+	if (!stream) {
+		entry = g_hash_table_lookup (pack->entries, key);
+
+		if (g_hash_table_lookup (pack->pending, key) != NULL) {
+			if (g_stat (real, &st) == 0 && st.st_size > 0)
+				stream = camel_stream_fs_new_with_name (
+					real, O_RDWR, 0600, error);
+		} else if (entry != NULL) {
+			buffer = data_cache_pack_read (pack, entry);
+			if (buffer != NULL) {
+				entry->accessed = time (NULL);
+				pack->dirty = TRUE;
+			} else
+				data_cache_pack_forget (pack, entry);
+		} else {
+			/* move items cached before the cache was packed */
+			legacy = data_cache_path (cdc, FALSE, path, key);
+			if (g_file_get_contents (legacy, &contents, &length, NULL)) {
+				if (length > 0) {
+					buffer = g_byte_array_sized_new (length);
+					g_byte_array_append (buffer, (guint8 *) contents, length);
+					if (data_cache_pack_store (pack, key, contents, length, time (NULL), time (NULL)))
+						g_unlink (legacy);
+				}
+				g_free (contents);
+			}
+			g_free (legacy);
+		}
+
+		if (buffer != NULL)
+			stream = camel_stream_mem_new_with_byte_array (buffer);
+
+		if (stream)
+			camel_object_bag_add (cdc->priv->busy_bag, real, stream);
+		else
+			camel_object_bag_abort (cdc->priv->busy_bag, real);
+	}
+	g_free (real);
+
+	g_mutex_unlock (cdc->priv->pack_lock);
+
+	return stream;
+}
+
+static gchar *
+data_cache_packed_get_filename (CamelDataCache *cdc,
+                                const gchar *path,
+                                const gchar *key)
+{
+	DataCachePack *pack;
+	DataCacheEntry *entry;
+	GByteArray *buffer;
+	gchar *real = NULL, *dir;
+
+	g_mutex_lock (cdc->priv->pack_lock);
+
+	pack = data_cache_get_pack (cdc, path, FALSE);
+	if (pack != NULL && g_hash_table_lookup (pack->pending, key) != NULL)
+		real = data_cache_pack_file_path (pack, "new", key);
+	else if (pack != NULL && (entry = g_hash_table_lookup (pack->entries, key)) != NULL) {
+		/* copy it out to a file of its own, for as long as the entry lives */
+		real = data_cache_pack_file_path (pack, "files", key);
+		if (g_access (real, F_OK) == -1) {
+			dir = g_strdup_printf ("%s/files", pack->dir);
+			g_mkdir_with_parents (dir, 0700);
+			g_free (dir);
+
+			buffer = data_cache_pack_read (pack, entry);
+			if (buffer != NULL) {
+				g_file_set_contents (real, (gchar *) buffer->data, buffer->len, NULL);
+				g_byte_array_free (buffer, TRUE);
+			}
+		}
+	}
+
+	g_mutex_unlock (cdc->priv->pack_lock);
+
+	if (real == NULL)
+		real = data_cache_path (cdc, FALSE, path, key);
+
+	return real;
+}
+
+static gint
+data_cache_packed_remove (CamelDataCache *cdc,
+                          const gchar *path,
+                          const gchar *key,
+                          GError **error)
+{
+	DataCachePack *pack;
+	DataCacheEntry *entry;
+	CamelStream *stream;
+	gchar *real;
+	gint ret = 0;
+
+	g_mutex_lock (cdc->priv->pack_lock);
+
+	pack = data_cache_get_pack (cdc, path, FALSE);
+	if (pack != NULL) {
+		real = data_cache_pack_file_path (pack, "new", key);
+		stream = camel_object_bag_get (cdc->priv->busy_bag, real);
+		if (stream) {
+			camel_object_bag_remove (cdc->priv->busy_bag, stream);
+			g_object_unref (stream);
+		}
+
+		if (g_hash_table_remove (pack->pending, key)
+		    && g_unlink (real) == -1 && errno != ENOENT) {
+			g_set_error (
+				error, G_IO_ERROR,
+				g_io_error_from_errno (errno),
+				_("Could not remove cache entry: %s: %s"),
+				real, g_strerror (errno));
+			ret = -1;
+		}
+		g_free (real);
+
+		entry = g_hash_table_lookup (pack->entries, key);
+		if (entry != NULL)
+			data_cache_pack_forget (pack, entry);
+	}
+
+	g_mutex_unlock (cdc->priv->pack_lock);
+
+	/* and anything left from before the cache was packed */
+	real = data_cache_path (cdc, FALSE, path, key);
+	if (ret == 0 && g_unlink (real) == -1 && errno != ENOENT) {
+		g_set_error (
+			error, G_IO_ERROR,
+			g_io_error_from_errno (errno),
+			_("Could not remove cache entry: %s: %s"),
+			real, g_strerror (errno));
+		ret = -1;
+	}
+	g_free (real);
+
+	return ret;
+}
+
 /**
  * camel_data_cache_add:
  * @cdc: A #CamelDataCache
@@ -369,6 +1352,9 @@ camel_data_cache_add (CamelDataCache *cdc,
 	gchar *real;
 	CamelStream *stream;
 
+	if (cdc->priv->packed)
+		return data_cache_packed_add (cdc, path, key, error);
+
 	real = data_cache_path (cdc, TRUE, path, key);
 	/* need to loop 'cause otherwise we can call bag_add/bag_abort
 	 * after bag_reserve returned a pointer, which is an invalid
@@ -417,6 +1403,9 @@ camel_data_cache_get (CamelDataCache *cdc,
 	gchar *real;
 	CamelStream *stream;
 
+	if (cdc->priv->packed)
+		return data_cache_packed_get (cdc, path, key, error);
+
 	real = data_cache_path (cdc, FALSE, path, key);
 	stream = camel_object_bag_reserve (cdc->priv->busy_bag, real);
 	if (!stream) {
@@ -458,6 +1447,9 @@ camel_data_cache_get_filename (CamelDataCache *cdc,
 {
 	gchar *real;
 
+	if (cdc->priv->packed)
+		return data_cache_packed_get_filename (cdc, path, key);
+
 	real = data_cache_path (cdc, FALSE, path, key);
 
 	return real;
@@ -484,6 +1476,9 @@ camel_data_cache_remove (CamelDataCache *cdc,
 	gchar *real;
 	gint ret;
 
+	if (cdc->priv->packed)
+		return data_cache_packed_remove (cdc, path, key, error);
+
 	real = data_cache_path (cdc, FALSE, path, key);
 	stream = camel_object_bag_get (cdc->priv->busy_bag, real);
 	if (stream) {
@@ -74,6 +74,9 @@ void		camel_data_cache_set_expire_age	(CamelDataCache *cdc,
 void		camel_data_cache_set_expire_access
 						(CamelDataCache *cdc,
 						 time_t when);
+void		camel_data_cache_set_packed	(CamelDataCache *cdc,
+						 gboolean packed);
+gboolean	camel_data_cache_get_packed	(CamelDataCache *cdc);
 CamelStream *	camel_data_cache_add		(CamelDataCache *cdc,
 						 const gchar *path,
 						 const gchar *key,
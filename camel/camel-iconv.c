@@ -53,44 +53,37 @@ static GStaticMutex lock = G_STATIC_MUTEX_INIT;
 #define UNLOCK()
 #endif
 
-typedef struct _CamelDListNode {
-	struct _CamelDListNode *next;
-	struct _CamelDListNode *prev;
-} CamelDListNode;
-
-typedef struct _CamelDList {
-	struct _CamelDListNode *head;
-	struct _CamelDListNode *tail;
-	struct _CamelDListNode *tailpred;
-} CamelDList;
-
-#define CAMEL_DLIST_INITIALISER(l) { (CamelDListNode *)&l.tail, 0, (CamelDListNode *)&l.head }
-
-struct _iconv_cache_node {
-	struct _iconv_cache_node *next;
-	struct _iconv_cache_node *prev;
-
-	struct _iconv_cache *parent;
-
-	gint busy;
-	iconv_t ip;
+/* Converters are pooled per thread, so the usual open/convert/close
+ * cycle of a thread never has to touch the global lock.  The global
+ * table only records which descriptors belong to the pools, so that a
+ * converter closed from a different thread than it was opened in (or
+ * after its thread went away) can be adopted by the closing thread.
+ *
+ * Each thread also remembers the converters it handed out, to find
+ * their pool entry again on close.  Once a converter is really closed,
+ * iconv may hand its address out again for another conversion, so
+ * these maps are only trusted while no converter was closed since. */
+struct _iconv_pool_entry {
+	gchar *conv;		/* "to%from" */
+	GSList *idle;		/* idle iconv_t's, ready for reuse */
+	guint n_idle;
+	gboolean failed;	/* iconv_open() failed, don't retry */
 };
 
-struct _iconv_cache {
-	struct _iconv_cache *next;
-	struct _iconv_cache *prev;
-
-	gchar *conv;
-
-	CamelDList open;		/* stores iconv_cache_nodes, busy ones up front */
+struct _iconv_thread_pool {
+	GHashTable *entries;	/* conv -> struct _iconv_pool_entry */
+	GHashTable *opened;	/* iconv_t -> struct _iconv_pool_entry */
+	gint closes;		/* iconv_closes when opened was valid */
+	GHashTable *names;	/* charset -> camel_iconv_charset_name () */
 };
 
-#define E_ICONV_CACHE_SIZE (16)
+/* idle converters kept per thread for any one conversion */
+#define E_ICONV_POOL_IDLE (4)
 
-static CamelDList iconv_cache_list;
-static GHashTable *iconv_cache;
-static GHashTable *iconv_cache_open;
-static guint iconv_cache_size = 0;
+static GStaticPrivate iconv_thread_pool = G_STATIC_PRIVATE_INIT;
+/* every open converter, idle or busy, whichever thread opened it */
+static GHashTable *iconv_pool_owned;	/* iconv_t -> conv, under LOCK */
+static volatile gint iconv_closes = 0;	/* pooled converters really closed */
 
 static GHashTable *iconv_charsets = NULL;
 static gchar *locale_charset = NULL;
@@ -155,41 +148,6 @@ struct {
 	{ NULL,             NULL         }
 };
 
-/* Another copy of this trivial list implementation
-   Why?  This stuff gets called a lot (potentially), should run fast,
-   and g_list's are f@@#$ed up to make this a hassle */
-static void camel_dlist_init (CamelDList *v)
-{
-	v->head = (CamelDListNode *)&v->tail;
-	v->tail = NULL;
-	v->tailpred = (CamelDListNode *)&v->head;
-}
-
-static CamelDListNode *camel_dlist_addhead (CamelDList *l, CamelDListNode *n)
-{
-	n->next = l->head;
-	n->prev = (CamelDListNode *)&l->head;
-	l->head->prev = n;
-	l->head = n;
-	return n;
-}
-
-static CamelDListNode *camel_dlist_addtail (CamelDList *l, CamelDListNode *n)
-{
-	n->next = (CamelDListNode *)&l->tail;
-	n->prev = l->tailpred;
-	l->tailpred->next = n;
-	l->tailpred = n;
-	return n;
-}
-
-static CamelDListNode *camel_dlist_remove (CamelDListNode *n)
-{
-	n->next->prev = n->prev;
-	n->prev->next = n->next;
-	return n;
-}
-
 static const gchar *
 e_strdown (gchar *str)
 {
@@ -280,9 +238,7 @@ iconv_init (gint keep)
 		g_hash_table_insert (iconv_charsets, from, to);
 	}
 
-	camel_dlist_init (&iconv_cache_list);
-	iconv_cache = g_hash_table_new (g_str_hash, g_str_equal);
-	iconv_cache_open = g_hash_table_new (NULL, NULL);
+	iconv_pool_owned = g_hash_table_new_full (NULL, NULL, NULL, g_free);
 
 #ifndef G_OS_WIN32
 	locale = setlocale (LC_ALL, NULL);
@@ -343,13 +299,98 @@ iconv_init (gint keep)
 		UNLOCK ();
 }
 
-const gchar *
-camel_iconv_charset_name (const gchar *charset)
+static void
+iconv_pool_entry_free (struct _iconv_pool_entry *entry)
 {
-	gchar *name, *ret, *tmp;
+	g_free (entry->conv);
+	g_slice_free (struct _iconv_pool_entry, entry);
+}
 
-	if (charset == NULL)
-		return NULL;
+static void
+iconv_thread_pool_free (struct _iconv_thread_pool *pool)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GSList *link;
+
+	/* converters still handed out stay in iconv_pool_owned,
+	 * whoever closes them will take them over */
+	LOCK ();
+	g_atomic_int_inc (&iconv_closes);
+	g_hash_table_iter_init (&iter, pool->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		struct _iconv_pool_entry *entry = value;
+
+		for (link = entry->idle; link != NULL; link = link->next) {
+			g_hash_table_remove (iconv_pool_owned, link->data);
+			iconv_close ((iconv_t) link->data);
+		}
+		g_slist_free (entry->idle);
+	}
+	UNLOCK ();
+
+	g_hash_table_destroy (pool->opened);
+	g_hash_table_destroy (pool->entries);
+	g_hash_table_destroy (pool->names);
+	g_slice_free (struct _iconv_thread_pool, pool);
+}
+
+static struct _iconv_thread_pool *
+iconv_thread_pool_get (void)
+{
+	struct _iconv_thread_pool *pool;
+
+	pool = g_static_private_get (&iconv_thread_pool);
+	if (pool == NULL) {
+		pool = g_slice_new (struct _iconv_thread_pool);
+		pool->entries = g_hash_table_new_full (
+			g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify) iconv_pool_entry_free);
+		pool->opened = g_hash_table_new (
+			g_direct_hash, g_direct_equal);
+		pool->closes = g_atomic_int_get (&iconv_closes);
+		pool->names = g_hash_table_new_full (
+			g_str_hash, g_str_equal, g_free, NULL);
+		g_static_private_set (
+			&iconv_thread_pool, pool,
+			(GDestroyNotify) iconv_thread_pool_free);
+	}
+
+	return pool;
+}
+
+static struct _iconv_pool_entry *
+iconv_thread_pool_entry (struct _iconv_thread_pool *pool,
+                         const gchar *conv)
+{
+	struct _iconv_pool_entry *entry;
+
+	entry = g_hash_table_lookup (pool->entries, conv);
+	if (entry == NULL) {
+		entry = g_slice_new0 (struct _iconv_pool_entry);
+		entry->conv = g_strdup (conv);
+		g_hash_table_insert (pool->entries, entry->conv, entry);
+	}
+
+	return entry;
+}
+
+/* forgets the converters handed out, once any converter was closed */
+static void
+iconv_thread_pool_sync (struct _iconv_thread_pool *pool)
+{
+	gint closes = g_atomic_int_get (&iconv_closes);
+
+	if (closes != pool->closes) {
+		g_hash_table_remove_all (pool->opened);
+		pool->closes = closes;
+	}
+}
+
+static const gchar *
+iconv_charset_name_resolve (const gchar *charset)
+{
+	gchar *name, *ret, *tmp;
 
 	name = g_alloca (strlen (charset) + 1);
 	strcpy (name, charset);
@@ -420,34 +461,69 @@ camel_iconv_charset_name (const gchar *charset)
 	return ret;
 }
 
-static void
-flush_entry (struct _iconv_cache *ic)
+const gchar *
+camel_iconv_charset_name (const gchar *charset)
 {
-	struct _iconv_cache_node *in, *nn;
-
-	in = (struct _iconv_cache_node *)ic->open.head;
-	nn = in->next;
-	while (nn) {
-		if (in->ip != (iconv_t)-1) {
-			g_hash_table_remove (iconv_cache_open, in->ip);
-			iconv_close (in->ip);
-		}
-		g_free (in);
-		in = nn;
-		nn = in->next;
+	struct _iconv_thread_pool *pool;
+	const gchar *ret;
+
+	if (charset == NULL)
+		return NULL;
+
+	/* resolved names live in iconv_charsets for good, so each
+	 * thread can remember them without going through the lock */
+	pool = iconv_thread_pool_get ();
+	ret = g_hash_table_lookup (pool->names, charset);
+	if (ret == NULL) {
+		ret = iconv_charset_name_resolve (charset);
+		g_hash_table_insert (pool->names, g_strdup (charset), (gpointer) ret);
+	}
+
+	return ret;
+}
+
+/**
+ * camel_iconv_charset_is_ascii_compatible:
+ * @charset: a charset name
+ *
+ * Checks whether @charset is a stateless charset in which bytes below
+ * 0x80 always stand for the US-ASCII characters of the same value, so
+ * that 7-bit text needs no conversion to or from it.
+ *
+ * Returns: %TRUE if 7-bit text can be passed through unconverted
+ *
+ * Since: 3.0
+ **/
+gboolean
+camel_iconv_charset_is_ascii_compatible (const gchar *charset)
+{
+	static const gchar *prefixes[] = {
+		"utf-8", "us-ascii", "ascii", "iso-8859", "iso8859", "iso_8859",
+		"cp125", "windows-125", "koi8", "gb2312", "gbk", "gb18030",
+		"big5", "euc", "tis-620"
+	};
+	gint i;
+
+	if (charset == NULL)
+		return FALSE;
+
+	charset = camel_iconv_charset_name (charset);
+	for (i = 0; i < G_N_ELEMENTS (prefixes); i++) {
+		if (!g_ascii_strncasecmp (charset, prefixes[i], strlen (prefixes[i])))
+			return TRUE;
 	}
-	g_free (ic->conv);
-	g_free (ic);
+
+	return FALSE;
 }
 
 /* This should run pretty quick, its called a lot */
 iconv_t
 camel_iconv_open (const gchar *oto, const gchar *ofrom)
 {
+	struct _iconv_thread_pool *pool;
+	struct _iconv_pool_entry *entry;
 	const gchar *to, *from;
 	gchar *tofrom;
-	struct _iconv_cache *ic;
-	struct _iconv_cache_node *in;
 	gint errnosav;
 	iconv_t ip;
 
@@ -461,77 +537,47 @@ camel_iconv_open (const gchar *oto, const gchar *ofrom)
 	tofrom = g_alloca (strlen (to) + strlen (from) + 2);
 	sprintf(tofrom, "%s%%%s", to, from);
 
-	LOCK ();
-
-	ic = g_hash_table_lookup (iconv_cache, tofrom);
-	if (ic) {
-		camel_dlist_remove ((CamelDListNode *)ic);
-	} else {
-		struct _iconv_cache *last = (struct _iconv_cache *)iconv_cache_list.tailpred;
-		struct _iconv_cache *prev;
-
-		prev = last->prev;
-		while (prev && iconv_cache_size > E_ICONV_CACHE_SIZE) {
-			in = (struct _iconv_cache_node *)last->open.head;
-			if (in->next && !in->busy) {
-				cd(printf("Flushing iconv converter '%s'\n", last->conv));
-				camel_dlist_remove ((CamelDListNode *)last);
-				g_hash_table_remove (iconv_cache, last->conv);
-				flush_entry (last);
-				iconv_cache_size--;
-			}
-			last = prev;
-			prev = last->prev;
-		}
-
-		iconv_cache_size++;
-
-		ic = g_malloc (sizeof (*ic));
-		camel_dlist_init (&ic->open);
-		ic->conv = g_strdup (tofrom);
-		g_hash_table_insert (iconv_cache, ic->conv, ic);
+	pool = iconv_thread_pool_get ();
+	iconv_thread_pool_sync (pool);
+	entry = iconv_thread_pool_entry (pool, tofrom);
 
-		cd(printf("Creating iconv converter '%s'\n", ic->conv));
+	if (entry->failed) {
+		errno = EINVAL;
+		return (iconv_t) -1;
 	}
-	camel_dlist_addhead (&iconv_cache_list, (CamelDListNode *)ic);
 
 	/* If we have a free iconv, use it */
-	in = (struct _iconv_cache_node *)ic->open.tailpred;
-	if (in->prev && !in->busy) {
-		cd(printf("using existing iconv converter '%s'\n", ic->conv));
-		ip = in->ip;
-		if (ip != (iconv_t)-1) {
-			/* work around some broken iconv implementations
-			 * that die if the length arguments are NULL
-			 */
-			gsize buggy_iconv_len = 0;
-			gchar *buggy_iconv_buf = NULL;
-
-			/* resets the converter */
-			iconv (ip, &buggy_iconv_buf, &buggy_iconv_len, &buggy_iconv_buf, &buggy_iconv_len);
-			in->busy = TRUE;
-			camel_dlist_remove ((CamelDListNode *)in);
-			camel_dlist_addhead (&ic->open, (CamelDListNode *)in);
-		}
+	if (entry->idle != NULL) {
+		/* work around some broken iconv implementations
+		 * that die if the length arguments are NULL
+		 */
+		gsize buggy_iconv_len = 0;
+		gchar *buggy_iconv_buf = NULL;
+
+		cd(printf("using existing iconv converter '%s'\n", entry->conv));
+		ip = (iconv_t) entry->idle->data;
+		entry->idle = g_slist_delete_link (entry->idle, entry->idle);
+		entry->n_idle--;
+
+		/* resets the converter */
+		iconv (ip, &buggy_iconv_buf, &buggy_iconv_len, &buggy_iconv_buf, &buggy_iconv_len);
 	} else {
-		cd(printf("creating new iconv converter '%s'\n", ic->conv));
+		cd(printf("creating new iconv converter '%s'\n", entry->conv));
 		ip = iconv_open (to, from);
-		in = g_malloc (sizeof (*in));
-		in->ip = ip;
-		in->parent = ic;
-		camel_dlist_addhead (&ic->open, (CamelDListNode *)in);
-		if (ip != (iconv_t)-1) {
-			g_hash_table_insert (iconv_cache_open, ip, in);
-			in->busy = TRUE;
-		} else {
+		if (ip == (iconv_t) -1) {
 			errnosav = errno;
 			g_warning("Could not open converter for '%s' to '%s' charset", from, to);
-			in->busy = FALSE;
+			entry->failed = TRUE;
 			errno = errnosav;
+			return ip;
 		}
+
+		LOCK ();
+		g_hash_table_insert (iconv_pool_owned, ip, g_strdup (tofrom));
+		UNLOCK ();
 	}
 
-	UNLOCK ();
+	g_hash_table_insert (pool->opened, ip, entry);
 
 	return ip;
 }
@@ -546,24 +592,48 @@ camel_iconv (iconv_t cd, const gchar **inbuf, gsize *inbytesleft,
 void
 camel_iconv_close (iconv_t ip)
 {
-	struct _iconv_cache_node *in;
+	struct _iconv_thread_pool *pool;
+	struct _iconv_pool_entry *entry;
+	gchar *conv;
 
 	if (ip == (iconv_t)-1)
 		return;
 
-	LOCK ();
-	in = g_hash_table_lookup (iconv_cache_open, ip);
-	if (in) {
-		cd(printf("closing iconv converter '%s'\n", in->parent->conv));
-		camel_dlist_remove ((CamelDListNode *)in);
-		in->busy = FALSE;
-		camel_dlist_addtail (&in->parent->open, (CamelDListNode *)in);
+	pool = iconv_thread_pool_get ();
+	iconv_thread_pool_sync (pool);
+
+	entry = g_hash_table_lookup (pool->opened, ip);
+	if (entry != NULL) {
+		g_hash_table_remove (pool->opened, ip);
 	} else {
-		g_warning("trying to close iconv i dont know about: %p", ip);
-		iconv_close (ip);
+		/* the converter was opened on another thread, so find
+		 * its conversion in the global map and take it over */
+		LOCK ();
+		conv = iconv_pool_owned ? g_hash_table_lookup (iconv_pool_owned, ip) : NULL;
+		UNLOCK ();
+
+		if (conv == NULL) {
+			g_warning("trying to close iconv i dont know about: %p", ip);
+			iconv_close (ip);
+			return;
+		}
+
+		/* conv stays valid, only this call could drop ip from the map */
+		entry = iconv_thread_pool_entry (pool, conv);
 	}
-	UNLOCK ();
 
+	cd(printf("closing iconv converter '%s'\n", entry->conv));
+
+	if (entry->n_idle < E_ICONV_POOL_IDLE) {
+		entry->idle = g_slist_prepend (entry->idle, ip);
+		entry->n_idle++;
+	} else {
+		LOCK ();
+		g_hash_table_remove (iconv_pool_owned, ip);
+		g_atomic_int_inc (&iconv_closes);
+		UNLOCK ();
+		iconv_close (ip);
+	}
 }
 
 const gchar *
@@ -74,7 +74,7 @@ mime_filter_basic_filter (CamelMimeFilter *mime_filter,
 	case CAMEL_MIME_FILTER_BASIC_BASE64_DEC:
 		/* output can't possibly exceed the input size */
 		camel_mime_filter_set_size (mime_filter, len+3, FALSE);
-		newlen = g_base64_decode_step (in, len, (guchar *) mime_filter->outbuf, &priv->state, (guint *) &priv->save);
+		newlen = camel_base64_decode_step ((const guchar *) in, len, (guchar *) mime_filter->outbuf, &priv->state, (guint *) &priv->save);
 		g_assert (newlen <= len+3);
 		break;
 	case CAMEL_MIME_FILTER_BASIC_QP_DEC:
@@ -181,7 +181,7 @@ mime_filter_basic_complete (CamelMimeFilter *mime_filter,
 	case CAMEL_MIME_FILTER_BASIC_BASE64_DEC:
 		/* output can't possibly exceed the input size */
 		camel_mime_filter_set_size (mime_filter, len, FALSE);
-		newlen = g_base64_decode_step (in, len, (guchar *) mime_filter->outbuf, &priv->state, (guint *) &priv->save);
+		newlen = camel_base64_decode_step ((const guchar *) in, len, (guchar *) mime_filter->outbuf, &priv->state, (guint *) &priv->save);
 		g_assert (newlen <= len);
 		break;
 	case CAMEL_MIME_FILTER_BASIC_QP_DEC:
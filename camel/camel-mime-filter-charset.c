@@ -41,8 +41,16 @@ struct _CamelMimeFilterCharsetPrivate {
 	iconv_t ic;
 	gchar *from;
 	gchar *to;
+
+	/* 7-bit text needs no conversion between from and to */
+	guint ascii_passthrough : 1;
+	/* both are UTF-8, valid text needs no conversion */
+	guint utf8_passthrough : 1;
 };
 
+/* bytes of a machine word with the high bit set */
+#define HIGH_BITS (((gulong) -1 / 0xff) * 0x80)
+
 G_DEFINE_TYPE (CamelMimeFilterCharset, camel_mime_filter_charset, CAMEL_TYPE_MIME_FILTER)
 
 static void
@@ -64,6 +72,67 @@ mime_filter_charset_finalize (GObject *object)
 	G_OBJECT_CLASS (camel_mime_filter_charset_parent_class)->finalize (object);
 }
 
+static gboolean
+text_is_7bit (const guchar *in,
+              gsize len)
+{
+	const guchar *inend = in + len;
+
+	while (in < inend && ((gsize) in & (sizeof (gulong) - 1)) != 0) {
+		if (*in++ & 0x80)
+			return FALSE;
+	}
+
+	/* check a word at a time */
+	for (; in + sizeof (gulong) <= inend; in += sizeof (gulong)) {
+		if (*((const gulong *) in) & HIGH_BITS)
+			return FALSE;
+	}
+
+	while (in < inend) {
+		if (*in++ & 0x80)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Checks whether the input can be handed on without going through
+ * iconv at all, which is the case for the vast majority of mail.
+ * *passlen is set to the number of leading bytes to pass on, any
+ * incomplete UTF-8 sequence at the end is saved for next time. */
+static gboolean
+mime_filter_charset_passthrough (CamelMimeFilter *mime_filter,
+                                 const gchar *in,
+                                 gsize len,
+                                 gboolean complete,
+                                 gsize *passlen)
+{
+	CamelMimeFilterCharsetPrivate *priv;
+	const gchar *end;
+
+	priv = CAMEL_MIME_FILTER_CHARSET_GET_PRIVATE (mime_filter);
+
+	if (priv->utf8_passthrough) {
+		if (g_utf8_validate (in, len, &end)) {
+			*passlen = len;
+			return TRUE;
+		}
+
+		/* a multibyte character split across two chunks */
+		if (!complete && g_utf8_get_char_validated (end, in + len - end) == (gunichar) -2) {
+			camel_mime_filter_backup (mime_filter, end, in + len - end);
+			*passlen = end - in;
+			return TRUE;
+		}
+	} else if (priv->ascii_passthrough && text_is_7bit ((const guchar *) in, len)) {
+		*passlen = len;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 static void
 mime_filter_charset_complete (CamelMimeFilter *mime_filter,
                               const gchar *in,
@@ -77,12 +146,20 @@ mime_filter_charset_complete (CamelMimeFilter *mime_filter,
 	gsize inleft, outleft, converted = 0;
 	const gchar *inbuf;
 	gchar *outbuf;
+	gsize passlen;
 
 	priv = CAMEL_MIME_FILTER_CHARSET_GET_PRIVATE (mime_filter);
 
 	if (priv->ic == (iconv_t) -1)
 		goto noop;
 
+	if (mime_filter_charset_passthrough (mime_filter, in, len, TRUE, &passlen)) {
+		*out = (gchar *) in;
+		*outlen = passlen;
+		*outprespace = prespace;
+		return;
+	}
+
 	camel_mime_filter_set_size (mime_filter, len * 5 + 16, FALSE);
 	outbuf = mime_filter->outbuf;
 	outleft = mime_filter->outsize;
@@ -160,12 +237,20 @@ mime_filter_charset_filter (CamelMimeFilter *mime_filter,
 	gsize inleft, outleft, converted = 0;
 	const gchar *inbuf;
 	gchar *outbuf;
+	gsize passlen;
 
 	priv = CAMEL_MIME_FILTER_CHARSET_GET_PRIVATE (mime_filter);
 
 	if (priv->ic == (iconv_t) -1)
 		goto noop;
 
+	if (mime_filter_charset_passthrough (mime_filter, in, len, FALSE, &passlen)) {
+		*out = (gchar *) in;
+		*outlen = passlen;
+		*outprespace = prespace;
+		return;
+	}
+
 	camel_mime_filter_set_size (mime_filter, len * 5 + 16, FALSE);
 	outbuf = mime_filter->outbuf + converted;
 	outleft = mime_filter->outsize - converted;
@@ -288,6 +373,13 @@ camel_mime_filter_charset_new (const gchar *from_charset,
 	} else {
 		priv->from = g_strdup (from_charset);
 		priv->to = g_strdup (to_charset);
+
+		priv->ascii_passthrough =
+			camel_iconv_charset_is_ascii_compatible (from_charset) &&
+			camel_iconv_charset_is_ascii_compatible (to_charset);
+		priv->utf8_passthrough =
+			!g_ascii_strcasecmp (camel_iconv_charset_name (from_charset), "UTF-8") &&
+			!g_ascii_strcasecmp (camel_iconv_charset_name (to_charset), "UTF-8");
 	}
 
 	return new;
@@ -63,6 +63,9 @@ struct _CamelMimePartPrivate {
 	gchar *content_location;
 	GList *content_languages;
 	CamelTransferEncoding encoding;
+
+	/* structured headers that have been set but not decoded yet */
+	guint lazy_headers;
 };
 
 struct _AsyncContext {
@@ -92,6 +95,14 @@ typedef enum {
 	HEADER_CONTENT_TYPE
 } CamelHeaderType;
 
+/* structured headers which are only decoded on first access */
+enum {
+	LAZY_DESCRIPTION	= 1 << 0,
+	LAZY_DISPOSITION	= 1 << 1,
+	LAZY_CONTENT_ID		= 1 << 2,
+	LAZY_CONTENT_LOCATION	= 1 << 3
+};
+
 static GHashTable *header_name_table;
 static GHashTable *header_formatted_table;
 
@@ -244,6 +255,23 @@ init_header_name_table (void)
 		(gpointer) "References", write_references);
 }
 
+/* The decoded value of a structured header comes from its last
+ * occurrence, as mime_part_process_header() sees them in order. */
+static const gchar *
+mime_part_find_last_header (CamelMimePart *mime_part,
+                            const gchar *name)
+{
+	struct _camel_header_raw *h;
+	const gchar *value = NULL;
+
+	for (h = mime_part->headers; h; h = h->next) {
+		if (!g_ascii_strcasecmp (h->name, name))
+			value = h->value;
+	}
+
+	return value;
+}
+
 static void
 mime_part_set_disposition (CamelMimePart *mime_part,
                            const gchar *disposition)
@@ -256,6 +284,63 @@ mime_part_set_disposition (CamelMimePart *mime_part,
 		mime_part->priv->disposition = NULL;
 }
 
+static void
+mime_part_set_lazy (CamelMimePart *mime_part,
+                    guint which,
+                    const gchar *value)
+{
+	if (value != NULL)
+		mime_part->priv->lazy_headers |= which;
+	else
+		mime_part->priv->lazy_headers &= ~which;
+}
+
+/* Decodes a structured header from its raw value the first time it is
+ * asked for, rather than for every header of every part we construct. */
+static void
+mime_part_decode_lazy (CamelMimePart *mime_part,
+                       guint which)
+{
+	CamelMimePartPrivate *priv = mime_part->priv;
+	const gchar *charset;
+	const gchar *value;
+	gchar *text;
+
+	if ((priv->lazy_headers & which) == 0)
+		return;
+
+	priv->lazy_headers &= ~which;
+
+	switch (which) {
+	case LAZY_DESCRIPTION:
+		value = mime_part_find_last_header (mime_part, "Content-Description");
+		if (value == NULL)
+			break;
+		if (((CamelDataWrapper *) mime_part)->mime_type) {
+			charset = camel_content_type_param (((CamelDataWrapper *) mime_part)->mime_type, "charset");
+			charset = camel_iconv_charset_name (charset);
+		} else
+			charset = NULL;
+		text = camel_header_decode_string (value, charset);
+		priv->description = text ? g_strstrip (text) : NULL;
+		break;
+	case LAZY_DISPOSITION:
+		value = mime_part_find_last_header (mime_part, "Content-Disposition");
+		mime_part_set_disposition (mime_part, value);
+		break;
+	case LAZY_CONTENT_ID:
+		value = mime_part_find_last_header (mime_part, "Content-ID");
+		if (value != NULL)
+			priv->content_id = camel_header_contentid_decode (value);
+		break;
+	case LAZY_CONTENT_LOCATION:
+		value = mime_part_find_last_header (mime_part, "Content-Location");
+		if (value != NULL)
+			priv->content_location = camel_header_location_decode (value);
+		break;
+	}
+}
+
 static gboolean
 mime_part_process_header (CamelMedium *medium,
                           const gchar *name,
@@ -263,7 +348,6 @@ mime_part_process_header (CamelMedium *medium,
 {
 	CamelMimePart *mime_part = CAMEL_MIME_PART (medium);
 	CamelHeaderType header_type;
-	const gchar *charset;
 	gchar *text;
 
 	/* Try to parse the header pair. If it corresponds to something   */
@@ -272,21 +356,20 @@ mime_part_process_header (CamelMedium *medium,
 
 	header_type = (CamelHeaderType) g_hash_table_lookup (header_name_table, name);
 	switch (header_type) {
-	case HEADER_DESCRIPTION: /* raw header->utf8 conversion */
+	case HEADER_DESCRIPTION:
+		/* raw header->utf8 conversion is done on demand */
 		g_free (mime_part->priv->description);
-		if (((CamelDataWrapper *) mime_part)->mime_type) {
-			charset = camel_content_type_param (((CamelDataWrapper *) mime_part)->mime_type, "charset");
-			charset = camel_iconv_charset_name (charset);
-		} else
-			charset = NULL;
-		mime_part->priv->description = g_strstrip (camel_header_decode_string (value, charset));
+		mime_part->priv->description = NULL;
+		mime_part_set_lazy (mime_part, LAZY_DESCRIPTION, value);
 		break;
 	case HEADER_DISPOSITION:
-		mime_part_set_disposition (mime_part, value);
+		mime_part_set_disposition (mime_part, NULL);
+		mime_part_set_lazy (mime_part, LAZY_DISPOSITION, value);
 		break;
 	case HEADER_CONTENT_ID:
 		g_free (mime_part->priv->content_id);
-		mime_part->priv->content_id = camel_header_contentid_decode (value);
+		mime_part->priv->content_id = NULL;
+		mime_part_set_lazy (mime_part, LAZY_CONTENT_ID, value);
 		break;
 	case HEADER_ENCODING:
 		text = camel_header_token_decode (value);
@@ -299,7 +382,8 @@ mime_part_process_header (CamelMedium *medium,
 		break;
 	case HEADER_CONTENT_LOCATION:
 		g_free (mime_part->priv->content_location);
-		mime_part->priv->content_location = camel_header_location_decode (value);
+		mime_part->priv->content_location = NULL;
+		mime_part_set_lazy (mime_part, LAZY_CONTENT_LOCATION, value);
 		break;
 	case HEADER_CONTENT_TYPE:
 		if (((CamelDataWrapper *) mime_part)->mime_type)
@@ -995,6 +1079,8 @@ camel_mime_part_get_content_disposition (CamelMimePart *mime_part)
 {
 	g_return_val_if_fail (mime_part != NULL, NULL);
 
+	mime_part_decode_lazy (mime_part, LAZY_DISPOSITION);
+
 	return mime_part->priv->disposition;
 }
 
@@ -1011,6 +1097,8 @@ camel_mime_part_get_content_id (CamelMimePart *mime_part)
 {
 	g_return_val_if_fail (CAMEL_IS_MIME_PART (mime_part), NULL);
 
+	mime_part_decode_lazy (mime_part, LAZY_CONTENT_ID);
+
 	return mime_part->priv->content_id;
 }
 
@@ -1059,6 +1147,8 @@ camel_mime_part_get_content_location (CamelMimePart *mime_part)
 {
 	g_return_val_if_fail (CAMEL_IS_MIME_PART (mime_part), NULL);
 
+	mime_part_decode_lazy (mime_part, LAZY_CONTENT_LOCATION);
+
 	return mime_part->priv->content_location;
 }
 
@@ -1211,6 +1301,8 @@ camel_mime_part_get_description (CamelMimePart *mime_part)
 {
 	g_return_val_if_fail (CAMEL_IS_MIME_PART (mime_part), NULL);
 
+	mime_part_decode_lazy (mime_part, LAZY_DESCRIPTION);
+
 	return mime_part->priv->description;
 }
 
@@ -1253,6 +1345,8 @@ camel_mime_part_get_disposition (CamelMimePart *mime_part)
 {
 	g_return_val_if_fail (CAMEL_IS_MIME_PART (mime_part), NULL);
 
+	mime_part_decode_lazy (mime_part, LAZY_DISPOSITION);
+
 	if (mime_part->priv->disposition)
 		return mime_part->priv->disposition->disposition;
 	else
@@ -1277,6 +1371,8 @@ camel_mime_part_set_disposition (CamelMimePart *mime_part,
 
 	medium = CAMEL_MEDIUM (mime_part);
 
+	mime_part_decode_lazy (mime_part, LAZY_DISPOSITION);
+
 	/* we poke in a new disposition (so we dont lose 'filename', etc) */
 	if (mime_part->priv->disposition == NULL)
 		mime_part_set_disposition (mime_part, disposition);
@@ -1344,6 +1440,8 @@ camel_mime_part_set_encoding (CamelMimePart *mime_part,
 const gchar *
 camel_mime_part_get_filename (CamelMimePart *mime_part)
 {
+	mime_part_decode_lazy (mime_part, LAZY_DISPOSITION);
+
 	if (mime_part->priv->disposition) {
 		const gchar *name = camel_header_param (
 			mime_part->priv->disposition->params, "filename");
@@ -1372,6 +1470,8 @@ camel_mime_part_set_filename (CamelMimePart *mime_part,
 
 	medium = CAMEL_MEDIUM (mime_part);
 
+	mime_part_decode_lazy (mime_part, LAZY_DISPOSITION);
+
 	if (mime_part->priv->disposition == NULL)
 		mime_part->priv->disposition =
 			camel_content_disposition_decode("attachment");
@@ -374,6 +374,127 @@ camel_uudecode_step (guchar *in, gsize len, guchar *out, gint *state, guint32 *s
 	return outptr - out;
 }
 
+/* base64 alphabet rank, 0xff for characters which are skipped.
+ * '=' ranks as 0 like in g_base64_decode_step(), the decoder looks
+ * at the characters themselves to honour the padding. */
+static guchar base64_rank[256];
+static GOnce base64_rank_once = G_ONCE_INIT;
+
+static gpointer
+base64_rank_init (gpointer data)
+{
+	static const gchar alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	gint i;
+
+	memset (base64_rank, 0xff, sizeof (base64_rank));
+	for (i = 0; i < 64; i++)
+		base64_rank[(guchar) alphabet[i]] = i;
+	base64_rank['='] = 0;
+
+	return NULL;
+}
+
+/**
+ * camel_base64_decode_step:
+ * @in: input stream
+ * @len: max length of data to decode
+ * @out: output stream
+ * @state: holds the number of bits that are stored in @save
+ * @save: leftover bits that have not yet been decoded
+ *
+ * Decodes a chunk of base64 encoded data.  The output and the
+ * @state / @save semantics are the same as g_base64_decode_step(),
+ * so the two may be used interchangeably, but whole groups of four
+ * encoded characters are converted at a time when possible, which is
+ * considerably faster on large attachments.
+ *
+ * Returns: the number of bytes decoded
+ *
+ * Since: 3.0
+ **/
+gsize
+camel_base64_decode_step (const guchar *in, gsize len, guchar *out, gint *state, guint *save)
+{
+	register const guchar *inptr;
+	register guchar *outptr;
+	const guchar *inend;
+	guchar c, rank, last[2];
+	guint32 v;
+	gint i;
+
+	if (len == 0)
+		return 0;
+
+	g_once (&base64_rank_once, base64_rank_init, NULL);
+
+	inend = in + len;
+	outptr = out;
+
+	v = *save;
+	i = *state;
+	last[0] = last[1] = 0;
+
+	/* a negative state means the previous group ended in padding */
+	if (i < 0) {
+		i = -i;
+		last[0] = '=';
+	}
+
+	inptr = in;
+	while (inptr < inend) {
+		/* fast path: at a group boundary with a full group of
+		 * plain alphabet characters ahead, convert it in one go */
+		while (i == 0 && last[0] != '=' && inend - inptr >= 4) {
+			guint32 r0, r1, r2, r3;
+
+			r0 = base64_rank[inptr[0]];
+			r1 = base64_rank[inptr[1]];
+			r2 = base64_rank[inptr[2]];
+			r3 = base64_rank[inptr[3]];
+
+			/* any of them skipped (0xff) or padding ('=' ranks 0) */
+			if (((r0 | r1 | r2 | r3) & 0xc0) != 0
+			    || inptr[2] == '=' || inptr[3] == '=')
+				break;
+
+			v = (r0 << 18) | (r1 << 12) | (r2 << 6) | r3;
+			*outptr++ = v >> 16;
+			*outptr++ = v >> 8;
+			*outptr++ = v;
+
+			last[1] = inptr[2];
+			last[0] = inptr[3];
+			inptr += 4;
+		}
+
+		if (inptr >= inend)
+			break;
+
+		c = *inptr++;
+		rank = base64_rank[c];
+		if (rank != 0xff) {
+			last[1] = last[0];
+			last[0] = c;
+			v = (v << 6) | rank;
+			i++;
+			if (i == 4) {
+				*outptr++ = v >> 16;
+				if (last[1] != '=')
+					*outptr++ = v >> 8;
+				if (last[0] != '=')
+					*outptr++ = v;
+				i = 0;
+			}
+		}
+	}
+
+	*save = v;
+	*state = last[0] == '=' ? -i : i;
+
+	return outptr - out;
+}
+
 /**
  * camel_quoted_encode_close:
  * @in: input stream
@@ -453,6 +574,24 @@ camel_quoted_encode_step (guchar *in, gsize len, guchar *out, gint *statep, gint
 	inend = in + len;
 	outptr = out;
 	while (inptr < inend) {
+		/* copy a run of plain safe characters straight through,
+		 * up to the point where the line would need a soft break */
+		if (last == -1 && sofar <= 74) {
+			register guchar *start = inptr, *runend;
+
+			runend = inptr + MIN (inend - inptr, 75 - sofar);
+			while (inptr < runend && camel_mime_is_qpsafe (*inptr)
+			       && *inptr != ' ' && *inptr != '\t')
+				inptr++;
+
+			if (inptr > start) {
+				memcpy (outptr, start, inptr - start);
+				outptr += inptr - start;
+				sofar += inptr - start;
+				continue;
+			}
+		}
+
 		c = *inptr++;
 		if (c == '\r') {
 			if (last != -1) {
@@ -538,8 +677,9 @@ gsize
 camel_quoted_decode_step (guchar *in, gsize len, guchar *out, gint *savestate, gint *saveme)
 {
 	register guchar *inptr, *outptr;
-	guchar *inend, c;
+	guchar *inend, *eq, c;
 	gint state, save;
+	gsize n;
 
 	inend = in+len;
 	outptr = out;
@@ -552,23 +692,15 @@ camel_quoted_decode_step (guchar *in, gsize len, guchar *out, gint *savestate, g
 	while (inptr<inend) {
 		switch (state) {
 		case 0:
-			while (inptr<inend) {
-				c = *inptr++;
-				if (c=='=') {
-					state = 1;
-					break;
-				}
-#ifdef CANONICALISE_EOL
-				/*else if (c=='\r') {
-					state = 3;
-				} else if (c=='\n') {
-					*outptr++ = '\r';
-					*outptr++ = c;
-					} */
-#endif
-				else {
-					*outptr++ = c;
-				}
+			/* copy everything up to the next escape in one go */
+			eq = memchr (inptr, '=', inend - inptr);
+			n = (eq ? eq : inend) - inptr;
+			memcpy (outptr, inptr, n);
+			outptr += n;
+			inptr += n;
+			if (eq) {
+				inptr++;
+				state = 1;
 			}
 			break;
 		case 1:
@@ -1032,6 +1164,15 @@ rfc2047_decode_word (const gchar *in, gsize inlen, const gchar *default_charset)
 	if (charset[0])
 		charset = camel_iconv_charset_name (charset);
 
+	/* plenty of mailers encode plain US-ASCII words */
+	if (charset[0] && camel_iconv_charset_is_ascii_compatible (charset)) {
+		for (p = (gchar *) decoded; p < (gchar *) decoded + declen && is_ascii (*p) && *p; p++)
+			;
+
+		if (p == (gchar *) decoded + declen)
+			return g_strndup ((gchar *) decoded, declen);
+	}
+
 	if (!charset[0] || (cd = camel_iconv_open ("UTF-8", charset)) == (iconv_t) -1) {
 		w(g_warning ("Cannot convert from %s to UTF-8, header display may "
 			     "be corrupt: %s", charset[0] ? charset : "unspecified charset",
@@ -1139,6 +1280,19 @@ header_decode_text (const gchar *in, gint ctext, const gchar *default_charset)
 	if (in == NULL)
 		return g_strdup ("");
 
+	/* the common case, nothing to decode at all */
+	if (!ctext) {
+		for (inptr = in; *inptr && is_ascii (*inptr); inptr++) {
+			if (inptr[0] == '=' && inptr[1] == '?')
+				break;
+		}
+
+		if (*inptr == '\0')
+			return g_strdup (in);
+
+		inptr = in;
+	}
+
 	out = g_string_sized_new (strlen (in) + 1);
 
 	while (*inptr != '\0') {
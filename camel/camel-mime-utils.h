@@ -238,6 +238,8 @@ gsize camel_uuencode_step (guchar *in, gsize len, guchar *out, guchar *uubuf, gi
 gsize camel_uuencode_close (guchar *in, gsize len, guchar *out, guchar *uubuf, gint *state,
 		       guint32 *save);
 
+gsize camel_base64_decode_step (const guchar *in, gsize len, guchar *out, gint *state, guint *save);
+
 gsize camel_quoted_decode_step (guchar *in, gsize len, guchar *out, gint *savestate, gint *saveme);
 
 gsize camel_quoted_encode_step (guchar *in, gsize len, guchar *out, gint *state, gint *save);
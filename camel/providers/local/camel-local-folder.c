@@ -62,8 +62,106 @@ enum {
 	PROP_INDEX_BODY = 0x2400
 };
 
+/* Byte range of one MIME part of a message, as recorded by
+ * local_folder_index_part().  Offsets are relative to the end of the
+ * top-level headers, which are the only bytes of a stored message that
+ * ever get rewritten (X-Evolution in mbox).  A negative start means the
+ * range begins at the top-level headers themselves. */
+typedef struct _LocalPartOffsets LocalPartOffsets;
+
+struct _LocalPartOffsets {
+	gchar *spec;
+	goffset start;
+	goffset end;
+};
+
+static CamelStream *	local_folder_get_part_stream_sync
+						(CamelLocalFolder *local_folder,
+						 const gchar *uid,
+						 const gchar *part_spec,
+						 GCancellable *cancellable,
+						 GError **error);
+
 G_DEFINE_TYPE (CamelLocalFolder, camel_local_folder, CAMEL_TYPE_FOLDER)
 
+static void
+local_part_offsets_free (GArray *parts)
+{
+	guint ii;
+
+	for (ii = 0; ii < parts->len; ii++)
+		g_free (g_array_index (parts, LocalPartOffsets, ii).spec);
+
+	g_array_free (parts, TRUE);
+}
+
+static gboolean
+local_part_offsets_find (GArray *parts,
+                         const gchar *spec,
+                         goffset *start,
+                         goffset *end)
+{
+	guint ii;
+
+	for (ii = 0; ii < parts->len; ii++) {
+		LocalPartOffsets *part;
+
+		part = &g_array_index (parts, LocalPartOffsets, ii);
+		if (strcmp (part->spec, spec) == 0) {
+			*start = part->start;
+			*end = part->end;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* the messages whose part offsets are kept at any one time */
+#define LOCAL_PART_INDEX_MAX (64)
+
+static void
+local_folder_clear_part_index (CamelLocalFolder *lf)
+{
+	gchar *uid;
+
+	CAMEL_LOCAL_FOLDER_LOCK (lf, part_index_lock);
+	g_hash_table_remove_all (lf->priv->part_index);
+	while ((uid = g_queue_pop_head (&lf->priv->part_index_uids)) != NULL)
+		g_free (uid);
+	CAMEL_LOCAL_FOLDER_UNLOCK (lf, part_index_lock);
+}
+
+/* Keeps the offsets of the last LOCAL_PART_INDEX_MAX messages asked
+ * for; the parts of one message tend to be asked for together. */
+static void
+local_folder_add_part_index (CamelLocalFolder *lf,
+                             const gchar *uid,
+                             GArray *parts)
+{
+	gchar *oldest;
+
+	CAMEL_LOCAL_FOLDER_LOCK (lf, part_index_lock);
+
+	/* another thread indexed it meanwhile */
+	if (g_hash_table_lookup (lf->priv->part_index, uid) != NULL) {
+		CAMEL_LOCAL_FOLDER_UNLOCK (lf, part_index_lock);
+		local_part_offsets_free (parts);
+		return;
+	}
+
+	g_hash_table_insert (lf->priv->part_index, g_strdup (uid), parts);
+	g_queue_push_tail (&lf->priv->part_index_uids, g_strdup (uid));
+
+	while (g_queue_get_length (&lf->priv->part_index_uids) > LOCAL_PART_INDEX_MAX) {
+		oldest = g_queue_pop_head (&lf->priv->part_index_uids);
+		g_hash_table_remove (lf->priv->part_index, oldest);
+		g_free (oldest);
+	}
+
+	CAMEL_LOCAL_FOLDER_UNLOCK (lf, part_index_lock);
+}
+
 static void
 local_folder_set_property (GObject *object,
                            guint property_id,
@@ -147,6 +245,10 @@ local_folder_finalize (GObject *object)
 	camel_folder_change_info_free (local_folder->changes);
 
 	g_mutex_free (local_folder->priv->search_lock);
+	g_mutex_free (local_folder->priv->part_index_lock);
+	g_hash_table_destroy (local_folder->priv->part_index);
+	g_queue_foreach (&local_folder->priv->part_index_uids, (GFunc) g_free, NULL);
+	g_queue_clear (&local_folder->priv->part_index_uids);
 
 	/* Chain up to parent's finalize() method. */
 	G_OBJECT_CLASS (camel_local_folder_parent_class)->finalize (object);
@@ -368,22 +470,131 @@ local_folder_expunge_sync (CamelFolder *folder,
 		folder, TRUE, cancellable, error);
 }
 
+/* Builds the previews of newly found messages from their first part
+ * only, so the attachments are neither read nor parsed.  Runs in a
+ * session thread, so a refresh does not wait for the messages to be
+ * read. */
+
+struct _preview_added_msg {
+	CamelSessionThreadMsg msg;
+
+	CamelLocalFolder *folder;
+	GPtrArray *uids;
+};
+
+static void
+local_folder_preview_added_exec (CamelSession *session,
+                                 CamelSessionThreadMsg *msg)
+{
+	struct _preview_added_msg *m = (struct _preview_added_msg *) msg;
+	CamelFolder *folder = CAMEL_FOLDER (m->folder);
+	GPtrArray *uids = m->uids;
+	GCancellable *cancellable = msg->cancellable;
+	guint ii;
+
+	for (ii = 0; ii < uids->len; ii++) {
+		CamelMessageInfo *info;
+		CamelMimePart *part;
+		CamelStream *stream;
+
+		if (g_cancellable_is_cancelled (cancellable))
+			break;
+
+		info = camel_folder_summary_uid (folder->summary, uids->pdata[ii]);
+		if (info == NULL)
+			continue;
+
+		if (((CamelMessageInfoBase *) info)->preview != NULL) {
+			camel_message_info_free (info);
+			continue;
+		}
+
+		/* serialized with the other folder operations */
+		camel_folder_lock (folder, CAMEL_FOLDER_REC_LOCK);
+		stream = camel_local_folder_get_part_stream_sync (
+			m->folder, uids->pdata[ii], "1", cancellable, NULL);
+		camel_folder_unlock (folder, CAMEL_FOLDER_REC_LOCK);
+		if (stream == NULL) {
+			camel_message_info_free (info);
+			continue;
+		}
+
+		part = camel_mime_part_new ();
+		if (camel_data_wrapper_construct_from_stream_sync (
+			CAMEL_DATA_WRAPPER (part), stream, cancellable, NULL) != -1 &&
+		    camel_mime_message_build_preview (part, info) &&
+		    ((CamelMessageInfoBase *) info)->preview != NULL)
+			camel_folder_summary_add_preview (folder->summary, info);
+
+		g_object_unref (part);
+		g_object_unref (stream);
+		camel_message_info_free (info);
+	}
+}
+
+static void
+local_folder_preview_added_free (CamelSession *session,
+                                 CamelSessionThreadMsg *msg)
+{
+	struct _preview_added_msg *m = (struct _preview_added_msg *) msg;
+
+	g_ptr_array_foreach (m->uids, (GFunc) g_free, NULL);
+	g_ptr_array_free (m->uids, TRUE);
+	g_object_unref (m->folder);
+}
+
+static CamelSessionThreadOps preview_added_ops = {
+	local_folder_preview_added_exec,
+	local_folder_preview_added_free,
+};
+
+static void
+local_folder_preview_added (CamelLocalFolder *lf,
+                            GPtrArray *uids)
+{
+	struct _preview_added_msg *m;
+	CamelStore *parent_store;
+	CamelSession *session;
+
+	parent_store = camel_folder_get_parent_store (CAMEL_FOLDER (lf));
+	session = camel_service_get_session (CAMEL_SERVICE (parent_store));
+
+	m = camel_session_thread_msg_new (session, &preview_added_ops, sizeof (*m));
+	m->folder = g_object_ref (lf);
+	m->uids = uids;
+	camel_session_thread_queue (session, &m->msg, 0);
+}
+
 static gboolean
 local_folder_refresh_info_sync (CamelFolder *folder,
                                 GCancellable *cancellable,
                                 GError **error)
 {
 	CamelLocalFolder *lf = (CamelLocalFolder *)folder;
+	GPtrArray *added = NULL;
+	guint ii;
 
 	if (lf->need_summary_check &&
 	    camel_local_summary_check ((CamelLocalSummary *)folder->summary, lf->changes, cancellable, error) == -1)
 		return FALSE;
 
+	local_folder_clear_part_index (lf);
+
 	if (camel_folder_change_info_changed (lf->changes)) {
+		if (camel_folder_summary_get_need_preview (folder->summary) &&
+		    lf->changes->uid_added->len > 0) {
+			added = g_ptr_array_sized_new (lf->changes->uid_added->len);
+			for (ii = 0; ii < lf->changes->uid_added->len; ii++)
+				g_ptr_array_add (added, g_strdup (lf->changes->uid_added->pdata[ii]));
+		}
+
 		camel_folder_changed (folder, lf->changes);
 		camel_folder_change_info_clear (lf->changes);
 	}
 
+	if (added != NULL)
+		local_folder_preview_added (lf, added);
+
 	return TRUE;
 }
 
@@ -407,6 +618,7 @@ local_folder_synchronize_sync (CamelFolder *folder,
 	success = (camel_local_summary_sync (
 		(CamelLocalSummary *)folder->summary,
 		expunge, lf->changes, cancellable, error) == 0);
+	local_folder_clear_part_index (lf);
 	camel_local_folder_unlock (lf);
 
 	if (camel_folder_change_info_changed (lf->changes)) {
@@ -460,6 +672,7 @@ camel_local_folder_class_init (CamelLocalFolderClass *class)
 
 	class->lock = local_folder_lock;
 	class->unlock = local_folder_unlock;
+	class->get_part_stream_sync = local_folder_get_part_stream_sync;
 
 	g_object_class_install_property (
 		object_class,
@@ -480,6 +693,11 @@ camel_local_folder_init (CamelLocalFolder *local_folder)
 
 	local_folder->priv = CAMEL_LOCAL_FOLDER_GET_PRIVATE (local_folder);
 	local_folder->priv->search_lock = g_mutex_new ();
+	local_folder->priv->part_index_lock = g_mutex_new ();
+	local_folder->priv->part_index = g_hash_table_new_full (
+		g_str_hash, g_str_equal,
+		(GDestroyNotify) g_free,
+		(GDestroyNotify) local_part_offsets_free);
 
 	folder->folder_flags |= (CAMEL_FOLDER_HAS_SUMMARY_CAPABILITY |
 				 CAMEL_FOLDER_HAS_SEARCH_CAPABILITY);
@@ -639,6 +857,257 @@ camel_local_folder_set_index_body (CamelLocalFolder *local_folder,
 	g_object_notify (G_OBJECT (local_folder), "index-body");
 }
 
+static gchar *
+local_part_spec (const gchar *prefix,
+                 gint n)
+{
+	if (*prefix == '\0')
+		return g_strdup_printf ("%d", n);
+
+	return g_strdup_printf ("%s.%d", prefix, n);
+}
+
+/* Walks one part with the parser, without decoding or keeping any of
+ * its content, and records the byte range of it and all its subparts.
+ * Parts are numbered like IMAP body sections: the subparts of a
+ * multipart are "prefix.1", "prefix.2"..., and the body of a message
+ * is "prefix.1" unless it is a multipart, in which case its subparts
+ * are numbered directly below the message. */
+static void
+local_folder_index_part (CamelMimeParser *mp,
+                         GArray *parts,
+                         const gchar *spec,
+                         const gchar *prefix,
+                         gboolean is_body,
+                         goffset base)
+{
+	LocalPartOffsets part;
+	camel_mime_parser_state_t state;
+	const gchar *name = spec;
+	gchar *buffer, *child;
+	gsize len;
+	gint self = -1, alias = -1, n;
+
+	state = camel_mime_parser_step (mp, &buffer, &len);
+	if (state == CAMEL_MIME_PARSER_STATE_EOF)
+		return;
+
+	part.start = camel_mime_parser_tell_start_headers (mp) - base;
+	part.end = part.start;
+
+	if (spec != NULL) {
+		part.spec = g_strdup (spec);
+		self = parts->len;
+		g_array_append_val (parts, part);
+	}
+
+	if (is_body && state != CAMEL_MIME_PARSER_STATE_MULTIPART) {
+		part.spec = local_part_spec (prefix, 1);
+		name = part.spec;
+		alias = parts->len;
+		g_array_append_val (parts, part);
+	}
+
+	switch (state) {
+	case CAMEL_MIME_PARSER_STATE_HEADER:
+		while ((state = camel_mime_parser_step (mp, &buffer, &len)) != CAMEL_MIME_PARSER_STATE_BODY_END
+		       && state != CAMEL_MIME_PARSER_STATE_EOF)
+			;
+		break;
+	case CAMEL_MIME_PARSER_STATE_MULTIPART:
+		n = 1;
+		while ((state = camel_mime_parser_step (mp, &buffer, &len)) != CAMEL_MIME_PARSER_STATE_MULTIPART_END
+		       && state != CAMEL_MIME_PARSER_STATE_EOF) {
+			camel_mime_parser_unstep (mp);
+			child = local_part_spec (prefix, n++);
+			local_folder_index_part (mp, parts, child, child, FALSE, base);
+			g_free (child);
+		}
+		break;
+	case CAMEL_MIME_PARSER_STATE_MESSAGE:
+		local_folder_index_part (mp, parts, NULL, name, TRUE, base);
+		if (camel_mime_parser_state (mp) != CAMEL_MIME_PARSER_STATE_EOF)
+			camel_mime_parser_step (mp, &buffer, &len);
+		break;
+	default:
+		break;
+	}
+
+	part.end = camel_mime_parser_tell (mp) - base;
+	if (self != -1)
+		g_array_index (parts, LocalPartOffsets, self).end = part.end;
+	if (alias != -1)
+		g_array_index (parts, LocalPartOffsets, alias).end = part.end;
+}
+
+static CamelStream *
+local_folder_get_part_stream_sync (CamelLocalFolder *local_folder,
+                                   const gchar *uid,
+                                   const gchar *part_spec,
+                                   GCancellable *cancellable,
+                                   GError **error)
+{
+	CamelLocalFolderClass *class;
+	CamelMimeParser *parser = NULL;
+	CamelStream *stream = NULL;
+	GByteArray *buffer;
+	GArray *parts;
+	goffset headers, base, start, end;
+	gboolean found;
+
+	class = CAMEL_LOCAL_FOLDER_GET_CLASS (local_folder);
+
+	if (class->get_message_parser == NULL) {
+		g_set_error (
+			error, CAMEL_ERROR, CAMEL_ERROR_GENERIC,
+			_("Cannot get message %s from folder %s\n%s"),
+			uid, local_folder->folder_path,
+			_("Operation not supported"));
+		return NULL;
+	}
+
+	if (part_spec == NULL)
+		part_spec = "";
+
+	if (camel_local_folder_lock (local_folder, CAMEL_LOCK_WRITE, error) == -1)
+		return NULL;
+
+	parser = class->get_message_parser (local_folder, uid, cancellable, error);
+	if (parser == NULL)
+		goto fail;
+
+	switch (camel_mime_parser_step (parser, NULL, NULL)) {
+	case CAMEL_MIME_PARSER_STATE_HEADER:
+	case CAMEL_MIME_PARSER_STATE_MULTIPART:
+	case CAMEL_MIME_PARSER_STATE_MESSAGE:
+		break;
+	default:
+		set_cannot_get_message_ex (
+			error, CAMEL_FOLDER_ERROR_INVALID,
+			uid, local_folder->folder_path,
+			_("The folder appears to be irrecoverably corrupted."));
+		goto fail;
+	}
+
+	headers = camel_mime_parser_tell_start_headers (parser);
+	base = camel_mime_parser_tell (parser);
+	camel_mime_parser_unstep (parser);
+
+	CAMEL_LOCAL_FOLDER_LOCK (local_folder, part_index_lock);
+	parts = g_hash_table_lookup (local_folder->priv->part_index, uid);
+	found = parts != NULL && local_part_offsets_find (parts, part_spec, &start, &end);
+	CAMEL_LOCAL_FOLDER_UNLOCK (local_folder, part_index_lock);
+
+	if (parts == NULL) {
+		parts = g_array_new (FALSE, FALSE, sizeof (LocalPartOffsets));
+		local_folder_index_part (parser, parts, "", "", TRUE, base);
+		found = local_part_offsets_find (parts, part_spec, &start, &end);
+		local_folder_add_part_index (local_folder, uid, parts);
+	}
+
+	if (!found) {
+		set_cannot_get_message_ex (
+			error, CAMEL_FOLDER_ERROR_INVALID,
+			uid, local_folder->folder_path,
+			_("No such message part"));
+		goto fail;
+	}
+
+	start = start < 0 ? headers : base + start;
+	end += base;
+
+	if (camel_mime_parser_seek (parser, start, SEEK_SET) != start) {
+		set_cannot_get_message_ex (
+			error, CAMEL_ERROR_GENERIC,
+			uid, local_folder->folder_path,
+			g_strerror (camel_mime_parser_errno (parser)));
+		goto fail;
+	}
+
+	buffer = g_byte_array_sized_new (end - start);
+	while (start < end) {
+		const gchar *data;
+		gint n;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+			g_byte_array_free (buffer, TRUE);
+			goto fail;
+		}
+
+		n = camel_mime_parser_read (parser, &data, MIN (end - start, 65536), error);
+		if (n <= 0) {
+			if (n == 0)
+				set_cannot_get_message_ex (
+					error, CAMEL_FOLDER_ERROR_INVALID,
+					uid, local_folder->folder_path,
+					_("The folder appears to be irrecoverably corrupted."));
+			g_byte_array_free (buffer, TRUE);
+			goto fail;
+		}
+
+		g_byte_array_append (buffer, (guint8 *) data, n);
+		start += n;
+	}
+
+	stream = camel_stream_mem_new_with_byte_array (buffer);
+
+fail:
+	camel_local_folder_unlock (local_folder);
+
+	if (parser != NULL)
+		g_object_unref (parser);
+
+	if (camel_folder_change_info_changed (local_folder->changes)) {
+		camel_folder_changed (CAMEL_FOLDER (local_folder), local_folder->changes);
+		camel_folder_change_info_clear (local_folder->changes);
+	}
+
+	return stream;
+}
+
+/**
+ * camel_local_folder_get_part_stream_sync:
+ * @local_folder: a #CamelLocalFolder
+ * @uid: the UID of a message
+ * @part_spec: the part to get, or %NULL for the whole message
+ * @cancellable: optional #GCancellable object, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Reads a single MIME part of a message straight from the folder,
+ * without building the whole #CamelMimeMessage.  Parts are numbered
+ * like IMAP body sections ("1", "2.1", ...).  The returned stream
+ * holds the part exactly as stored, its headers followed by its still
+ * transfer-encoded content, so it can be passed to
+ * camel_data_wrapper_construct_from_stream_sync() on a #CamelMimePart.
+ *
+ * The byte offsets of all the parts of a message are found by a single
+ * scan of it the first time one of them is asked for, and remembered
+ * for the most recently asked for messages until the folder is next
+ * synchronized or refreshed.
+ *
+ * Returns: a new #CamelStream, or %NULL on error
+ *
+ * Since: 3.0
+ **/
+CamelStream *
+camel_local_folder_get_part_stream_sync (CamelLocalFolder *local_folder,
+                                         const gchar *uid,
+                                         const gchar *part_spec,
+                                         GCancellable *cancellable,
+                                         GError **error)
+{
+	CamelLocalFolderClass *class;
+
+	g_return_val_if_fail (CAMEL_IS_LOCAL_FOLDER (local_folder), NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+
+	class = CAMEL_LOCAL_FOLDER_GET_CLASS (local_folder);
+	g_return_val_if_fail (class->get_part_stream_sync != NULL, NULL);
+
+	return class->get_part_stream_sync (
+		local_folder, uid, part_spec, cancellable, error);
+}
+
 /* lock the folder, may be called repeatedly (with matching unlock calls),
    with type the same or less than the first call */
 gint
@@ -90,6 +90,22 @@ struct _CamelLocalFolderClass {
 
 	/* Unlock the folder for my operations */
 	void		(*unlock)		(CamelLocalFolder *);
+
+	/* Parser positioned at the start of a message's headers,
+	 * called with the folder locked */
+	CamelMimeParser *
+			(*get_message_parser)	(CamelLocalFolder *lf,
+						 const gchar *uid,
+						 GCancellable *cancellable,
+						 GError **error);
+
+	/* Stream of a single MIME part of a message */
+	CamelStream *	(*get_part_stream_sync)
+						(CamelLocalFolder *lf,
+						 const gchar *uid,
+						 const gchar *part_spec,
+						 GCancellable *cancellable,
+						 GError **error);
 };
 
 GType		camel_local_folder_get_type	(void);
@@ -105,6 +121,12 @@ gboolean	camel_local_folder_get_index_body
 void		camel_local_folder_set_index_body
 						(CamelLocalFolder *local_folder,
 						 gboolean index_body);
+CamelStream *	camel_local_folder_get_part_stream_sync
+						(CamelLocalFolder *local_folder,
+						 const gchar *uid,
+						 const gchar *part_spec,
+						 GCancellable *cancellable,
+						 GError **error);
 
 /* Lock the folder for internal use.  May be called repeatedly */
 /* UNIMPLEMENTED */
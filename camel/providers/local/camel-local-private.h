@@ -36,6 +36,10 @@ G_BEGIN_DECLS
 
 struct _CamelLocalFolderPrivate {
 	GMutex *search_lock;	/* for locking the search object */
+
+	GMutex *part_index_lock;	/* for locking part_index */
+	GHashTable *part_index;	/* uid -> GArray of part offsets */
+	GQueue part_index_uids;	/* the uids in part_index, oldest first */
 };
 
 #define CAMEL_LOCAL_FOLDER_LOCK(f, l) (g_mutex_lock(((CamelLocalFolder *)f)->priv->l))
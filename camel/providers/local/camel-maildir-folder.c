@@ -219,6 +219,38 @@ maildir_folder_append_message_sync (CamelFolder *folder,
 	return success;
 }
 
+static CamelMimeParser *
+maildir_folder_get_message_parser (CamelLocalFolder *lf,
+                                   const gchar *uid,
+                                   GCancellable *cancellable,
+                                   GError **error)
+{
+	CamelMimeParser *parser;
+	CamelStream *message_stream;
+	gchar *name;
+
+	name = maildir_folder_get_filename ((CamelFolder *)lf, uid, error);
+	if (!name)
+		return NULL;
+
+	message_stream = camel_stream_fs_new_with_name (
+		name, O_RDONLY, 0, error);
+	g_free (name);
+
+	if (message_stream == NULL) {
+		g_prefix_error (
+			error, _("Cannot get message %s from folder %s: "),
+			uid, lf->folder_path);
+		return NULL;
+	}
+
+	parser = camel_mime_parser_new ();
+	camel_mime_parser_init_with_stream (parser, message_stream, NULL);
+	g_object_unref (message_stream);
+
+	return parser;
+}
+
 static CamelMimeMessage *
 maildir_folder_get_message_sync (CamelFolder *folder,
                                  const gchar *uid,
@@ -386,6 +418,7 @@ camel_maildir_folder_class_init (CamelMaildirFolderClass *class)
 
 	local_folder_class = CAMEL_LOCAL_FOLDER_CLASS (class);
 	local_folder_class->create_summary = maildir_folder_create_summary;
+	local_folder_class->get_message_parser = maildir_folder_get_message_parser;
 }
 
 static void
@@ -289,31 +289,23 @@ fail:
 	return FALSE;
 }
 
-static CamelMimeMessage *
-mbox_folder_get_message_sync (CamelFolder *folder,
-                              const gchar *uid,
-                              GCancellable *cancellable,
-                              GError **error)
+/* must be called with the folder locked for writing */
+static CamelMimeParser *
+mbox_folder_get_message_parser (CamelLocalFolder *lf,
+                                const gchar *uid,
+                                GCancellable *cancellable,
+                                GError **error)
 {
-	CamelLocalFolder *lf = (CamelLocalFolder *)folder;
-	CamelMimeMessage *message = NULL;
+	CamelFolder *folder = (CamelFolder *)lf;
 	CamelMboxMessageInfo *info;
 	CamelMimeParser *parser = NULL;
 	gint fd, retval;
 	gint retried = FALSE;
 	goffset frompos;
 
-	d(printf("Getting message %s\n", uid));
-
-	/* lock the folder first, burn if we can't, need write lock for summary check */
-	if (camel_local_folder_lock (lf, CAMEL_LOCK_WRITE, error) == -1)
-		return NULL;
-
 	/* check for new messages always */
-	if (camel_local_summary_check ((CamelLocalSummary *)folder->summary, lf->changes, cancellable, error) == -1) {
-		camel_local_folder_unlock (lf);
+	if (camel_local_summary_check ((CamelLocalSummary *)folder->summary, lf->changes, cancellable, error) == -1)
 		return NULL;
-	}
 
 retry:
 	/* get the message summary info */
@@ -323,12 +315,12 @@ retry:
 		set_cannot_get_message_ex (
 			error, CAMEL_FOLDER_ERROR_INVALID_UID,
 			uid, lf->folder_path, _("No such message"));
-		goto fail;
+		return NULL;
 	}
 
 	if (info->frompos == -1) {
 		camel_message_info_free ((CamelMessageInfo *)info);
-		goto fail;
+		return NULL;
 	}
 
 	frompos = info->frompos;
@@ -344,7 +336,7 @@ retry:
 		set_cannot_get_message_ex (
 			error, CAMEL_ERROR_GENERIC,
 			uid, lf->folder_path, g_strerror (errno));
-		goto fail;
+		return NULL;
 	}
 
 	/* we use a parser to verify the message is correct, and in the correct position */
@@ -362,7 +354,6 @@ retry:
 			  camel_mime_parser_state (parser));
 
 		g_object_unref (parser);
-		parser = NULL;
 
 		if (!retried) {
 			retried = TRUE;
@@ -376,9 +367,32 @@ retry:
 			error, CAMEL_FOLDER_ERROR_INVALID,
 			uid, lf->folder_path,
 			_("The folder appears to be irrecoverably corrupted."));
-		goto fail;
+		return NULL;
 	}
 
+	return parser;
+}
+
+static CamelMimeMessage *
+mbox_folder_get_message_sync (CamelFolder *folder,
+                              const gchar *uid,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+	CamelLocalFolder *lf = (CamelLocalFolder *)folder;
+	CamelMimeMessage *message = NULL;
+	CamelMimeParser *parser = NULL;
+
+	d(printf("Getting message %s\n", uid));
+
+	/* lock the folder first, burn if we can't, need write lock for summary check */
+	if (camel_local_folder_lock (lf, CAMEL_LOCK_WRITE, error) == -1)
+		return NULL;
+
+	parser = mbox_folder_get_message_parser (lf, uid, cancellable, error);
+	if (parser == NULL)
+		goto fail;
+
 	message = camel_mime_message_new ();
 	if (!camel_mime_part_construct_from_parser_sync (
 		(CamelMimePart *)message, parser, cancellable, error)) {
@@ -477,6 +491,7 @@ camel_mbox_folder_class_init (CamelMboxFolderClass *class)
 	local_folder_class->create_summary = mbox_folder_create_summary;
 	local_folder_class->lock = mbox_folder_lock;
 	local_folder_class->unlock = mbox_folder_unlock;
+	local_folder_class->get_message_parser = mbox_folder_get_message_parser;
 }
 
 static void
@@ -132,6 +132,48 @@ mh_folder_append_message_sync (CamelFolder *folder,
 	return TRUE;
 }
 
+static CamelMimeParser *
+mh_folder_get_message_parser (CamelLocalFolder *lf,
+                              const gchar *uid,
+                              GCancellable *cancellable,
+                              GError **error)
+{
+	CamelFolder *folder = (CamelFolder *)lf;
+	CamelMimeParser *parser;
+	CamelStream *message_stream;
+	CamelMessageInfo *info;
+	gchar *name;
+
+	/* we only need the info to check the message exists */
+	if ((info = camel_folder_summary_uid (folder->summary, uid)) == NULL) {
+		set_cannot_get_message_ex (
+			error, CAMEL_FOLDER_ERROR_INVALID_UID,
+			uid, lf->folder_path, _("No such message"));
+		return NULL;
+	}
+
+	camel_message_info_free (info);
+
+	name = g_strdup_printf("%s/%s", lf->folder_path, uid);
+	message_stream = camel_stream_fs_new_with_name (
+		name, O_RDONLY, 0, error);
+	if (message_stream == NULL) {
+		g_prefix_error (
+			error, _("Cannot get message %s from folder %s: "),
+			name, lf->folder_path);
+		g_free (name);
+		return NULL;
+	}
+
+	g_free (name);
+
+	parser = camel_mime_parser_new ();
+	camel_mime_parser_init_with_stream (parser, message_stream, NULL);
+	g_object_unref (message_stream);
+
+	return parser;
+}
+
 static CamelMimeMessage *
 mh_folder_get_message_sync (CamelFolder *folder,
                             const gchar *uid,
@@ -219,6 +261,7 @@ camel_mh_folder_class_init (CamelMhFolderClass *class)
 
 	local_folder_class = CAMEL_LOCAL_FOLDER_CLASS (class);
 	local_folder_class->create_summary = mh_folder_create_summary;
+	local_folder_class->get_message_parser = mh_folder_get_message_parser;
 }
 
 static void
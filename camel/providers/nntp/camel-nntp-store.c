@@ -463,6 +463,9 @@ nntp_connect_offline (CamelService *service,
 		/* Default cache expiry - 2 weeks old, or not visited in 5 days */
 		camel_data_cache_set_expire_age (nntp_store->cache, 60*60*24*14);
 		camel_data_cache_set_expire_access (nntp_store->cache, 60*60*24*5);
+
+		/* Articles are small and many, keep them out of the inode table */
+		camel_data_cache_set_packed (nntp_store->cache, TRUE);
 	}
 
 	if (disco_store->diary)
@@ -1333,6 +1336,9 @@ nntp_construct (CamelService *service, CamelSession *session,
 	camel_data_cache_set_expire_age (nntp_store->cache, 60*60*24*14);
 	camel_data_cache_set_expire_access (nntp_store->cache, 60*60*24*5);
 
+	/* Articles are small and many, keep them out of the inode table */
+	camel_data_cache_set_packed (nntp_store->cache, TRUE);
+
 	return TRUE;
 }
 
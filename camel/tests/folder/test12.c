@@ -0,0 +1,196 @@
+/* reading single message parts from local folders */
+
+#include <string.h>
+
+#include "camel-test.h"
+#include "camel-test-provider.h"
+#include "camel-local-folder.h"
+#include "messages.h"
+#include "session.h"
+
+/* more than the messages whose part offsets a folder remembers */
+#define MAX_MESSAGES (80)
+
+static const gchar *local_drivers[] = { "local" };
+
+static const gchar *stores[] = {
+	"mbox:///tmp/camel-test/mbox",
+	"mh:///tmp/camel-test/mh",
+	"maildir:///tmp/camel-test/maildir"
+};
+
+static const gchar *texts[] = {
+	"This is the body of the message.\n",
+	"and this is the attachment, which is not text at all\n"
+};
+
+/* the provider is a module, which the test is not linked with, so go
+ * through the class instead of camel_local_folder_get_part_stream_sync() */
+static CamelStream *
+get_part_stream (CamelFolder *folder,
+                 const gchar *uid,
+                 const gchar *part_spec,
+                 GCancellable *cancellable,
+                 GError **error)
+{
+	CamelLocalFolderClass *class;
+
+	class = (CamelLocalFolderClass *) G_OBJECT_GET_CLASS (folder);
+
+	return class->get_part_stream_sync (
+		(CamelLocalFolder *) folder, uid, part_spec, cancellable, error);
+}
+
+static CamelMimeMessage *
+create_message (gint n)
+{
+	CamelMimeMessage *msg;
+	CamelMultipart *mp;
+	CamelMimePart *part;
+	gchar *subject;
+
+	msg = test_message_create_simple ();
+	subject = g_strdup_printf ("Test message %d", n);
+	camel_mime_message_set_subject (msg, subject);
+	g_free (subject);
+
+	mp = camel_multipart_new ();
+	camel_data_wrapper_set_mime_type (CAMEL_DATA_WRAPPER (mp), "multipart/mixed");
+	camel_multipart_set_boundary (mp, NULL);
+
+	part = camel_mime_part_new ();
+	test_message_set_content_simple (part, 0, "text/plain", texts[0], strlen (texts[0]));
+	camel_multipart_add_part (mp, part);
+	g_object_unref (part);
+
+	part = camel_mime_part_new ();
+	test_message_set_content_simple (part, 0, "application/octet-stream", texts[1], strlen (texts[1]));
+	camel_mime_part_set_encoding (part, CAMEL_TRANSFER_ENCODING_BASE64);
+	camel_multipart_add_part (mp, part);
+	g_object_unref (part);
+
+	camel_medium_set_content (CAMEL_MEDIUM (msg), CAMEL_DATA_WRAPPER (mp));
+	g_object_unref (mp);
+
+	return msg;
+}
+
+static void
+check_part (CamelFolder *folder,
+            const gchar *uid,
+            const gchar *part_spec,
+            const gchar *text)
+{
+	CamelMimePart *part;
+	CamelStream *stream;
+	GError *error = NULL;
+
+	push ("getting part '%s' of '%s'", part_spec, uid);
+
+	stream = get_part_stream (folder, uid, part_spec, NULL, &error);
+	check_msg (error == NULL, "%s", error->message);
+	check (stream != NULL);
+
+	part = camel_mime_part_new ();
+	check (camel_data_wrapper_construct_from_stream_sync (
+		CAMEL_DATA_WRAPPER (part), stream, NULL, NULL) != -1);
+	test_message_compare_content (
+		camel_medium_get_content (CAMEL_MEDIUM (part)), text, strlen (text));
+
+	check_unref (part, 1);
+	check_unref (stream, 1);
+
+	pull ();
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	CamelSession *session;
+	gint i, j;
+
+	camel_test_init (argc, argv);
+	camel_test_provider_init (1, local_drivers);
+
+	/* clear out any camel-test data */
+	system ("/bin/rm -rf /tmp/camel-test");
+
+	session = camel_test_session_new ("/tmp/camel-test");
+
+	for (i = 0; i < G_N_ELEMENTS (stores); i++) {
+		CamelStore *store;
+		CamelFolder *folder;
+		CamelStream *stream;
+		GPtrArray *uids;
+		GError *error = NULL;
+
+		camel_test_start ("Reading message parts");
+
+		push ("opening store %s", stores[i]);
+		store = camel_session_get_store (session, stores[i], &error);
+		check_msg (error == NULL, "%s", error->message);
+		folder = camel_store_get_folder_sync (
+			store, "testbox", CAMEL_STORE_FOLDER_CREATE, NULL, &error);
+		check_msg (error == NULL, "%s", error->message);
+		pull ();
+
+		push ("appending %d messages", MAX_MESSAGES);
+		for (j = 0; j < MAX_MESSAGES; j++) {
+			CamelMimeMessage *msg = create_message (j);
+
+			camel_folder_append_message_sync (
+				folder, msg, NULL, NULL, NULL, &error);
+			check_msg (error == NULL, "%s", error->message);
+			check_unref (msg, 1);
+		}
+		pull ();
+
+		uids = camel_folder_get_uids (folder);
+		check (uids->len == MAX_MESSAGES);
+
+		push ("reading the parts of every message");
+		for (j = 0; j < uids->len; j++) {
+			check_part (folder, uids->pdata[j], "1", texts[0]);
+			check_part (folder, uids->pdata[j], "2", texts[1]);
+		}
+		pull ();
+
+		/* the first messages have been forgotten by now */
+		push ("reading the parts of forgotten messages");
+		check_part (folder, uids->pdata[0], "2", texts[1]);
+		check_part (folder, uids->pdata[0], "1", texts[0]);
+		pull ();
+
+		push ("reading a part that does not exist");
+		stream = get_part_stream (folder, uids->pdata[0], "3", NULL, &error);
+		check (stream == NULL);
+		check (error != NULL);
+		g_clear_error (&error);
+		pull ();
+
+		push ("reading a message that does not exist");
+		stream = get_part_stream (folder, "unknown-uid", "1", NULL, &error);
+		check (stream == NULL);
+		check (error != NULL);
+		g_clear_error (&error);
+		pull ();
+
+		push ("reading parts after the folder is synchronized");
+		camel_folder_synchronize_sync (folder, FALSE, NULL, &error);
+		check_msg (error == NULL, "%s", error->message);
+		check_part (folder, uids->pdata[uids->len - 1], "1", texts[0]);
+		check_part (folder, uids->pdata[uids->len - 1], "2", texts[1]);
+		pull ();
+
+		camel_folder_free_uids (folder, uids);
+
+		check_unref (folder, 1);
+		g_object_unref (store);
+
+		camel_test_end ();
+	}
+
+	check_unref (session, 1);
+
+	return 0;
+}
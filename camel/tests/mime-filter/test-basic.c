@@ -0,0 +1,261 @@
+/*
+  test-basic.c
+
+  Test (and time) the base64 and quoted-printable codecs used by
+  CamelMimeFilterBasic on attachment-sized inputs, and check the
+  quoted-printable encoder output byte for byte on known cases
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "camel-test.h"
+
+#define d(x)
+
+/* a typical big attachment, and an odd size to exercise the tails */
+static const gsize sizes[] = { 1, 2, 3, 4, 57, 4095, 1024 * 1024, 4 * 1024 * 1024 + 7 };
+
+/* feed the decoders in chunks of these sizes, including ones which
+ * split encoded groups and escapes */
+static const gsize chunks[] = { 1, 3, 7, 4096, G_MAXSIZE };
+
+extern gint camel_test_verbose;
+
+/* the output of the quoted-printable encoder for @n_a 'a's followed by
+ * @in is @n_a 'a's followed by @out; lines are broken after 75
+ * characters with a trailing '=', and a space or tab ending a line or
+ * the text is escaped */
+static const struct {
+	gint n_a;
+	const gchar *in;
+	const gchar *out;
+} qp_known[] = {
+	{ 75, "b\n", "=\nb\n" },
+	{ 75, "\n", "\n" },
+	{ 72, "=", "=3D" },
+	{ 73, "=", "=\n=3D" },
+	{ 74, " b", " =\nb" },
+	{ 74, " \n", "=\n=20\n" },
+	{ 73, "\t\n", "=\n=09\n" },
+	{ 0, "foo \nbar\t\nbaz", "foo=20\nbar=09\nbaz" },
+	{ 0, "end ", "end=20" },
+	{ 0, "end\t", "end=09" },
+	{ 0, "a \r\nb\r\n", "a=20\nb\n" },
+	{ 0, "caf\xe9 = ok", "caf=E9 =3D ok" }
+};
+
+static guchar *
+random_data (gsize len, gboolean text)
+{
+	guchar *data;
+	gsize i;
+
+	data = g_malloc (len);
+	for (i = 0; i < len; i++) {
+		if (text) {
+			/* mostly printable with a few lines, spaces and 8bit */
+			switch (g_random_int_range (0, 40)) {
+			case 0:
+				data[i] = '\n';
+				break;
+			case 1:
+				data[i] = ' ';
+				break;
+			case 2:
+				data[i] = 128 + g_random_int_range (0, 128);
+				break;
+			case 3:
+				data[i] = '=';
+				break;
+			default:
+				data[i] = g_random_int_range (33, 127);
+				break;
+			}
+		} else
+			data[i] = g_random_int_range (0, 256);
+	}
+
+	return data;
+}
+
+static void
+test_base64 (gsize len)
+{
+	guchar *data, *out1, *out2;
+	gchar *encoded;
+	gsize elen, i, j, n1, n2;
+	gint state1, state2;
+	guint save1, save2;
+	GTimer *timer;
+	gdouble t1, t2;
+
+	data = random_data (len, FALSE);
+
+	/* break the lines like CamelMimeFilterBasic does */
+	encoded = g_malloc (len * 2 + 8);
+	state1 = save1 = 0;
+	elen = g_base64_encode_step (data, len, TRUE, encoded, &state1, (gint *) &save1);
+	elen += g_base64_encode_close (TRUE, encoded + elen, &state1, (gint *) &save1);
+
+	out1 = g_malloc (elen + 3);
+	out2 = g_malloc (elen + 3);
+
+	timer = g_timer_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (chunks); i++) {
+		state1 = state2 = 0;
+		save1 = save2 = 0;
+		n1 = n2 = 0;
+
+		g_timer_start (timer);
+		for (j = 0; j < elen; j += MIN (chunks[i], elen - j))
+			n1 += g_base64_decode_step (encoded + j, MIN (chunks[i], elen - j), out1 + n1, &state1, &save1);
+		t1 = g_timer_elapsed (timer, NULL);
+
+		g_timer_start (timer);
+		for (j = 0; j < elen; j += MIN (chunks[i], elen - j))
+			n2 += camel_base64_decode_step ((guchar *) encoded + j, MIN (chunks[i], elen - j), out2 + n2, &state2, &save2);
+		t2 = g_timer_elapsed (timer, NULL);
+
+		check_msg (n1 == len, "glib decoded %d of %d bytes", (gint) n1, (gint) len);
+		check_msg (n2 == n1, "decoded %d bytes, expected %d", (gint) n2, (gint) n1);
+		check_msg (memcmp (out1, out2, n1) == 0, "decoded data differs, chunk %d", (gint) chunks[i]);
+		check (state1 == state2);
+
+		if (camel_test_verbose > 1 && chunks[i] >= 4096 && len >= 1024 * 1024)
+			printf ("\n  base64 decode %d bytes in %d byte chunks: glib %.3fs, camel %.3fs",
+				(gint) len, (gint) MIN (chunks[i], elen), t1, t2);
+	}
+
+	g_timer_destroy (timer);
+	g_free (encoded);
+	g_free (out1);
+	g_free (out2);
+	g_free (data);
+}
+
+static void
+test_qp (gsize len)
+{
+	guchar *data, *encoded, *decoded;
+	gsize elen, dlen, i, j;
+	gint state, save;
+	GTimer *timer;
+
+	data = random_data (len, TRUE);
+	encoded = g_malloc (len * 4 + 4);
+	decoded = g_malloc (len * 4 + 4);
+
+	timer = g_timer_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (chunks); i++) {
+		state = -1;
+		save = 0;
+		elen = 0;
+
+		g_timer_start (timer);
+		for (j = 0; j < len; j += MIN (chunks[i], len - j))
+			elen += camel_quoted_encode_step (data + j, MIN (chunks[i], len - j), encoded + elen, &state, &save);
+		elen += camel_quoted_encode_close (NULL, 0, encoded + elen, &state, &save);
+
+		if (camel_test_verbose > 1 && chunks[i] >= 4096 && len >= 1024 * 1024)
+			printf ("\n  qp encode %d bytes: %.3fs", (gint) len, g_timer_elapsed (timer, NULL));
+
+		/* no encoded line may exceed 76 characters */
+		for (j = 0, dlen = 0; j < elen; j++) {
+			dlen = encoded[j] == '\n' ? 0 : dlen + 1;
+			check_msg (dlen <= 76, "encoded line too long at %d", (gint) j);
+		}
+
+		state = 0;
+		save = 0;
+		dlen = 0;
+
+		g_timer_start (timer);
+		for (j = 0; j < elen; j += MIN (chunks[i], elen - j))
+			dlen += camel_quoted_decode_step (encoded + j, MIN (chunks[i], elen - j), decoded + dlen, &state, &save);
+
+		if (camel_test_verbose > 1 && chunks[i] >= 4096 && len >= 1024 * 1024)
+			printf ("\n  qp decode %d bytes: %.3fs", (gint) elen, g_timer_elapsed (timer, NULL));
+
+		check_msg (dlen == len, "decoded %d bytes, expected %d", (gint) dlen, (gint) len);
+		check_msg (memcmp (data, decoded, len) == 0, "qp round trip differs, chunk %d", (gint) chunks[i]);
+	}
+
+	g_timer_destroy (timer);
+	g_free (encoded);
+	g_free (decoded);
+	g_free (data);
+}
+
+static void
+test_qp_known (gint n)
+{
+	GString *in, *out;
+	guchar *encoded;
+	gsize elen, i, j;
+	gint state, save;
+
+	in = g_string_new (NULL);
+	out = g_string_new (NULL);
+	for (i = 0; i < qp_known[n].n_a; i++) {
+		g_string_append_c (in, 'a');
+		g_string_append_c (out, 'a');
+	}
+	g_string_append (in, qp_known[n].in);
+	g_string_append (out, qp_known[n].out);
+
+	encoded = g_malloc (in->len * 4 + 4);
+
+	for (i = 0; i < G_N_ELEMENTS (chunks); i++) {
+		state = -1;
+		save = 0;
+		elen = 0;
+
+		for (j = 0; j < in->len; j += MIN (chunks[i], in->len - j))
+			elen += camel_quoted_encode_step ((guchar *) in->str + j, MIN (chunks[i], in->len - j), encoded + elen, &state, &save);
+		elen += camel_quoted_encode_close (NULL, 0, encoded + elen, &state, &save);
+
+		check_msg (elen == out->len && memcmp (encoded, out->str, elen) == 0,
+			   "encoded '%.*s', expected '%s', chunk %d", (gint) elen, encoded, out->str, (gint) chunks[i]);
+	}
+
+	g_free (encoded);
+	g_string_free (in, TRUE);
+	g_string_free (out, TRUE);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	gint i;
+
+	camel_test_init (argc, argv);
+
+	camel_test_start ("base64 decoder matches g_base64_decode_step");
+	for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+		camel_test_push ("%d bytes", (gint) sizes[i]);
+		test_base64 (sizes[i]);
+		camel_test_pull ();
+	}
+	camel_test_end ();
+
+	camel_test_start ("quoted-printable encoder output");
+	for (i = 0; i < G_N_ELEMENTS (qp_known); i++) {
+		camel_test_push ("case %d", i);
+		test_qp_known (i);
+		camel_test_pull ();
+	}
+	camel_test_end ();
+
+	camel_test_start ("quoted-printable round trip");
+	for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+		camel_test_push ("%d bytes", (gint) sizes[i]);
+		test_qp (sizes[i]);
+		camel_test_pull ();
+	}
+	camel_test_end ();
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <camel/camel.h>
+
+#include "camel-test.h"
+
+#define CACHE_DIR "/tmp/camel-test/data-cache"
+#define N_ITEMS (50)
+
+static gchar *
+item_content (gint n)
+{
+	return g_strdup_printf ("Content of item %d\n%s\n", n, n % 2 ? "odd" : "even");
+}
+
+static gchar *
+read_stream (CamelStream *stream)
+{
+	GString *str = g_string_new (NULL);
+	gchar buffer[256];
+	gssize n;
+
+	while ((n = camel_stream_read (stream, buffer, sizeof (buffer), NULL, NULL)) > 0)
+		g_string_append_len (str, buffer, n);
+
+	return g_string_free (str, FALSE);
+}
+
+static void
+add_item (CamelDataCache *cdc, const gchar *key, const gchar *content)
+{
+	CamelStream *stream;
+	GError *error = NULL;
+
+	stream = camel_data_cache_add (cdc, "cache", key, &error);
+	check_msg (error == NULL, "%s", error->message);
+	check (stream != NULL);
+	check (camel_stream_write_string (stream, content, NULL, NULL) == strlen (content));
+	check (camel_stream_flush (stream, NULL, NULL) == 0);
+	g_object_unref (stream);
+}
+
+static void
+check_item (CamelDataCache *cdc, const gchar *key, const gchar *content)
+{
+	CamelStream *stream;
+	gchar *found;
+
+	push ("getting item '%s'", key);
+
+	stream = camel_data_cache_get (cdc, "cache", key, NULL);
+	if (content == NULL) {
+		check (stream == NULL);
+	} else {
+		check (stream != NULL);
+		found = read_stream (stream);
+		check_msg (strcmp (found, content) == 0, "found '%s', expected '%s'", found, content);
+		g_free (found);
+		g_object_unref (stream);
+	}
+
+	pull ();
+}
+
+static guint
+count_files (const gchar *path)
+{
+	const gchar *name;
+	guint n = 0;
+	GDir *dir;
+
+	dir = g_dir_open (path, 0, NULL);
+	while (dir && (name = g_dir_read_name (dir)))
+		n++;
+	if (dir)
+		g_dir_close (dir);
+
+	return n;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	CamelDataCache *cdc;
+	gchar *key, *content, *filename;
+	gsize length;
+	gint i;
+
+	camel_test_init (argc, argv);
+
+	system ("/bin/rm -rf /tmp/camel-test");
+
+	camel_test_start ("Packed data cache");
+
+	push ("moving an item cached before packing");
+	cdc = camel_data_cache_new (CACHE_DIR, NULL);
+	check (cdc != NULL);
+	add_item (cdc, "legacy", "cached one file per item");
+	camel_data_cache_set_packed (cdc, TRUE);
+	check (camel_data_cache_get_packed (cdc));
+	check_item (cdc, "legacy", "cached one file per item");
+	pull ();
+
+	push ("adding %d items", N_ITEMS);
+	for (i = 0; i < N_ITEMS; i++) {
+		key = g_strdup_printf ("key-%d", i);
+		content = item_content (i);
+		add_item (cdc, key, content);
+		g_free (content);
+		g_free (key);
+	}
+	pull ();
+
+	push ("reading the items back");
+	for (i = 0; i < N_ITEMS; i++) {
+		key = g_strdup_printf ("key-%d", i);
+		content = item_content (i);
+		check_item (cdc, key, content);
+		g_free (content);
+		g_free (key);
+	}
+	check_item (cdc, "missing", NULL);
+	pull ();
+
+	push ("replacing and removing items");
+	add_item (cdc, "key-1", "replaced");
+	check_item (cdc, "key-1", "replaced");
+	check (camel_data_cache_remove (cdc, "cache", "key-0", NULL) == 0);
+	check_item (cdc, "key-0", NULL);
+	pull ();
+
+	push ("copying an item out to a file");
+	filename = camel_data_cache_get_filename (cdc, "cache", "key-2", NULL);
+	check (filename != NULL);
+	check (g_file_get_contents (filename, &content, &length, NULL));
+	key = item_content (2);
+	check (strcmp (content, key) == 0);
+	g_free (key);
+	g_free (content);
+	g_free (filename);
+	pull ();
+
+	check_unref (cdc, 1);
+
+	push ("reopening the cache");
+	cdc = camel_data_cache_new (CACHE_DIR, NULL);
+	camel_data_cache_set_packed (cdc, TRUE);
+	check_item (cdc, "legacy", "cached one file per item");
+	check_item (cdc, "key-0", NULL);
+	check_item (cdc, "key-1", "replaced");
+	for (i = 2; i < N_ITEMS; i++) {
+		key = g_strdup_printf ("key-%d", i);
+		content = item_content (i);
+		check_item (cdc, key, content);
+		g_free (content);
+		g_free (key);
+	}
+	pull ();
+
+	/* the index, one segment, and the new/ and files/ directories */
+	push ("checking the items were packed");
+	check_msg (count_files (CACHE_DIR "/cache/pack") <= 4,
+		   "%u files", count_files (CACHE_DIR "/cache/pack"));
+	check (count_files (CACHE_DIR "/cache/pack/new") == 0);
+	pull ();
+
+	check_unref (cdc, 1);
+
+	push ("reopening the cache with a truncated index");
+	check (g_file_get_contents (CACHE_DIR "/cache/pack/index", &content, &length, NULL));
+	check (length > 4);
+	check (g_file_set_contents (CACHE_DIR "/cache/pack/index", content, length - 3, NULL));
+	g_free (content);
+
+	cdc = camel_data_cache_new (CACHE_DIR, NULL);
+	camel_data_cache_set_packed (cdc, TRUE);
+	check_item (cdc, "key-0", NULL);
+	/* at most the last record is lost */
+	for (i = 2, length = 0; i < N_ITEMS; i++) {
+		CamelStream *stream;
+
+		key = g_strdup_printf ("key-%d", i);
+		stream = camel_data_cache_get (cdc, "cache", key, NULL);
+		if (stream != NULL) {
+			g_object_unref (stream);
+			length++;
+		}
+		g_free (key);
+	}
+	check_msg (length >= N_ITEMS - 3, "only %d items left", (gint) length);
+	check_unref (cdc, 1);
+	pull ();
+
+	camel_test_end ();
+
+	return 0;
+}
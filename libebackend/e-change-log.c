@@ -0,0 +1,481 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "e-change-log.h"
+
+/* The log file is text, one entry per line:
+ *
+ *   Q <seq>		the sequence the log starts from
+ *   C <seq> <uid>	the record @uid changed at @seq
+ *   S <seq> <client>	the client has seen the changes up to @seq
+ *   T <stamp>		the stamp of the backend's data, written on close
+ *
+ * Strings are escaped with g_strescape().  Only the last entry for each
+ * uid and client matters; the file is rewritten with just those once the
+ * older entries take most of it, leaving out the changes all the clients
+ * have seen.  A C entry after the last T entry means
+ * the log was not closed after the data changed, so it can't be trusted. */
+
+/* the least number of stale entries before the file is rewritten */
+#define COMPACT_MIN_STALE 1024
+
+struct _EChangeLogPrivate {
+	GMutex *lock;
+	gchar *filename;
+	FILE *file;
+	guint64 sequence;
+	GHashTable *uids;	/* uid -> guint64 *sequence */
+	GHashTable *clients;	/* client id -> guint64 *sequence */
+	guint n_entries;	/* entries in the file */
+};
+
+static guint64 *
+sequence_dup (guint64 sequence)
+{
+	guint64 *seq = g_new (guint64, 1);
+
+	*seq = sequence;
+
+	return seq;
+}
+
+static void
+append_entry (EChangeLog *log, gchar kind, guint64 sequence, const gchar *str)
+{
+	EChangeLogPrivate *priv = log->priv;
+	gchar *escaped;
+
+	if (!priv->file)
+		return;
+
+	escaped = g_strescape (str, NULL);
+	if (kind == 'T')
+		fprintf (priv->file, "T %s\n", escaped);
+	else
+		fprintf (priv->file, "%c %" G_GUINT64_FORMAT " %s\n", kind, sequence, escaped);
+	fflush (priv->file);
+	g_free (escaped);
+
+	priv->n_entries++;
+}
+
+static void
+write_entries (gpointer key, gpointer value, gpointer user_data)
+{
+	GString *contents = ((gpointer *) user_data)[0];
+	const gchar *kind = ((gpointer *) user_data)[1];
+	gchar *escaped;
+
+	escaped = g_strescape (key, NULL);
+	g_string_append_printf (contents, "%s %" G_GUINT64_FORMAT " %s\n",
+				kind, *(guint64 *) value, escaped);
+	g_free (escaped);
+}
+
+/* Forgets the changes every client has seen.  Without any client they
+ * are kept, one may be about to store the sequence it started from. */
+static void
+prune_seen (EChangeLog *log)
+{
+	EChangeLogPrivate *priv = log->priv;
+	GHashTableIter iter;
+	gpointer value;
+	guint64 seen = G_MAXUINT64;
+
+	if (g_hash_table_size (priv->clients) == 0)
+		return;
+
+	g_hash_table_iter_init (&iter, priv->clients);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		seen = MIN (seen, *(guint64 *) value);
+
+	g_hash_table_iter_init (&iter, priv->uids);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		if (*(guint64 *) value <= seen)
+			g_hash_table_iter_remove (&iter);
+	}
+}
+
+/* Rewrites the file with only the current entries. */
+static void
+compact (EChangeLog *log)
+{
+	EChangeLogPrivate *priv = log->priv;
+	GString *contents;
+	gpointer data[2];
+
+	prune_seen (log);
+
+	if (priv->file) {
+		fclose (priv->file);
+		priv->file = NULL;
+	}
+
+	contents = g_string_new (NULL);
+	g_string_append_printf (contents, "Q %" G_GUINT64_FORMAT "\n", priv->sequence);
+
+	data[0] = contents;
+	data[1] = (gpointer) "C";
+	g_hash_table_foreach (priv->uids, write_entries, data);
+	data[1] = (gpointer) "S";
+	g_hash_table_foreach (priv->clients, write_entries, data);
+
+	if (!g_file_set_contents (priv->filename, contents->str, contents->len, NULL))
+		g_warning ("%s: Failed to write '%s'", G_STRFUNC, priv->filename);
+
+	priv->n_entries = g_hash_table_size (priv->uids) + g_hash_table_size (priv->clients) + 1;
+	g_string_free (contents, TRUE);
+
+	priv->file = g_fopen (priv->filename, "a");
+}
+
+static void
+maybe_compact (EChangeLog *log)
+{
+	EChangeLogPrivate *priv = log->priv;
+	guint live;
+
+	live = g_hash_table_size (priv->uids) + g_hash_table_size (priv->clients);
+	if (priv->n_entries > 2 * live + COMPACT_MIN_STALE)
+		compact (log);
+}
+
+/* Reads the entries of the file, and returns the stamp if it's valid. */
+static gchar *
+load (EChangeLog *log)
+{
+	EChangeLogPrivate *priv = log->priv;
+	gchar *contents, *line, *end, *stamp = NULL;
+
+	if (!g_file_get_contents (priv->filename, &contents, NULL, NULL))
+		return NULL;
+
+	/* an unterminated last line is an interrupted write, skip it */
+	for (line = contents; (end = strchr (line, '\n')); line = end + 1) {
+		gchar kind = line[0];
+		guint64 sequence = 0;
+		gchar *p;
+
+		*end = '\0';
+		priv->n_entries++;
+
+		if (line[0] == '\0' || line[1] != ' ')
+			continue;
+
+		if (kind == 'T') {
+			g_free (stamp);
+			stamp = g_strcompress (line + 2);
+			continue;
+		}
+
+		sequence = g_ascii_strtoull (line + 2, &p, 10);
+		priv->sequence = MAX (priv->sequence, sequence);
+
+		if (kind == 'Q' || *p != ' ')
+			continue;
+
+		p++;
+		if (kind == 'C') {
+			g_hash_table_insert (priv->uids, g_strcompress (p), sequence_dup (sequence));
+			g_free (stamp);
+			stamp = NULL;
+		} else if (kind == 'S') {
+			g_hash_table_insert (priv->clients, g_strcompress (p), sequence_dup (sequence));
+		}
+	}
+
+	g_free (contents);
+
+	return stamp;
+}
+
+/**
+ * e_change_log_new:
+ * @filename: the file holding the log
+ * @stamp: the stamp of the data the log is for, like its modification time
+ *
+ * Opens the change log in @filename, creating it if needed.  When the
+ * stamp recorded by e_change_log_set_stamp() is not @stamp, the data was
+ * changed without the log knowing, so the recorded changes and client
+ * sequences are dropped.
+ *
+ * Returns: A new #EChangeLog, or %NULL if @filename can't be written.
+ *
+ * Since: 3.0
+ **/
+EChangeLog *
+e_change_log_new (const gchar *filename, const gchar *stamp)
+{
+	EChangeLog *log;
+	gchar *last_stamp;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	log = g_new0 (EChangeLog, 1);
+	log->priv = g_new0 (EChangeLogPrivate, 1);
+	log->priv->lock = g_mutex_new ();
+	log->priv->filename = g_strdup (filename);
+	log->priv->uids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	log->priv->clients = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	last_stamp = load (log);
+	if (g_strcmp0 (last_stamp, stamp) != 0) {
+		g_hash_table_remove_all (log->priv->uids);
+		g_hash_table_remove_all (log->priv->clients);
+	}
+	g_free (last_stamp);
+
+	/* drop the stale entries and the stamp, which is valid only until
+	 * the data changes again */
+	compact (log);
+
+	if (!log->priv->file) {
+		e_change_log_destroy (log);
+		return NULL;
+	}
+
+	return log;
+}
+
+/**
+ * e_change_log_touch:
+ * @log: an #EChangeLog
+ * @uid: the uid of a record
+ *
+ * Records that the record @uid was added, modified or removed, at a new
+ * sequence number.
+ *
+ * Since: 3.0
+ **/
+void
+e_change_log_touch (EChangeLog *log, const gchar *uid)
+{
+	EChangeLogPrivate *priv;
+
+	g_return_if_fail (log != NULL);
+	g_return_if_fail (uid != NULL);
+
+	priv = log->priv;
+
+	g_mutex_lock (priv->lock);
+
+	priv->sequence++;
+	g_hash_table_insert (priv->uids, g_strdup (uid), sequence_dup (priv->sequence));
+	append_entry (log, 'C', priv->sequence, uid);
+	maybe_compact (log);
+
+	g_mutex_unlock (priv->lock);
+}
+
+/**
+ * e_change_log_get_sequence:
+ * @log: an #EChangeLog
+ *
+ * Returns: The sequence number of the last change.
+ *
+ * Since: 3.0
+ **/
+guint64
+e_change_log_get_sequence (EChangeLog *log)
+{
+	guint64 sequence;
+
+	g_return_val_if_fail (log != NULL, 0);
+
+	g_mutex_lock (log->priv->lock);
+	sequence = log->priv->sequence;
+	g_mutex_unlock (log->priv->lock);
+
+	return sequence;
+}
+
+/**
+ * e_change_log_get_changed_uids:
+ * @log: an #EChangeLog
+ * @since: a sequence number
+ *
+ * Finds the records changed after @since.  Removed records are included,
+ * the caller has to check whether they still exist.  Changes every known
+ * client has seen may have been forgotten, so @since should be a sequence
+ * stored with e_change_log_set_client_sequence().
+ *
+ * Returns: A list of newly allocated uids; free them with g_free() and
+ * the list with g_slist_free().
+ *
+ * Since: 3.0
+ **/
+GSList *
+e_change_log_get_changed_uids (EChangeLog *log, guint64 since)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *uids = NULL;
+
+	g_return_val_if_fail (log != NULL, NULL);
+
+	g_mutex_lock (log->priv->lock);
+
+	g_hash_table_iter_init (&iter, log->priv->uids);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		if (*(guint64 *) value > since)
+			uids = g_slist_prepend (uids, g_strdup (key));
+	}
+
+	g_mutex_unlock (log->priv->lock);
+
+	return uids;
+}
+
+/**
+ * e_change_log_get_client_sequence:
+ * @log: an #EChangeLog
+ * @client_id: the id of a client
+ * @sequence: return location for the sequence number
+ *
+ * Looks up the sequence number stored with
+ * e_change_log_set_client_sequence() for @client_id.
+ *
+ * Returns: %TRUE if the log knows the changes after @sequence, %FALSE
+ * if it doesn't know the client, or was reset since.
+ *
+ * Since: 3.0
+ **/
+gboolean
+e_change_log_get_client_sequence (EChangeLog *log, const gchar *client_id, guint64 *sequence)
+{
+	guint64 *seq;
+
+	g_return_val_if_fail (log != NULL, FALSE);
+	g_return_val_if_fail (client_id != NULL, FALSE);
+	g_return_val_if_fail (sequence != NULL, FALSE);
+
+	g_mutex_lock (log->priv->lock);
+
+	seq = g_hash_table_lookup (log->priv->clients, client_id);
+	if (seq)
+		*sequence = *seq;
+
+	g_mutex_unlock (log->priv->lock);
+
+	return seq != NULL;
+}
+
+/**
+ * e_change_log_set_client_sequence:
+ * @log: an #EChangeLog
+ * @client_id: the id of a client
+ * @sequence: the sequence number of the last change the client has seen
+ *
+ * Stores @sequence for @client_id, usually the result of
+ * e_change_log_get_sequence() taken before the client's changes were
+ * computed.
+ *
+ * Since: 3.0
+ **/
+void
+e_change_log_set_client_sequence (EChangeLog *log, const gchar *client_id, guint64 sequence)
+{
+	EChangeLogPrivate *priv;
+
+	g_return_if_fail (log != NULL);
+	g_return_if_fail (client_id != NULL);
+
+	priv = log->priv;
+
+	g_mutex_lock (priv->lock);
+
+	g_hash_table_insert (priv->clients, g_strdup (client_id), sequence_dup (sequence));
+	append_entry (log, 'S', sequence, client_id);
+	maybe_compact (log);
+
+	g_mutex_unlock (priv->lock);
+}
+
+/**
+ * e_change_log_set_stamp:
+ * @log: an #EChangeLog
+ * @stamp: the stamp of the data
+ *
+ * Records the stamp of the data, which e_change_log_new() checks the next
+ * time the log is opened.  Call it once the data is written, usually when
+ * closing it.
+ *
+ * Since: 3.0
+ **/
+void
+e_change_log_set_stamp (EChangeLog *log, const gchar *stamp)
+{
+	g_return_if_fail (log != NULL);
+	g_return_if_fail (stamp != NULL);
+
+	g_mutex_lock (log->priv->lock);
+	append_entry (log, 'T', 0, stamp);
+	g_mutex_unlock (log->priv->lock);
+}
+
+/**
+ * e_change_log_reset:
+ * @log: an #EChangeLog
+ *
+ * Forgets the recorded changes and client sequences, for when the data
+ * was replaced.  Clients will have to compare all the records again.
+ *
+ * Since: 3.0
+ **/
+void
+e_change_log_reset (EChangeLog *log)
+{
+	g_return_if_fail (log != NULL);
+
+	g_mutex_lock (log->priv->lock);
+
+	g_hash_table_remove_all (log->priv->uids);
+	g_hash_table_remove_all (log->priv->clients);
+	compact (log);
+
+	g_mutex_unlock (log->priv->lock);
+}
+
+/**
+ * e_change_log_destroy:
+ * @log: an #EChangeLog
+ *
+ * Closes @log and frees it.
+ *
+ * Since: 3.0
+ **/
+void
+e_change_log_destroy (EChangeLog *log)
+{
+	g_return_if_fail (log != NULL);
+
+	if (log->priv->file)
+		fclose (log->priv->file);
+
+	g_hash_table_destroy (log->priv->uids);
+	g_hash_table_destroy (log->priv->clients);
+	g_mutex_free (log->priv->lock);
+	g_free (log->priv->filename);
+	g_free (log->priv);
+	g_free (log);
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * A log of the records a backend changed, so the changes a client
+ * hasn't seen can be found without comparing every record.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __E_CHANGE_LOG_H__
+#define __E_CHANGE_LOG_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EChangeLog EChangeLog;
+typedef struct _EChangeLogPrivate EChangeLogPrivate;
+
+struct _EChangeLog
+{
+	EChangeLogPrivate *priv;
+};
+
+EChangeLog *e_change_log_new (const gchar *filename, const gchar *stamp);
+
+void e_change_log_touch (EChangeLog *log, const gchar *uid);
+guint64 e_change_log_get_sequence (EChangeLog *log);
+GSList *e_change_log_get_changed_uids (EChangeLog *log, guint64 since);
+
+gboolean e_change_log_get_client_sequence (EChangeLog *log, const gchar *client_id, guint64 *sequence);
+void e_change_log_set_client_sequence (EChangeLog *log, const gchar *client_id, guint64 sequence);
+
+void e_change_log_set_stamp (EChangeLog *log, const gchar *stamp);
+void e_change_log_reset (EChangeLog *log);
+
+void e_change_log_destroy (EChangeLog *log);
+
+G_END_DECLS
+
+#endif /* __E_CHANGE_LOG_H__ */
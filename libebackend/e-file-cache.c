@@ -20,6 +20,7 @@
  */
 
 #include <config.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -30,10 +31,24 @@
 #include "libedataserver/e-data-server-util.h"
 #include "libedataserver/e-xml-hash-utils.h"
 
+/* The cache file is a log of changes: a header followed by records of
+ * one byte '+' (set) or '-' (remove), the key and value lengths as
+ * big-endian 32-bit integers, then the key and the value.  The objects
+ * are kept in a hash table, changes are appended to the file, and the
+ * file is rewritten only when most of it is stale records. */
+#define CACHE_MAGIC "EFileCache 1\n"
+#define CACHE_MAGIC_LEN (sizeof (CACHE_MAGIC) - 1)
+#define RECORD_HEADER_LEN 9
+/* the least space the stale records take before the file is rewritten */
+#define COMPACT_MIN_STALE (64 * 1024)
+
 struct _EFileCachePrivate {
 	gchar *filename;
-	EXmlHash *xml_hash;
-	gboolean dirty;
+	GHashTable *objects;	/* key -> value */
+	GString *pending;	/* records not written yet */
+	gsize log_size;		/* bytes in the file */
+	gsize live_size;	/* bytes the records of the objects take */
+	gboolean rewrite;	/* the file has to be rewritten from the objects */
 	guint32 frozen;
 };
 
@@ -45,6 +60,221 @@ enum {
 
 G_DEFINE_TYPE (EFileCache, e_file_cache, G_TYPE_OBJECT)
 
+static gsize
+record_len (const gchar *key, const gchar *value)
+{
+	return RECORD_HEADER_LEN + strlen (key) + (value ? strlen (value) : 0);
+}
+
+static void
+append_uint32 (GString *buf, guint32 n)
+{
+	n = GUINT32_TO_BE (n);
+	g_string_append_len (buf, (const gchar *) &n, 4);
+}
+
+static guint32
+read_uint32 (const gchar *p)
+{
+	guint32 n;
+
+	memcpy (&n, p, 4);
+
+	return GUINT32_FROM_BE (n);
+}
+
+/* Appends the record setting @key to @value, or removing it if @value is NULL */
+static void
+append_record (GString *buf, const gchar *key, const gchar *value)
+{
+	gsize key_len = strlen (key);
+	gsize value_len = value ? strlen (value) : 0;
+
+	g_string_append_c (buf, value ? '+' : '-');
+	append_uint32 (buf, key_len);
+	append_uint32 (buf, value_len);
+	g_string_append_len (buf, key, key_len);
+	if (value)
+		g_string_append_len (buf, value, value_len);
+}
+
+static void
+append_object_record (gpointer key, gpointer value, gpointer user_data)
+{
+	append_record (user_data, key, value);
+}
+
+/* Sets @key to @value in the hash table, taking both */
+static void
+cache_set (EFileCachePrivate *priv, gchar *key, gchar *value)
+{
+	const gchar *old_value;
+
+	old_value = g_hash_table_lookup (priv->objects, key);
+	if (old_value)
+		priv->live_size -= record_len (key, old_value);
+
+	priv->live_size += record_len (key, value);
+	g_hash_table_replace (priv->objects, key, value);
+}
+
+static void
+cache_unset (EFileCachePrivate *priv, const gchar *key)
+{
+	const gchar *old_value;
+
+	old_value = g_hash_table_lookup (priv->objects, key);
+	if (old_value) {
+		priv->live_size -= record_len (key, old_value);
+		g_hash_table_remove (priv->objects, key);
+	}
+}
+
+static void
+import_xml_object (const gchar *key, const gchar *value, gpointer user_data)
+{
+	cache_set (user_data, g_strdup (key), g_strdup (value));
+}
+
+/* Replays the records of @contents, returns the length of the valid part */
+static gsize
+replay_log (EFileCachePrivate *priv, const gchar *contents, gsize length)
+{
+	gsize pos = CACHE_MAGIC_LEN;
+
+	while (length - pos >= RECORD_HEADER_LEN) {
+		gchar op = contents[pos];
+		gsize key_len = read_uint32 (contents + pos + 1);
+		gsize value_len = read_uint32 (contents + pos + 5);
+		gsize rest = length - pos - RECORD_HEADER_LEN;
+		const gchar *key = contents + pos + RECORD_HEADER_LEN;
+
+		if ((op != '+' && op != '-') || key_len > rest || value_len > rest - key_len)
+			break;
+
+		if (op == '+') {
+			cache_set (priv, g_strndup (key, key_len),
+				   g_strndup (key + key_len, value_len));
+		} else {
+			gchar *tmp = g_strndup (key, key_len);
+
+			cache_unset (priv, tmp);
+			g_free (tmp);
+		}
+
+		pos += RECORD_HEADER_LEN + key_len + value_len;
+	}
+
+	return pos;
+}
+
+/* Writes the pending changes to the file */
+static void
+cache_write (EFileCache *cache)
+{
+	EFileCachePrivate *priv = cache->priv;
+	gsize log_size, stale_size;
+	GError *error = NULL;
+
+	if (!priv->filename || (!priv->rewrite && !priv->pending->len))
+		return;
+
+	/* drop the stale records once they take more space than the objects */
+	log_size = MAX (priv->log_size, CACHE_MAGIC_LEN) + priv->pending->len;
+	stale_size = log_size - MIN (log_size, CACHE_MAGIC_LEN + priv->live_size);
+	if (stale_size > COMPACT_MIN_STALE && stale_size > priv->live_size)
+		priv->rewrite = TRUE;
+
+	if (priv->rewrite) {
+		GString *buf;
+
+		buf = g_string_sized_new (CACHE_MAGIC_LEN + priv->live_size);
+		g_string_append_len (buf, CACHE_MAGIC, CACHE_MAGIC_LEN);
+		g_hash_table_foreach (priv->objects, append_object_record, buf);
+
+		if (g_file_set_contents (priv->filename, buf->str, buf->len, &error)) {
+			priv->log_size = buf->len;
+			priv->rewrite = FALSE;
+		} else {
+			g_warning (G_STRLOC ": could not write cache file %s: %s",
+				   priv->filename, error->message);
+			g_error_free (error);
+		}
+
+		g_string_free (buf, TRUE);
+	} else {
+		FILE *file;
+		gboolean success;
+
+		file = g_fopen (priv->filename, "ab");
+		success = file != NULL;
+
+		if (success && !priv->log_size)
+			success = fwrite (CACHE_MAGIC, 1, CACHE_MAGIC_LEN, file) == CACHE_MAGIC_LEN;
+		if (success)
+			success = fwrite (priv->pending->str, 1, priv->pending->len, file) == priv->pending->len;
+		if (file && fclose (file) != 0)
+			success = FALSE;
+
+		if (success) {
+			priv->log_size = MAX (priv->log_size, CACHE_MAGIC_LEN) + priv->pending->len;
+		} else {
+			/* the file may end with a partial record now */
+			g_warning (G_STRLOC ": could not write cache file %s", priv->filename);
+			priv->rewrite = TRUE;
+		}
+	}
+
+	g_string_truncate (priv->pending, 0);
+}
+
+static gboolean
+cache_load (EFileCache *cache)
+{
+	EFileCachePrivate *priv = cache->priv;
+	gchar *contents = NULL;
+	gsize length = 0;
+
+	g_hash_table_remove_all (priv->objects);
+	g_string_truncate (priv->pending, 0);
+	priv->live_size = 0;
+	priv->log_size = 0;
+	priv->rewrite = FALSE;
+
+	if (!g_file_test (priv->filename, G_FILE_TEST_EXISTS))
+		return TRUE;
+
+	if (!g_file_get_contents (priv->filename, &contents, &length, NULL))
+		return FALSE;
+
+	if (length >= CACHE_MAGIC_LEN && !memcmp (contents, CACHE_MAGIC, CACHE_MAGIC_LEN)) {
+		priv->log_size = replay_log (priv, contents, length);
+
+		/* drop the partial record of an interrupted write */
+		if (priv->log_size < length)
+			priv->rewrite = TRUE;
+	} else if (length > 0) {
+		EXmlHash *xml_hash;
+
+		/* convert a cache written as XML by older versions */
+		xml_hash = e_xmlhash_new (priv->filename);
+		if (!xml_hash) {
+			g_free (contents);
+			return FALSE;
+		}
+
+		e_xmlhash_foreach_key (xml_hash, (EXmlHashFunc) import_xml_object, priv);
+		e_xmlhash_destroy (xml_hash);
+		priv->rewrite = TRUE;
+	}
+
+	g_free (contents);
+
+	cache_write (cache);
+
+	return TRUE;
+}
+
 static void
 e_file_cache_set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec)
 {
@@ -72,17 +302,12 @@ e_file_cache_set_property (GObject *object, guint property_id, const GValue *val
 		if (result != 0)
 			break;
 
-		if (priv->xml_hash)
-			e_xmlhash_destroy (priv->xml_hash);
-		priv->xml_hash = e_xmlhash_new (g_value_get_string (value));
-
 		/* if opening the cache file fails, remove it and try again */
-		if (!priv->xml_hash) {
-			g_unlink (g_value_get_string (value));
-			priv->xml_hash = e_xmlhash_new (g_value_get_string (value));
-			if (priv->xml_hash) {
+		if (!cache_load (cache)) {
+			g_unlink (priv->filename);
+			if (!cache_load (cache)) {
 				g_message (G_STRLOC ": could not open not re-create cache file %s",
-					   g_value_get_string (value));
+					   priv->filename);
 			}
 		}
 		break;
@@ -124,10 +349,8 @@ e_file_cache_finalize (GObject *object)
 			priv->filename = NULL;
 		}
 
-		if (priv->xml_hash) {
-			e_xmlhash_destroy (priv->xml_hash);
-			priv->xml_hash = NULL;
-		}
+		g_hash_table_destroy (priv->objects);
+		g_string_free (priv->pending, TRUE);
 
 		g_free (priv);
 		cache->priv = NULL;
@@ -158,7 +381,8 @@ e_file_cache_init (EFileCache *cache)
 	EFileCachePrivate *priv;
 
 	priv = g_new0 (EFileCachePrivate, 1);
-	priv->dirty = FALSE;
+	priv->objects = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	priv->pending = g_string_new (NULL);
 	priv->frozen = 0;
 	cache->priv = priv;
 }
@@ -233,8 +457,11 @@ e_file_cache_remove (EFileCache *cache)
 		g_free (priv->filename);
 		priv->filename = NULL;
 
-		e_xmlhash_destroy (priv->xml_hash);
-		priv->xml_hash = NULL;
+		g_hash_table_remove_all (priv->objects);
+		g_string_truncate (priv->pending, 0);
+		priv->live_size = 0;
+		priv->log_size = 0;
+		priv->rewrite = FALSE;
 
 		return success;
 	}
@@ -243,11 +470,11 @@ e_file_cache_remove (EFileCache *cache)
 }
 
 static void
-add_key_to_slist (const gchar *key, const gchar *value, gpointer user_data)
+add_key_to_slist (gpointer key, gpointer value, gpointer user_data)
 {
 	GSList **keys = user_data;
 
-	*keys = g_slist_append (*keys, (gchar *) key);
+	*keys = g_slist_prepend (*keys, key);
 }
 
 /**
@@ -262,78 +489,40 @@ gboolean
 e_file_cache_clean (EFileCache *cache)
 {
 	EFileCachePrivate *priv;
-	GSList *keys = NULL;
-	gboolean iFroze;
 
 	g_return_val_if_fail (E_IS_FILE_CACHE (cache), FALSE);
 
 	priv = cache->priv;
-	iFroze = !priv->frozen;
-
-	if (iFroze)
-		e_file_cache_freeze_changes (cache);
 
-	e_xmlhash_foreach_key (priv->xml_hash, (EXmlHashFunc) add_key_to_slist, &keys);
-	while (keys != NULL) {
-		e_file_cache_remove_object (cache, (const gchar *) keys->data);
-		keys = g_slist_remove (keys, keys->data);
-	}
+	g_hash_table_remove_all (priv->objects);
+	g_string_truncate (priv->pending, 0);
+	priv->live_size = 0;
+	priv->rewrite = TRUE;
 
-	if (iFroze)
-		e_file_cache_thaw_changes (cache);
+	if (!priv->frozen)
+		cache_write (cache);
 
 	return TRUE;
 }
 
-typedef struct {
-	const gchar *key;
-	gboolean found;
-	const gchar *found_value;
-} CacheFindData;
-
-static void
-find_object_in_hash (gpointer key, gpointer value, gpointer user_data)
-{
-	CacheFindData *find_data = user_data;
-
-	if (find_data->found)
-		return;
-
-	if (!strcmp (find_data->key, (const gchar *) key)) {
-		find_data->found = TRUE;
-		find_data->found_value = (const gchar *) value;
-	}
-}
-
 /**
  * e_file_cache_get_object:
  */
 const gchar *
 e_file_cache_get_object (EFileCache *cache, const gchar *key)
 {
-	CacheFindData find_data;
-	EFileCachePrivate *priv;
-
 	g_return_val_if_fail (E_IS_FILE_CACHE (cache), NULL);
 	g_return_val_if_fail (key != NULL, NULL);
 
-	priv = cache->priv;
-
-	find_data.key = key;
-	find_data.found = FALSE;
-	find_data.found_value = NULL;
-
-	e_xmlhash_foreach_key (priv->xml_hash, (EXmlHashFunc) find_object_in_hash, &find_data);
-
-	return find_data.found_value;
+	return g_hash_table_lookup (cache->priv->objects, key);
 }
 
 static void
-add_object_to_slist (const gchar *key, const gchar *value, gpointer user_data)
+add_object_to_slist (gpointer key, gpointer value, gpointer user_data)
 {
 	GSList **list = user_data;
 
-	*list = g_slist_prepend (*list, (gchar *) value);
+	*list = g_slist_prepend (*list, value);
 }
 
 /**
@@ -349,7 +538,7 @@ e_file_cache_get_objects (EFileCache *cache)
 
 	priv = cache->priv;
 
-	e_xmlhash_foreach_key (priv->xml_hash, (EXmlHashFunc) add_object_to_slist, &list);
+	g_hash_table_foreach (priv->objects, add_object_to_slist, &list);
 
 	return list;
 }
@@ -367,7 +556,7 @@ e_file_cache_get_keys (EFileCache *cache)
 
 	priv = cache->priv;
 
-	e_xmlhash_foreach_key (priv->xml_hash, (EXmlHashFunc) add_key_to_slist, &list);
+	g_hash_table_foreach (priv->objects, add_key_to_slist, &list);
 
 	return list;
 }
@@ -382,19 +571,18 @@ e_file_cache_add_object (EFileCache *cache, const gchar *key, const gchar *value
 
 	g_return_val_if_fail (E_IS_FILE_CACHE (cache), FALSE);
 	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (value != NULL, FALSE);
 
 	priv = cache->priv;
 
 	if (e_file_cache_get_object (cache, key))
 		return FALSE;
 
-	e_xmlhash_add (priv->xml_hash, key, value);
-	if (priv->frozen)
-		priv->dirty = TRUE;
-	else {
-		e_xmlhash_write (priv->xml_hash);
-		priv->dirty = FALSE;
-	}
+	append_record (priv->pending, key, value);
+	cache_set (priv, g_strdup (key), g_strdup (value));
+
+	if (!priv->frozen)
+		cache_write (cache);
 
 	return TRUE;
 }
@@ -405,16 +593,25 @@ e_file_cache_add_object (EFileCache *cache, const gchar *key, const gchar *value
 gboolean
 e_file_cache_replace_object (EFileCache *cache, const gchar *key, const gchar *new_value)
 {
+	EFileCachePrivate *priv;
+
 	g_return_val_if_fail (E_IS_FILE_CACHE (cache), FALSE);
 	g_return_val_if_fail (key != NULL, FALSE);
+	g_return_val_if_fail (new_value != NULL, FALSE);
+
+	priv = cache->priv;
 
 	if (!e_file_cache_get_object (cache, key))
 		return FALSE;
 
-	if (!e_file_cache_remove_object (cache, key))
-		return FALSE;
+	/* one record replaces the old value */
+	append_record (priv->pending, key, new_value);
+	cache_set (priv, g_strdup (key), g_strdup (new_value));
+
+	if (!priv->frozen)
+		cache_write (cache);
 
-	return e_file_cache_add_object (cache, key, new_value);
+	return TRUE;
 }
 
 /**
@@ -433,13 +630,12 @@ e_file_cache_remove_object (EFileCache *cache, const gchar *key)
 	if (!e_file_cache_get_object (cache, key))
 		return FALSE;
 
-	e_xmlhash_remove (priv->xml_hash, key);
-	if (priv->frozen)
-		priv->dirty = TRUE;
-	else {
-		e_xmlhash_write (priv->xml_hash);
-		priv->dirty = FALSE;
-	}
+	/* @key may be one of the keys of the cache */
+	append_record (priv->pending, key, NULL);
+	cache_unset (priv, key);
+
+	if (!priv->frozen)
+		cache_write (cache);
 
 	return TRUE;
 }
@@ -481,10 +677,8 @@ e_file_cache_thaw_changes (EFileCache *cache)
 	g_return_if_fail (priv->frozen > 0);
 
 	priv->frozen--;
-	if (!priv->frozen && priv->dirty) {
-		e_xmlhash_write (priv->xml_hash);
-		priv->dirty = FALSE;
-	}
+	if (!priv->frozen)
+		cache_write (cache);
 }
 
 /**
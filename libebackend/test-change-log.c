@@ -0,0 +1,264 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Checks that EChangeLog finds the changes a client hasn't seen, keeps
+ * them across a clean close, and forgets them when the log can't be
+ * trusted: a stamp mismatch, a missing stamp or an explicit reset. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "e-change-log.h"
+
+static gint
+compare_uids (gconstpointer a, gconstpointer b)
+{
+	return strcmp (a, b);
+}
+
+/* the uids changed after @since, sorted and joined with spaces */
+static gchar *
+changed_uids (EChangeLog *log, guint64 since)
+{
+	GSList *uids, *link;
+	GString *str = g_string_new (NULL);
+
+	uids = e_change_log_get_changed_uids (log, since);
+	uids = g_slist_sort (uids, compare_uids);
+	for (link = uids; link; link = link->next) {
+		if (str->len)
+			g_string_append_c (str, ' ');
+		g_string_append (str, link->data);
+	}
+
+	g_slist_foreach (uids, (GFunc) g_free, NULL);
+	g_slist_free (uids);
+
+	return g_string_free (str, FALSE);
+}
+
+static void
+assert_changed (EChangeLog *log, guint64 since, const gchar *expected)
+{
+	gchar *found = changed_uids (log, since);
+
+	g_assert_cmpstr (found, ==, expected);
+	g_free (found);
+}
+
+static guint
+count_lines (const gchar *filename)
+{
+	gchar *contents, *p;
+	guint n = 0;
+
+	if (!g_file_get_contents (filename, &contents, NULL, NULL))
+		return 0;
+
+	for (p = contents; *p; p++)
+		if (*p == '\n')
+			n++;
+
+	g_free (contents);
+
+	return n;
+}
+
+static void
+test_changes (const gchar *filename)
+{
+	EChangeLog *log;
+	guint64 seq;
+
+	log = e_change_log_new (filename, NULL);
+	g_assert (log != NULL);
+	g_assert (e_change_log_get_sequence (log) == 0);
+	assert_changed (log, 0, "");
+
+	e_change_log_touch (log, "a");
+	e_change_log_touch (log, "b");
+	e_change_log_touch (log, "c");
+	g_assert (e_change_log_get_sequence (log) == 3);
+	assert_changed (log, 0, "a b c");
+	assert_changed (log, 1, "b c");
+	assert_changed (log, 3, "");
+
+	/* touching again moves a record past the others */
+	e_change_log_touch (log, "a");
+	g_assert (e_change_log_get_sequence (log) == 4);
+	assert_changed (log, 3, "a");
+
+	g_assert (!e_change_log_get_client_sequence (log, "client", &seq));
+	e_change_log_set_client_sequence (log, "client", 2);
+	g_assert (e_change_log_get_client_sequence (log, "client", &seq) && seq == 2);
+	assert_changed (log, seq, "a c");
+	e_change_log_set_client_sequence (log, "client", 4);
+	g_assert (e_change_log_get_client_sequence (log, "client", &seq) && seq == 4);
+	g_assert (!e_change_log_get_client_sequence (log, "other", &seq));
+
+	e_change_log_set_stamp (log, "stamp-1");
+	e_change_log_destroy (log);
+}
+
+static void
+test_reopen (const gchar *filename)
+{
+	EChangeLog *log;
+	guint64 seq;
+
+	/* closed cleanly, with the same stamp */
+	log = e_change_log_new (filename, "stamp-1");
+	g_assert (log != NULL);
+	g_assert (e_change_log_get_sequence (log) == 4);
+	g_assert (e_change_log_get_client_sequence (log, "client", &seq) && seq == 4);
+	e_change_log_touch (log, "d");
+	assert_changed (log, seq, "d");
+	e_change_log_destroy (log);
+
+	/* the last change came after the stamp, so the data may have
+	 * changed without the log */
+	log = e_change_log_new (filename, "stamp-1");
+	g_assert (log != NULL);
+	g_assert (!e_change_log_get_client_sequence (log, "client", &seq));
+	assert_changed (log, 0, "");
+	g_assert (e_change_log_get_sequence (log) >= 5);
+	e_change_log_set_client_sequence (log, "client", e_change_log_get_sequence (log));
+	e_change_log_set_stamp (log, "stamp-2");
+	e_change_log_destroy (log);
+
+	/* the data has another stamp */
+	log = e_change_log_new (filename, "stamp-3");
+	g_assert (log != NULL);
+	g_assert (!e_change_log_get_client_sequence (log, "client", &seq));
+	e_change_log_destroy (log);
+}
+
+static void
+test_reset (const gchar *filename)
+{
+	EChangeLog *log;
+	guint64 seq, before;
+
+	log = e_change_log_new (filename, NULL);
+	g_assert (log != NULL);
+	e_change_log_touch (log, "a");
+	e_change_log_set_client_sequence (log, "client", 0);
+	before = e_change_log_get_sequence (log);
+
+	e_change_log_reset (log);
+	g_assert (!e_change_log_get_client_sequence (log, "client", &seq));
+	assert_changed (log, 0, "");
+	/* sequences keep growing, a stale client sequence can't match */
+	g_assert (e_change_log_get_sequence (log) == before);
+	e_change_log_touch (log, "b");
+	g_assert (e_change_log_get_sequence (log) == before + 1);
+	assert_changed (log, 0, "b");
+
+	e_change_log_destroy (log);
+}
+
+static void
+test_truncated (const gchar *filename)
+{
+	EChangeLog *log;
+	guint64 seq;
+	const gchar *contents =
+		"Q 0\n"
+		"C 1 a\n"
+		"C 2 b\n"
+		"S 1 client\n"
+		"T stamp\n"
+		"C 3 d";	/* interrupted while writing */
+
+	g_assert (g_file_set_contents (filename, contents, -1, NULL));
+
+	/* the partial change neither counts nor makes the stamp stale */
+	log = e_change_log_new (filename, "stamp");
+	g_assert (log != NULL);
+	g_assert (e_change_log_get_sequence (log) == 2);
+	g_assert (e_change_log_get_client_sequence (log, "client", &seq) && seq == 1);
+	assert_changed (log, seq, "b");
+
+	/* and it is gone once the log was rewritten */
+	e_change_log_touch (log, "e");
+	g_assert (e_change_log_get_sequence (log) == 3);
+	assert_changed (log, seq, "b e");
+	e_change_log_set_stamp (log, "stamp");
+	e_change_log_destroy (log);
+
+	log = e_change_log_new (filename, "stamp");
+	g_assert (log != NULL);
+	g_assert (e_change_log_get_sequence (log) == 3);
+	assert_changed (log, 1, "b e");
+	assert_changed (log, 2, "e");
+	e_change_log_destroy (log);
+}
+
+static void
+test_compact (const gchar *filename)
+{
+	EChangeLog *log;
+	guint64 seq, slow;
+	gint i;
+
+	log = e_change_log_new (filename, NULL);
+	g_assert (log != NULL);
+
+	e_change_log_touch (log, "old");
+	e_change_log_touch (log, "seen");
+	slow = e_change_log_get_sequence (log) - 1;
+	e_change_log_set_client_sequence (log, "slow", slow);
+	e_change_log_set_client_sequence (log, "fast", e_change_log_get_sequence (log));
+
+	/* enough entries for the file to be rewritten */
+	for (i = 0; i < 3000; i++)
+		e_change_log_touch (log, "hot");
+
+	g_assert (count_lines (filename) < 3000);
+	g_assert (e_change_log_get_sequence (log) == slow + 1 + 3000);
+
+	/* "old" was seen by both clients, "seen" only by the fast one */
+	assert_changed (log, 0, "hot seen");
+	g_assert (e_change_log_get_client_sequence (log, "slow", &seq) && seq == slow);
+	assert_changed (log, seq, "hot seen");
+	g_assert (e_change_log_get_client_sequence (log, "fast", &seq));
+	assert_changed (log, seq, "hot");
+
+	e_change_log_set_stamp (log, "stamp");
+	e_change_log_destroy (log);
+
+	log = e_change_log_new (filename, "stamp");
+	g_assert (log != NULL);
+	g_assert (e_change_log_get_sequence (log) == slow + 1 + 3000);
+	assert_changed (log, 0, "hot seen");
+	g_assert (count_lines (filename) <= 5);
+	e_change_log_destroy (log);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	gchar *filename;
+
+	g_thread_init (NULL);
+
+	filename = g_build_filename (g_get_tmp_dir (), "test-change-log.log", NULL);
+
+	g_unlink (filename);
+	test_changes (filename);
+	test_reopen (filename);
+
+	g_unlink (filename);
+	test_reset (filename);
+
+	g_unlink (filename);
+	test_truncated (filename);
+
+	g_unlink (filename);
+	test_compact (filename);
+
+	g_unlink (filename);
+	g_free (filename);
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/* Checks that EFileCache converts the XML caches of older versions, drops
+ * the partial record of an interrupted write, rewrites its log once it is
+ * mostly stale records, and writes nothing while frozen. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "e-file-cache.h"
+#include "libedataserver/e-xml-hash-utils.h"
+
+#define CACHE_MAGIC "EFileCache 1\n"
+
+static gsize
+file_size (const gchar *filename)
+{
+	struct stat st;
+
+	if (g_stat (filename, &st) != 0)
+		return 0;
+
+	return st.st_size;
+}
+
+static gboolean
+has_object (EFileCache *cache, const gchar *key, const gchar *value)
+{
+	return g_strcmp0 (e_file_cache_get_object (cache, key), value) == 0;
+}
+
+static guint
+count_keys (EFileCache *cache)
+{
+	GSList *keys;
+	guint n;
+
+	keys = e_file_cache_get_keys (cache);
+	n = g_slist_length (keys);
+	g_slist_free (keys);
+
+	return n;
+}
+
+static void
+test_xml (const gchar *filename)
+{
+	EXmlHash *xml_hash;
+	EFileCache *cache;
+	gchar *contents = NULL;
+
+	xml_hash = e_xmlhash_new (filename);
+	e_xmlhash_add (xml_hash, "uid-1", "BEGIN:VCARD\nFN:One\nEND:VCARD");
+	e_xmlhash_add (xml_hash, "uid-2", "a < b & c > \"d\"");
+	e_xmlhash_write (xml_hash);
+	e_xmlhash_destroy (xml_hash);
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 2);
+	g_assert (has_object (cache, "uid-1", "BEGIN:VCARD\nFN:One\nEND:VCARD"));
+	g_assert (has_object (cache, "uid-2", "a < b & c > \"d\""));
+	g_object_unref (cache);
+
+	/* converted once, then read back as a log */
+	g_assert (g_file_get_contents (filename, &contents, NULL, NULL));
+	g_assert (contents && g_str_has_prefix (contents, CACHE_MAGIC));
+	g_free (contents);
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 2);
+	g_assert (has_object (cache, "uid-2", "a < b & c > \"d\""));
+	g_object_unref (cache);
+}
+
+static void
+test_partial_record (const gchar *filename)
+{
+	EFileCache *cache;
+	FILE *file;
+	gsize size;
+	/* a set record promising a longer key and value than follow */
+	static const gchar partial[] = { '+', 0, 0, 0, 5, 0, 0, 0, 5, 'u', 'i', 'd' };
+
+	cache = e_file_cache_new (filename);
+	g_assert (e_file_cache_add_object (cache, "a", "1"));
+	g_assert (e_file_cache_add_object (cache, "b", "2"));
+	g_object_unref (cache);
+
+	size = file_size (filename);
+	file = g_fopen (filename, "ab");
+	g_assert (file != NULL);
+	if (file) {
+		g_assert (fwrite (partial, 1, sizeof (partial), file) == sizeof (partial));
+		fclose (file);
+	}
+	g_assert (file_size (filename) == size + sizeof (partial));
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 2);
+	g_assert (has_object (cache, "a", "1"));
+	g_assert (has_object (cache, "b", "2"));
+	/* the file was rewritten without it */
+	g_assert (file_size (filename) == size);
+
+	g_assert (e_file_cache_add_object (cache, "c", "3"));
+	g_object_unref (cache);
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 3);
+	g_assert (has_object (cache, "c", "3"));
+	g_object_unref (cache);
+}
+
+static void
+test_compact (const gchar *filename)
+{
+	EFileCache *cache;
+	gchar *value;
+	gsize max_size = 0;
+	gint i;
+
+	cache = e_file_cache_new (filename);
+	g_assert (e_file_cache_add_object (cache, "kept", "value"));
+	g_assert (e_file_cache_add_object (cache, "hot", "0"));
+
+	/* about 200 KB of records, of which only one is live */
+	value = g_malloc (1025);
+	for (i = 0; i < 200; i++) {
+		memset (value, 'a' + i % 26, 1024);
+		value[1024] = '\0';
+		g_assert (e_file_cache_replace_object (cache, "hot", value));
+		max_size = MAX (max_size, file_size (filename));
+	}
+
+	/* the stale records are dropped once they take 64 KB */
+	g_assert (max_size < 70 * 1024);
+	g_assert (has_object (cache, "hot", value));
+	g_object_unref (cache);
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 2);
+	g_assert (has_object (cache, "kept", "value"));
+	g_assert (has_object (cache, "hot", value));
+	g_object_unref (cache);
+
+	g_free (value);
+}
+
+static void
+test_freeze (const gchar *filename)
+{
+	EFileCache *cache;
+	gsize size;
+	gchar *key;
+	gint i;
+
+	cache = e_file_cache_new (filename);
+	size = file_size (filename);
+
+	e_file_cache_freeze_changes (cache);
+	for (i = 0; i < 10; i++) {
+		key = g_strdup_printf ("frozen-%d", i);
+		g_assert (e_file_cache_add_object (cache, key, "value"));
+		g_free (key);
+	}
+	g_assert (e_file_cache_remove_object (cache, "frozen-0"));
+	g_assert (e_file_cache_replace_object (cache, "frozen-1", "other"));
+
+	/* the changes are visible, but not written until the last thaw */
+	g_assert (has_object (cache, "frozen-1", "other"));
+	g_assert (file_size (filename) == size);
+	e_file_cache_freeze_changes (cache);
+	e_file_cache_thaw_changes (cache);
+	g_assert (file_size (filename) == size);
+	e_file_cache_thaw_changes (cache);
+	g_assert (file_size (filename) > size);
+	g_object_unref (cache);
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 9);
+	g_assert (!e_file_cache_get_object (cache, "frozen-0"));
+	g_assert (has_object (cache, "frozen-1", "other"));
+	g_assert (has_object (cache, "frozen-9", "value"));
+	g_object_unref (cache);
+}
+
+static void
+test_clean_frozen (const gchar *filename)
+{
+	EFileCache *cache;
+	gsize size;
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) > 0);
+	size = file_size (filename);
+
+	e_file_cache_freeze_changes (cache);
+	g_assert (e_file_cache_clean (cache));
+	g_assert (count_keys (cache) == 0);
+	g_assert (e_file_cache_add_object (cache, "after-clean", "value"));
+	g_assert (file_size (filename) == size);
+	e_file_cache_thaw_changes (cache);
+	g_assert (file_size (filename) < size);
+	g_object_unref (cache);
+
+	cache = e_file_cache_new (filename);
+	g_assert (count_keys (cache) == 1);
+	g_assert (has_object (cache, "after-clean", "value"));
+
+	g_assert (e_file_cache_remove (cache));
+	g_object_unref (cache);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	gchar *dirname, *filename;
+
+	g_type_init ();
+
+	dirname = g_build_filename (g_get_tmp_dir (), "test-file-cache", NULL);
+	filename = g_build_filename (dirname, "cache.xml", NULL);
+	g_mkdir_with_parents (dirname, 0700);
+
+	g_unlink (filename);
+	test_xml (filename);
+
+	g_unlink (filename);
+	test_partial_record (filename);
+
+	g_unlink (filename);
+	test_compact (filename);
+
+	g_unlink (filename);
+	test_freeze (filename);
+	test_clean_frozen (filename);
+
+	g_rmdir (dirname);
+	g_free (filename);
+	g_free (dirname);
+
+	return 0;
+}